@@ -411,3 +411,26 @@ AC_DEFUN([CHECK_LIBMAXMINDDB],
 	])
 ])
 
+
+AC_DEFUN([CHECK_ZLIB],
+[
+	AC_ARG_ENABLE(zlib,
+	[AC_HELP_STRING([--enable-zlib=no/yes],[enable zlib, used for WebSocket compression (permessage-deflate)])],
+	[enable_zlib=$enableval],
+	[enable_zlib=yes])
+
+	AS_IF([test "x$enable_zlib" = "xyes"],
+	[
+		dnl see if the system provides it
+		has_system_zlib="no"
+		PKG_CHECK_MODULES([ZLIB], [zlib >= 1.2.3],
+		                  [has_system_zlib=yes],
+		                  [has_system_zlib=no])
+		AS_IF([test "x$has_system_zlib" = "xyes"],
+		[
+			AC_DEFINE([HAVE_ZLIB], [], [Define if you have zlib])
+			AC_SUBST(ZLIB_LIBS)
+			AC_SUBST(ZLIB_CFLAGS)
+		])
+	])
+])
@@ -159,11 +159,11 @@
       (defined(HAVE_POLL) || defined(HAVE_EPOLL) || defined(HAVE_KQUEUE))
   /* Have poll/epoll/kqueue and either no --with-maxconnections or
    * --with-maxconnections=0, either of which indicates 'automatic' mode.
-   * At the time of writing we will try a limit of 16384.
-   * It will automatically be lowered at boottime if we can only use
-   * 4096, 2048 or 1024. No problem.
+   * This is only an upper limit: at boottime we use whatever the
+   * (hard) limit of open files is, so usually much less.
+   * The fd table grows on demand, so a high value here costs nothing.
    */
-  #define MAXCONNECTIONS 16384
+  #define MAXCONNECTIONS 1048576
  #elif defined(MAXCONNECTIONS_REQUEST) && (MAXCONNECTIONS_REQUEST >= 1)
   /* --with-maxconnections=something */
   #define MAXCONNECTIONS MAXCONNECTIONS_REQUEST
@@ -184,7 +184,8 @@
 #endif
 
 /*
- * this defines the length of the nickname history.  each time a user changes
+ * this defines the default length of the nickname history, this can be
+ * changed at runtime with set::whowas-history-length.  each time a user changes
  * nickname or signs off, their old nickname is added to the top of the list.
  * The following sizes are recommended:
  * 8MB or less  core memory : 500	(at least 1/4 of max users)
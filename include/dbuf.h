@@ -97,5 +97,6 @@ void dbuf_delete(dbuf *, size_t);
 extern int dbuf_getmsg(dbuf *, char *);
 extern void dbuf_queue_init(dbuf *dyn);
 extern void dbuf_init(void);
+extern void dbuf_pool_stats(unsigned long long *bytes_used, unsigned long long *bytes_allocated);
 
 #endif /* __dbuf_include__ */
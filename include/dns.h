@@ -63,6 +63,7 @@ struct DNSStats {
 
 
 extern ares_channel resolver_channel;
+extern MODVAR DNSStats dnsstats;
 
 extern void init_resolver(int);
 
@@ -140,6 +140,7 @@ struct Configuration {
 	int kick_length;
 	int quit_length;
 	int away_length;
+	int whowas_history_length;
 	int hide_list;
 	int max_unknown_connections_per_ip;
 	long handshake_timeout;
@@ -259,6 +260,8 @@ extern MODVAR int ipv6_disabled;
 
 #define WATCH_AWAY_NOTIFICATION	iConf.watch_away_notification
 
+#define WHOWAS_HISTORY_LENGTH	iConf.whowas_history_length
+
 #define UHNAMES_ENABLED	iConf.uhnames
 
 /** Used for testing the set { } block configuration.
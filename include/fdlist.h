@@ -21,7 +21,11 @@ typedef struct fd_entry {
 	unsigned int backend_flags;
 } FDEntry;
 
-extern MODVAR FDEntry fd_table[MAXCONNECTIONS + 1];
+/** Initial number of entries in fd_table, it grows on demand (up to MAXCONNECTIONS) */
+#define FD_TABLE_INITIAL_SIZE	1024
+
+extern MODVAR FDEntry *fd_table;
+extern MODVAR int fd_table_size;
 
 extern int fd_open(int fd, const char *desc, FDCloseMethod close_method);
 extern int fd_close(int fd);
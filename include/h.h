@@ -58,8 +58,6 @@ extern SERVICE_STATUS IRCDStatus;
 #endif
 extern MODVAR char *extraflags;
 extern MODVAR int tainted;
-extern MODVAR Member *freemember;
-extern MODVAR Membership *freemembership;
 extern MODVAR Client me;
 extern MODVAR Channel *channels;
 extern MODVAR ModData local_variable_moddata[MODDATA_MAX_LOCAL_VARIABLE];
@@ -165,6 +163,8 @@ extern void append_ListItem(ListStruct *item, ListStruct **list);
 extern void add_ListItemPrio(ListStructPrio *, ListStructPrio **, int);
 extern void del_ListItem(ListStruct *, ListStruct **);
 extern MODVAR LoopStruct loop;
+extern MODVAR ServerMetrics metrics;
+extern MODVAR const unsigned int metrics_loop_bucket_usec[METRICS_LOOP_BUCKETS-1];
 extern int del_banid(Channel *channel, const char *banid);
 extern int del_exbanid(Channel *channel, const char *banid);
 #define REPORT_DO_DNS	"NOTICE * :*** Looking up your hostname...\r\n"
@@ -185,8 +185,11 @@ extern MODVAR struct list_head global_server_list;
 extern MODVAR struct list_head dead_list;
 extern RealCommand *find_command(const char *cmd, int flags);
 extern RealCommand *find_command_simple(const char *cmd);
+extern void command_lookup_invalidate(void);
 extern Membership *find_membership_link(Membership *lp, Channel *ptr);
 extern Member *find_member_link(Member *, Client *);
+extern Member *find_member(Channel *channel, Client *client);
+extern Membership *find_membership(Client *client, Channel *channel);
 extern int remove_user_from_channel(Client *client, Channel *channel, int dont_log);
 extern void add_server_to_table(Client *);
 extern void remove_server_from_table(Client *);
@@ -401,7 +404,6 @@ extern void del_queries(const char *);
 /* Hash stuff */
 #define NICK_HASH_TABLE_SIZE 32768
 #define CHAN_HASH_TABLE_SIZE 32768
-#define WHOWAS_HASH_TABLE_SIZE 32768
 #define THROTTLING_HASH_TABLE_SIZE 8192
 extern uint64_t siphash(const char *in, const char *k);
 extern uint64_t siphash_raw(const char *in, size_t len, const char *k);
@@ -409,6 +411,7 @@ extern uint64_t siphash_nocase(const char *in, const char *k);
 extern void siphash_generate_key(char *k);
 extern void init_hash(void);
 uint64_t hash_whowas_name(const char *name);
+extern uint64_t hash_ban_mask(const char *banstr);
 extern int add_to_client_hash_table(const char *, Client *);
 extern int del_from_client_hash_table(const char *, Client *);
 extern int add_to_id_hash_table(const char *, Client *);
@@ -853,6 +856,9 @@ extern MODVAR void (*rpc_error_fmt)(Client *client, json_t *request, JsonRpcErro
 extern MODVAR int (*websocket_handle_websocket)(Client *client, WebRequest *web, const char *readbuf2, int length2, int callback(Client *client, char *buf, int len));
 extern MODVAR int (*websocket_create_packet)(int opcode, char **buf, int *len);
 extern MODVAR int (*websocket_create_packet_simple)(int opcode, const char **buf, int *len);
+extern MODVAR void (*rpc_send_notification)(Client *client, const char *method, json_t *params);
+extern MODVAR void (*tkl_check_pending_bans)(void);
+extern MODVAR int (*websocket_create_packet_ex)(Client *client, int opcode, char **buf, int *len);
 /* /Efuncs */
 
 /* TLS functions */
@@ -872,6 +878,7 @@ extern TLSOptions *get_tls_options_for_client(Client *acptr);
 extern int outdated_tls_client(Client *acptr);
 extern const char *outdated_tls_client_build_string(const char *pattern, Client *acptr);
 extern int check_certificate_expiry_ctx(SSL_CTX *ctx, char **errstr);
+extern void check_certificate_expiry_ctx_and_warn(SSL_CTX *ctx, TLSOptions *tlsoptions);
 extern EVENT(tls_check_expiry);
 extern MODVAR EVP_MD *sha256_function;
 extern MODVAR EVP_MD *sha1_function;
@@ -898,6 +905,8 @@ extern void rpc_error_fmt_default_handler(Client *client, json_t *request, JsonR
 extern int websocket_handle_websocket_default_handler(Client *client, WebRequest *web, const char *readbuf2, int length2, int callback(Client *client, char *buf, int len));
 extern int websocket_create_packet_default_handler(int opcode, char **buf, int *len);
 extern int websocket_create_packet_simple_default_handler(int opcode, const char **buf, int *len);
+extern void rpc_send_notification_default_handler(Client *client, const char *method, json_t *params);
+extern int websocket_create_packet_ex_default_handler(Client *client, int opcode, char **buf, int *len);
 /* End of default handlers for efunctions */
 
 extern MODVAR MOTDFile opermotd, svsmotd, motd, botmotd, smotd, rules;
@@ -905,6 +914,7 @@ extern MODVAR int max_connection_count;
 extern int add_listmode(Ban **list, Client *cptr, Channel *channel, const char *banid);
 extern int add_listmode_ex(Ban **list, Client *cptr, Channel *channel, const char *banid, const char *setby, time_t seton);
 extern int del_listmode(Ban **list, Channel *channel, const char *banid);
+extern void free_ban_indexes(Channel *channel);
 extern int Halfop_mode(long mode);
 extern const char *convert_regular_ban(char *mask, char *buf, size_t buflen);
 extern const char *clean_ban_mask(const char *, int, Client *, int);
@@ -1045,6 +1055,9 @@ extern MODVAR int maxclients;
 extern int fast_badword_match(ConfigItem_badword *badword, const char *line);
 extern int fast_badword_replace(ConfigItem_badword *badword, const char *line, char *buf, int max);
 extern const char *stripbadwords(const char *str, ConfigItem_badword *start_bw, int *blocked);
+extern BadwordMatcher *badword_matcher_compile(ConfigItem_badword *list);
+extern void badword_matcher_free(BadwordMatcher *m);
+extern const char *badword_matcher_strip(const char *str, BadwordMatcher *m, int *blocked);
 extern int badword_config_process(ConfigItem_badword *ca, const char *str);
 extern void badword_config_free(ConfigItem_badword *ca);
 extern const char *badword_config_check_regex(const char *s, int fastsupport, int check_broadness);
@@ -1086,9 +1099,49 @@ extern void _del_name_list(NameList **list, const char *name);
 extern NameList *find_name_list(NameList *list, const char *name);
 extern NameList *find_name_list_match(NameList *list, const char *name);
 extern int minimum_msec_since_last_run(struct timeval *tv_old, long minimum);
+extern uint64_t monotonic_nsec(void);
+/* Profiler */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+ #define PROFILER_USE_TSC
+ #define profiler_now() __builtin_ia32_rdtsc()
+#else
+ #define profiler_now() monotonic_nsec()
+#endif
+extern MODVAR int profiler_enabled;
+extern MODVAR time_t profiler_enabled_since;
+extern const char *hooktype_name(int hooktype);
+extern void profiler_init(void);
+extern void profiler_enable(void);
+extern void profiler_disable(void);
+extern void profiler_reset(void);
+extern void profiler_record(ProfilerHistogram **hist, uint64_t start);
+extern void profiler_record_value(ProfilerHistogram **hist, uint64_t v);
+extern void profiler_record_hooktype(int hooktype, uint64_t start);
+extern ProfilerHistogram *profiler_hooktype(int hooktype);
+extern uint64_t profiler_percentile(ProfilerHistogram *h, double percentile);
+extern double profiler_to_usec(uint64_t value);
+extern uint64_t profiler_to_nsec(uint64_t value);
+extern uint64_t profiler_count_upto(ProfilerHistogram *h, double usec);
+extern int profiler_get_entries(ProfilerEntry **entries);
 extern int unrl_utf8_validate(const char *str, const char **end);
 extern char *unrl_utf8_make_valid(const char *str, char *outputbuf, size_t outputbuflen, int strict_length_check);
 extern void utf8_test(void);
+extern void hot_restart_request(Client *requester);
+extern void hot_restart_receive(void);
+extern int hot_restart_take_listener(ConfigItem_listen *listener, int index);
+extern void hot_restart_close_listeners(void);
+extern void hot_restart_restore(void);
+extern MODVAR uint64_t scratch_allocations;
+extern void *scratch_alloc(size_t size);
+extern char *scratch_strdup(const char *str);
+extern void scratch_mark(ScratchMark *mark);
+extern void scratch_release(ScratchMark *mark);
+extern void scratch_reset(void);
+extern int scratch_owns(const void *ptr);
+extern size_t scratch_memory_size(void);
+extern MODVAR TextKernels text_kernels;
+extern void text_kernels_init(void);
+extern void text_kernels_test(void);
 extern MODVAR int non_utf8_nick_chars_in_use;
 extern void short_motd(Client *client);
 extern int should_show_connect_info(Client *client);
@@ -1263,6 +1316,9 @@ extern const char *log_level_valtostring(LogLevel loglevel);
 extern LogLevel log_level_stringtoval(const char *str);
 extern int valid_event_id(const char *s);
 extern int valid_subsystem(const char *s);
+extern LogSource *add_log_source(const char *str);
+extern void free_log_sources(LogSource *l);
+extern int log_sources_match(LogSource *logsource, LogLevel loglevel, const char *subsystem, const char *event_id, int matched_already);
 extern const char *timestamp_iso8601_now(void);
 extern const char *timestamp_iso8601(time_t v);
 extern int is_valid_snomask(char c);
@@ -48,14 +48,23 @@
 * details. */
 typedef struct mp_pool_t mp_pool_t;
 
+/** Flag for mp_pool_new_ex(): align every item to the start of a cache line */
+#define MP_POOL_CACHE_ALIGN	0x1
+
+/** Size of a cache line, used for MP_POOL_CACHE_ALIGN */
+#define MP_CACHE_LINE_SIZE	64
+
 extern void mp_pool_init(void);
 extern void *mp_pool_get(mp_pool_t *);
 extern void mp_pool_release(void *);
 extern mp_pool_t *mp_pool_new(size_t, size_t);
+extern mp_pool_t *mp_pool_new_ex(const char *, size_t, size_t, int);
+extern mp_pool_t *mp_pool_list(void);
 extern void mp_pool_clean(mp_pool_t *, int, int);
 extern void mp_pool_destroy(mp_pool_t *);
 extern void mp_pool_assert_ok(mp_pool_t *);
 extern void mp_pool_log_status(mp_pool_t *);
+extern void mp_pool_stats(mp_pool_t *, unsigned long long *, unsigned long long *);
 extern void mp_pool_garbage_collect(void *);
 
 #define MEMPOOL_STATS
@@ -64,6 +73,12 @@ struct mp_pool_t {
   /** Next pool. A pool is usually linked into the mp_allocated_pools list. */
   mp_pool_t *next;
 
+  /** Name of the pool, for statistics (may be NULL). */
+  const char *name;
+
+  /** Flags from mp_pool_new_ex(), such as MP_POOL_CACHE_ALIGN. */
+  int flags;
+
   /** Doubly-linked list of chunks in which no items have been allocated.
    * The front of the list is the most recently emptied chunk. */
   struct mp_chunk_t *empty_chunks;
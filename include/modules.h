@@ -56,6 +56,7 @@
 typedef struct Event Event;
 typedef struct EventInfo EventInfo;
 typedef struct Hook Hook;
+typedef struct HookVector HookVector;
 typedef struct Hooktype Hooktype;
 typedef struct Callback Callback;
 typedef struct Efunction Efunction;
@@ -656,8 +657,30 @@ struct Hook {
 		const char *(*conststringfunc)();
 	} func;
 	Module *owner;
+	ProfilerHistogram *profile; /**< Profiler data for this hook, see profiler_enabled */
+	int scope; /**< One of HOOK_SCOPE_*, see HookAddLocal() */
 };
 
+/** Hook scopes, see HookAddLocal() and HookAddRemote() */
+#define HOOK_SCOPE_ALL		0
+#define HOOK_SCOPE_LOCAL	1
+#define HOOK_SCOPE_REMOTE	2
+
+/** The hooks of one hook type as a priority-ordered array, used by the
+ * RunHook macros. There are three of these for each hook type, see
+ * HOOK_VECTOR_*. They are rebuilt when a hook is added or removed.
+ */
+struct HookVector {
+	int count;
+	int (**func)();	/**< The (int) functions of the hooks */
+	Hook **hook;	/**< The hooks themselves, for the profiler */
+	unsigned int generation; /**< Incremented on every rebuild */
+};
+
+#define HOOK_VECTOR_ALL		0	/**< All hooks, for RunHook() */
+#define HOOK_VECTOR_LOCAL	1	/**< For RunHookClient() with a local client */
+#define HOOK_VECTOR_REMOTE	2	/**< For RunHookClient() with a remote client */
+
 struct Callback {
 	Callback *prev, *next;
 	short type;
@@ -818,6 +841,7 @@ struct EventInfo {
 
 
 extern MODVAR Hook		*Hooks[MAXHOOKTYPES];
+extern MODVAR HookVector	HookVectors[MAXHOOKTYPES][3];
 extern MODVAR Hooktype		Hooktypes[MAXCUSTOMHOOKS];
 extern MODVAR Callback *Callbacks[MAXCALLBACKS], *RCallbacks[MAXCALLBACKS];
 extern MODVAR ClientCapability *clicaps;
@@ -907,31 +931,116 @@ __extension__ ({ \
 })
 #endif /* GCC_TYPCHECKING */
 
+/** Add a hook that is only called for local clients (MyConnect).
+ * This is only possible for hook types that are run through RunHookClient()
+ * and friends, see HookSetScope().
+ */
+#define HookAddLocal(module, hooktype, priority, func) HookSetScope(HookAdd(module, hooktype, priority, func), HOOK_SCOPE_LOCAL)
+/** Add a hook that is only called for remote clients, see HookAddLocal() */
+#define HookAddRemote(module, hooktype, priority, func) HookSetScope(HookAdd(module, hooktype, priority, func), HOOK_SCOPE_REMOTE)
+
 extern Hook	*HookAddMain(Module *module, int hooktype, int priority, int (*intfunc)(), void (*voidfunc)(), char *(*stringfunc)(), const char *(*conststringfunc)());
+extern Hook	*HookSetScope(Hook *hook, int scope);
 extern Hook	*HookDel(Hook *hook);
 
 extern Hooktype *HooktypeAdd(Module *module, const char *string, int *type);
 extern void HooktypeDel(Hooktype *hooktype, Module *module);
 
-#define RunHook(hooktype,...) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(__VA_ARGS__); } while(0)
-#define RunHookReturn(hooktype,retchk,...) \
+/* The RunHook macros have two variants of the loop: a plain one and one
+ * that records the time spent in each hook for the profiler. When the
+ * profiler is disabled this only costs a single (predictable) branch.
+ * The RunHookClient variants take the client as a separate argument
+ * (it is also passed to the hook as the first argument) and skip the
+ * hooks that were added with HookAddLocal() or HookAddRemote() and
+ * which don't apply to that client. The client argument is evaluated
+ * more than once, so don't pass an expression with side effects.
+ */
+#define RunHook(hooktype,...) RunHookVector(hooktype, &HookVectors[hooktype][HOOK_VECTOR_ALL], __VA_ARGS__)
+#define RunHookReturn(hooktype,retchk,...) RunHookVectorReturn(hooktype, &HookVectors[hooktype][HOOK_VECTOR_ALL], retchk, __VA_ARGS__)
+#define RunHookReturnInt(hooktype,retchk,...) RunHookVectorReturnInt(hooktype, &HookVectors[hooktype][HOOK_VECTOR_ALL], retchk, __VA_ARGS__)
+#define RunHookClient(hooktype,client,...) RunHookVector(hooktype, HookVectorForClient(hooktype, client), client, ##__VA_ARGS__)
+#define RunHookReturnClient(hooktype,client,retchk,...) RunHookVectorReturn(hooktype, HookVectorForClient(hooktype, client), retchk, client, ##__VA_ARGS__)
+#define RunHookReturnIntClient(hooktype,client,retchk,...) RunHookVectorReturnInt(hooktype, HookVectorForClient(hooktype, client), retchk, client, ##__VA_ARGS__)
+#define HookVectorForClient(hooktype,client) (&HookVectors[hooktype][MyConnect(client) ? HOOK_VECTOR_LOCAL : HOOK_VECTOR_REMOTE])
+
+/* The loops re-read count and func on each iteration, so a hook
+ * that adds or removes hooks can't make us read freed memory.
+ * For the same reason the profiler only records the time of a hook
+ * if the vector was not rebuilt during the call: the hook (and its
+ * histogram) may have been freed by then.
+ */
+#define RunHookVector(hooktype,vector,...) do { \
+ HookVector *_hv = (vector); \
+ int _i; \
+ if (profiler_enabled) \
+ { \
+  uint64_t _prof_start = profiler_now(), _prof_hook; \
+  for (_i = 0; _i < _hv->count; _i++) \
+  { \
+   Hook *_h = _hv->hook[_i]; \
+   unsigned int _gen = _hv->generation; \
+   _prof_hook = profiler_now(); \
+   (*_hv->func[_i])(__VA_ARGS__); \
+   if (_hv->generation == _gen) \
+    profiler_record(&_h->profile, _prof_hook); \
+  } \
+  profiler_record_hooktype(hooktype, _prof_start); \
+ } else { \
+  for (_i = 0; _i < _hv->count; _i++) (*_hv->func[_i])(__VA_ARGS__); \
+ } \
+} while(0)
+#define RunHookVectorReturn(hooktype,vector,retchk,...) \
 { \
  int retval; \
- Hook *h; \
- for (h = Hooks[hooktype]; h; h = h->next) \
+ HookVector *_hv = (vector); \
+ int _i; \
+ if (profiler_enabled) \
  { \
-  retval = (*(h->func.intfunc))(__VA_ARGS__); \
-  if (retval retchk) return; \
+  uint64_t _prof_start = profiler_now(), _prof_hook; \
+  for (_i = 0; _i < _hv->count; _i++) \
+  { \
+   Hook *_h = _hv->hook[_i]; \
+   unsigned int _gen = _hv->generation; \
+   _prof_hook = profiler_now(); \
+   retval = (*_hv->func[_i])(__VA_ARGS__); \
+   if (_hv->generation == _gen) \
+    profiler_record(&_h->profile, _prof_hook); \
+   if (retval retchk) { profiler_record_hooktype(hooktype, _prof_start); return; } \
+  } \
+  profiler_record_hooktype(hooktype, _prof_start); \
+ } else { \
+  for (_i = 0; _i < _hv->count; _i++) \
+  { \
+   retval = (*_hv->func[_i])(__VA_ARGS__); \
+   if (retval retchk) return; \
+  } \
  } \
 }
-#define RunHookReturnInt(hooktype,retchk,...) \
+#define RunHookVectorReturnInt(hooktype,vector,retchk,...) \
 { \
  int retval; \
- Hook *h; \
- for (h = Hooks[hooktype]; h; h = h->next) \
+ HookVector *_hv = (vector); \
+ int _i; \
+ if (profiler_enabled) \
  { \
-  retval = (*(h->func.intfunc))(__VA_ARGS__); \
-  if (retval retchk) return retval; \
+  uint64_t _prof_start = profiler_now(), _prof_hook; \
+  for (_i = 0; _i < _hv->count; _i++) \
+  { \
+   Hook *_h = _hv->hook[_i]; \
+   unsigned int _gen = _hv->generation; \
+   _prof_hook = profiler_now(); \
+   retval = (*_hv->func[_i])(__VA_ARGS__); \
+   if (_hv->generation == _gen) \
+    profiler_record(&_h->profile, _prof_hook); \
+   if (retval retchk) { profiler_record_hooktype(hooktype, _prof_start); return retval; } \
+  } \
+  profiler_record_hooktype(hooktype, _prof_start); \
+ } else { \
+  for (_i = 0; _i < _hv->count; _i++) \
+  { \
+   retval = (*_hv->func[_i])(__VA_ARGS__); \
+   if (retval retchk) return retval; \
+  } \
  } \
 }
 
@@ -1229,6 +1338,10 @@ extern void SavePersistentLongX(ModuleInfo *modinfo, const char *varshortname, l
 #define HOOKTYPE_JSON_EXPAND_CHANNEL	115
 /** See hooktype_accept() */
 #define HOOKTYPE_ACCEPT		116
+/** See hooktype_metrics() */
+#define HOOKTYPE_METRICS	117
+/** See hooktype_loop_end() */
+#define HOOKTYPE_LOOP_END	118
 
 /* Adding a new hook here?
  * 1) Add the #define HOOKTYPE_.... with a new number
@@ -2271,6 +2384,23 @@ int hooktype_json_expand_client_server(Client *client, int detail, json_t *j, js
  */
 int hooktype_json_expand_channel(Channel *channel, int detail, json_t *j);
 
+/** Called when the metrics are collected, eg by the metrics module (function prototype for HOOKTYPE_METRICS).
+ * Modules can use this to expose their own metrics.
+ * Each line must be in the Prometheus / OpenMetrics text format,
+ * eg "# TYPE unrealircd_xyz gauge" followed by "unrealircd_xyz 123".
+ * @param out			The list of lines, use addmultiline() to add to it
+ * @return The return value is ignored (use return 0)
+ */
+int hooktype_metrics(MultiLine **out);
+
+/** Called at the end of each iteration of the main loop (function prototype for HOOKTYPE_LOOP_END).
+ * This can be used to send out things that were collected during this
+ * iteration, eg all the notifications caused by a netsplit at once.
+ * Keep this cheap, it is called very often.
+ * @return The return value is ignored (use return 0)
+ */
+int hooktype_loop_end(void);
+
 /** @} */
 
 #ifdef GCC_TYPECHECKING
@@ -2389,7 +2519,9 @@ _UNREAL_ERROR(_hook_error_incompatible, "Incompatible hook function. Check argum
         ((hooktype == HOOKTYPE_JSON_EXPAND_CLIENT) && !ValidateHook(hooktype_json_expand_client, func)) || \
         ((hooktype == HOOKTYPE_JSON_EXPAND_CLIENT_USER) && !ValidateHook(hooktype_json_expand_client_user, func)) || \
         ((hooktype == HOOKTYPE_JSON_EXPAND_CLIENT_SERVER) && !ValidateHook(hooktype_json_expand_client_server, func)) || \
-        ((hooktype == HOOKTYPE_JSON_EXPAND_CHANNEL) && !ValidateHook(hooktype_json_expand_channel, func)) ) \
+        ((hooktype == HOOKTYPE_JSON_EXPAND_CHANNEL) && !ValidateHook(hooktype_json_expand_channel, func)) || \
+        ((hooktype == HOOKTYPE_METRICS) && !ValidateHook(hooktype_metrics, func)) || \
+        ((hooktype == HOOKTYPE_LOOP_END) && !ValidateHook(hooktype_loop_end, func)) ) \
         _hook_error_incompatible();
 #endif /* GCC_TYPECHECKING */
 
@@ -2526,6 +2658,9 @@ enum EfunctionType {
 	EFUNC_WEBSOCKET_HANDLE_WEBSOCKET,
 	EFUNC_WEBSOCKET_CREATE_PACKET,
 	EFUNC_WEBSOCKET_CREATE_PACKET_SIMPLE,
+	EFUNC_RPC_SEND_NOTIFICATION,
+	EFUNC_TKL_CHECK_PENDING_BANS,
+	EFUNC_WEBSOCKET_CREATE_PACKET_EX,
 };
 
 /* Module flags */
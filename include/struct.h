@@ -123,6 +123,7 @@ typedef struct ListStructPrio ListStructPrio;
 #define CFG_YESNO 0x0004
 
 typedef struct Watch Watch;
+typedef struct WhoWas WhoWas;
 typedef struct Client Client;
 typedef struct LocalClient LocalClient;
 typedef struct Channel Channel;
@@ -138,7 +139,12 @@ typedef struct MOTDLine MOTDLine; /* one line of a MOTD stored as a linked list
 typedef struct RealCommand RealCommand;
 typedef struct CommandOverride CommandOverride;
 typedef struct Member Member;
+typedef struct ChannelDirection ChannelDirection;
 typedef struct Membership Membership;
+typedef struct MemberIndex MemberIndex;
+typedef struct MemberIndexEntry MemberIndexEntry;
+typedef struct BanIndex BanIndex;
+typedef struct BanIndexEntry BanIndexEntry;
 
 typedef enum OperClassEntryType { OPERCLASSENTRY_ALLOW=1, OPERCLASSENTRY_DENY=2} OperClassEntryType;
 
@@ -406,6 +412,7 @@ typedef enum ClientStatus {
 #define CLIENT_FLAG_PINGWARN		0x10000000	/**< Server ping warning (remote server slow with responding to PINGs) */
 #define CLIENT_FLAG_NOHANDSHAKEDELAY	0x20000000	/**< No handshake delay */
 #define CLIENT_FLAG_SERVER_DISCONNECT_LOGGED	0x40000000	/**< Server disconnect message is (already) logged */
+#define CLIENT_FLAG_KTLS		0x80000000	/**< TLS records are encrypted by the kernel (kTLS), so we write with send() */
 
 /** @} */
 
@@ -494,6 +501,7 @@ typedef enum ClientStatus {
 #define IsShunned(x)			((x)->flags & CLIENT_FLAG_SHUNNED)
 #define IsSQuit(x)			((x)->flags & CLIENT_FLAG_SQUIT)
 #define IsTLS(x)			((x)->flags & CLIENT_FLAG_TLS)
+#define IsKTLS(x)			((x)->flags & CLIENT_FLAG_KTLS)
 #define IsSecure(x)			((x)->flags & CLIENT_FLAG_TLS)
 #define IsULine(x)			((x)->flags & CLIENT_FLAG_ULINE)
 #define IsVirus(x)			((x)->flags & CLIENT_FLAG_VIRUS)
@@ -526,6 +534,7 @@ typedef enum ClientStatus {
 #define SetShunned(x)			do { (x)->flags |= CLIENT_FLAG_SHUNNED; } while(0)
 #define SetSQuit(x)			do { (x)->flags |= CLIENT_FLAG_SQUIT; } while(0)
 #define SetTLS(x)			do { (x)->flags |= CLIENT_FLAG_TLS; } while(0)
+#define SetKTLS(x)			do { (x)->flags |= CLIENT_FLAG_KTLS; } while(0)
 #define SetULine(x)			do { (x)->flags |= CLIENT_FLAG_ULINE; } while(0)
 #define SetVirus(x)			do { (x)->flags |= CLIENT_FLAG_VIRUS; } while(0)
 #define SetIdentLookupSent(x)		do { (x)->flags |= CLIENT_FLAG_IDENTLOOKUPSENT; } while(0)
@@ -556,6 +565,7 @@ typedef enum ClientStatus {
 #define ClearShunned(x)			do { (x)->flags &= ~CLIENT_FLAG_SHUNNED; } while(0)
 #define ClearSQuit(x)			do { (x)->flags &= ~CLIENT_FLAG_SQUIT; } while(0)
 #define ClearTLS(x)			do { (x)->flags &= ~CLIENT_FLAG_TLS; } while(0)
+#define ClearKTLS(x)			do { (x)->flags &= ~CLIENT_FLAG_KTLS; } while(0)
 #define ClearULine(x)			do { (x)->flags &= ~CLIENT_FLAG_ULINE; } while(0)
 #define ClearVirus(x)			do { (x)->flags &= ~CLIENT_FLAG_VIRUS; } while(0)
 #define ClearIdentLookupSent(x)		do { (x)->flags &= ~CLIENT_FLAG_IDENTLOOKUPSENT; } while(0)
@@ -817,12 +827,80 @@ struct LoopStruct {
 	unsigned config_load_failed : 1;
 	unsigned rehash_download_busy : 1; /* don't return "all downloads complete", needed for race condition */
 	unsigned tainted : 1;
+	unsigned hot_restart : 1; /* started with -H: take over from the running server */
 	int rehashing;
 	ConfigStatus config_status;
 	Client *rehash_save_client;
 	void (*boot_function)();
 };
 
+/** Number of buckets in the event loop duration histogram (the last one is +Inf) */
+#define METRICS_LOOP_BUCKETS	14
+
+/** Cheap always-on counters about the internals of the IRCd.
+ * These are plain increments on hot paths, they are exposed
+ * by the metrics module (and possibly others).
+ */
+typedef struct ServerMetrics ServerMetrics;
+struct ServerMetrics {
+	/* Event loop */
+	uint64_t loop_iterations;		/**< Number of main loop iterations */
+	uint64_t loop_busy_nsec;		/**< Total time spent in the loop, excluding time waiting for I/O */
+	uint64_t loop_busy_bucket[METRICS_LOOP_BUCKETS]; /**< Histogram of busy time per iteration, see metrics_loop_bucket_usec[] */
+	uint64_t fd_select_calls;		/**< Number of fd_select() calls */
+	uint64_t fd_select_wakeups;		/**< Number of fd_select() calls that returned events */
+	uint64_t fd_select_events;		/**< Total number of events returned by fd_select() */
+	uint64_t fd_select_wait_nsec;		/**< Total time spent waiting in fd_select() */
+	/* Server bans */
+	uint64_t tkl_checks;			/**< Number of times a client was checked against server bans */
+	uint64_t tkl_entries_scanned;		/**< Number of server ban entries that were matched against */
+	uint64_t tkl_matches;			/**< Number of checks that resulted in a ban */
+	uint64_t tkl_new_bans_checked;		/**< Number of newly added server bans that were applied to existing clients */
+	uint64_t tkl_new_bans_full_scan;	/**< Number of newly added server bans that had to be checked against all clients */
+	uint64_t spamfilter_checks;		/**< Number of strings checked against spamfilters */
+	uint64_t spamfilter_matches;		/**< Number of spamfilter hits */
+	/* TLS */
+	uint64_t tls_handshakes_full;		/**< Number of incoming TLS handshakes that were not resumed */
+	uint64_t tls_handshakes_resumed;	/**< Number of incoming TLS handshakes that resumed a session */
+	uint64_t tls_ktls_enabled;		/**< Number of TLS connections where the kernel took over encryption */
+	uint64_t tls_ktls_fallback;		/**< Number of TLS connections with 'ktls' set that stayed in userspace */
+	/* Configuration */
+	uint64_t rehash_blocked_nsec;		/**< Time the last rehash kept the main loop busy */
+};
+
+/** Number of linear sub-buckets per power of two in a ProfilerHistogram (as a bit count) */
+#define PROFILER_SUB_BUCKET_BITS	3
+#define PROFILER_SUB_BUCKETS		(1 << PROFILER_SUB_BUCKET_BITS)
+#define PROFILER_HISTOGRAM_BUCKETS	(64 * PROFILER_SUB_BUCKETS)
+
+/** A histogram of durations (in profiler_now() units), used by the profiler.
+ * The buckets are log-linear like a HDR histogram: every power of two
+ * is split up in PROFILER_SUB_BUCKETS linear buckets, so any recorded
+ * value is accurate to within 12.5%.
+ */
+typedef struct ProfilerHistogram ProfilerHistogram;
+struct ProfilerHistogram {
+	uint64_t count;		/**< Number of recorded values */
+	uint64_t sum;		/**< Sum of all recorded values */
+	uint64_t max;		/**< Highest recorded value */
+	uint32_t buckets[PROFILER_HISTOGRAM_BUCKETS];
+};
+
+typedef enum ProfilerEntryType {
+	PROFILER_ENTRY_COMMAND = 1,	/**< Command handler */
+	PROFILER_ENTRY_HOOKTYPE = 2,	/**< All hooks of a hook type together */
+	PROFILER_ENTRY_HOOK = 3,	/**< A hook of a module */
+} ProfilerEntryType;
+
+/** Profiler data of a command or hook, as returned by profiler_get_entries() */
+typedef struct ProfilerEntry ProfilerEntry;
+struct ProfilerEntry {
+	ProfilerEntryType type;
+	const char *name;		/**< Command name or hook type name */
+	const char *module;		/**< Module name (only for PROFILER_ENTRY_HOOK) */
+	ProfilerHistogram *histogram;
+};
+
 /** Matching types for Match.type */
 typedef enum {
 	MATCH_SIMPLE=1, /**< Simple pattern with * and ? */
@@ -838,22 +916,26 @@ typedef struct Match {
 	} ext;
 } Match;
 
-typedef struct Whowas {
-	int  hashv;
-	char *name;
-	char *username;
-	char *hostname;
-	char *virthost;
-	char *servername;
-	char *realname;
-	long umodes;
-	time_t   logoff;
-	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
-	struct Whowas *next;	/* for hash table... */
-	struct Whowas *prev;	/* for hash table... */
-	struct Whowas *cnext;	/* for client struct linked list */
-	struct Whowas *cprev;	/* for client struct linked list */
-} WhoWas;
+/** A WHOWAS history entry.
+ * These live in one fixed-size ring (see src/whowas.c) whose length is
+ * set::whowas-history-length. All strings are stored inline, except for
+ * the server name which points to the scache, so an entry never needs
+ * any allocations of its own.
+ */
+struct WhoWas {
+	char name[NICKLEN+1];		/**< Nick name, empty if the slot is unused */
+	char username[USERLEN+1];	/**< Username */
+	char realname[REALLEN+1];	/**< Real name (gecos) */
+	char online_id[IDLEN+1];	/**< UID of the user if this entry is for a nick change, otherwise empty. For nick chasing, see get_history() */
+	char hostname[HOSTLEN+1];	/**< Real host */
+	char virthost[HOSTLEN+1];	/**< Virtual host, empty if none */
+	const char *servername;		/**< Server name (from the scache) */
+	long umodes;			/**< User modes */
+	time_t logoff;			/**< Time of the nick change or quit */
+	uint32_t hashv;			/**< Hash value of 'name', see hash_whowas_name() */
+	int newer;			/**< Next newer entry with the same nick, or -1 */
+	int older;			/**< Next older entry with the same nick, or -1 */
+};
 
 typedef struct SWhois SWhois;
 struct SWhois {
@@ -1145,6 +1227,7 @@ struct BanException {
 #define TKL_SUBTYPE_SOFT	0x0001 /* (require SASL) */
 
 #define TKL_FLAG_CONFIG		0x0001 /* Entry from configuration file. Cannot be removed by using commands. */
+#define TKL_FLAG_BANCHECK_PENDING	0x0002 /* Entry still needs to be applied to existing clients, see tkl_check_pending_bans() */
 
 /** A TKL entry, such as a KLINE, GLINE, Spamfilter, QLINE, Exception, .. */
 struct TKL {
@@ -1225,10 +1308,10 @@ struct RealCommand {
 	Module 			*owner;
 	RealCommand		*friend; /* cmd if token, token if cmd */
 	CommandOverride		*overriders;
-#ifdef DEBUGMODE
-	unsigned long 		lticks;
-	unsigned long 		rticks;
-#endif
+	uint64_t		local_nsec;	/**< Time spent handling this command for local clients (nanoseconds) */
+	uint64_t		remote_nsec;	/**< Time spent handling this command for remote clients (nanoseconds) */
+	ProfilerHistogram	*profile;	/**< Profiler data, only when the profiler is or was enabled */
+	uint64_t		scratch_allocs;	/**< Allocations served from scratch memory instead of malloc() */
 };
 
 /** A command override */
@@ -1263,6 +1346,7 @@ extern void unload_all_unused_moddata(void);
 #define LISTENER_CONTROL		0x000080	/**< Control channel */
 #define LISTENER_NO_CHECK_CONNECT_FLOOD	0x000100	/**< Don't check for connect-flood and max-unknown-connections-per-ip (eg for RPC) */
 #define LISTENER_NO_CHECK_ZLINED	0x000200	/**< Don't check for zlines */
+#define LISTENER_REUSEPORT		0x000400	/**< Use SO_REUSEPORT, see also ConfigItem_listen::reuseport_sockets */
 
 #define IsServersOnlyListener(x)	((x) && ((x)->options & LISTENER_SERVERSONLY))
 
@@ -1274,6 +1358,7 @@ extern void unload_all_unused_moddata(void);
 #define TLSFLAG_FAILIFNOCERT 		0x0001
 #define TLSFLAG_NOSTARTTLS		0x0002
 #define TLSFLAG_DISABLECLIENTCERT	0x0004
+#define TLSFLAG_KTLS			0x0008
 
 /** Flood counters for local clients */
 typedef struct FloodCounter {
@@ -1385,6 +1470,7 @@ struct LocalClient {
  */
 struct User {
 	Membership *channel;		/**< Channels that the user is in (linked list) */
+	MemberIndex *channel_index;	/**< Hash index on 'channel' when in many channels, see find_membership() */
 	Link *dccallow;			/**< DCCALLOW list (linked list) */
 	char account[ACCOUNTLEN + 1];	/**< Services account name or ID (SVID) - use IsLoggedIn(client) to check if logged in */
 	int joined;			/**< Number of channels joined */
@@ -1394,7 +1480,6 @@ struct User {
 	char *virthost;			/**< Virtual host - when user has user mode +x this is the active host */
 	char *server;			/**< Server name the user is on (?) */
 	SWhois *swhois;			/**< Special "additional" WHOIS entries such as "a Network Administrator" */
-	WhoWas *whowas;			/**< Something for whowas :D :D */
 	char *snomask;			/**< Server Notice Mask (snomask) - only for IRCOps */
 	char *operlogin;		/**< Which oper { } block was used to oper up, otherwise NULL - used for auditting and by oper::maxlogins */
 	char *away;			/**< AWAY message, or NULL if not away */
@@ -1690,6 +1775,9 @@ struct TLSOptions {
 	int sts_port;
 	long sts_duration;
 	int sts_preload;
+	int session_resumption;		/**< Permit session resumption through session tickets */
+	long session_ticket_rotation;	/**< Rotate ticket keys every this many seconds (only used from set::tls) */
+	char *session_ticket_key_file;	/**< Derive the ticket keys from this file (only used from set::tls) */
 };
 
 struct ConfigItem_mask {
@@ -1779,8 +1867,23 @@ struct WebSocketUser {
 	char *sec_websocket_protocol; /**< Only valid during parsing of the request, after that it is NULL again */
 	char *forwarded; /**< Unparsed `Forwarded:` header, RFC 7239 */
 	int secure; /**< If there is a Forwarded header, this indicates if the remote connection is secure */
+	char *sec_websocket_extensions; /**< Only valid during parsing of the request, after that it is NULL again */
+	int deflate; /**< Negotiated permessage-deflate options (WEBSOCKET_DEFLATE_*), 0 if not in use */
+	int deflate_server_window_bits; /**< LZ77 window bits for messages we send (8-15) */
+	int deflate_client_window_bits; /**< LZ77 window bits for messages the client sends (8-15) */
+	void *deflate_stream; /**< zlib state for outgoing messages, only with server context takeover */
+	void *inflate_stream; /**< zlib state for incoming messages, only with client context takeover */
 };
 
+/* permessage-deflate (RFC7692) options, for WebSocketUser->deflate: */
+#define WEBSOCKET_DEFLATE				0x1	/**< permessage-deflate is in use */
+#define WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER	0x2	/**< Every message we send is compressed on its own */
+#define WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER	0x4	/**< Every message the client sends is compressed on its own */
+
+/* listen::options::websocket::compression, for ConfigItem_listen->websocket_compression: */
+#define WEBSOCKET_COMPRESSION				0x1	/**< Offer permessage-deflate */
+#define WEBSOCKET_COMPRESSION_CONTEXT_TAKEOVER		0x2	/**< Allow context takeover (better compression, more memory) */
+
 #define WEBSOCKET_MAGIC_KEY "258EAFA5-E914-47DA-95CA-C5AB0DC85B11" /* see RFC6455 */
 
 /* Websocket operations: */
@@ -1800,6 +1903,8 @@ struct ConfigItem_listen {
 	int port;
 	int options, clients;
 	int fd;
+	int reuseport_sockets;		/**< Number of sockets in the SO_REUSEPORT group (listen::reuseport-sockets) */
+	int *reuseport_fds;		/**< The other sockets of the SO_REUSEPORT group, -1 if not open */
 	SSL_CTX *ssl_ctx;
 	TLSOptions *tls_options;
 	WebServer *webserver;
@@ -1807,6 +1912,7 @@ struct ConfigItem_listen {
 	int websocket_options; /* should be in module, but lazy */
 	int rpc_options;
 	char *websocket_forward;
+	int websocket_compression; /**< WEBSOCKET_COMPRESSION* flags */
 };
 
 struct ConfigItem_sni {
@@ -1928,6 +2034,7 @@ struct ConfigItem_alias_format {
 #define RESOURCE_REMOTE     0x1
 #define RESOURCE_DLQUEUED   0x2
 #define RESOURCE_INCLUDE    0x4
+#define RESOURCE_DLDEFERRED 0x8 /**< Download not started yet, see config_read_thread_finish() */
 
 typedef struct ConfigEntryWrapper ConfigEntryWrapper;
 struct ConfigEntryWrapper {
@@ -2106,14 +2213,30 @@ struct Channel {
 	time_t topic_time;			/**< Time at which the topic was last set */
 	int users;				/**< Number of users in the channel */
 	Member *members;			/**< List of channel members (users in the channel) */
+	MemberIndex *member_index;		/**< Hash index on 'members' for big channels, see find_member() */
 	Ban *banlist;				/**< List of bans (+b) */
 	Ban *exlist;				/**< List of ban exceptions (+e) */
 	Ban *invexlist;				/**< List of invite exceptions (+I) */
+	BanIndex *banlist_index;		/**< Hash index on 'banlist' for big lists, see add_listmode_ex() */
+	BanIndex *exlist_index;			/**< Hash index on 'exlist' for big lists */
+	BanIndex *invexlist_index;		/**< Hash index on 'invexlist' for big lists */
 	char *mode_lock;			/**< Mode lock (MLOCK) applied to channel - usually by Services */
+	Member **local_members;			/**< Array of members that are local clients (used by sendto_channel) */
+	int local_members_count;		/**< Number of entries used in local_members */
+	int local_members_size;			/**< Number of entries allocated in local_members */
+	ChannelDirection *directions;		/**< Server links that have one or more members behind them */
+	int directions_count;			/**< Number of entries used in directions */
+	int directions_size;			/**< Number of entries allocated in directions */
 	ModData moddata[MODDATA_MAX_CHANNEL];	/**< Channel attached module data, used by the ModData system */
 	char name[CHANNELLEN+1];		/**< Channel name */
 };
 
+/** A server link (direction) with channel members behind it, see Channel::directions */
+struct ChannelDirection {
+	Client *client;				/**< The directly connected server */
+	int users;				/**< Number of channel members behind this server link */
+};
+
 /** user/channel member struct (channel->members).
  * This is Member which is used in the linked list channel->members for each channel.
  * There is also Membership which is used in client->user->channels (see Membership for that).
@@ -2122,11 +2245,36 @@ struct Channel {
 struct Member
 {
 	struct Member *next;				/**< Next entry in list */
+	struct Member *prev;				/**< Previous entry in list */
 	Client	      *client;				/**< The client */
+	int local_index;				/**< Index in channel->local_members (local clients only) */
 	char member_modes[MEMBERMODESLEN];		/**< The access of the user on this channel (eg "vhoqa") */
 	ModData moddata[MODDATA_MAX_MEMBER];		/** Member attached module data, used by the ModData system */
 };
 
+/** Build a MemberIndex once a member or membership list reaches this size.
+ * It is freed again when the list drops below half of this.
+ */
+#define MEMBER_INDEX_THRESHOLD	16
+
+/** Hash index on channel->members or client->user->channel.
+ * This is only built for big lists (see MEMBER_INDEX_THRESHOLD),
+ * use find_member() and find_membership() for lookups.
+ */
+struct MemberIndex
+{
+	int size;					/**< Number of slots, always a power of two */
+	int count;					/**< Number of slots in use */
+	MemberIndexEntry *slots;			/**< The slots (open addressing, linear probing) */
+};
+
+/** A slot in MemberIndex */
+struct MemberIndexEntry
+{
+	const void *key;				/**< Client (channel index) or Channel (user index), NULL if free */
+	void *value;					/**< Member (channel index) or Membership (user index) */
+};
+
 /** user/channel membership struct (client->user->channels).
  * This is Membership which is used in the linked list client->user->channels for each user.
  * There is also Member which is used in channel->members (see Member for that).
@@ -2135,6 +2283,7 @@ struct Member
 struct Membership
 {
 	struct Membership 	*next;			/**< Next entry in list */
+	struct Membership	*prev;			/**< Previous entry in list */
 	struct Channel		*channel;			/**< The channel */
 	char member_modes[MEMBERMODESLEN];		/**< The (new) access of the user on this channel (eg "vhoqa") */
 	ModData moddata[MODDATA_MAX_MEMBERSHIP];	/**< Membership attached module data, used by the ModData system */
@@ -2145,11 +2294,38 @@ struct Membership
 /** A ban, exempt or invite exception entry */
 struct Ban {
 	struct Ban *next;	/**< Next entry in list */
+	struct Ban *prev;	/**< Previous entry in list, only maintained for lists with a BanIndex */
 	char *banstr;		/**< The string (eg: *!*@*.example.org) */
 	char *who;		/**< Person or server who set the entry (eg: Nick) */
 	time_t when;		/**< When the entry was added */
 };
 
+/** Build a BanIndex once a +beI list reaches this size.
+ * It is freed again when the list drops below half of this.
+ */
+#define BAN_INDEX_THRESHOLD	16
+
+/** Hash index on a +beI list of a channel (channel->banlist etc).
+ * This is only built for big lists (see BAN_INDEX_THRESHOLD) and is kept
+ * up to date by add_listmode_ex() and del_listmode(). If other code replaced
+ * the list then the index is rebuilt on next use, see ban_index_get().
+ */
+struct BanIndex
+{
+	Ban *head;		/**< First entry of the list, as last seen by the index */
+	int count;		/**< Number of entries in the list */
+	int length;		/**< Total length of all entries, for MAXBANLENGTH */
+	int size;		/**< Number of slots, always a power of two */
+	BanIndexEntry *slots;	/**< The slots (open addressing, linear probing) */
+};
+
+/** A slot in BanIndex */
+struct BanIndexEntry
+{
+	Ban *ban;		/**< The entry, NULL if free */
+	unsigned int hashv;	/**< hash_ban_mask() of ban->banstr */
+};
+
 /* Channel macros */
 #define MODE_EXCEPT		0x0200
 #define	MODE_BAN		0x0400
@@ -2166,7 +2342,7 @@ struct Ban {
 #define	IsChannelName(name) ((name) && (*(name) == '#'))
 
 #define IsMember(blah,chan) ((blah && blah->user && \
-                find_membership_link((blah->user)->channel, chan)) ? 1 : 0)
+                find_membership(blah, chan)) ? 1 : 0)
 
 
 /* Misc macros */
@@ -2345,6 +2521,30 @@ struct ConfigItem_badword {
 	pcre2_code	*pcre2_expr;
 };
 
+/** A position in the scratch arena, see scratch_mark() in src/scratch.c */
+typedef struct ScratchMark {
+	void *chunk;
+	size_t used;
+} ScratchMark;
+
+/** Vectorized text kernels, see src/simd.c and 'text_kernels' */
+typedef struct TextKernels {
+	const char *name;	/**< Name of the implementation, eg "avx2" */
+	/** Returns the number of leading bytes in 's' that are ASCII (<128) */
+	size_t (*ascii_span)(const char *s, size_t len);
+	/** Returns the number of leading bytes that are not a control code (<32) or 0xe2 */
+	size_t (*control_span)(const char *s, size_t len);
+	/** Convert A-Z to a-z, 'dst' may be the same as 'src' */
+	void (*tolower_ascii)(char *dst, const char *src, size_t len);
+	/** XOR 'src' with the 4 byte 'key' (websocket unmasking), 'dst' may be the same as 'src' */
+	void (*unmask)(char *dst, const char *src, size_t len, const char *key);
+} TextKernels;
+
+/** A badword list compiled for fast matching, see badword_matcher_compile().
+ * The contents are private to src/match.c.
+ */
+typedef struct BadwordMatcher BadwordMatcher;
+
 /*-- end of badwords --*/
 
 /* Flags for 'sendflags' in 'sendto_channel' */
@@ -44,15 +44,6 @@
 */
 void add_history(Client *, int);
 
-/*
-** off_history
-**	This must be called when the client structure is about to
-**	be released. History mechanism keeps pointers to client
-**	structures and it must know when they cease to exist. This
-**	also implicitly calls AddHistory.
-*/
-void off_history(Client *);
-
 /*
 ** get_history
 **	Return the current client that was using the given
@@ -63,6 +54,23 @@ Client *get_history(const char *, time_t);
 					/* Nick name */
 					/* Time limit in seconds */
 
+/*
+** whowas_find
+**	Return the most recent history entry for the given
+**	nickname, or NULL if there is none. Use whowas_older()
+**	to walk to the older entries for the same nickname.
+*/
+WhoWas *whowas_find(const char *);
+WhoWas *whowas_older(WhoWas *);
+
+/*
+** whowas_set_length
+**	(Re)size the history to the given number of entries,
+**	keeping the most recent ones. Called after (re)hash
+**	with set::whowas-history-length.
+*/
+void whowas_set_length(int);
+
 /*
 ** for debugging...counts related structures stored in whowas array.
 */
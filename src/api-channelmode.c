@@ -36,6 +36,14 @@
 /** List of all channel modes, their handlers, etc */
 Cmode *channelmodes = NULL;
 
+/** Lookup tables for channel modes, indexed by mode letter,
+ * prefix (eg '@') and SJOIN prefix. These are rebuilt by
+ * channelmode_rebuild_tables() whenever a mode is added or removed.
+ */
+static Cmode *channelmode_by_letter[256];
+static Cmode *channelmode_by_prefix[256];
+static Cmode *channelmode_by_sjoin_prefix[256];
+
 /** @} */
 
 /** Channel parameter to slot# mapping - used by GETPARAMSLOT() macro */
@@ -261,6 +269,27 @@ void extcmode_para_delslot(Cmode *cm, int slot)
 	param_to_slot_mapping[cm->letter] = 0;
 }
 
+/** Rebuild the letter and prefix lookup tables from 'channelmodes' */
+static void channelmode_rebuild_tables(void)
+{
+	Cmode *cm;
+
+	memset(channelmode_by_letter, 0, sizeof(channelmode_by_letter));
+	memset(channelmode_by_prefix, 0, sizeof(channelmode_by_prefix));
+	memset(channelmode_by_sjoin_prefix, 0, sizeof(channelmode_by_sjoin_prefix));
+	for (cm=channelmodes; cm; cm = cm->next)
+	{
+		channelmode_by_letter[(unsigned char)cm->letter] = cm;
+		if (cm->type == CMODE_MEMBER)
+		{
+			if (cm->prefix)
+				channelmode_by_prefix[(unsigned char)cm->prefix] = cm;
+			if (cm->sjoin_prefix)
+				channelmode_by_sjoin_prefix[(unsigned char)cm->sjoin_prefix] = cm;
+		}
+	}
+}
+
 void channelmode_add_sorted(Cmode *n)
 {
 	Cmode *m;
@@ -441,6 +470,7 @@ Cmode *CmodeAdd(Module *module, CmodeInfo req, Cmode_t *mode)
 		AddListItem(cmodeobj, module->objects);
 		module->errorcode = MODERR_NOERROR;
 	}
+	channelmode_rebuild_tables();
 	return cm;
 }
 
@@ -568,6 +598,7 @@ static void unload_extcmode_commit(Cmode *cmode)
 
 	DelListItem(cmode, channelmodes);
 	safe_free(cmode);
+	channelmode_rebuild_tables();
 }
 
 /** Unload all unused channel modes after a REHASH */
@@ -749,7 +780,7 @@ const char *get_channel_access(Client *client, Channel *channel)
 {
 	Membership *mb;
 
-	mb = find_membership_link(client->user->channel, channel);
+	mb = find_membership(client, channel);
 	if (!mb)
 		return "";
 	return mb->member_modes;
@@ -771,7 +802,7 @@ int check_channel_access(Client *client, Channel *channel, const char *modes)
 	if (!IsUser(client))
 		return 0; /* eg server */
 
-	mb = find_membership_link(client->user->channel, channel);
+	mb = find_membership(client, channel);
 	if (!mb)
 		return 0; /* not a member */
 
@@ -854,14 +885,14 @@ int check_channel_access_letter(const char *current_modes, const char letter)
 	return strchr(current_modes, letter) ? 1 : 0;
 }
 
+/** Find the channel mode handler for a mode letter.
+ * This is a simple table lookup, so cheap enough to call from hot paths.
+ * @param letter	The channel mode letter, eg 'm'
+ * @returns The channel mode or NULL if no such mode exists.
+ */
 Cmode *find_channel_mode_handler(char letter)
 {
-	Cmode *cm;
-
-	for (cm=channelmodes; cm; cm = cm->next)
-		if (cm->letter == letter)
-			return cm;
-	return NULL;
+	return channelmode_by_letter[(unsigned char)letter];
 }
 
 /** Is 'letter' a valid mode used for access/levels/ranks? (vhoaq and such)
@@ -929,10 +960,10 @@ int find_mbs(Client *client, Channel *channel, Member **mb, Membership **mbs)
 {
 	*mbs = NULL;
 
-	if (!(*mb = find_member_link(channel->members, client)))
+	if (!(*mb = find_member(channel, client)))
 		return 0;
 
-	if (!(*mbs = find_membership_link(client->user->channel, channel)))
+	if (!(*mbs = find_membership(client, channel)))
 		return 0;
 	
 	return 1;
@@ -977,9 +1008,8 @@ char sjoin_prefix_to_mode(char s)
 		return 'I';
 
 	/* Now the dynamic ones (+vhoaq): */
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->sjoin_prefix == s) && (cm->type == CMODE_MEMBER))
-			return cm->letter;
+	if ((cm = channelmode_by_sjoin_prefix[(unsigned char)s]))
+		return cm->letter;
 
 	/* Not found */
 	return '\0';
@@ -1002,9 +1032,9 @@ char mode_to_sjoin_prefix(char s)
 		return '\'';
 
 	/* Now the dynamic ones (+vhoaq): */
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->letter == s) && (cm->type == CMODE_MEMBER))
-			return cm->sjoin_prefix;
+	cm = channelmode_by_letter[(unsigned char)s];
+	if (cm && (cm->type == CMODE_MEMBER))
+		return cm->sjoin_prefix;
 
 	/* Not found */
 	return '\0';
@@ -1036,9 +1066,9 @@ char mode_to_prefix(char s)
 		return '\0';
 
 	/* Now the dynamic ones (+vhoaq): */
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->letter == s) && (cm->type == CMODE_MEMBER))
-			return cm->prefix;
+	cm = channelmode_by_letter[(unsigned char)s];
+	if (cm && (cm->type == CMODE_MEMBER))
+		return cm->prefix;
 
 	/* Not found */
 	return '\0';
@@ -1070,9 +1100,8 @@ char prefix_to_mode(char s)
 		return '\0';
 
 	/* Now the dynamic ones (+vhoaq): */
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->prefix == s) && (cm->type == CMODE_MEMBER))
-			return cm->letter;
+	if ((cm = channelmode_by_prefix[(unsigned char)s]))
+		return cm->letter;
 
 	/* Not found */
 	return '\0';
@@ -1089,19 +1118,17 @@ char rank_to_mode(int rank)
 
 int mode_to_rank(char mode)
 {
-	Cmode *cm;
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->type == CMODE_MEMBER) && (cm->letter == mode))
-			return cm->rank;
+	Cmode *cm = channelmode_by_letter[(unsigned char)mode];
+	if (cm && (cm->type == CMODE_MEMBER))
+		return cm->rank;
 	return '\0';
 }
 
 int prefix_to_rank(char prefix)
 {
-	Cmode *cm;
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->type == CMODE_MEMBER) && (cm->prefix == prefix))
-			return cm->rank;
+	Cmode *cm = channelmode_by_prefix[(unsigned char)prefix];
+	if (cm)
+		return cm->rank;
 	return '\0';
 }
 
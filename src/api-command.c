@@ -26,6 +26,9 @@
 static Command *CommandAddInternal(Module *module, const char *cmd, CmdFunc func, AliasCmdFunc aliasfunc, unsigned char params, int flags);
 static RealCommand *add_Command_backend(const char *cmd);
 
+/* Set when a command is added or removed, see command_lookup() */
+static int command_lookup_dirty = 1;
+
 /** @defgroup CommandAPI Command API
  * @{
  */
@@ -34,15 +37,7 @@ static RealCommand *add_Command_backend(const char *cmd);
  */
 int CommandExists(const char *name)
 {
-	RealCommand *p;
-	
-	for (p = CommandHash[toupper(*name)]; p; p = p->next)
-	{
-		if (!strcasecmp(p->cmd, name))
-			return 1;
-	}
-
-	return 0;
+	return find_command_simple(name) ? 1 : 0;
 }
 
 /** Register a new command.
@@ -135,6 +130,7 @@ void CommandDelX(Command *command, RealCommand *cmd)
 	CommandOverride *ovr, *ovrnext;
 
 	DelListItem(cmd, CommandHash[toupper(*cmd->cmd)]);
+	command_lookup_invalidate();
 	if (command && cmd->owner)
 	{
 		ModuleObject *cmdobj;
@@ -154,6 +150,7 @@ void CommandDelX(Command *command, RealCommand *cmd)
 		CommandOverrideDel(ovr);
 	}
 	safe_free(cmd->cmd);
+	safe_free(cmd->profile);
 	safe_free(cmd);
 	if (command)
 		safe_free(command);
@@ -241,56 +238,235 @@ static RealCommand *add_Command_backend(const char *cmd)
 
 	/* Add in hash with hash value = first byte */
 	AddListItem(c, CommandHash[toupper(*cmd)]);
+	command_lookup_invalidate();
 
 	return c;
 }
 
-/** @defgroup CommandAPI Command API
- * @{
+/* The CommandHash[] lists above are the real list of commands, but the
+ * lookups in find_command() and find_command_simple() are done through
+ * the table below: a cuckoo hash table on the case-insensitive command
+ * name, where each name lives in one of two slots. So a lookup is at most
+ * two string compares, no matter how many commands there are.
+ * For each name we also precompute the find_command() result for each
+ * flag class, so the flag checks are not done at lookup time either.
+ * The table is rebuilt on the first lookup after a command was added
+ * or removed (eg: after loading or unloading modules).
  */
 
-/** Find a command by name and flags */
-RealCommand *find_command(const char *cmd, int flags)
+/** Flag classes: the 16 combinations of the flags that find_command()
+ * filters on, plus one class for CMD_CONTROL (which ignores the others).
+ */
+#define COMMAND_LOOKUP_CLASSES		17
+#define COMMAND_LOOKUP_CLASS_CONTROL	16
+
+typedef struct CommandLookup CommandLookup;
+struct CommandLookup {
+	const char *name;
+	RealCommand *any; /**< First command with this name, for find_command_simple() */
+	RealCommand *class[COMMAND_LOOKUP_CLASSES]; /**< Result of find_command() for each flag class */
+};
+
+static CommandLookup *command_lookup_entries = NULL;
+static CommandLookup **command_lookup_table = NULL;
+static unsigned int command_lookup_mask = 0;
+static uint64_t command_lookup_seed = 0;
+
+/** Throw away the precomputed command lookups, they are rebuilt on
+ * the next lookup. Call this when RealCommand->flags of an existing
+ * command is changed (adding and removing commands does this already).
+ */
+void command_lookup_invalidate(void)
 {
-	RealCommand *p;
-	for (p = CommandHash[toupper(*cmd)]; p; p = p->next)
+	command_lookup_dirty = 1;
+}
+
+static int command_flag_class(int flags)
+{
+	int class = 0;
+
+	if (flags & CMD_CONTROL)
+		return COMMAND_LOOKUP_CLASS_CONTROL;
+	if (flags & CMD_UNREGISTERED)
+		class |= 1;
+	if (flags & CMD_SHUN)
+		class |= 2;
+	if (flags & CMD_VIRUS)
+		class |= 4;
+	if (flags & CMD_ALIAS)
+		class |= 8;
+	return class;
+}
+
+/** Returns 1 if find_command() may return command 'p' for a lookup in flag class 'class' */
+static int command_in_class(RealCommand *p, int class)
+{
+	if (class == COMMAND_LOOKUP_CLASS_CONTROL)
+		return (p->flags & CMD_CONTROL) ? 1 : 0;
+	if (p->flags & CMD_CONTROL)
+		return 0; /* important to also filter it this way ;) */
+	if ((class & 1) && !(p->flags & CMD_UNREGISTERED))
+		return 0;
+	if ((class & 2) && !(p->flags & CMD_SHUN))
+		return 0;
+	if ((class & 4) && !(p->flags & CMD_VIRUS))
+		return 0;
+	if ((class & 8) && !(p->flags & CMD_ALIAS))
+		return 0;
+	return 1;
+}
+
+/** Hash of the case-insensitive command name (FNV-1a with a seed and a final mix).
+ * The low and high 32 bits are used for the two slots.
+ */
+static uint64_t command_lookup_hash(const char *cmd, uint64_t seed)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+
+	for (; *cmd; cmd++)
+		h = (h ^ (unsigned char)tolower(*cmd)) * 0x100000001b3ULL;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/** Insert 'e' into the table, kicking out other entries to their
+ * other slot if needed.
+ * @returns 1 on success, 0 if we gave up (caller should pick a new seed).
+ */
+static int command_lookup_insert(CommandLookup *e)
+{
+	CommandLookup *kicked;
+	uint64_t h;
+	unsigned int slot1, slot2, slot;
+	int i;
+
+	for (i = 0; i < 64; i++)
 	{
-		if (flags & CMD_CONTROL)
+		h = command_lookup_hash(e->name, command_lookup_seed);
+		slot1 = h & command_lookup_mask;
+		slot2 = (h >> 32) & command_lookup_mask;
+		if (!command_lookup_table[slot1])
+		{
+			command_lookup_table[slot1] = e;
+			return 1;
+		}
+		if (!command_lookup_table[slot2])
 		{
-			if (!(p->flags & CMD_CONTROL))
-				continue;
-		} else
+			command_lookup_table[slot2] = e;
+			return 1;
+		}
+		slot = (i & 1) ? slot2 : slot1;
+		kicked = command_lookup_table[slot];
+		command_lookup_table[slot] = e;
+		e = kicked;
+	}
+	return 0;
+}
+
+static void command_lookup_build(void)
+{
+	RealCommand *p;
+	CommandLookup *e;
+	int total = 0, names = 0, first, i, j, class;
+	unsigned int size;
+	int attempt;
+
+	for (i = 0; i < 256; i++)
+		for (p = CommandHash[i]; p; p = p->next)
+			total++;
+
+	/* Group the commands by name. Walking the lists in order means
+	 * that the first match is the same one that a walk of the list
+	 * in CommandHash[] would find.
+	 */
+	safe_free(command_lookup_entries);
+	command_lookup_entries = safe_alloc(sizeof(CommandLookup) * (total ? total : 1));
+	for (i = 0; i < 256; i++)
+	{
+		first = names; /* names in other lists have a different first letter */
+		for (p = CommandHash[i]; p; p = p->next)
 		{
-			if ((flags & CMD_UNREGISTERED) && !(p->flags & CMD_UNREGISTERED))
-				continue;
-			if ((flags & CMD_SHUN) && !(p->flags & CMD_SHUN))
-				continue;
-			if ((flags & CMD_VIRUS) && !(p->flags & CMD_VIRUS))
-				continue;
-			if ((flags & CMD_ALIAS) && !(p->flags & CMD_ALIAS))
-				continue;
-			if (p->flags & CMD_CONTROL)
-				continue; /* important to also filter it this way ;) */
+			e = NULL;
+			for (j = first; j < names; j++)
+			{
+				if (!strcasecmp(command_lookup_entries[j].name, p->cmd))
+				{
+					e = &command_lookup_entries[j];
+					break;
+				}
+			}
+			if (!e)
+			{
+				e = &command_lookup_entries[names++];
+				e->name = p->cmd;
+				e->any = p;
+			}
+			for (class = 0; class < COMMAND_LOOKUP_CLASSES; class++)
+				if (!e->class[class] && command_in_class(p, class))
+					e->class[class] = p;
 		}
+	}
 
-		if (!strcasecmp(p->cmd, cmd))
-			return p;
+	/* A table of at least 4 times the number of names nearly always
+	 * works on the first try. If not, try another seed, and grow
+	 * the table if that does not help either.
+	 */
+	for (size = 16; size < names * 4; size *= 2);
+	for (attempt = 1; ; attempt++)
+	{
+		safe_free(command_lookup_table);
+		command_lookup_table = safe_alloc(sizeof(CommandLookup *) * size);
+		command_lookup_mask = size - 1;
+		command_lookup_seed = ((uint64_t)getrandom32() << 32) | getrandom32();
+		for (i = 0; i < names; i++)
+			if (!command_lookup_insert(&command_lookup_entries[i]))
+				break;
+		if (i == names)
+			break;
+		if (attempt % 8 == 0)
+			size *= 2;
 	}
+	command_lookup_dirty = 0;
+}
+
+static CommandLookup *command_lookup(const char *cmd)
+{
+	CommandLookup *e;
+	uint64_t h;
+
+	if (command_lookup_dirty)
+		command_lookup_build();
+
+	h = command_lookup_hash(cmd, command_lookup_seed);
+	e = command_lookup_table[h & command_lookup_mask];
+	if (e && !strcasecmp(e->name, cmd))
+		return e;
+	e = command_lookup_table[(h >> 32) & command_lookup_mask];
+	if (e && !strcasecmp(e->name, cmd))
+		return e;
 	return NULL;
 }
 
+/** @defgroup CommandAPI Command API
+ * @{
+ */
+
+/** Find a command by name and flags */
+RealCommand *find_command(const char *cmd, int flags)
+{
+	CommandLookup *e = command_lookup(cmd);
+
+	return e ? e->class[command_flag_class(flags)] : NULL;
+}
+
 /** Find a command by name (no access rights check) */
 RealCommand *find_command_simple(const char *cmd)
 {
-	RealCommand *c;
+	CommandLookup *e = command_lookup(cmd);
 
-	for (c = CommandHash[toupper(*cmd)]; c; c = c->next)
-	{
-		if (!strcasecmp(c->cmd, cmd))
-				return c;
-	}
-
-	return NULL;
+	return e ? e->any : NULL;
 }
 
 /** @} */
@@ -148,6 +148,9 @@ void (*rpc_error_fmt)(Client *client, json_t *request, JsonRpcError error_code,
 int (*websocket_handle_websocket)(Client *client, WebRequest *web, const char *readbuf2, int length2, int callback(Client *client, char *buf, int len));
 int (*websocket_create_packet)(int opcode, char **buf, int *len);
 int (*websocket_create_packet_simple)(int opcode, const char **buf, int *len);
+void (*rpc_send_notification)(Client *client, const char *method, json_t *params);
+void (*tkl_check_pending_bans)(void);
+int (*websocket_create_packet_ex)(Client *client, int opcode, char **buf, int *len);
 
 Efunction *EfunctionAddMain(Module *module, EfunctionType eftype, int (*func)(), void (*vfunc)(), void *(*pvfunc)(), char *(*stringfunc)(), const char *(*conststringfunc)())
 {
@@ -431,4 +434,7 @@ void efunctions_init(void)
 	efunc_init_function(EFUNC_WEBSOCKET_HANDLE_WEBSOCKET, websocket_handle_websocket, websocket_handle_websocket_default_handler);
 	efunc_init_function(EFUNC_WEBSOCKET_CREATE_PACKET, websocket_create_packet, websocket_create_packet_default_handler);
 	efunc_init_function(EFUNC_WEBSOCKET_CREATE_PACKET_SIMPLE, websocket_create_packet_simple, websocket_create_packet_simple_default_handler);
+	efunc_init_function(EFUNC_RPC_SEND_NOTIFICATION, rpc_send_notification, rpc_send_notification_default_handler);
+	efunc_init_function(EFUNC_TKL_CHECK_PENDING_BANS, tkl_check_pending_bans, NULL);
+	efunc_init_function(EFUNC_WEBSOCKET_CREATE_PACKET_EX, websocket_create_packet_ex, websocket_create_packet_ex_default_handler);
 }
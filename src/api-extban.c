@@ -25,6 +25,9 @@
 /** List of all extbans, their handlers, etc */
 MODVAR Extban *extbans = NULL;
 
+/** Extbans by letter, kept in sync with 'extbans' */
+static Extban *extban_by_letter[256];
+
 void set_isupport_extban(void)
 {
 	char extbanstr[512];
@@ -42,10 +45,11 @@ Extban *findmod_by_bantype_raw(const char *str, int ban_name_length)
 {
 	Extban *e;
 
+	if ((ban_name_length == 1) && (e = extban_by_letter[(unsigned char)str[0]]))
+		return e;
+
 	for (e=extbans; e; e = e->next)
 	{
-		if ((ban_name_length == 1) && (e->letter == str[0]))
-			return e;
 		if (e->name)
 		{
 			int namelen = strlen(e->name);
@@ -213,6 +217,7 @@ Extban *ExtbanAdd(Module *module, ExtbanInfo req)
 		e = safe_alloc(sizeof(Extban));
 		e->letter = req.letter;
 		extban_add_sorted(e);
+		extban_by_letter[(unsigned char)e->letter] = e;
 	}
 	e->letter = req.letter;
 	safe_strdup(e->name, req.name);
@@ -245,6 +250,7 @@ static void unload_extban_commit(Extban *e)
 	// noop
 
 	/* Then unload the extban */
+	extban_by_letter[(unsigned char)e->letter] = NULL;
 	DelListItem(e, extbans);
 	safe_free(e->name);
 	safe_free(e);
@@ -56,6 +56,9 @@ long SNO_OPER = 0L;
 long AllUmodes;		/* All umodes */
 long SendUmodes;	/* All umodes which are sent to other servers (global umodes) */
 
+/** Usermodes by letter, kept in sync with 'usermodes' */
+static Umode *usermode_by_letter[256];
+
 /* Forward declarations */
 int umode_hidle_allow(Client *client, int what);
 static void unload_usermode_commit(Umode *m);
@@ -207,6 +210,7 @@ Umode *UmodeAdd(Module *module, char ch, int global, int unset_on_deoper, int (*
 		um->letter = ch;
 		um->mode = l;
 		usermode_add_sorted(um);
+		usermode_by_letter[(unsigned char)ch] = um;
 	}
 
 	um->letter = ch;
@@ -318,6 +322,7 @@ static void unload_usermode_commit(Umode *um)
 	}
 
 	/* Then unload the mode */
+	usermode_by_letter[(unsigned char)um->letter] = NULL;
 	DelListItem(um, usermodes);
 	safe_free(um);
 	make_umodestr();
@@ -377,14 +382,16 @@ void remove_oper_privileges(Client *client, int broadcast_mode_change)
 		swhois_delete(client, "oper", "*", &me, NULL);
 }
 
-/** Return long integer mode for a user mode character (eg: 'x' -> 0x10) */
+/** Return long integer mode for a user mode character (eg: 'x' -> 0x10).
+ * This is a table lookup. The value only changes when the mode
+ * is (un)loaded, so modules may cache it until the next REHASH.
+ */
 long find_user_mode(char letter)
 {
-	Umode *um;
+	Umode *um = usermode_by_letter[(unsigned char)letter];
 
-	for (um = usermodes; um; um = um->next)
-		if ((um->letter == letter) && !um->unloaded)
-			return um->mode;
+	if (um && !um->unloaded)
+		return um->mode;
 
 	return 0;
 }
@@ -41,6 +41,8 @@ long sajoinmode = 0;
 Channel *channels = NULL;
 
 static mp_pool_t *channel_pool = NULL;
+static mp_pool_t *member_pool = NULL;
+static mp_pool_t *membership_pool = NULL;
 
 /** This describes the letters, modes and options for core channel modes.
  * These are +ntmispklr and also the list modes +vhoaq and +beI.
@@ -109,24 +111,142 @@ Membership *find_membership_link(Membership *lp, Channel *ptr)
 	return NULL;
 }
 
-/** Allocate and return an empty Member struct */
-static Member *make_member(void)
+/* The MemberIndex is a simple open addressing hash table with linear
+ * probing, keyed on a pointer. It is used for channel->member_index
+ * (Client -> Member) and client->user->channel_index (Channel -> Membership)
+ * and only exists for lists of MEMBER_INDEX_THRESHOLD entries or more.
+ * The table is kept at most half full.
+ */
+
+static unsigned int member_index_slot(MemberIndex *idx, const void *key)
 {
-	Member *lp;
-	unsigned int	i;
+	uint64_t h = (uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)(h >> 32) & (idx->size - 1);
+}
+
+static void *member_index_find(MemberIndex *idx, const void *key)
+{
+	unsigned int i;
+
+	for (i = member_index_slot(idx, key); idx->slots[i].key; i = (i + 1) & (idx->size - 1))
+		if (idx->slots[i].key == key)
+			return idx->slots[i].value;
+	return NULL;
+}
+
+static void member_index_resize(MemberIndex *idx, int size);
+
+static void member_index_add(MemberIndex *idx, const void *key, void *value)
+{
+	unsigned int i;
+
+	if ((idx->count + 1) * 2 > idx->size)
+		member_index_resize(idx, idx->size * 2);
+
+	for (i = member_index_slot(idx, key); idx->slots[i].key; i = (i + 1) & (idx->size - 1));
+	idx->slots[i].key = key;
+	idx->slots[i].value = value;
+	idx->count++;
+}
+
+static void member_index_resize(MemberIndex *idx, int size)
+{
+	MemberIndexEntry *old = idx->slots;
+	int old_size = idx->size;
+	int i;
+
+	idx->size = size;
+	idx->count = 0;
+	idx->slots = safe_alloc(sizeof(MemberIndexEntry) * size);
+	for (i = 0; i < old_size; i++)
+		if (old[i].key)
+			member_index_add(idx, old[i].key, old[i].value);
+	safe_free(old);
+}
+
+/** Delete 'key' from the index.
+ * Entries after it in the same probe run are moved back,
+ * so we never need tombstones.
+ */
+static void member_index_del(MemberIndex *idx, const void *key)
+{
+	unsigned int mask = idx->size - 1;
+	unsigned int i, j, home;
+
+	for (i = member_index_slot(idx, key); idx->slots[i].key != key; i = (i + 1) & mask)
+		if (!idx->slots[i].key)
+			return; /* not found */
 
-	if (freemember == NULL)
+	for (j = (i + 1) & mask; idx->slots[j].key; j = (j + 1) & mask)
 	{
-		for (i = 1; i <= (4072/sizeof(Member)); ++i)
+		home = member_index_slot(idx, idx->slots[j].key);
+		/* Can the entry at 'j' be moved to the hole at 'i'?
+		 * Only if its home slot is not in the cyclic range (i, j].
+		 */
+		if (((j - home) & mask) >= ((j - i) & mask))
 		{
-			lp = safe_alloc(sizeof(Member));
-			lp->next = freemember;
-			freemember = lp;
+			idx->slots[i] = idx->slots[j];
+			i = j;
 		}
 	}
-	lp = freemember;
-	freemember = freemember->next;
-	lp->next = NULL;
+	idx->slots[i].key = NULL;
+	idx->slots[i].value = NULL;
+	idx->count--;
+}
+
+static MemberIndex *member_index_new(int entries)
+{
+	MemberIndex *idx = safe_alloc(sizeof(MemberIndex));
+
+	idx->size = 16;
+	while (idx->size < entries * 2)
+		idx->size *= 2;
+	idx->slots = safe_alloc(sizeof(MemberIndexEntry) * idx->size);
+	return idx;
+}
+
+static void member_index_free(MemberIndex **idx)
+{
+	if (*idx)
+	{
+		safe_free((*idx)->slots);
+		safe_free(*idx);
+	}
+}
+
+/** Find the Member entry of 'client' in 'channel'.
+ * This is like find_member_link(channel->members, client)
+ * but uses the index on big channels.
+ */
+Member *find_member(Channel *channel, Client *client)
+{
+	if (!client)
+		return NULL;
+	if (channel->member_index)
+		return member_index_find(channel->member_index, client);
+	return find_member_link(channel->members, client);
+}
+
+/** Find the Membership entry of 'client' for 'channel'.
+ * This is like find_membership_link(client->user->channel, channel)
+ * but uses the index if the user is in many channels.
+ */
+Membership *find_membership(Client *client, Channel *channel)
+{
+	if (!channel || !client->user)
+		return NULL;
+	if (client->user->channel_index)
+		return member_index_find(client->user->channel_index, channel);
+	return find_membership_link(client->user->channel, channel);
+}
+
+/** Allocate and return an empty Member struct */
+static Member *make_member(void)
+{
+	Member *lp;
+
+	lp = mp_pool_get(member_pool);
+	memset(lp, 0, sizeof(Member));
 	return lp;
 }
 
@@ -136,33 +256,15 @@ static void free_member(Member *lp)
 	if (!lp)
 		return;
 	moddata_free_member(lp);
-	memset(lp, 0, sizeof(Member));
-	lp->next = freemember;
-	freemember = lp;
+	mp_pool_release(lp);
 }
 
 /** Allocate and return an empty Membership struct */
 static Membership *make_membership(void)
 {
-	Membership *m = NULL;
-	unsigned int	i;
+	Membership *m;
 
-	if (freemembership == NULL)
-	{
-		for (i = 1; i <= (4072/sizeof(Membership)); i++)
-		{
-			m = safe_alloc(sizeof(Membership));
-			m->next = freemembership;
-			freemembership = m;
-		}
-		m = freemembership;
-		freemembership = m->next;
-	}
-	else
-	{
-		m = freemembership;
-		freemembership = freemembership->next;
-	}
+	m = mp_pool_get(membership_pool);
 	memset(m, 0, sizeof(Membership));
 	return m;
 }
@@ -173,9 +275,7 @@ static void free_membership(Membership *m)
 	if (m)
 	{
 		moddata_free_membership(m);
-		memset(m, 0, sizeof(Membership));
-		m->next = freemembership;
-		freemembership = m;
+		mp_pool_release(m);
 	}
 }
 
@@ -239,6 +339,146 @@ int identical_ban(const char *one, const char *two)
 	return 0;
 }
 
+/* The BanIndex is an open addressing hash table with linear probing
+ * on the (case insensitive) ban string, much like the MemberIndex.
+ * It also keeps the number of entries and their total length, so the
+ * MAXBANS and MAXBANLENGTH checks don't have to walk the list either.
+ */
+
+static BanIndex **ban_index_ptr(Channel *channel, Ban **list)
+{
+	if (list == &channel->banlist)
+		return &channel->banlist_index;
+	if (list == &channel->exlist)
+		return &channel->exlist_index;
+	if (list == &channel->invexlist)
+		return &channel->invexlist_index;
+	return NULL;
+}
+
+static Ban *ban_index_find(BanIndex *idx, const char *banid, unsigned int hashv)
+{
+	unsigned int i;
+
+	for (i = hashv & (idx->size - 1); idx->slots[i].ban; i = (i + 1) & (idx->size - 1))
+		if ((idx->slots[i].hashv == hashv) && identical_ban(idx->slots[i].ban->banstr, banid))
+			return idx->slots[i].ban;
+	return NULL;
+}
+
+static void ban_index_insert(BanIndex *idx, Ban *ban, unsigned int hashv)
+{
+	unsigned int i;
+
+	for (i = hashv & (idx->size - 1); idx->slots[i].ban; i = (i + 1) & (idx->size - 1));
+	idx->slots[i].ban = ban;
+	idx->slots[i].hashv = hashv;
+}
+
+static void ban_index_add(BanIndex *idx, Ban *ban, unsigned int hashv)
+{
+	if ((idx->count + 1) * 2 > idx->size)
+	{
+		BanIndexEntry *old = idx->slots;
+		int old_size = idx->size;
+		int i;
+
+		idx->size *= 2;
+		idx->slots = safe_alloc(sizeof(BanIndexEntry) * idx->size);
+		for (i = 0; i < old_size; i++)
+			if (old[i].ban)
+				ban_index_insert(idx, old[i].ban, old[i].hashv);
+		safe_free(old);
+	}
+	ban_index_insert(idx, ban, hashv);
+	idx->count++;
+	idx->length += strlen(ban->banstr);
+}
+
+/** Delete 'ban' from the index, see member_index_del() for how this works */
+static void ban_index_del(BanIndex *idx, Ban *ban, unsigned int hashv)
+{
+	unsigned int mask = idx->size - 1;
+	unsigned int i, j, home;
+
+	for (i = hashv & mask; idx->slots[i].ban != ban; i = (i + 1) & mask)
+		if (!idx->slots[i].ban)
+			return; /* not found */
+
+	for (j = (i + 1) & mask; idx->slots[j].ban; j = (j + 1) & mask)
+	{
+		home = idx->slots[j].hashv & mask;
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			idx->slots[i] = idx->slots[j];
+			i = j;
+		}
+	}
+	idx->slots[i].ban = NULL;
+	idx->count--;
+	idx->length -= strlen(ban->banstr);
+}
+
+/** (Re)build the index for 'list'. This also sets all the 'prev' pointers. */
+static void ban_index_build(BanIndex *idx, Ban *list)
+{
+	Ban *ban, *prev = NULL;
+	int entries = 0;
+
+	for (ban = list; ban; ban = ban->next)
+		entries++;
+
+	safe_free(idx->slots);
+	idx->size = 16;
+	while (idx->size < entries * 2)
+		idx->size *= 2;
+	idx->slots = safe_alloc(sizeof(BanIndexEntry) * idx->size);
+	idx->count = idx->length = 0;
+	for (ban = list; ban; ban = ban->next)
+	{
+		ban->prev = prev;
+		prev = ban;
+		ban_index_add(idx, ban, hash_ban_mask(ban->banstr));
+	}
+	idx->head = list;
+}
+
+static void ban_index_free(BanIndex **idx)
+{
+	if (*idx)
+	{
+		safe_free((*idx)->slots);
+		safe_free(*idx);
+	}
+}
+
+/** Return the index of 'list' in 'channel', or NULL if there is none.
+ * If the list was replaced by code that does not use add_listmode_ex()
+ * and del_listmode() then the index is rebuilt first.
+ */
+static BanIndex *ban_index_get(Channel *channel, Ban **list)
+{
+	BanIndex **idx = ban_index_ptr(channel, list);
+
+	if (!idx || !*idx)
+		return NULL;
+	if ((*idx)->head != *list)
+	{
+		ban_index_build(*idx, *list);
+		if ((*idx)->count < BAN_INDEX_THRESHOLD / 2)
+			ban_index_free(idx);
+	}
+	return *idx;
+}
+
+/** Free the ban indexes of a channel */
+void free_ban_indexes(Channel *channel)
+{
+	ban_index_free(&channel->banlist_index);
+	ban_index_free(&channel->exlist_index);
+	ban_index_free(&channel->invexlist_index);
+}
+
 /** Add a listmode (+beI) with the specified banid to
  *  the specified channel. (Extended version with
  *  set by nick and set on timestamp)
@@ -246,8 +486,12 @@ int identical_ban(const char *one, const char *two)
 int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *banid, const char *setby, time_t seton)
 {
 	Ban *ban;
+	BanIndex *idx;
+	BanIndex **idxp;
+	unsigned int hashv = 0;
 	int cnt = 0, len;
 	int do_not_add = 0;
+	int new_ban = 0;
 
 	//if (MyUser(client))
 	//	collapse(banid);
@@ -262,20 +506,30 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 		}
 		do_not_add = 1;
 	}
-	for (ban = *list; ban; ban = ban->next)
+
+	idx = ban_index_get(channel, list);
+	if (idx)
 	{
-		len += strlen(ban->banstr);
-		/* Check MAXBANLENGTH / MAXBANS only for local clients
-		 * and 'me' (for +b's set during +f).
-		 */
-		if ((MyUser(client) || IsMe(client)) && ((len > MAXBANLENGTH) || (++cnt >= MAXBANS)))
+		hashv = hash_ban_mask(banid);
+		ban = ban_index_find(idx, banid, hashv);
+		cnt = idx->count;
+		len += idx->length;
+	} else {
+		for (ban = *list; ban; ban = ban->next)
 		{
-			do_not_add = 1;
+			if (identical_ban(ban->banstr, banid))
+				break; /* update existing ban (potentially) */
+			cnt++;
+			len += strlen(ban->banstr);
 		}
-		if (identical_ban(ban->banstr, banid))
-			break; /* update existing ban (potentially) */
 	}
 
+	/* Check MAXBANLENGTH / MAXBANS only for local clients
+	 * and 'me' (for +b's set during +f).
+	 */
+	if (!ban && *list && (MyUser(client) || IsMe(client)) && ((len > MAXBANLENGTH) || (cnt >= MAXBANS)))
+		do_not_add = 1;
+
 	/* Create a new ban if needed */
 	if (!ban)
 	{
@@ -293,7 +547,10 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 		}
 		ban = make_ban();
 		ban->next = *list;
+		if (*list)
+			(*list)->prev = ban;
 		*list = ban;
+		new_ban = 1;
 	}
 
 	if ((ban->when > 0) && (seton >= ban->when))
@@ -308,6 +565,20 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 	safe_strdup(ban->banstr, banid); /* cAsE may differ, use oldest version of it */
 	safe_strdup(ban->who, setby);
 	ban->when = seton;
+
+	if (new_ban)
+	{
+		if (idx)
+		{
+			ban_index_add(idx, ban, hashv);
+			idx->head = *list;
+		} else
+		if ((cnt + 1 >= BAN_INDEX_THRESHOLD) && (idxp = ban_index_ptr(channel, list)))
+		{
+			*idxp = safe_alloc(sizeof(BanIndex));
+			ban_index_build(*idxp, *list);
+		}
+	}
 	return 0;
 }
 
@@ -331,9 +602,35 @@ int del_listmode(Ban **list, Channel *channel, const char *banid)
 {
 	Ban **ban;
 	Ban *tmp;
+	BanIndex *idx;
+	unsigned int hashv;
 
 	if (!banid)
 		return -1;
+
+	idx = ban_index_get(channel, list);
+	if (idx)
+	{
+		hashv = hash_ban_mask(banid);
+		tmp = ban_index_find(idx, banid, hashv);
+		if (!tmp)
+			return -1;
+		ban_index_del(idx, tmp, hashv);
+		if (tmp->prev)
+			tmp->prev->next = tmp->next;
+		else
+			*list = tmp->next;
+		if (tmp->next)
+			tmp->next->prev = tmp->prev;
+		idx->head = *list;
+		if (idx->count < BAN_INDEX_THRESHOLD / 2)
+			ban_index_free(ban_index_ptr(channel, list));
+		safe_free(tmp->banstr);
+		safe_free(tmp->who);
+		free_ban(tmp);
+		return 0;
+	}
+
 	for (ban = list; *ban; ban = &((*ban)->next))
 	{
 		if (identical_ban(banid, (*ban)->banstr))
@@ -405,7 +702,11 @@ Ban *is_banned_with_nick(Client *client, Channel *channel, int type, const char
 {
 	Ban *ban, *ex;
 	char savednick[NICKLEN+1];
-	BanContext *b = safe_alloc(sizeof(BanContext));
+	ScratchMark scratch;
+	BanContext *b;
+
+	scratch_mark(&scratch);
+	b = scratch_alloc(sizeof(BanContext));
 
 	/* It's not really doable to pass 'nick' to all the ban layers,
 	 * including extbans (with stacking) and so on. Or at least not
@@ -469,10 +770,83 @@ Ban *is_banned_with_nick(Client *client, Channel *channel, int type, const char
 	if (errmsg)
 		*errmsg = b->error_msg;
 
-	safe_free(b);
+	scratch_release(&scratch);
 	return ban;
 }
 
+/** Add the member to the recipient index of the channel.
+ * Local members are added to channel->local_members and for
+ * remote members the user count of their server link is raised.
+ */
+static void channel_index_add_member(Channel *channel, Member *m)
+{
+	Client *client = m->client;
+	ChannelDirection *d;
+	int i;
+
+	if (MyConnect(client))
+	{
+		if (channel->local_members_count == channel->local_members_size)
+		{
+			channel->local_members_size = channel->local_members_size ? channel->local_members_size * 2 : 8;
+			channel->local_members = realloc(channel->local_members, sizeof(Member *) * channel->local_members_size);
+			if (!channel->local_members)
+				outofmemory(sizeof(Member *) * channel->local_members_size);
+		}
+		m->local_index = channel->local_members_count;
+		channel->local_members[channel->local_members_count++] = m;
+		return;
+	}
+
+	for (i = 0; i < channel->directions_count; i++)
+	{
+		if (channel->directions[i].client == client->direction)
+		{
+			channel->directions[i].users++;
+			return;
+		}
+	}
+
+	if (channel->directions_count == channel->directions_size)
+	{
+		channel->directions_size = channel->directions_size ? channel->directions_size * 2 : 4;
+		channel->directions = realloc(channel->directions, sizeof(ChannelDirection) * channel->directions_size);
+		if (!channel->directions)
+			outofmemory(sizeof(ChannelDirection) * channel->directions_size);
+	}
+	d = &channel->directions[channel->directions_count++];
+	d->client = client->direction;
+	d->users = 1;
+}
+
+/** Remove the member from the recipient index of the channel */
+static void channel_index_del_member(Channel *channel, Member *m)
+{
+	Client *client = m->client;
+	int i;
+
+	if (MyConnect(client))
+	{
+		/* Move the last entry into our slot */
+		i = m->local_index;
+		if ((i >= channel->local_members_count) || (channel->local_members[i] != m))
+			abort(); /* index out of sync, should never happen */
+		channel->local_members[i] = channel->local_members[--channel->local_members_count];
+		channel->local_members[i]->local_index = i;
+		return;
+	}
+
+	for (i = 0; i < channel->directions_count; i++)
+	{
+		if (channel->directions[i].client == client->direction)
+		{
+			if (--channel->directions[i].users == 0)
+				channel->directions[i] = channel->directions[--channel->directions_count];
+			return;
+		}
+	}
+}
+
 /** Add user to the channel.
  * This adds both the Member struct to the channel->members linked list
  * and also the Membership struct to the client->user->channel linked list.
@@ -490,14 +864,41 @@ void add_user_to_channel(Channel *channel, Client *client, const char *modes)
 	m = make_member();
 	m->client = client;
 	m->next = channel->members;
+	if (channel->members)
+		channel->members->prev = m;
 	channel->members = m;
 	channel->users++;
+	channel_index_add_member(channel, m);
+	if (channel->member_index)
+	{
+		member_index_add(channel->member_index, client, m);
+	} else
+	if (channel->users >= MEMBER_INDEX_THRESHOLD)
+	{
+		Member *e;
+		channel->member_index = member_index_new(channel->users);
+		for (e = channel->members; e; e = e->next)
+			member_index_add(channel->member_index, e->client, e);
+	}
 
 	mb = make_membership();
 	mb->channel = channel;
 	mb->next = client->user->channel;
+	if (client->user->channel)
+		client->user->channel->prev = mb;
 	client->user->channel = mb;
 	client->user->joined++;
+	if (client->user->channel_index)
+	{
+		member_index_add(client->user->channel_index, channel, mb);
+	} else
+	if (client->user->joined >= MEMBER_INDEX_THRESHOLD)
+	{
+		Membership *e;
+		client->user->channel_index = member_index_new(client->user->joined);
+		for (e = client->user->channel; e; e = e->next)
+			member_index_add(client->user->channel_index, e->channel, e);
+	}
 
 	for (p = modes; *p; p++)
 		add_member_mode_fast(m, mb, *p);
@@ -516,31 +917,45 @@ void add_user_to_channel(Channel *channel, Client *client, const char *modes)
  */
 int remove_user_from_channel(Client *client, Channel *channel, int dont_log)
 {
-	Member **m;
-	Member *m2;
-	Membership **mb;
-	Membership *mb2;
+	Member *m;
+	Membership *mb;
 
 	/* Update channel->members list */
-	for (m = &channel->members; (m2 = *m); m = &m2->next)
+	if ((m = find_member(channel, client)))
 	{
-		if (m2->client == client)
+		if (m->prev)
+			m->prev->next = m->next;
+		else
+			channel->members = m->next;
+		if (m->next)
+			m->next->prev = m->prev;
+		channel_index_del_member(channel, m);
+		if (channel->member_index)
 		{
-			*m = m2->next;
-			free_member(m2);
-			break;
+			member_index_del(channel->member_index, client);
+			/* channel->users is decreased later by sub1_from_channel() */
+			if (channel->users - 1 < MEMBER_INDEX_THRESHOLD / 2)
+				member_index_free(&channel->member_index);
 		}
+		free_member(m);
 	}
 
 	/* Update client->user->channel list */
-	for (mb = &client->user->channel; (mb2 = *mb); mb = &mb2->next)
+	if ((mb = find_membership(client, channel)))
 	{
-		if (mb2->channel == channel)
+		if (mb->prev)
+			mb->prev->next = mb->next;
+		else
+			client->user->channel = mb->next;
+		if (mb->next)
+			mb->next->prev = mb->prev;
+		if (client->user->channel_index)
 		{
-			*mb = mb2->next;
-			free_membership(mb2);
-			break;
+			member_index_del(client->user->channel_index, channel);
+			if (client->user->joined - 1 < MEMBER_INDEX_THRESHOLD / 2)
+				member_index_free(&client->user->channel_index);
 		}
+		free_membership(mb);
 	}
 
 	/* Update user record to reflect 1 less joined */
@@ -569,37 +984,25 @@ int remove_user_from_channel(Client *client, Channel *channel, int dont_log)
 /** Returns 1 if channel has this channel mode set and 0 if not */
 int has_channel_mode(Channel *channel, char mode)
 {
-	Cmode *cm;
-
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->letter == mode) && (channel->mode.mode & cm->mode))
-			return 1;
-
-	return 0; /* Not found */
+	return (channel->mode.mode & get_extmode_bitbychar(mode)) ? 1 : 0;
 }
 
 /** Returns 1 if channel has this mode is set and 0 if not */
 int has_channel_mode_raw(Cmode_t m, char mode)
 {
-	Cmode *cm;
-
-	for (cm=channelmodes; cm; cm = cm->next)
-		if ((cm->letter == mode) && (m & cm->mode))
-			return 1;
-
-	return 0; /* Not found */
+	return (m & get_extmode_bitbychar(mode)) ? 1 : 0;
 }
 
-/** Get the extended channel mode 'bit' value (eg: 0x20) by character (eg: 'Z') */
+/** Get the extended channel mode 'bit' value (eg: 0x20) by character (eg: 'Z').
+ * This is a table lookup, so modules may call it at will, but the value
+ * only changes when the mode is (un)loaded so it may also be cached
+ * until the next REHASH.
+ */
 Cmode_t get_extmode_bitbychar(char m)
 {
-	Cmode *cm;
-
-	for (cm=channelmodes; cm; cm = cm->next)
-                if (cm->letter == m)
-                        return cm->mode;
+	Cmode *cm = find_channel_mode_handler(m);
 
-        return 0;
+	return cm ? cm->mode : 0;
 }
 
 /** Write the "simple" list of channel modes for channel channel onto buffer mbuf with the parameters in pbuf.
@@ -920,7 +1323,9 @@ int valid_channelname(const char *cname)
 
 void initlist_channels(void)
 {
-	channel_pool = mp_pool_new(sizeof(Channel), 512 * 1024);
+	channel_pool = mp_pool_new_ex("channel", sizeof(Channel), 512 * 1024, MP_POOL_CACHE_ALIGN);
+	member_pool = mp_pool_new_ex("member", sizeof(Member), 256 * 1024, 0);
+	membership_pool = mp_pool_new_ex("membership", sizeof(Membership), 256 * 1024, 0);
 }
 
 /** Create channel 'name' (or if it exists, return the existing one)
@@ -987,7 +1392,7 @@ Channel *make_channel(const char *name)
 int is_invited(Client *client, Channel *channel)
 {
 	int invited = 0;
-	RunHook(HOOKTYPE_IS_INVITED, client, channel, &invited);
+	RunHookClient(HOOKTYPE_IS_INVITED, client, channel, &invited);
 	return invited;
 }
 
@@ -1044,9 +1449,14 @@ int sub1_from_channel(Channel *channel)
 		free_ban(ban);
 	}
 
+	free_ban_indexes(channel);
+
 	/* free extcmode params */
 	extcmode_free_paramlist(channel->mode.mode_params);
 
+	safe_free(channel->local_members);
+	safe_free(channel->directions);
+	member_index_free(&channel->member_index);
 	safe_free(channel->mode_lock);
 	safe_free(channel->topic);
 	safe_free(channel->topic_nick);
@@ -1225,6 +1635,17 @@ int has_common_channels(Client *c1, Client *c2)
 {
 	Membership *lp;
 
+	/* Walk the shortest channel list and look up in the other one */
+	if (c2->user->joined < c1->user->joined)
+	{
+		for (lp = c2->user->channel; lp; lp = lp->next)
+		{
+			if (IsMember(c1, lp->channel) && user_can_see_member(c1, c2, lp->channel))
+				return 1;
+		}
+		return 0;
+	}
+
 	for (lp = c1->user->channel; lp; lp = lp->next)
 	{
 		if (IsMember(c2, lp->channel) && user_can_see_member(c1, c2, lp->channel))
@@ -19,6 +19,9 @@
  */
 
 #include "unrealircd.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 /*
  * Some typedefs..
@@ -134,6 +137,7 @@ static ConfigCommand _ConfigCommands[] = {
 static NameValue _ListenerFlags[] = {
 	{ LISTENER_CLIENTSONLY,  "clientsonly"},
 	{ LISTENER_DEFER_ACCEPT, "defer-accept"},
+	{ LISTENER_REUSEPORT,	 "reuseport"},
 	{ LISTENER_SERVERSONLY,  "serversonly"},
 	{ LISTENER_TLS, 	 "ssl"},
 	{ LISTENER_NORMAL, 	 "standard"},
@@ -152,6 +156,7 @@ static NameValue _LinkFlags[] = {
 /* This MUST be alphabetized */
 static NameValue _TLSFlags[] = {
 	{ TLSFLAG_FAILIFNOCERT, "fail-if-no-clientcert" },
+	{ TLSFLAG_KTLS, "ktls" },
 	{ TLSFLAG_DISABLECLIENTCERT, "no-client-certificate" },
 	{ TLSFLAG_NOSTARTTLS, "no-starttls" },
 };
@@ -183,6 +188,7 @@ ConfigFile	 	*config_parse(const char *filename, char *confdata);
 ConfigEntry		*config_find_entry(ConfigEntry *ce, const char *name);
 
 extern void add_entropy_configfile(struct stat *st, const char *buf);
+extern void add_entropy_configfile_hash(struct stat *st, const char *sha256buf);
 extern void unload_all_unused_umodes(void);
 extern void unload_all_unused_extcmodes(void);
 extern void unload_all_unused_extbans(void);
@@ -252,7 +258,48 @@ int invalid_snomasks_encountered = 0;
 int have_tls_listeners = 0;
 char *port_6667_ip = NULL;
 
+#ifdef HAVE_PTHREAD
+/* On a rehash the configuration files are read and parsed by a
+ * separate thread, so clients are still served while that happens.
+ * That thread may not log or send anything itself, so any messages
+ * are queued and shown by the main thread once it is done.
+ */
+typedef struct ConfigReadMessage ConfigReadMessage;
+struct ConfigReadMessage {
+	ConfigReadMessage *prev, *next;
+	LogLevel loglevel;
+	const char *event_id;
+	int expand; /**< Message is an unreal_log() template and not a config_error() etc. */
+	char *msg;
+	LogData *data[2];
+};
+/* Same for the entropy from the files that were read, since the
+ * random number generator may only be used from the main thread.
+ */
+typedef struct ConfigReadEntropy ConfigReadEntropy;
+struct ConfigReadEntropy {
+	ConfigReadEntropy *prev, *next;
+	struct stat st;
+	char sha256[SHA256_DIGEST_LENGTH];
+};
+static pthread_t config_read_thread;
+static pthread_t config_read_main_thread;
+static pthread_mutex_t config_read_lock = PTHREAD_MUTEX_INITIALIZER;
+static int config_read_thread_active = 0;
+static int config_read_thread_done = 0; /* protected by config_read_lock */
+static int config_read_thread_ret = 0;
+static ConfigReadMessage *config_read_messages = NULL; /* protected by config_read_lock */
+static ConfigReadEntropy *config_read_entropy = NULL; /* protected by config_read_lock */
+static int in_config_read_thread(void);
+static void config_read_queue_entropy(struct stat *st, const char *buf);
+#endif
+
 int add_config_resource(const char *resource, int type, ConfigEntry *ce);
+static void config_resource_download(ConfigResource *rs);
+static int config_read_done(int ret);
+#ifdef HAVE_PTHREAD
+static int config_read_thread_start(void);
+#endif
 void resource_download_complete(const char *url, const char *file, const char *errorbuf, int cached, void *rs_key);
 void free_all_config_resources(void);
 int rehash_internal(Client *client);
@@ -905,6 +952,11 @@ ConfigFile *config_load(const char *filename, const char *displayname)
 	/* Just me or could this cause memory corrupted when ret <0 ? */
 	buf[ret] = '\0';
 	close(fd);
+#ifdef HAVE_PTHREAD
+	if (in_config_read_thread())
+		config_read_queue_entropy(&sb, buf);
+	else
+#endif
 	add_entropy_configfile(&sb, buf);
 	cfptr = config_parse(displayname, buf);
 	safe_free(buf);
@@ -1403,6 +1455,87 @@ ConfigEntry *config_find_entry(ConfigEntry *ce, const char *name)
 	return cep;
 }
 
+#ifdef HAVE_PTHREAD
+/** Returns 1 if we are running in the configuration reading thread */
+static int in_config_read_thread(void)
+{
+	return config_read_thread_active && !pthread_equal(pthread_self(), config_read_main_thread);
+}
+
+/** Queue a message from the configuration reading thread.
+ * The message is shown by config_read_thread_finish().
+ * If 'expand' is set then 'msg' is an unreal_log() template
+ * and d1 and d2 are its (optional) log data.
+ */
+static void config_read_queue_message(LogLevel loglevel, const char *event_id, int expand, const char *msg, LogData *d1, LogData *d2)
+{
+	ConfigReadMessage *m = safe_alloc(sizeof(ConfigReadMessage));
+
+	m->loglevel = loglevel;
+	m->event_id = event_id;
+	m->expand = expand;
+	safe_strdup(m->msg, msg);
+	m->data[0] = d1;
+	m->data[1] = d2;
+	pthread_mutex_lock(&config_read_lock);
+	AppendListItem(m, config_read_messages);
+	pthread_mutex_unlock(&config_read_lock);
+}
+
+/** Queue the entropy of a configuration file that was read by the
+ * configuration reading thread. It is added by config_read_thread_finish().
+ */
+static void config_read_queue_entropy(struct stat *st, const char *buf)
+{
+	ConfigReadEntropy *e = safe_alloc(sizeof(ConfigReadEntropy));
+
+	e->st = *st;
+	sha256hash_binary(e->sha256, buf, strlen(buf));
+	pthread_mutex_lock(&config_read_lock);
+	AppendListItem(e, config_read_entropy);
+	pthread_mutex_unlock(&config_read_lock);
+}
+#endif
+
+/** Log a message from config_error(), config_warn() or config_status()
+ * and send it to the user who requested the rehash (if any).
+ */
+static void config_message(LogLevel loglevel, const char *event_id, const char *msg)
+{
+#ifdef HAVE_PTHREAD
+	if (in_config_read_thread())
+	{
+		config_read_queue_message(loglevel, event_id, 0, msg, NULL, NULL);
+		return;
+	}
+#endif
+	unreal_log_raw(loglevel, "config", event_id, NULL, msg);
+	if (remote_rehash_client)
+	{
+		if (loglevel == ULOG_ERROR)
+			sendnotice(remote_rehash_client, "error: %s", msg);
+		else if (loglevel == ULOG_WARNING)
+			sendnotice(remote_rehash_client, "[warning] %s", msg);
+		else
+			sendnotice(remote_rehash_client, "%s", msg);
+	}
+}
+
+/** Log a message with log data from config_read_file(), which may
+ * run in the configuration reading thread (see config_message).
+ */
+static void config_read_log(LogLevel loglevel, const char *event_id, const char *msg, LogData *d1, LogData *d2)
+{
+#ifdef HAVE_PTHREAD
+	if (in_config_read_thread())
+	{
+		config_read_queue_message(loglevel, event_id, 1, msg, d1, d2);
+		return;
+	}
+#endif
+	unreal_log(loglevel, "config", event_id, NULL, msg, d1, d2);
+}
+
 void config_error(FORMAT_STRING(const char *format), ...)
 {
 	va_list		ap;
@@ -1414,9 +1547,7 @@ void config_error(FORMAT_STRING(const char *format), ...)
 	va_end(ap);
 	if ((ptr = strchr(buffer, '\n')) != NULL)
 		*ptr = '\0';
-	unreal_log_raw(ULOG_ERROR, "config", "CONFIG_ERROR_GENERIC", NULL, buffer);
-	if (remote_rehash_client)
-		sendnotice(remote_rehash_client, "error: %s", buffer);
+	config_message(ULOG_ERROR, "CONFIG_ERROR_GENERIC", buffer);
 	/* We cannot live with this */
 	config_error_flag = 1;
 }
@@ -1472,9 +1603,7 @@ void config_status(FORMAT_STRING(const char *format), ...)
 	va_end(ap);
 	if ((ptr = strchr(buffer, '\n')) != NULL)
 		*ptr = '\0';
-	unreal_log_raw(ULOG_INFO, "config", "CONFIG_INFO_GENERIC", NULL, buffer);
-	if (remote_rehash_client)
-		sendnotice(remote_rehash_client, "%s", buffer);
+	config_message(ULOG_INFO, "CONFIG_INFO_GENERIC", buffer);
 }
 
 void config_warn(FORMAT_STRING(const char *format), ...)
@@ -1488,9 +1617,7 @@ void config_warn(FORMAT_STRING(const char *format), ...)
 	va_end(ap);
 	if ((ptr = strchr(buffer, '\n')) != NULL)
 		*ptr = '\0';
-	unreal_log_raw(ULOG_WARNING, "config", "CONFIG_WARNING_GENERIC", NULL, buffer);
-	if (remote_rehash_client)
-		sendnotice(remote_rehash_client, "[warning] %s", buffer);
+	config_message(ULOG_WARNING, "CONFIG_WARNING_GENERIC", buffer);
 }
 
 void config_warn_duplicate(const char *filename, int line, const char *entry)
@@ -1686,6 +1813,7 @@ void config_setdefaultsettings(Configuration *i)
 	i->away_length = 307;
 	i->kick_length = 307;
 	i->quit_length = 307;
+	i->whowas_history_length = NICKNAMEHISTORYLENGTH;
 	safe_strdup(i->link_bindip, "*");
 	safe_strdup(i->cloak_prefix, "Clk");
 	if (!ipv6_capable())
@@ -1743,6 +1871,7 @@ void config_setdefaultsettings(Configuration *i)
 	 * Any decent client using AES will use ECDHE-xx-AES.
 	 */
 	safe_strdup(i->tls_options->outdated_ciphers, "AES*,RC4*,DES*");
+	i->tls_options->session_ticket_rotation = 43200; /* 12 hours */
 
 	i->plaintext_policy_user = POLICY_ALLOW;
 	i->plaintext_policy_oper = POLICY_DENY;
@@ -1860,6 +1989,7 @@ RealCommand *cmptr;
 			cmptr->flags |= CMD_SHUN;
 		else
 			cmptr->flags &= ~CMD_SHUN;
+		command_lookup_invalidate();
 	}
 }
 
@@ -1874,13 +2004,18 @@ void postconf(void)
 	postconf_defaults();
 	postconf_fixes();
 	do_weird_shun_stuff();
+	whowas_set_length(WHOWAS_HISTORY_LENGTH);
 	isupport_init(); /* for all the 005 values that changed.. */
-	tls_check_expiry(NULL);
 
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/* On rehash the expiry is checked by reinit_tls(), which
+	 * loads all certificates anyway, so we don't load them twice.
+	 */
 	if (loop.rehashing)
 		reinit_tls();
+	else
 #endif
+		tls_check_expiry(NULL);
 }
 
 int isanyserverlinked(void)
@@ -2011,7 +2146,20 @@ int config_read_start(void)
 	 */
 	loop.rehash_download_busy = 1;
 	add_config_resource(configfile, RESOURCE_INCLUDE, NULL);
+#ifdef HAVE_PTHREAD
+	/* On rehash, read the files in the background.
+	 * is_config_read_finished() picks up the result.
+	 */
+	if (loop.rehashing && config_read_thread_start())
+		return 1;
+#endif
 	ret = config_read_file(configfile, configfile);
+	return config_read_done(ret);
+}
+
+/** Finish config_read_start(), ret is the return value of config_read_file() */
+static int config_read_done(int ret)
+{
 	loop.rehash_download_busy = 0;
 	if (ret < 0)
 	{
@@ -2021,10 +2169,119 @@ int config_read_start(void)
 	return 1;
 }
 
+#ifdef HAVE_PTHREAD
+static void *config_read_thread_main(void *unused)
+{
+	int ret;
+
+	ret = config_read_file(configfile, configfile);
+
+	pthread_mutex_lock(&config_read_lock);
+	config_read_thread_ret = ret;
+	config_read_thread_done = 1;
+	pthread_mutex_unlock(&config_read_lock);
+	return NULL;
+}
+
+/** Start reading the configuration files in a separate thread.
+ * Only config_read_file() and the parser run in that thread:
+ * anything it logs is queued, and remote includes are only
+ * noted, to be downloaded from the main thread afterwards.
+ * @returns 1 if the thread was started, 0 if the caller should
+ *          read the files itself.
+ */
+static int config_read_thread_start(void)
+{
+	sigset_t all, old;
+	int ret;
+
+	config_read_main_thread = pthread_self();
+	config_read_thread_done = 0;
+	config_read_thread_active = 1;
+
+	/* Signals should be handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&config_read_thread, NULL, config_read_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0)
+	{
+		config_read_thread_active = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/** Wait for the configuration reading thread and process the results:
+ * show the queued messages and start any remote include downloads.
+ * Called from the main thread.
+ */
+static void config_read_thread_finish(void)
+{
+	ConfigReadMessage *m, *m_next;
+	ConfigReadEntropy *e, *e_next;
+	ConfigResource *rs, *rs_next;
+	uint64_t start = monotonic_nsec();
+
+	pthread_join(config_read_thread, NULL);
+	config_read_thread_active = 0;
+
+	for (m = config_read_messages; m; m = m_next)
+	{
+		m_next = m->next;
+		if (m->expand)
+			unreal_log(m->loglevel, "config", m->event_id, NULL, m->msg, m->data[0], m->data[1]);
+		else
+			config_message(m->loglevel, m->event_id, m->msg);
+		safe_free(m->msg);
+		safe_free(m);
+	}
+	config_read_messages = NULL;
+
+	for (e = config_read_entropy; e; e = e_next)
+	{
+		e_next = e->next;
+		add_entropy_configfile_hash(&e->st, e->sha256);
+		safe_free(e);
+	}
+	config_read_entropy = NULL;
+
+	if (config_read_thread_ret >= 0)
+	{
+		for (rs = config_resources; rs; rs = rs_next)
+		{
+			rs_next = rs->next;
+			if (rs->type & RESOURCE_DLDEFERRED)
+			{
+				rs->type &= ~RESOURCE_DLDEFERRED;
+				config_resource_download(rs);
+			}
+		}
+	}
+
+	config_read_done(config_read_thread_ret);
+	metrics.rehash_blocked_nsec += monotonic_nsec() - start;
+}
+#endif
+
 int is_config_read_finished(void)
 {
 	ConfigResource *rs;
 
+#ifdef HAVE_PTHREAD
+	if (config_read_thread_active)
+	{
+		int done;
+
+		pthread_mutex_lock(&config_read_lock);
+		done = config_read_thread_done;
+		pthread_mutex_unlock(&config_read_lock);
+		if (!done)
+			return 0;
+		config_read_thread_finish();
+	}
+#endif
+
 	if (loop.rehash_download_busy)
 		return 0;
 
@@ -2215,12 +2472,12 @@ int config_read_file(const char *filename, const char *display_name)
 	}
 	if (counter > 1)
 	{
-		unreal_log(ULOG_ERROR, "config", "CONFIG_BUG_DUPLICATE_RESOURCE", NULL,
-		           "[BUG] Config file $file has been loaded $counter times. "
-		           "This should not happen. Someone forgot to call "
-		           "add_config_resource() or check its return value!",
-		           log_data_string("file", filename),
-		           log_data_integer("counter", counter));
+		config_read_log(ULOG_ERROR, "CONFIG_BUG_DUPLICATE_RESOURCE",
+		                "[BUG] Config file $file has been loaded $counter times. "
+		                "This should not happen. Someone forgot to call "
+		                "add_config_resource() or check its return value!",
+		                log_data_string("file", filename),
+		                log_data_integer("counter", counter));
 		return -1;
 	}
 	/* end include recursion checking code */
@@ -2271,10 +2528,10 @@ int config_read_file(const char *filename, const char *display_name)
 	}
 	else
 	{
-		unreal_log(ULOG_ERROR, "config", "CONFIG_LOAD_FILE_FAILED", NULL,
-		           "Could not load configuration file: $resource",
-		           log_data_string("resource", display_name),
-		           log_data_string("filename", filename));
+		config_read_log(ULOG_ERROR, "CONFIG_LOAD_FILE_FAILED",
+		                "Could not load configuration file: $resource",
+		                log_data_string("resource", display_name),
+		                log_data_string("filename", filename));
 #ifdef _WIN32
 		if (!strcmp(filename, "conf/unrealircd.conf"))
 		{
@@ -4956,7 +5213,10 @@ void conf_listen_configure(const char *ip, int port, SocketType socket_type, int
 		listen->tls_options = NULL;
 	}
 	safe_free(listen->websocket_forward);
+	listen->websocket_compression = 0;
 	safe_free(listen->webserver);
+	if (!(listen->options & LISTENER_BOUND))
+		listen->reuseport_sockets = 1;
 
 	/* Now set the new settings: */
 	if (tlsconfig)
@@ -4995,6 +5255,13 @@ void conf_listen_configure(const char *ip, int port, SocketType socket_type, int
 		if (!strcmp(cep->name, "ssl-options") || !strcmp(cep->name, "tls-options"))
 			;
 		else
+		if (!strcmp(cep->name, "reuseport-sockets"))
+		{
+			/* Can't change the number of sockets of a listener that is already bound */
+			if (!(listen->options & LISTENER_BOUND))
+				listen->reuseport_sockets = atoi(cep->value);
+		}
+		else
 		{
 			for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
 			{
@@ -5054,6 +5321,10 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 		{
 			tlsconfig = cep;
 		} else
+		if (!strcmp(cep->name, "reuseport-sockets"))
+		{
+			/* handled in conf_listen_configure() */
+		} else
 		{
 			for (h = Hooks[HOOKTYPE_CONFIGRUN]; h; h = h->next)
 			{
@@ -5091,6 +5362,7 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 	ConfigEntry *cepp;
 	int errors = 0;
 	char has_file = 0, has_ip = 0, has_port = 0, has_options = 0, port_6667 = 0;
+	char has_reuseport = 0, has_reuseport_sockets = 0;
 	char *file = NULL;
 	char *ip = NULL;
 	Hook *h;
@@ -5188,6 +5460,15 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 				}
 				if (!strcmp(cepp->name, "ssl") || !strcmp(cepp->name, "tls"))
 					have_tls_listeners = 1; /* for ssl config test */
+				if (!strcmp(cepp->name, "reuseport"))
+				{
+#ifndef SO_REUSEPORT
+					config_error("%s:%i: listen::options::reuseport is not supported on this platform",
+						cepp->file->filename, cepp->line_number);
+					errors++;
+#endif
+					has_reuseport = 1;
+				}
 			}
 		}
 		else
@@ -5272,6 +5553,17 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 			if ((6667 >= start) && (6667 <= end))
 				port_6667 = 1;
 		} else
+		if (!strcmp(cep->name, "reuseport-sockets"))
+		{
+			int v = atoi(cep->value);
+			has_reuseport_sockets = 1;
+			if ((v < 1) || (v > 64))
+			{
+				config_error("%s:%i: listen::reuseport-sockets must be between 1 and 64",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
 		{
 			if (!used_by_module)
 			{
@@ -5311,6 +5603,13 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 		}
 	}
 
+	if (has_reuseport_sockets && (!has_reuseport || has_file))
+	{
+		config_error("%s:%d: listen::reuseport-sockets requires an ip/port listen block with listen::options::reuseport",
+			ce->file->filename, ce->line_number);
+		errors++;
+	}
+
 	if (port_6667)
 		safe_strdup(port_6667_ip, ip);
 
@@ -7110,6 +7409,14 @@ void test_tlsblock(ConfigFile *conf, ConfigEntry *cep, int *totalerrors)
 							 ceppp->line_number, ceppp->name);
 					errors ++;
 				}
+#ifndef SSL_OP_ENABLE_KTLS
+				else if (!strcmp(ceppp->name, "ktls"))
+				{
+					config_warn("%s:%i: TLS option 'ktls' is set but your OpenSSL library "
+					            "has no kernel TLS support. The option will be ignored.",
+					            ceppp->file->filename, ceppp->line_number);
+				}
+#endif
 			}
 		}
 		else if (!strcmp(cepp->name, "sts-policy"))
@@ -7163,6 +7470,55 @@ void test_tlsblock(ConfigFile *conf, ConfigEntry *cep, int *totalerrors)
 				errors++;
 			}
 		}
+		else if (!strcmp(cepp->name, "session-resumption"))
+		{
+			/* The ticket keys are shared by all listeners,
+			 * so they can only be configured in set::tls.
+			 */
+			int is_set_block = cep->parent && !strcmp(cep->parent->name, "set");
+
+			for (ceppp = cepp->items; ceppp; ceppp = ceppp->next)
+			{
+				if (!is_set_block)
+				{
+					config_error("%s:%i: %s can only be set in set::tls::session-resumption",
+					             ceppp->file->filename, ceppp->line_number, config_var(ceppp));
+					errors++;
+				}
+				else if (!strcmp(ceppp->name, "key-rotation"))
+				{
+					long v;
+					CheckNull(ceppp);
+					v = config_checkval(ceppp->value, CFG_TIME);
+					if (v < 300)
+					{
+						config_error("%s:%i: %s must be at least 5 minutes",
+						             ceppp->file->filename, ceppp->line_number, config_var(ceppp));
+						errors++;
+					}
+				}
+				else if (!strcmp(ceppp->name, "key-file"))
+				{
+					char *path;
+					CheckNull(ceppp);
+					path = convert_to_absolute_path_duplicate(ceppp->value, CONFDIR);
+					if (!file_exists(path))
+					{
+						config_error("%s:%i: %s: could not open '%s': %s",
+							ceppp->file->filename, ceppp->line_number, config_var(ceppp),
+							path, strerror(errno));
+						errors++;
+					}
+					safe_free(path);
+				}
+				else
+				{
+					config_error_unknown(ceppp->file->filename, ceppp->line_number,
+					                     "set::tls::session-resumption", ceppp->name);
+					errors++;
+				}
+			}
+		}
 		else
 		{
 			config_error("%s:%i: unknown directive %s",
@@ -7188,6 +7544,7 @@ void free_tls_options(TLSOptions *tlsoptions)
 	safe_free(tlsoptions->ecdh_curves);
 	safe_free(tlsoptions->outdated_protocols);
 	safe_free(tlsoptions->outdated_ciphers);
+	safe_free(tlsoptions->session_ticket_key_file);
 	memset(tlsoptions, 0, sizeof(TLSOptions));
 	safe_free(tlsoptions);
 }
@@ -7215,6 +7572,9 @@ void conf_tlsblock(ConfigFile *conf, ConfigEntry *cep, TLSOptions *tlsoptions)
 		tlsoptions->sts_port = tempiConf.tls_options->sts_port;
 		tlsoptions->sts_duration = tempiConf.tls_options->sts_duration;
 		tlsoptions->sts_preload = tempiConf.tls_options->sts_preload;
+		tlsoptions->session_resumption = tempiConf.tls_options->session_resumption;
+		tlsoptions->session_ticket_rotation = tempiConf.tls_options->session_ticket_rotation;
+		safe_strdup(tlsoptions->session_ticket_key_file, tempiConf.tls_options->session_ticket_key_file);
 	}
 
 	/* Now process the options */
@@ -7329,6 +7689,22 @@ void conf_tlsblock(ConfigFile *conf, ConfigEntry *cep, TLSOptions *tlsoptions)
 					tlsoptions->sts_preload = config_checkval(ceppp->value, CFG_YESNO);
 			}
 		}
+		else if (!strcmp(cepp->name, "session-resumption"))
+		{
+			tlsoptions->session_resumption = 1;
+			for (ceppp = cepp->items; ceppp; ceppp = ceppp->next)
+			{
+				if (!strcmp(ceppp->name, "key-rotation"))
+				{
+					tlsoptions->session_ticket_rotation = config_checkval(ceppp->value, CFG_TIME);
+				}
+				else if (!strcmp(ceppp->name, "key-file"))
+				{
+					convert_to_absolute_path(&ceppp->value, CONFDIR);
+					safe_strdup(tlsoptions->session_ticket_key_file, ceppp->value);
+				}
+			}
+		}
 	}
 }
 
@@ -7775,6 +8151,9 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 			int v = atoi(cep->value);
 			tempiConf.topic_length = v;
 		}
+		else if (!strcmp(cep->name, "whowas-history-length")) {
+			tempiConf.whowas_history_length = atoi(cep->value);
+		}
 		else if (!strcmp(cep->name, "away-length")) {
 			int v = atoi(cep->value);
 			tempiConf.away_length = v;
@@ -8952,6 +9331,17 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 				errors++;
 			}
 		}
+		else if (!strcmp(cep->name, "whowas-history-length")) {
+			int v;
+			CheckNull(cep);
+			v = atoi(cep->value);
+			if ((v < 100) || (v > 1000000))
+			{
+				config_error("%s:%i: set::whowas-history-length: value '%d' out of range (should be 100-1000000)",
+					cep->file->filename, cep->line_number, v);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->name, "away-length")) {
 			int v;
 			CheckNull(cep);
@@ -9494,7 +9884,11 @@ void config_run(void)
 {
 	loop.config_status = CONFIG_STATUS_POSTLOAD;
 	extcmodes_check_for_changes();
+	if (loop.hot_restart)
+		hot_restart_receive();
 	start_listeners();
+	if (loop.hot_restart)
+		hot_restart_close_listeners();
 	add_proc_io_server();
 	free_all_config_resources();
 }
@@ -10656,6 +11050,8 @@ void resource_download_complete(const char *url, const char *file, const char *e
  */
 void request_rehash(Client *client)
 {
+	uint64_t start;
+
 	if (loop.rehashing)
 	{
 		if (client)
@@ -10663,9 +11059,11 @@ void request_rehash(Client *client)
 		return;
 	}
 
+	start = monotonic_nsec();
 	loop.rehashing = 1;
 	loop.rehash_save_client = client;
 	config_read_start();
+	metrics.rehash_blocked_nsec = monotonic_nsec() - start;
 	/* More config reading (or network I/O), and the actual rehash will
 	 * happen in "the main loop". See end of SocketLoop() in src/ircd.c.
 	 */
@@ -10674,6 +11072,7 @@ void request_rehash(Client *client)
 int rehash_internal(Client *client)
 {
 	int failure;
+	uint64_t start = monotonic_nsec();
 
 	/* Log it here if it is by a signal */
 	if (client == NULL)
@@ -10701,6 +11100,7 @@ int rehash_internal(Client *client)
 	remote_rehash_client = NULL;
 	procio_post_rehash(failure);
 	loop.config_status = CONFIG_STATUS_COMPLETE;
+	metrics.rehash_blocked_nsec += monotonic_nsec() - start;
 	return 1;
 }
 
@@ -10766,6 +11166,7 @@ void	listen_cleanup()
 			DelListItem(listen_ptr, conf_listen);
 			safe_free(listen_ptr->webserver);
 			safe_free(listen_ptr->websocket_forward);
+			safe_free(listen_ptr->reuseport_fds);
 			safe_free(listen_ptr);
 			i++;
 		}
@@ -10834,54 +11235,76 @@ int add_config_resource(const char *resource, int type, ConfigEntry *ce)
 	{
 		safe_strdup(rs->file, resource);
 	} else {
-		const char *cache_file;
-		time_t modtime;
-
 		safe_strdup(rs->url, resource);
 		rs->type = type|RESOURCE_REMOTE|RESOURCE_DLQUEUED;
+#ifdef HAVE_PTHREAD
+		if (in_config_read_thread())
+		{
+			/* Started from the main thread, see config_read_thread_finish() */
+			rs->type |= RESOURCE_DLDEFERRED;
+			return 1;
+		}
+#endif
+		config_resource_download(rs);
+	}
+	return 1;
+}
 
-		cache_file = unreal_mkcache(rs->url);
-		modtime = unreal_getfilemodtime(cache_file);
-		if (modtime > 0)
-		{
-			safe_strdup(rs->cache_file, cache_file); /* Cached copy is available */
-			/* Check if there is an "url-refresh" argument */
-			ConfigEntry *cep, *prev = NULL;
-			for (cep = ce->items; cep; cep = cep->next)
-			{
-				if (!strcmp(cep->name, "url-refresh"))
-				{
-					/* First find out the time value of url-refresh... (eg '7d' -> 86400*7) */
-					long refresh_time = 0;
-					if (cep->value)
-						refresh_time = config_checkval(cep->value, CFG_TIME);
-					/* Then remove the config item so it is not seen by the rest of unrealircd.
-					 * Can't use DelListItem() here as ConfigEntry has no ->prev, only ->next.
-					 */
-					if (prev)
-						prev->next = cep->next; /* (skip over us) */
-					else
-						ce->items = cep->next; /* (new head) */
-					/* ..and free it */
-					config_entry_free(cep);
-					/* And now check if the current cached copy is recent enough */
-					if (TStime() - modtime < refresh_time)
-					{
-						/* Don't download, use cached copy */
-						//config_status("DEBUG: using cached copy due to url-refresh %ld", refresh_time);
-						resource_download_complete(rs->url, NULL, NULL, 1, rs);
-						return 1;
-					} else {
-						//config_status("DEBUG: requires download attempt, out of date url-refresh %ld < %ld", refresh_time, TStime() - modtime);
-					}
-					break; // MUST break now as we touched the linked list.
+/** Download a remote config resource, or use the cached copy
+ * if it is recent enough (see url-refresh).
+ */
+static void config_resource_download(ConfigResource *rs)
+{
+	ConfigEntryWrapper *wce;
+	ConfigEntry *ce;
+	const char *cache_file;
+	time_t modtime;
+
+	/* The entry that added the resource is the oldest one */
+	for (wce = rs->wce; wce->next; wce = wce->next)
+		;
+	ce = wce->ce;
+
+	cache_file = unreal_mkcache(rs->url);
+	modtime = unreal_getfilemodtime(cache_file);
+	if (modtime > 0)
+	{
+		safe_strdup(rs->cache_file, cache_file); /* Cached copy is available */
+		/* Check if there is an "url-refresh" argument */
+		ConfigEntry *cep, *prev = NULL;
+		for (cep = ce->items; cep; cep = cep->next)
+		{
+			if (!strcmp(cep->name, "url-refresh"))
+			{
+				/* First find out the time value of url-refresh... (eg '7d' -> 86400*7) */
+				long refresh_time = 0;
+				if (cep->value)
+					refresh_time = config_checkval(cep->value, CFG_TIME);
+				/* Then remove the config item so it is not seen by the rest of unrealircd.
+				 * Can't use DelListItem() here as ConfigEntry has no ->prev, only ->next.
+				 */
+				if (prev)
+					prev->next = cep->next; /* (skip over us) */
+				else
+					ce->items = cep->next; /* (new head) */
+				/* ..and free it */
+				config_entry_free(cep);
+				/* And now check if the current cached copy is recent enough */
+				if (TStime() - modtime < refresh_time)
+				{
+					/* Don't download, use cached copy */
+					//config_status("DEBUG: using cached copy due to url-refresh %ld", refresh_time);
+					resource_download_complete(rs->url, NULL, NULL, 1, rs);
+					return;
+				} else {
+					//config_status("DEBUG: requires download attempt, out of date url-refresh %ld < %ld", refresh_time, TStime() - modtime);
 				}
-				prev = cep;
+				break; // MUST break now as we touched the linked list.
 			}
+			prev = cep;
 		}
-		download_file_async(rs->url, modtime, resource_download_complete, (void *)rs, NULL, DOWNLOAD_MAX_REDIRECTS);
 	}
-	return 1;
+	download_file_async(rs->url, modtime, resource_download_complete, (void *)rs, NULL, DOWNLOAD_MAX_REDIRECTS);
 }
 
 void free_all_config_resources(void)
@@ -23,7 +23,16 @@ static mp_pool_t *dbuf_bufpool = NULL;
 
 void dbuf_init(void)
 {
-	dbuf_bufpool = mp_pool_new(sizeof(struct dbufbuf), 512 * 1024);
+	dbuf_bufpool = mp_pool_new_ex("dbuf", sizeof(struct dbufbuf), 512 * 1024, 0);
+}
+
+/** Get memory usage of the dbuf memory pool (for statistics).
+ * @param bytes_used		Set to the number of bytes used by buffers
+ * @param bytes_allocated	Set to the number of bytes allocated by the pool
+ */
+void dbuf_pool_stats(unsigned long long *bytes_used, unsigned long long *bytes_allocated)
+{
+	mp_pool_stats(dbuf_bufpool, bytes_used, bytes_allocated);
 }
 
 /*
@@ -44,6 +44,11 @@
  */
 //#define DETECT_HIGH_CPU
 
+/** Maximum number of events to process in one fd_select() call.
+ * Any remaining events are simply returned by the next call.
+ */
+#define FD_SELECT_BATCH		1024
+
 /***************************************************************************************
  * Backend-independent functions.  fd_setselect() and friends                          *
  ***************************************************************************************/
@@ -58,12 +63,12 @@ void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 	           log_data_integer("fd_flags", flags),
 	           log_data_integer("function_pointer", (long long)iocb));
 #endif
-	if ((fd < 0) || (fd >= MAXCONNECTIONS))
+	if ((fd < 0) || (fd >= fd_table_size))
 	{
 		unreal_log(ULOG_ERROR, "io", "BUG_FD_SETSELECT_OUT_OF_RANGE", NULL,
-		           "[BUG] trying to modify fd $fd in fd table, but MAXCONNECTIONS is $maxconnections",
+		           "[BUG] trying to modify fd $fd in fd table, but the fd table size is $fd_table_size",
 		           log_data_integer("fd", fd),
-		           log_data_integer("maxconnections", MAXCONNECTIONS));
+		           log_data_integer("fd_table_size", fd_table_size));
 #ifdef DEBUGMODE
 		abort();
 #endif
@@ -96,6 +101,21 @@ void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 		fd_refresh(fd);
 }
 
+/** Update the fd_select() statistics after waiting for events.
+ * @param wait_start	Timestamp from before the wait (monotonic_nsec)
+ * @param num		Number of events returned by the backend
+ */
+static void fd_select_metrics(uint64_t wait_start, int num)
+{
+	metrics.fd_select_calls++;
+	metrics.fd_select_wait_nsec += monotonic_nsec() - wait_start;
+	if (num > 0)
+	{
+		metrics.fd_select_wakeups++;
+		metrics.fd_select_events += num;
+	}
+}
+
 /***************************************************************************************
  * select() backend.                                                                   *
  ***************************************************************************************/
@@ -164,6 +184,7 @@ void fd_select(time_t delay)
 {
 	struct timeval to;
 	int num, fd;
+	uint64_t wait_start;
 	fd_set work_read_fds;
 	fd_set work_write_fds;
 #ifdef _WIN32
@@ -181,11 +202,13 @@ void fd_select(time_t delay)
 	to.tv_sec = delay / 1000;
 	to.tv_usec = (delay % 1000) * 1000;
 
+	wait_start = monotonic_nsec();
 #ifdef _WIN32
 	num = select(highest_fd + 1, &work_read_fds, &work_write_fds, &work_except_fds, &to);
 #else
 	num = select(highest_fd + 1, &work_read_fds, &work_write_fds, NULL, &to);
 #endif
+	fd_select_metrics(wait_start, num);
 	if (num < 0)
 	{
 		unreal_log(ULOG_FATAL, "io", "SELECT_ERROR", NULL,
@@ -239,6 +262,7 @@ void fd_select(time_t delay)
 
 		if (evflags & FD_SELECT_WRITE)
 		{
+			fde = &fd_table[fd]; /* the fd table may have moved */
 			iocb = fde->write_callback;
 
 			if (iocb != NULL)
@@ -263,30 +287,23 @@ void fd_fork()
 #include <sys/event.h>
 
 static int kqueue_fd = -1;
-static struct kevent kqueue_events[MAXCONNECTIONS * 2];
-static struct kevent kqueue_prepared[MAXCONNECTIONS * 2];
-static char kqueue_enabled[MAXCONNECTIONS * 2];
+static struct kevent kqueue_events[FD_SELECT_BATCH];
 
 void fd_fork()
 {
+	int fd;
+
+	/* The kqueue is not inherited by the child, so create a new one
+	 * and register all file descriptors again.
+	 */
 	kqueue_fd = kqueue();
-	int p;
 
-	for (p=0; p < MAXCONNECTIONS * 2; ++p)
+	for (fd = 0; fd < fd_table_size; fd++)
 	{
-		if (kqueue_enabled[p])
+		if (fd_table[fd].is_open)
 		{
-			if (kevent(kqueue_fd, &kqueue_prepared[p], 1, NULL, 0, &(const struct timespec){ .tv_sec = 0, .tv_nsec = 0}) != 0)
-			{
-				if (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN)
-					continue;
-					
-#ifdef DEBUGMODE
-				unreal_log(ULOG_ERROR, "io", "KEVENT_FAILED", NULL,
-				           "[io] fd_fork(): kevent returned error: $system_error",
-				           log_data_string("system_error", strerror(errno)));
-#endif
-			}
+			fd_table[fd].backend_flags = 0;
+			fd_refresh(fd);
 		}
 	}
 }
@@ -294,20 +311,15 @@ void fd_fork()
 void fd_refresh(int fd)
 {
 	FDEntry *fde = &fd_table[fd];
+	struct kevent ev;
 
 	if (kqueue_fd == -1)
-	{
 		kqueue_fd = kqueue();
-		memset(kqueue_enabled,0,MAXCONNECTIONS*2);
-	}
-
-	kqueue_enabled[fd] = 0;
-	kqueue_enabled[fd+MAXCONNECTIONS] = 0;
 
 	if (fde->read_callback != NULL || fde->backend_flags & EVFILT_READ)
 	{
-		EV_SET(&kqueue_prepared[fd], (uintptr_t) fd, (short) EVFILT_READ, fde->read_callback != NULL ? EV_ADD : EV_DELETE, 0, 0, fde);
-		if (kevent(kqueue_fd, &kqueue_prepared[fd], 1, NULL, 0, &(const struct timespec){ .tv_sec = 0, .tv_nsec = 0}) != 0)
+		EV_SET(&ev, (uintptr_t) fd, (short) EVFILT_READ, fde->read_callback != NULL ? EV_ADD : EV_DELETE, 0, 0, NULL);
+		if (kevent(kqueue_fd, &ev, 1, NULL, 0, &(const struct timespec){ .tv_sec = 0, .tv_nsec = 0}) != 0)
 		{
 #ifdef DEBUGMODE
 			if (ERRNO != P_EWOULDBLOCK && ERRNO != P_EAGAIN)
@@ -326,8 +338,8 @@ void fd_refresh(int fd)
 
 	if (fde->write_callback != NULL || fde->backend_flags & EVFILT_WRITE)
 	{
-		EV_SET(&kqueue_prepared[fd+MAXCONNECTIONS], (uintptr_t) fd, (short) EVFILT_WRITE, fde->write_callback != NULL ? EV_ADD : EV_DELETE, 0, 0, fde);
-		if (kevent(kqueue_fd, &kqueue_prepared[fd+MAXCONNECTIONS], 1, NULL, 0, &(const struct timespec){ .tv_sec = 0, .tv_nsec = 0}) != 0)
+		EV_SET(&ev, (uintptr_t) fd, (short) EVFILT_WRITE, fde->write_callback != NULL ? EV_ADD : EV_DELETE, 0, 0, NULL);
+		if (kevent(kqueue_fd, &ev, 1, NULL, 0, &(const struct timespec){ .tv_sec = 0, .tv_nsec = 0}) != 0)
 		{
 #ifdef DEBUGMODE
 			if (ERRNO != P_EWOULDBLOCK && ERRNO != P_EAGAIN && fde->write_callback)
@@ -347,36 +359,29 @@ void fd_refresh(int fd)
 	fde->backend_flags = 0;
 
 	if (fde->read_callback != NULL)
-	{
 		fde->backend_flags |= EVFILT_READ;
-		kqueue_enabled[fd] = 1;
-
-	}
 
 	if (fde->write_callback != NULL)
-	{
 		fde->backend_flags |= EVFILT_WRITE;
-		kqueue_enabled[fd+MAXCONNECTIONS] = 1;
-	}
 }
 
 void fd_select(time_t delay)
 {
 	struct timespec ts;
 	int num, p, revents, fd;
+	uint64_t wait_start;
 	struct kevent *ke;
 
 	if (kqueue_fd == -1)
-	{
 		kqueue_fd = kqueue();
-		memset(kqueue_enabled,0,MAXCONNECTIONS*2);
-	}
 
 	memset(&ts, 0, sizeof(ts));
 	ts.tv_sec = delay / 1000;
 	ts.tv_nsec = delay % 1000 * 1000000;
 
-	num = kevent(kqueue_fd, NULL, 0, kqueue_events, MAXCONNECTIONS * 2, &ts);
+	wait_start = monotonic_nsec();
+	num = kevent(kqueue_fd, NULL, 0, kqueue_events, FD_SELECT_BATCH, &ts);
+	fd_select_metrics(wait_start, num);
 	if (num <= 0)
 		return;
 
@@ -384,12 +389,13 @@ void fd_select(time_t delay)
 	{
 		FDEntry *fde;
 		IOCallbackFunc iocb;
-		int evflags = 0;
 
 		ke = &kqueue_events[p];
 		fd = ke->ident;
 		revents = ke->filter;
-		fde = ke->udata;
+		if (fd >= fd_table_size)
+			continue;
+		fde = &fd_table[fd];
 
 		if (revents == EVFILT_READ)
 		{
@@ -418,7 +424,7 @@ void fd_select(time_t delay)
 #include <sys/epoll.h>
 
 static int epoll_fd = -1;
-static struct epoll_event epfds[MAXCONNECTIONS + 1];
+static struct epoll_event epfds[FD_SELECT_BATCH];
 
 void fd_refresh(int fd)
 {
@@ -428,7 +434,7 @@ void fd_refresh(int fd)
 	int op = -1;
 
 	if (epoll_fd == -1)
-		epoll_fd = epoll_create(MAXCONNECTIONS);
+		epoll_fd = epoll_create(FD_SELECT_BATCH);
 
 	if (fde->read_callback)
 		pflags |= EPOLLIN;
@@ -450,7 +456,7 @@ void fd_refresh(int fd)
 
 	memset(&ep_event, 0, sizeof(ep_event));
 	ep_event.events = pflags;
-	ep_event.data.ptr = fde;
+	ep_event.data.fd = fd; /* not the FDEntry, since fd_table may move */
 
 	if (epoll_ctl(epoll_fd, op, fd, &ep_event) != 0)
 	{
@@ -472,6 +478,7 @@ void fd_refresh(int fd)
 void fd_select(time_t delay)
 {
 	int num, p, revents, fd;
+	uint64_t wait_start;
 	struct epoll_event *epfd;
 #ifdef DETECT_HIGH_CPU
 	int read_callbacks = 0, write_callbacks = 0;
@@ -479,9 +486,11 @@ void fd_select(time_t delay)
 	long long tdiff;
 #endif
 	if (epoll_fd == -1)
-		epoll_fd = epoll_create(MAXCONNECTIONS);
+		epoll_fd = epoll_create(FD_SELECT_BATCH);
 
-	num = epoll_wait(epoll_fd, epfds, MAXCONNECTIONS, delay);
+	wait_start = monotonic_nsec();
+	num = epoll_wait(epoll_fd, epfds, FD_SELECT_BATCH, delay);
+	fd_select_metrics(wait_start, num);
 	if (num <= 0)
 		return;
 
@@ -501,8 +510,10 @@ void fd_select(time_t delay)
 		if (revents == 0)
 			continue;
 
-		fde = epfd->data.ptr;
-		fd = fde->fd;
+		fd = epfd->data.fd;
+		if (fd >= fd_table_size)
+			continue;
+		fde = &fd_table[fd];
 
 		if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR))
 			evflags |= FD_SELECT_READ;
@@ -524,6 +535,7 @@ void fd_select(time_t delay)
 
 		if (evflags & FD_SELECT_WRITE)
 		{
+			fde = &fd_table[fd]; /* the fd table may have moved */
 			iocb = fde->write_callback;
 
 			if (iocb != NULL)
@@ -577,14 +589,29 @@ void fd_fork()
 # define POLLWRNORM POLLOUT
 #endif
 
-static struct pollfd pollfds[FD_SETSIZE];
+static struct pollfd *pollfds = NULL;
+static int pollfds_size = 0;
 static nfds_t nfds = 0;
 
 void fd_refresh(int fd)
 {
 	FDEntry *fde = &fd_table[fd];
 	unsigned int pflags = 0;
-	unsigned int i;
+	int i;
+
+	/* Grow along with the fd table */
+	if (fd >= pollfds_size)
+	{
+		pollfds = realloc(pollfds, sizeof(struct pollfd) * fd_table_size);
+		if (!pollfds)
+			outofmemory(sizeof(struct pollfd) * fd_table_size);
+		for (i = pollfds_size; i < fd_table_size; i++)
+		{
+			memset(&pollfds[i], 0, sizeof(struct pollfd));
+			pollfds[i].fd = -1;
+		}
+		pollfds_size = fd_table_size;
+	}
 
 	if (fde->read_callback)
 		pflags |= (POLLRDNORM | POLLIN);
@@ -608,9 +635,12 @@ void fd_refresh(int fd)
 void fd_select(time_t delay)
 {
 	int num, p, revents, fd;
+	uint64_t wait_start;
 	struct pollfd *pfd;
 
-	num = poll(pollfds, nfds + 1, delay);
+	wait_start = monotonic_nsec();
+	num = poll(pollfds, pollfds ? nfds + 1 : 0, delay);
+	fd_select_metrics(wait_start, num);
 	if (num <= 0)
 		return;
 
@@ -645,6 +675,7 @@ void fd_select(time_t delay)
 
 		if (evflags & FD_SELECT_WRITE)
 		{
+			fde = &fd_table[fd]; /* the fd table may have moved */
 			iocb = fde->write_callback;
 			if (iocb != NULL)
 				iocb(fd, evflags, fde->data);
@@ -53,7 +53,7 @@ extern void proceed_normal_client_handshake(Client *client, struct hostent *he);
 
 ares_channel resolver_channel; /**< The resolver channel. */
 
-DNSStats dnsstats;
+MODVAR DNSStats dnsstats;
 
 static DNSReq *requests = NULL; /**< Linked list of requests (pending responses). */
 
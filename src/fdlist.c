@@ -17,12 +17,45 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for accept4() on glibc */
+#endif
 #include "unrealircd.h"
 
 /* new FD management code, based on mowgli.eventloop from atheme, hammered into Unreal by
  * me, nenolod.
  */
-FDEntry fd_table[MAXCONNECTIONS + 1];
+/** The fd table, indexed by file descriptor.
+ * Only the first 'fd_table_size' entries exist. The table is grown
+ * by fd_open() when needed, so a FDEntry may move in memory when
+ * a new fd is opened. Don't keep pointers to it around.
+ */
+MODVAR FDEntry *fd_table = NULL;
+MODVAR int fd_table_size = 0;
+
+/** Make sure the fd table is big enough to hold 'fd'.
+ * The table doubles in size each time, so memory use
+ * is proportional to the highest fd in use.
+ */
+static void fd_table_grow(int fd)
+{
+	int newsize;
+
+	if (fd < fd_table_size)
+		return;
+
+	newsize = fd_table_size ? fd_table_size : FD_TABLE_INITIAL_SIZE;
+	while (newsize <= fd)
+		newsize *= 2;
+	if (newsize > MAXCONNECTIONS)
+		newsize = MAXCONNECTIONS;
+
+	fd_table = realloc(fd_table, sizeof(FDEntry) * newsize);
+	if (!fd_table)
+		outofmemory(sizeof(FDEntry) * newsize);
+	memset(&fd_table[fd_table_size], 0, sizeof(FDEntry) * (newsize - fd_table_size));
+	fd_table_size = newsize;
+}
 
 /** Notify I/O engine that a file descriptor opened.
  * @param fd		The file descriptor
@@ -47,6 +80,7 @@ int fd_open(int fd, const char *desc, FDCloseMethod close_method)
 		return -1;
 	}
 
+	fd_table_grow(fd);
 	fde = &fd_table[fd];
 	memset(fde, 0, sizeof(FDEntry));
 
@@ -95,12 +129,12 @@ int fd_close(int fd)
 	unsigned int befl;
 	FDCloseMethod close_method;
 
-	if ((fd < 0) || (fd >= MAXCONNECTIONS))
+	if ((fd < 0) || (fd >= fd_table_size))
 	{
 		unreal_log(ULOG_ERROR, "io", "BUG_FD_CLOSE_OUT_OF_RANGE", NULL,
-		           "[BUG] trying to close fd $fd to fd table, but MAXCONNECTIONS is $maxconnections",
+		           "[BUG] trying to close fd $fd to fd table, but the fd table size is $fd_table_size",
 		           log_data_integer("fd", fd),
-		           log_data_integer("maxconnections", MAXCONNECTIONS));
+		           log_data_integer("fd_table_size", fd_table_size));
 #ifdef DEBUGMODE
 		abort();
 #endif
@@ -151,7 +185,7 @@ void fd_unnotify(int fd)
 {
 	FDEntry *fde;
 
-	if ((fd < 0) || (fd >= MAXCONNECTIONS))
+	if ((fd < 0) || (fd >= fd_table_size))
 		return;
 	
 	fde = &fd_table[fd];
@@ -178,7 +212,12 @@ int fd_accept(int sockfd)
 	const char buf[] = "Incoming connection";
 	int fd;
 
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+	/* Saves us a few fcntl() calls per connection */
+	fd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
 	fd = accept(sockfd, NULL, NULL);
+#endif
 	if (fd < 0)
 		return -1;
 
@@ -189,12 +228,12 @@ void fd_desc(int fd, const char *desc)
 {
 	FDEntry *fde;
 
-	if ((fd < 0) || (fd >= MAXCONNECTIONS))
+	if ((fd < 0) || (fd >= fd_table_size))
 	{
 		unreal_log(ULOG_ERROR, "io", "BUG_FD_DESC_OUT_OF_RANGE", NULL,
-		           "[BUG] trying to fd_desc fd $fd in fd table, but MAXCONNECTIONS is $maxconnections",
+		           "[BUG] trying to fd_desc fd $fd in fd table, but the fd table size is $fd_table_size",
 		           log_data_integer("fd", fd),
-		           log_data_integer("maxconnections", MAXCONNECTIONS));
+		           log_data_integer("fd_table_size", fd_table_size));
 #ifdef DEBUGMODE
 		abort();
 #endif
@@ -265,6 +265,7 @@ static char siphashkey_nick[SIPHASH_KEY_LENGTH];
 static char siphashkey_chan[SIPHASH_KEY_LENGTH];
 static char siphashkey_whowas[SIPHASH_KEY_LENGTH];
 static char siphashkey_throttling[SIPHASH_KEY_LENGTH];
+static char siphashkey_ban[SIPHASH_KEY_LENGTH];
 
 extern char unreallogo[];
 
@@ -277,6 +278,7 @@ void init_hash(void)
 	siphash_generate_key(siphashkey_chan);
 	siphash_generate_key(siphashkey_whowas);
 	siphash_generate_key(siphashkey_throttling);
+	siphash_generate_key(siphashkey_ban);
 
 	for (i = 0; i < NICK_HASH_TABLE_SIZE; i++)
 		INIT_LIST_HEAD(&clientTable[i]);
@@ -308,7 +310,13 @@ uint64_t hash_channel_name(const char *name)
 
 uint64_t hash_whowas_name(const char *name)
 {
-	return siphash_nocase(name, siphashkey_whowas) % WHOWAS_HASH_TABLE_SIZE;
+	return siphash_nocase(name, siphashkey_whowas);
+}
+
+/** Hash a +beI entry, case insensitive just like identical_ban() */
+uint64_t hash_ban_mask(const char *banstr)
+{
+	return siphash_nocase(banstr, siphashkey_ban);
 }
 
 /*
@@ -0,0 +1,1334 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/hotrestart.c
+ *   (C) 2022-.. Bram Matthys (Syzop) and the UnrealIRCd Team
+ *   License: GPLv2 or later
+ */
+
+/** @file
+ * @brief Hot restart: hand over listeners and clients to a new process.
+ *
+ * The new process is started with 'unrealircd -H' (this is what
+ * './unrealircd hot-restart' does). Once its configuration passed
+ * testing, it connects to the control socket of the running server
+ * and issues HOTRESTART. The old process then:
+ * - writes the state of all users that can be handed over, and of
+ *   their channels, to an UnrealDB file. This includes moddata that
+ *   has a serialize function and the WATCH/MONITOR lists. Users on
+ *   TLS or websocket connections cannot be handed over (there is no
+ *   way to hand over an established TLS session),
+ * - passes the listener and client sockets via SCM_RIGHTS,
+ * - only then disconnects everything that was not handed over: server
+ *   links, unregistered connections and the remaining users. Up to
+ *   this point any failure leaves the server running as it was,
+ * - saves its databases (by unloading all modules) and exits.
+ * The new process takes over the listening sockets instead of binding
+ * new ones, and once the modules are loaded it recreates the users and
+ * channels. Users stay connected and see nothing besides the netsplit
+ * of the server links, which are re-established as usual.
+ */
+
+#include "unrealircd.h"
+
+#ifndef _WIN32
+
+/** Version of the state file. Both processes are expected to run the
+ * same version, but be strict about it anyway.
+ */
+#define HOT_RESTART_VERSION		2
+
+#define MAGIC_USER_START		0x33333333
+#define MAGIC_USER_END			0x44444444
+#define MAGIC_CHANNEL_START		0x55555555
+#define MAGIC_CHANNEL_END		0x66666666
+
+/** Maximum number of file descriptors passed in one message */
+#define HOT_RESTART_FDS_PER_MSG		64
+
+/** How long to wait for the other process (in seconds) */
+#define HOT_RESTART_TIMEOUT		30
+
+/** Client flags that are carried over */
+#define HOT_RESTART_CLIENT_FLAGS	(CLIENT_FLAG_LOCALHOST|CLIENT_FLAG_USEIDENT|CLIENT_FLAG_IDENTSUCCESS| \
+					 CLIENT_FLAG_DCCNOTICE|CLIENT_FLAG_SHUNNED|CLIENT_FLAG_VIRUS| \
+					 CLIENT_FLAG_NOFAKELAG|CLIENT_FLAG_DCCBLOCK|CLIENT_FLAG_ULINE)
+
+typedef struct HotRestartListener HotRestartListener;
+/** A listener socket received from the old process */
+struct HotRestartListener {
+	HotRestartListener *prev, *next;
+	SocketType socket_type;
+	char *ip;	/**< IP, or file name for UNIX domain sockets */
+	int port;
+	int index;	/**< 0 for listener->fd, 1+ for listener->reuseport_fds[index-1] */
+	int fd;		/**< The file descriptor, or -1 if already taken */
+};
+
+extern MODVAR ModDataInfo *MDInfo;
+
+/* Forward declarations */
+static int hot_restart_write_state(const char *fname);
+static void hot_restart_read_state(const char *fname);
+
+/** File descriptors that are sent (old process) or received (new process) */
+static int *hot_restart_fds = NULL;
+static int hot_restart_num_fds = 0;
+static int hot_restart_max_fds = 0;
+static HotRestartListener *hot_restart_listeners = NULL;
+
+static const char *hot_restart_db_file(void)
+{
+	static char buf[512];
+
+	snprintf(buf, sizeof(buf), "%s/hotrestart.db", TMPDIR);
+	return buf;
+}
+
+/** Add a file descriptor to the list of fds to send.
+ * @returns The index, which is what is stored in the state file.
+ */
+static int hot_restart_add_fd(int fd)
+{
+	if (hot_restart_num_fds == hot_restart_max_fds)
+	{
+		hot_restart_max_fds = hot_restart_max_fds ? hot_restart_max_fds * 2 : 256;
+		hot_restart_fds = realloc(hot_restart_fds, sizeof(int) * hot_restart_max_fds);
+		if (!hot_restart_fds)
+			outofmemory(sizeof(int) * hot_restart_max_fds);
+	}
+	hot_restart_fds[hot_restart_num_fds] = fd;
+	return hot_restart_num_fds++;
+}
+
+/** Take a received file descriptor, so it is not closed afterwards.
+ * @returns The fd, or -1 if the index is invalid.
+ */
+static int hot_restart_take_fd(uint32_t idx)
+{
+	int fd;
+
+	if (idx >= hot_restart_num_fds)
+		return -1;
+	fd = hot_restart_fds[idx];
+	hot_restart_fds[idx] = -1;
+	return fd;
+}
+
+/** Can this client be handed over to the new process? */
+static int hot_restart_can_transfer(Client *client)
+{
+	if (!MyUser(client) || IsDead(client) || IsDeadSocket(client) || (client->local->fd < 0))
+		return 0;
+	/* OpenSSL has no way to hand over an established session */
+	if (IsTLS(client) || client->local->ssl)
+		return 0;
+	/* Websocket framing state lives in the websocket module */
+	if (client->local->listener->webserver)
+		return 0;
+	return 1;
+}
+
+/** Free a partially restored client, which is not in any list yet */
+static void hot_restart_free_client(Client *client)
+{
+	if (client->user)
+		free_user(client);
+	moddata_free_local_client(client);
+	moddata_free_client(client);
+	free_client(client);
+}
+
+/** Does the channel have any member that is handed over? */
+static int hot_restart_channel_transferable(Channel *channel)
+{
+	Member *m;
+
+	for (m = channel->members; m; m = m->next)
+		if (hot_restart_can_transfer(m->client))
+			return 1;
+	return 0;
+}
+
+static int hot_restart_listener_transferable(ConfigItem_listen *listener)
+{
+	if (!(listener->options & LISTENER_BOUND) || (listener->fd < 0))
+		return 0;
+	/* The new process creates its own control socket */
+	if (listener->options & LISTENER_CONTROL)
+		return 0;
+	return 1;
+}
+
+/*** Writing the state (old process) ***/
+
+#define W_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			unreal_log(ULOG_ERROR, "main", "HOT_RESTART_WRITE_ERROR", NULL, \
+			           "[hot restart] Error writing to temporary file $filename: $system_error", \
+			           log_data_string("filename", fname), \
+			           log_data_string("system_error", unrealdb_get_error_string())); \
+			return 0; \
+		} \
+	} while(0)
+
+/** Write all moddata of the specified type that can be serialized */
+static int hot_restart_write_moddata(UnrealDB *db, const char *fname, ModDataType type, ModData *moddata)
+{
+	ModDataInfo *md;
+	const char *str;
+	int cnt = 0;
+
+	for (md = MDInfo; md; md = md->next)
+		if ((md->type == type) && md->serialize && md->unserialize && md->serialize(&moddata[md->slot]))
+			cnt++;
+
+	W_SAFE(unrealdb_write_int32(db, cnt));
+
+	for (md = MDInfo; md; md = md->next)
+	{
+		if ((md->type == type) && md->serialize && md->unserialize && (str = md->serialize(&moddata[md->slot])))
+		{
+			W_SAFE(unrealdb_write_str(db, md->name));
+			W_SAFE(unrealdb_write_str(db, str));
+		}
+	}
+	return 1;
+}
+
+static int hot_restart_write_dbuf(UnrealDB *db, const char *fname, dbuf *dyn)
+{
+	dbufbuf *block;
+	char buf[DBUF_BLOCK_SIZE+1];
+	int cnt = 0;
+
+	list_for_each_entry(block, &dyn->dbuf_list, dbuf_node)
+		cnt++;
+
+	W_SAFE(unrealdb_write_int32(db, cnt));
+
+	list_for_each_entry(block, &dyn->dbuf_list, dbuf_node)
+	{
+		/* IRC traffic cannot contain NUL bytes, so a string will do */
+		memcpy(buf, block->data, block->size);
+		buf[block->size] = '\0';
+		W_SAFE(unrealdb_write_str(db, buf));
+	}
+	return 1;
+}
+
+/** Write the WATCH and MONITOR list of the user. These live in
+ * the watch-backend and not in moddata that can be serialized.
+ */
+static int hot_restart_write_watches(UnrealDB *db, const char *fname, Client *client)
+{
+	ModDataInfo *md = findmoddata_byname("watchList", MODDATATYPE_LOCAL_CLIENT);
+	Link *lp;
+	int cnt = 0;
+
+	if (md)
+		for (lp = moddata_local_client(client, md).ptr; lp; lp = lp->next)
+			cnt++;
+
+	W_SAFE(unrealdb_write_int32(db, cnt));
+
+	if (md)
+	{
+		for (lp = moddata_local_client(client, md).ptr; lp; lp = lp->next)
+		{
+			W_SAFE(unrealdb_write_str(db, lp->value.wptr->nick));
+			W_SAFE(unrealdb_write_int32(db, lp->flags));
+		}
+	}
+	return 1;
+}
+
+static int hot_restart_write_listener(UnrealDB *db, const char *fname, ConfigItem_listen *listener)
+{
+	int i, cnt = 1;
+
+	if (listener->reuseport_fds)
+		for (i = 0; i < listener->reuseport_sockets - 1; i++)
+			if (listener->reuseport_fds[i] >= 0)
+				cnt++;
+
+	W_SAFE(unrealdb_write_int32(db, listener->socket_type));
+	W_SAFE(unrealdb_write_str(db, listener->socket_type == SOCKET_TYPE_UNIX ? listener->file : listener->ip));
+	W_SAFE(unrealdb_write_int32(db, listener->port));
+	W_SAFE(unrealdb_write_int32(db, cnt));
+	W_SAFE(unrealdb_write_int32(db, 0));
+	W_SAFE(unrealdb_write_int32(db, hot_restart_add_fd(listener->fd)));
+	if (listener->reuseport_fds)
+	{
+		for (i = 0; i < listener->reuseport_sockets - 1; i++)
+		{
+			if (listener->reuseport_fds[i] >= 0)
+			{
+				W_SAFE(unrealdb_write_int32(db, i + 1));
+				W_SAFE(unrealdb_write_int32(db, hot_restart_add_fd(listener->reuseport_fds[i])));
+			}
+		}
+	}
+	return 1;
+}
+
+static int hot_restart_write_user(UnrealDB *db, const char *fname, Client *client)
+{
+	ConfigItem_listen *listener = client->local->listener;
+	ClientCapability *clicap;
+	SWhois *s;
+	int cnt;
+
+	W_SAFE(unrealdb_write_int32(db, MAGIC_USER_START));
+	W_SAFE(unrealdb_write_str(db, client->id));
+	W_SAFE(unrealdb_write_str(db, client->name));
+	W_SAFE(unrealdb_write_int64(db, client->lastnick));
+	W_SAFE(unrealdb_write_str(db, get_usermode_string_raw(client->umodes)));
+	W_SAFE(unrealdb_write_int64(db, client->flags & HOT_RESTART_CLIENT_FLAGS));
+	W_SAFE(unrealdb_write_str(db, client->ident));
+	W_SAFE(unrealdb_write_str(db, client->info));
+	W_SAFE(unrealdb_write_str(db, client->ip));
+	W_SAFE(unrealdb_write_str(db, client->local->sockhost));
+	W_SAFE(unrealdb_write_int32(db, client->local->port));
+	/* The listener it came in on */
+	W_SAFE(unrealdb_write_int32(db, listener->socket_type));
+	W_SAFE(unrealdb_write_str(db, listener->socket_type == SOCKET_TYPE_UNIX ? listener->file : listener->ip));
+	W_SAFE(unrealdb_write_int32(db, listener->port));
+	W_SAFE(unrealdb_write_str(db, client->local->class ? client->local->class->name : NULL));
+	W_SAFE(unrealdb_write_int64(db, client->local->creationtime));
+	W_SAFE(unrealdb_write_int64(db, client->local->last_msg_received));
+	W_SAFE(unrealdb_write_int64(db, client->local->idle_since));
+	/* Capabilities, by name, since the bits may differ in the new process */
+	cnt = 0;
+	for (clicap = clicaps; clicap; clicap = clicap->next)
+		if (clicap->cap && (client->local->caps & clicap->cap))
+			cnt++;
+	W_SAFE(unrealdb_write_int32(db, cnt));
+	for (clicap = clicaps; clicap; clicap = clicap->next)
+		if (clicap->cap && (client->local->caps & clicap->cap))
+			W_SAFE(unrealdb_write_str(db, clicap->name));
+	W_SAFE(unrealdb_write_int32(db, client->local->cap_protocol));
+	/* User */
+	W_SAFE(unrealdb_write_str(db, client->user->username));
+	W_SAFE(unrealdb_write_str(db, client->user->realhost));
+	W_SAFE(unrealdb_write_str(db, client->user->cloakedhost));
+	W_SAFE(unrealdb_write_str(db, client->user->virthost));
+	W_SAFE(unrealdb_write_str(db, client->user->account));
+	W_SAFE(unrealdb_write_str(db, client->user->snomask));
+	W_SAFE(unrealdb_write_str(db, client->user->operlogin));
+	W_SAFE(unrealdb_write_str(db, client->user->away));
+	W_SAFE(unrealdb_write_int64(db, client->user->away_since));
+	cnt = 0;
+	for (s = client->user->swhois; s; s = s->next)
+		cnt++;
+	W_SAFE(unrealdb_write_int32(db, cnt));
+	for (s = client->user->swhois; s; s = s->next)
+	{
+		W_SAFE(unrealdb_write_str(db, s->line));
+		W_SAFE(unrealdb_write_str(db, s->setby));
+		W_SAFE(unrealdb_write_int32(db, s->priority));
+	}
+	if (!hot_restart_write_moddata(db, fname, MODDATATYPE_CLIENT, client->moddata) ||
+	    !hot_restart_write_moddata(db, fname, MODDATATYPE_LOCAL_CLIENT, client->local->moddata) ||
+	    !hot_restart_write_watches(db, fname, client) ||
+	    !hot_restart_write_dbuf(db, fname, &client->local->sendQ) ||
+	    !hot_restart_write_dbuf(db, fname, &client->local->recvQ))
+	{
+		return 0;
+	}
+	W_SAFE(unrealdb_write_int32(db, hot_restart_add_fd(client->local->fd)));
+	W_SAFE(unrealdb_write_int32(db, MAGIC_USER_END));
+	return 1;
+}
+
+static int hot_restart_write_listmode(UnrealDB *db, const char *fname, Ban *lst)
+{
+	Ban *l;
+	int cnt = 0;
+
+	for (l = lst; l; l = l->next)
+		cnt++;
+	W_SAFE(unrealdb_write_int32(db, cnt));
+
+	for (l = lst; l; l = l->next)
+	{
+		W_SAFE(unrealdb_write_str(db, l->banstr));
+		W_SAFE(unrealdb_write_str(db, l->who));
+		W_SAFE(unrealdb_write_int64(db, l->when));
+	}
+	return 1;
+}
+
+static int hot_restart_write_channel(UnrealDB *db, const char *fname, Channel *channel)
+{
+	char modebuf[BUFSIZE], parabuf[BUFSIZE];
+	Member *m;
+	Membership *mb;
+	int cnt;
+
+	W_SAFE(unrealdb_write_int32(db, MAGIC_CHANNEL_START));
+	W_SAFE(unrealdb_write_str(db, channel->name));
+	W_SAFE(unrealdb_write_int64(db, channel->creationtime));
+	W_SAFE(unrealdb_write_str(db, channel->topic));
+	W_SAFE(unrealdb_write_str(db, channel->topic_nick));
+	W_SAFE(unrealdb_write_int64(db, channel->topic_time));
+	channel_modes(&me, modebuf, parabuf, sizeof(modebuf), sizeof(parabuf), channel, 1);
+	W_SAFE(unrealdb_write_str(db, modebuf));
+	W_SAFE(unrealdb_write_str(db, parabuf));
+	W_SAFE(unrealdb_write_str(db, channel->mode_lock));
+	if (!hot_restart_write_listmode(db, fname, channel->banlist) ||
+	    !hot_restart_write_listmode(db, fname, channel->exlist) ||
+	    !hot_restart_write_listmode(db, fname, channel->invexlist) ||
+	    !hot_restart_write_moddata(db, fname, MODDATATYPE_CHANNEL, channel->moddata))
+	{
+		return 0;
+	}
+	cnt = 0;
+	for (m = channel->members; m; m = m->next)
+		if (hot_restart_can_transfer(m->client))
+			cnt++;
+	W_SAFE(unrealdb_write_int32(db, cnt));
+	for (m = channel->members; m; m = m->next)
+	{
+		if (!hot_restart_can_transfer(m->client))
+			continue;
+		mb = find_membership(m->client, channel);
+		W_SAFE(unrealdb_write_str(db, m->client->id));
+		W_SAFE(unrealdb_write_str(db, m->member_modes));
+		if (!hot_restart_write_moddata(db, fname, MODDATATYPE_MEMBER, m->moddata) ||
+		    !hot_restart_write_moddata(db, fname, MODDATATYPE_MEMBERSHIP, mb->moddata))
+		{
+			return 0;
+		}
+	}
+	W_SAFE(unrealdb_write_int32(db, MAGIC_CHANNEL_END));
+	return 1;
+}
+
+/** Write the state of all listeners, users and channels.
+ * The file descriptors to pass on are collected in hot_restart_fds.
+ */
+static int hot_restart_write_state(const char *fname)
+{
+	UnrealDB *db;
+	ConfigItem_listen *listener;
+	Client *client;
+	Channel *channel;
+	int cnt;
+
+	db = unrealdb_open(fname, UNREALDB_MODE_WRITE, NULL);
+	if (!db)
+	{
+		unreal_log(ULOG_ERROR, "main", "HOT_RESTART_WRITE_ERROR", NULL,
+		           "[hot restart] Unable to open temporary file $filename for writing: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("system_error", unrealdb_get_error_string()));
+		return 0;
+	}
+
+#define W_CLOSE(x) do { if (!(x)) { unrealdb_close(db); return 0; } } while(0)
+
+	W_CLOSE(unrealdb_write_int32(db, HOT_RESTART_VERSION));
+
+	cnt = 0;
+	for (listener = conf_listen; listener; listener = listener->next)
+		if (hot_restart_listener_transferable(listener))
+			cnt++;
+	W_CLOSE(unrealdb_write_int32(db, cnt));
+	for (listener = conf_listen; listener; listener = listener->next)
+		if (hot_restart_listener_transferable(listener))
+			W_CLOSE(hot_restart_write_listener(db, fname, listener));
+
+	cnt = 0;
+	list_for_each_entry(client, &lclient_list, lclient_node)
+		if (hot_restart_can_transfer(client))
+			cnt++;
+	W_CLOSE(unrealdb_write_int64(db, cnt));
+	list_for_each_entry(client, &lclient_list, lclient_node)
+		if (hot_restart_can_transfer(client))
+			W_CLOSE(hot_restart_write_user(db, fname, client));
+
+	/* Only channels with users that we hand over are written, and
+	 * only with those members. Remote users and users that are not
+	 * handed over will be gone in the new process.
+	 * Empty +P channels are taken care of by channeldb.
+	 */
+	cnt = 0;
+	for (channel = channels; channel; channel = channel->nextch)
+		if (hot_restart_channel_transferable(channel))
+			cnt++;
+	W_CLOSE(unrealdb_write_int64(db, cnt));
+	for (channel = channels; channel; channel = channel->nextch)
+		if (hot_restart_channel_transferable(channel))
+			W_CLOSE(hot_restart_write_channel(db, fname, channel));
+
+#undef W_CLOSE
+
+	if (!unrealdb_close(db))
+	{
+		unreal_log(ULOG_ERROR, "main", "HOT_RESTART_WRITE_ERROR", NULL,
+		           "[hot restart] Error writing to temporary file $filename: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("system_error", unrealdb_get_error_string()));
+		return 0;
+	}
+	return 1;
+}
+#undef W_SAFE
+
+/** Send all collected file descriptors over the control socket.
+ * Each message carries one 'F' byte and up to HOT_RESTART_FDS_PER_MSG fds.
+ */
+static int hot_restart_send_fds(int sock)
+{
+	int i, n;
+
+	for (i = 0; i < hot_restart_num_fds; i += n)
+	{
+		struct msghdr msg;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int) * HOT_RESTART_FDS_PER_MSG)];
+		} control;
+		char byte = 'F';
+
+		n = MIN(hot_restart_num_fds - i, HOT_RESTART_FDS_PER_MSG);
+
+		memset(&msg, 0, sizeof(msg));
+		memset(&control, 0, sizeof(control));
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+		memcpy(CMSG_DATA(cmsg), &hot_restart_fds[i], sizeof(int) * n);
+
+		if (sendmsg(sock, &msg, 0) != 1)
+			return 0;
+	}
+	return 1;
+}
+
+/** Hand over everything to a new process (the HOTRESTART control command).
+ * @param requester	The control channel client of the new process
+ * @note  This only returns on failure. Nothing has been disconnected
+ *        at that point, so the server simply continues running.
+ */
+void hot_restart_request(Client *requester)
+{
+	Client *client, *next;
+	const char *fname = hot_restart_db_file();
+	struct timeval tv;
+	int users = 0, opt;
+
+	unreal_log(ULOG_INFO, "main", "HOT_RESTART", NULL,
+	           "Hot restart requested, handing over to the new UnrealIRCd process...");
+
+	/* Flush whatever we can, the rest is handed over */
+	list_for_each_entry(client, &lclient_list, lclient_node)
+	{
+		if (hot_restart_can_transfer(client))
+		{
+			(void)send_queued(client);
+			users++;
+		}
+	}
+
+	hot_restart_num_fds = 0;
+	if (!hot_restart_write_state(fname))
+	{
+		sendto_one(requester, NULL, "REPLY ERROR: Could not write the state file, see the log");
+		sendto_one(requester, NULL, "END 1");
+		unlink(fname);
+		return;
+	}
+
+	/* Talk to the new process synchronously from here on */
+	if ((opt = fcntl(requester->local->fd, F_GETFL, 0)) != -1)
+		fcntl(requester->local->fd, F_SETFL, opt & ~O_NONBLOCK);
+	tv.tv_sec = HOT_RESTART_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(requester->local->fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(tv));
+	send_queued(requester);
+
+	if (!hot_restart_send_fds(requester->local->fd))
+	{
+		unreal_log(ULOG_ERROR, "main", "HOT_RESTART_FAILED", NULL,
+		           "[hot restart] Could not pass the sockets to the new process: $socket_error. "
+		           "Continuing with the current process.",
+		           log_data_socket_error(requester->local->fd));
+		unlink(fname);
+		dead_socket(requester, "Hot restart failed");
+		return;
+	}
+
+	/* Whatever was still queued for the handed over users is in the
+	 * state file and will be sent by the new process. Drop our copy,
+	 * so from here on their sendQ only holds what we queue below.
+	 */
+	list_for_each_entry(client, &lclient_list, lclient_node)
+		if (hot_restart_can_transfer(client))
+			DBufClear(&client->local->sendQ);
+
+	/* The new process has everything and waits for our END, so we
+	 * can now disconnect everything that was not handed over.
+	 * Server links go first, so local users see the remote users
+	 * quit, just like with a normal netsplit. Those QUITs are sent
+	 * by us, anything that cannot be sent right away is lost. Any
+	 * data that was handed over is sent by the new process after
+	 * these, because it only starts once it received our END.
+	 */
+	list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
+		if (IsServer(client))
+			exit_client(client, NULL, "Server is restarting");
+	list_for_each_entry_safe(client, next, &unknown_list, lclient_node)
+		exit_client(client, NULL, "Server is restarting");
+	list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
+		if (IsUser(client) && !hot_restart_can_transfer(client))
+			exit_client(client, NULL, "Server is restarting, please reconnect");
+	list_for_each_entry(client, &lclient_list, lclient_node)
+		if (hot_restart_can_transfer(client))
+			(void)send_queued(client);
+
+	unreal_log(ULOG_INFO, "main", "HOT_RESTART_HANDOVER", NULL,
+	           "Handed over $num_users users and $num_sockets sockets to the new process. Goodbye!",
+	           log_data_integer("num_users", users),
+	           log_data_integer("num_sockets", hot_restart_num_fds));
+
+	/* Save databases, just like on a normal shutdown */
+	loop.terminating = 1;
+	unload_all_modules();
+
+	sendto_one(requester, NULL, "END 0");
+	send_queued(requester);
+	exit(0);
+}
+
+/*** Taking over (new process) ***/
+
+/** Read one byte, and any file descriptors that come with it */
+static int hot_restart_recv(int sock, char *byte)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * HOT_RESTART_FDS_PER_MSG)];
+	} control;
+	int flags = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	if (recvmsg(sock, &msg, flags) != 1)
+		return 0;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+		{
+			int i, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int *fds = (int *)CMSG_DATA(cmsg);
+			for (i = 0; i < n; i++)
+				hot_restart_add_fd(fds[i]);
+		}
+	}
+	return 1;
+}
+
+/** Connect to the running server and receive its sockets and state.
+ * This is called from config_run(), before the listeners are started.
+ * On failure we exit, since the old process is still running.
+ */
+void hot_restart_receive(void)
+{
+	struct sockaddr_un addr;
+	struct timeval tv;
+	char line[512];
+	int sock, len = 0;
+	char c;
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		config_error("[hot restart] Could not create socket: %s", strerror(ERRNO));
+		exit(-1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, CONTROLFILE, sizeof(addr.sun_path));
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		config_error("[hot restart] Could not connect to '%s': %s", CONTROLFILE, strerror(ERRNO));
+		config_error("[hot restart] The IRC server does not appear to be running.");
+		exit(-1);
+	}
+
+	tv.tv_sec = HOT_RESTART_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof(tv));
+
+	config_status("Requesting hot restart from the running server...");
+	if (send(sock, "HOTRESTART\r\n", 12, 0) != 12)
+	{
+		config_error("[hot restart] Could not send command: %s", strerror(ERRNO));
+		exit(-1);
+	}
+
+	/* The reply consists of text lines (READY, REPLY, END)
+	 * and 'F' messages that carry the file descriptors.
+	 */
+	while (1)
+	{
+		if (!hot_restart_recv(sock, &c))
+		{
+			config_error("[hot restart] Lost connection to the running server");
+			exit(-1);
+		}
+		if ((c == 'F') && (len == 0))
+			continue;
+		if (c == '\r')
+			continue;
+		if (c != '\n')
+		{
+			if (len < sizeof(line) - 1)
+				line[len++] = c;
+			continue;
+		}
+		line[len] = '\0';
+		len = 0;
+		if (!strncmp(line, "REPLY ", 6))
+		{
+			config_status("%s", line + 6);
+		} else
+		if (!strncmp(line, "END ", 4))
+		{
+			if (atoi(line + 4) != 0)
+			{
+				config_error("[hot restart] The running server refused the hot restart");
+				exit(-1);
+			}
+			break;
+		}
+	}
+	close(sock);
+
+	hot_restart_read_state(hot_restart_db_file());
+}
+
+/** Take over a listening socket from the old process, if we got one.
+ * @param listener	The listen { } block
+ * @param index		0 for the main socket, 1+ for the additional SO_REUSEPORT sockets
+ * @returns The file descriptor (not yet fd_open()'ed) or -1.
+ */
+int hot_restart_take_listener(ConfigItem_listen *listener, int index)
+{
+	HotRestartListener *e;
+	const char *ip = listener->socket_type == SOCKET_TYPE_UNIX ? listener->file : listener->ip;
+	int fd;
+
+	for (e = hot_restart_listeners; e; e = e->next)
+	{
+		if ((e->fd >= 0) && (e->socket_type == listener->socket_type) &&
+		    (e->port == listener->port) && (e->index == index) &&
+		    !strcmp(e->ip, ip ? ip : ""))
+		{
+			fd = e->fd;
+			e->fd = -1;
+			return fd;
+		}
+	}
+	return -1;
+}
+
+/** Close the listening sockets that the new configuration no longer uses */
+void hot_restart_close_listeners(void)
+{
+	HotRestartListener *e, *e_next;
+
+	for (e = hot_restart_listeners; e; e = e_next)
+	{
+		e_next = e->next;
+		if (e->fd >= 0)
+			close(e->fd);
+		safe_free(e->ip);
+		safe_free(e);
+	}
+	hot_restart_listeners = NULL;
+}
+
+/*** Reading the state ***/
+
+/** The state file is read in two steps: the listener section as soon
+ * as we received it (the listeners are started right after that),
+ * users and channels once all modules are loaded.
+ * In between we fork into the background, and the parent and child
+ * would share the file offset of an open state file. So the file is
+ * closed after the first step and opened again for the second one,
+ * this is where the second step starts (0 if there is nothing to do).
+ */
+static long hot_restart_db_offset = 0;
+
+#define R_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL, \
+			           "[hot restart] Read error from state file: $system_error", \
+			           log_data_string("system_error", unrealdb_get_error_string())); \
+			return 0; \
+		} \
+	} while(0)
+
+static int hot_restart_read_moddata(UnrealDB *db, ModDataType type, ModData *moddata)
+{
+	ModDataInfo *md;
+	uint32_t cnt, i;
+	char *name = NULL, *value = NULL;
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		if (!unrealdb_read_str(db, &name) || !unrealdb_read_str(db, &value))
+		{
+			safe_free(name);
+			R_SAFE(0);
+		}
+		/* Modules that are no longer loaded are simply skipped */
+		md = findmoddata_byname(name, type);
+		if (moddata && md && md->unserialize && value)
+			md->unserialize(value, &moddata[md->slot]);
+		safe_free(name);
+		safe_free(value);
+	}
+	return 1;
+}
+
+static int hot_restart_read_dbuf(UnrealDB *db, dbuf *dyn)
+{
+	uint32_t cnt, i;
+	char *str = NULL;
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		R_SAFE(unrealdb_read_str(db, &str));
+		if (str)
+			dbuf_put(dyn, str, strlen(str));
+		safe_free(str);
+	}
+	return 1;
+}
+
+static int hot_restart_read_listeners(UnrealDB *db)
+{
+	uint32_t cnt, socket_type, port, nfds, index, fdidx, i, j;
+	char *ip = NULL;
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		R_SAFE(unrealdb_read_int32(db, &socket_type));
+		R_SAFE(unrealdb_read_str(db, &ip));
+		R_SAFE(unrealdb_read_int32(db, &port));
+		R_SAFE(unrealdb_read_int32(db, &nfds));
+		for (j = 0; j < nfds; j++)
+		{
+			HotRestartListener *e;
+
+			R_SAFE(unrealdb_read_int32(db, &index));
+			R_SAFE(unrealdb_read_int32(db, &fdidx));
+			e = safe_alloc(sizeof(HotRestartListener));
+			e->socket_type = socket_type;
+			safe_strdup(e->ip, ip ? ip : "");
+			e->port = port;
+			e->index = index;
+			e->fd = hot_restart_take_fd(fdidx);
+			AddListItem(e, hot_restart_listeners);
+		}
+		safe_free(ip);
+	}
+	return 1;
+}
+
+/** Read the listener section of the state file */
+static void hot_restart_read_state(const char *fname)
+{
+	UnrealDB *db;
+	uint32_t version;
+
+	db = unrealdb_open(fname, UNREALDB_MODE_READ, NULL);
+	if (!db)
+	{
+		unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL,
+		           "[hot restart] Unable to open state file $filename: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("system_error", unrealdb_get_error_string()));
+		return;
+	}
+
+	if (!unrealdb_read_int32(db, &version) || (version != HOT_RESTART_VERSION) ||
+	    !hot_restart_read_listeners(db))
+	{
+		unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL,
+		           "[hot restart] State file is corrupt or has the wrong version");
+		unlink(fname);
+	} else {
+		hot_restart_db_offset = ftell(db->fd);
+	}
+	unrealdb_close(db);
+}
+
+#define FreeUserEntry() \
+	do { \
+		safe_free(id); safe_free(name); safe_free(umodes); safe_free(ident); \
+		safe_free(info); safe_free(ip); safe_free(sockhost); safe_free(listen_ip); \
+		safe_free(classname); safe_free(username); safe_free(realhost); \
+		safe_free(cloakedhost); safe_free(virthost); safe_free(account); \
+		safe_free(snomask); safe_free(operlogin); safe_free(away); \
+		free_nvplist(watches); \
+	} while(0)
+
+#undef R_SAFE
+#define R_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL, \
+			           "[hot restart] Read error from state file: $system_error", \
+			           log_data_string("system_error", unrealdb_get_error_string())); \
+			FreeUserEntry(); \
+			if (client) \
+				hot_restart_free_client(client); \
+			return 0; \
+		} \
+	} while(0)
+
+/** Read one user and recreate it as a local client */
+static int hot_restart_read_user(UnrealDB *db)
+{
+	char *id = NULL, *name = NULL, *umodes = NULL, *ident = NULL, *info = NULL;
+	char *ip = NULL, *sockhost = NULL, *listen_ip = NULL, *classname = NULL;
+	char *username = NULL, *realhost = NULL, *cloakedhost = NULL, *virthost = NULL;
+	char *account = NULL, *snomask = NULL, *operlogin = NULL, *away = NULL;
+	uint64_t lastnick, flags, creationtime, last_msg_received, idle_since, away_since;
+	uint32_t magic, port, listen_type, listen_port, cnt, cap_protocol, priority, fdidx, i;
+	ConfigItem_listen *listener;
+	Client *client = NULL;
+	NameValuePrioList *watches = NULL, *w;
+	char descbuf[BUFSIZE];
+	int fd;
+
+	R_SAFE(unrealdb_read_int32(db, &magic));
+	R_SAFE(magic == MAGIC_USER_START);
+	R_SAFE(unrealdb_read_str(db, &id));
+	R_SAFE(unrealdb_read_str(db, &name));
+	R_SAFE(unrealdb_read_int64(db, &lastnick));
+	R_SAFE(unrealdb_read_str(db, &umodes));
+	R_SAFE(unrealdb_read_int64(db, &flags));
+	R_SAFE(unrealdb_read_str(db, &ident));
+	R_SAFE(unrealdb_read_str(db, &info));
+	R_SAFE(unrealdb_read_str(db, &ip));
+	R_SAFE(unrealdb_read_str(db, &sockhost));
+	R_SAFE(unrealdb_read_int32(db, &port));
+	R_SAFE(unrealdb_read_int32(db, &listen_type));
+	R_SAFE(unrealdb_read_str(db, &listen_ip));
+	R_SAFE(unrealdb_read_int32(db, &listen_port));
+	R_SAFE(unrealdb_read_str(db, &classname));
+	R_SAFE(unrealdb_read_int64(db, &creationtime));
+	R_SAFE(unrealdb_read_int64(db, &last_msg_received));
+	R_SAFE(unrealdb_read_int64(db, &idle_since));
+	R_SAFE(id && name && ip && listen_ip);
+
+	/* From here on we have a client, so we can store things
+	 * right away and R_SAFE() will clean it up on failure.
+	 */
+	client = make_client(NULL, &me);
+	del_from_id_hash_table(client->id, client);
+	strlcpy(client->id, id, sizeof(client->id));
+	add_to_id_hash_table(client->id, client);
+	strlcpy(client->name, name, sizeof(client->name));
+	client->lastnick = lastnick;
+	client->flags = flags & HOT_RESTART_CLIENT_FLAGS;
+	strlcpy(client->ident, ident ? ident : "unknown", sizeof(client->ident));
+	strlcpy(client->info, info ? info : "", sizeof(client->info));
+	safe_strdup(client->ip, ip);
+	strlcpy(client->local->sockhost, sockhost ? sockhost : ip, sizeof(client->local->sockhost));
+	client->local->port = port;
+	client->local->creationtime = creationtime;
+	client->local->last_msg_received = last_msg_received;
+	client->local->idle_since = idle_since;
+	client->local->socket_type = listen_type;
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		ClientCapability *clicap;
+		char *capname = NULL;
+
+		R_SAFE(unrealdb_read_str(db, &capname));
+		if (capname && (clicap = ClientCapabilityFindReal(capname)))
+			client->local->caps |= clicap->cap;
+		safe_free(capname);
+	}
+	R_SAFE(unrealdb_read_int32(db, &cap_protocol));
+	client->local->cap_protocol = cap_protocol;
+
+	make_user(client);
+	client->user->server = me_hash;
+	R_SAFE(unrealdb_read_str(db, &username));
+	R_SAFE(unrealdb_read_str(db, &realhost));
+	R_SAFE(unrealdb_read_str(db, &cloakedhost));
+	R_SAFE(unrealdb_read_str(db, &virthost));
+	R_SAFE(unrealdb_read_str(db, &account));
+	R_SAFE(unrealdb_read_str(db, &snomask));
+	R_SAFE(unrealdb_read_str(db, &operlogin));
+	R_SAFE(unrealdb_read_str(db, &away));
+	R_SAFE(unrealdb_read_int64(db, &away_since));
+	strlcpy(client->user->username, username ? username : "unknown", sizeof(client->user->username));
+	strlcpy(client->user->realhost, realhost ? realhost : ip, sizeof(client->user->realhost));
+	strlcpy(client->user->cloakedhost, cloakedhost ? cloakedhost : "", sizeof(client->user->cloakedhost));
+	strlcpy(client->user->account, account ? account : "0", sizeof(client->user->account));
+	safe_strdup(client->user->virthost, virthost);
+	safe_strdup(client->user->snomask, snomask);
+	safe_strdup(client->user->operlogin, operlogin);
+	safe_strdup(client->user->away, away);
+	client->user->away_since = away_since;
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		char *line = NULL, *setby = NULL;
+
+		if (!unrealdb_read_str(db, &line) || !unrealdb_read_str(db, &setby) ||
+		    !unrealdb_read_int32(db, &priority))
+		{
+			safe_free(line);
+			safe_free(setby);
+			R_SAFE(0);
+		}
+		if (line && setby)
+			swhois_add(client, setby, priority, line, &me, NULL);
+		safe_free(line);
+		safe_free(setby);
+	}
+
+	R_SAFE(hot_restart_read_moddata(db, MODDATATYPE_CLIENT, client->moddata));
+	R_SAFE(hot_restart_read_moddata(db, MODDATATYPE_LOCAL_CLIENT, client->local->moddata));
+	/* The WATCH/MONITOR list is added once the client is in all lists */
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		char *nick = NULL;
+		uint32_t watchflags;
+
+		if (!unrealdb_read_str(db, &nick) || !unrealdb_read_int32(db, &watchflags))
+		{
+			safe_free(nick);
+			R_SAFE(0);
+		}
+		if (nick)
+			add_nvplist(&watches, watchflags, nick, NULL);
+		safe_free(nick);
+	}
+	R_SAFE(hot_restart_read_dbuf(db, &client->local->sendQ));
+	R_SAFE(hot_restart_read_dbuf(db, &client->local->recvQ));
+	R_SAFE(unrealdb_read_int32(db, &fdidx));
+	R_SAFE(unrealdb_read_int32(db, &magic));
+	R_SAFE(magic == MAGIC_USER_END);
+
+	fd = hot_restart_take_fd(fdidx);
+	listener = find_listen(listen_ip, listen_port, listen_type);
+	if ((fd < 0) || !listener || find_client(client->name, NULL))
+	{
+		/* No socket, no listener (removed from the config) or
+		 * a duplicate nick. Nothing we can do about it.
+		 */
+		if (fd >= 0)
+			close(fd);
+		hot_restart_free_client(client);
+		FreeUserEntry();
+		return 1;
+	}
+
+	/* The socket */
+	snprintf(descbuf, sizeof(descbuf), "Client: %s", client->name);
+	fd_open(fd, descbuf, FDCLOSE_SOCKET);
+	++OpenFiles;
+	client->local->fd = fd;
+	client->local->listener = listener;
+	listener->clients++;
+
+	/* Class, status and all the lists */
+	client->local->class = find_class(classname);
+	if (!client->local->class)
+		client->local->class = default_class;
+	client->local->class->clients++;
+	client->umodes = set_usermode(umodes);
+	SetUser(client);
+	add_client_to_list(client);
+	add_to_client_hash_table(client->name, client);
+	list_add(&client->lclient_node, &lclient_list);
+	irccounts.clients++;
+	irccounts.me_clients++;
+	me.server->users++;
+	if (IsInvisible(client))
+		irccounts.invisible++;
+	if (IsOper(client))
+	{
+		list_add(&client->special_node, &oper_list);
+		if (!IsHideOper(client))
+			irccounts.operators++;
+	}
+
+	for (w = watches; w; w = w->next)
+		watch_add(w->name, client, w->priority);
+
+	fd_setselect(fd, FD_SELECT_READ, read_packet, client);
+	if (DBufLength(&client->local->sendQ) > 0)
+		send_queued(client);
+
+	FreeUserEntry();
+	return 1;
+}
+#undef R_SAFE
+#undef FreeUserEntry
+
+#define FreeChannelEntry() \
+	do { \
+		safe_free(chname); safe_free(topic); safe_free(topic_nick); \
+		safe_free(modes1); safe_free(modes2); safe_free(mode_lock); safe_free(uid); safe_free(member_modes); \
+	} while(0)
+
+#define R_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL, \
+			           "[hot restart] Read error from state file: $system_error", \
+			           log_data_string("system_error", unrealdb_get_error_string())); \
+			FreeChannelEntry(); \
+			return 0; \
+		} \
+	} while(0)
+
+static int hot_restart_read_listmode(UnrealDB *db, Ban **lst)
+{
+	uint32_t cnt, i;
+	uint64_t when;
+	Ban *e, **tail;
+	char *banstr = NULL, *who = NULL;
+
+	/* Append, so the order stays the same */
+	for (tail = lst; tail && *tail; tail = &(*tail)->next)
+		;
+
+	if (!unrealdb_read_int32(db, &cnt))
+		return 0;
+	for (i = 0; i < cnt; i++)
+	{
+		if (!unrealdb_read_str(db, &banstr) || !unrealdb_read_str(db, &who) ||
+		    !unrealdb_read_int64(db, &when))
+		{
+			safe_free(banstr);
+			safe_free(who);
+			return 0;
+		}
+		if (!banstr || !tail)
+		{
+			safe_free(banstr);
+			safe_free(who);
+			continue;
+		}
+		e = make_ban();
+		e->banstr = banstr;
+		e->who = who;
+		e->when = when;
+		*tail = e;
+		tail = &e->next;
+		banstr = who = NULL;
+	}
+	return 1;
+}
+
+/** Read one channel and join the (already restored) users to it */
+static int hot_restart_read_channel(UnrealDB *db)
+{
+	char *chname = NULL, *topic = NULL, *topic_nick = NULL;
+	char *modes1 = NULL, *modes2 = NULL, *mode_lock = NULL;
+	char *uid = NULL, *member_modes = NULL;
+	uint64_t creationtime, topic_time;
+	uint32_t magic, cnt, i;
+	Channel *channel = NULL;
+	int existed;
+
+	R_SAFE(unrealdb_read_int32(db, &magic));
+	R_SAFE(magic == MAGIC_CHANNEL_START);
+	R_SAFE(unrealdb_read_str(db, &chname));
+	R_SAFE(unrealdb_read_int64(db, &creationtime));
+	R_SAFE(unrealdb_read_str(db, &topic));
+	R_SAFE(unrealdb_read_str(db, &topic_nick));
+	R_SAFE(unrealdb_read_int64(db, &topic_time));
+	R_SAFE(unrealdb_read_str(db, &modes1));
+	R_SAFE(unrealdb_read_str(db, &modes2));
+	R_SAFE(unrealdb_read_str(db, &mode_lock));
+	R_SAFE(chname);
+
+	/* A +P channel may already have been created by channeldb,
+	 * it has the same state since the old process just saved it.
+	 */
+	existed = find_channel(chname) ? 1 : 0;
+	channel = make_channel(chname);
+	if (!existed)
+	{
+		channel->creationtime = creationtime;
+		safe_strdup(channel->topic, topic);
+		safe_strdup(channel->topic_nick, topic_nick);
+		channel->topic_time = topic_time;
+		safe_strdup(channel->mode_lock, mode_lock);
+		/* The channel is still empty here, which is what we want since
+		 * nobody should see the MODE. Hold a reference though, otherwise
+		 * chanmodes/permanent would destroy the channel for being empty.
+		 */
+		channel->users++;
+		set_channel_mode(channel, modes1, modes2);
+		channel->users--;
+	}
+	R_SAFE(hot_restart_read_listmode(db, existed ? NULL : &channel->banlist));
+	R_SAFE(hot_restart_read_listmode(db, existed ? NULL : &channel->exlist));
+	R_SAFE(hot_restart_read_listmode(db, existed ? NULL : &channel->invexlist));
+	R_SAFE(hot_restart_read_moddata(db, MODDATATYPE_CHANNEL, existed ? NULL : channel->moddata));
+
+	R_SAFE(unrealdb_read_int32(db, &cnt));
+	for (i = 0; i < cnt; i++)
+	{
+		Client *client;
+		Member *m = NULL;
+		Membership *mb = NULL;
+
+		R_SAFE(unrealdb_read_str(db, &uid));
+		R_SAFE(unrealdb_read_str(db, &member_modes));
+		client = uid ? hash_find_id(uid, NULL) : NULL;
+		if (client && MyUser(client) && !find_membership(client, channel))
+		{
+			add_user_to_channel(channel, client, member_modes ? member_modes : "");
+			m = find_member(channel, client);
+			mb = find_membership(client, channel);
+		}
+		R_SAFE(hot_restart_read_moddata(db, MODDATATYPE_MEMBER, m ? m->moddata : NULL));
+		R_SAFE(hot_restart_read_moddata(db, MODDATATYPE_MEMBERSHIP, mb ? mb->moddata : NULL));
+		safe_free(uid);
+		safe_free(member_modes);
+	}
+
+	R_SAFE(unrealdb_read_int32(db, &magic));
+	R_SAFE(magic == MAGIC_CHANNEL_END);
+
+	FreeChannelEntry();
+
+	/* If none of the users made it, then get rid of the channel again */
+	if (channel->users == 0)
+		sub1_from_channel(channel);
+	return 1;
+}
+#undef R_SAFE
+#undef FreeChannelEntry
+
+/** Recreate the users and channels of the old process.
+ * This is called after all modules are loaded.
+ */
+void hot_restart_restore(void)
+{
+	const char *fname = hot_restart_db_file();
+	uint64_t users = 0, channels_cnt = 0, i = 0;
+	int restored = 0;
+	UnrealDB *db;
+
+	if (hot_restart_db_offset > 0)
+	{
+		db = unrealdb_open(fname, UNREALDB_MODE_READ, NULL);
+		unlink(fname);
+		if (!db || (fseek(db->fd, hot_restart_db_offset, SEEK_SET) != 0))
+		{
+			unreal_log(ULOG_ERROR, "main", "HOT_RESTART_READ_ERROR", NULL,
+			           "[hot restart] Unable to open state file $filename: $system_error",
+			           log_data_string("filename", fname),
+			           log_data_string("system_error", db ? strerror(errno) : unrealdb_get_error_string()));
+		} else {
+			if (unrealdb_read_int64(db, &users))
+				for (i = 0; i < users; i++)
+					if (!hot_restart_read_user(db))
+						break;
+
+			if ((i == users) && unrealdb_read_int64(db, &channels_cnt))
+				for (i = 0; i < channels_cnt; i++)
+					if (!hot_restart_read_channel(db))
+						break;
+		}
+		if (db)
+			unrealdb_close(db);
+		hot_restart_db_offset = 0;
+		restored = irccounts.me_clients;
+	}
+
+	/* Any socket that we did not take over is closed */
+	for (i = 0; i < hot_restart_num_fds; i++)
+	{
+		if (hot_restart_fds[i] >= 0)
+		{
+			const char *msg = "ERROR :Closing Link: Server restarted, please reconnect\r\n";
+			if (send(hot_restart_fds[i], msg, strlen(msg), 0) < 0)
+				; /* ignore */
+			close(hot_restart_fds[i]);
+		}
+	}
+	safe_free(hot_restart_fds);
+	hot_restart_num_fds = hot_restart_max_fds = 0;
+
+	unreal_log(ULOG_INFO, "main", "HOT_RESTART_COMPLETE", NULL,
+	           "Hot restart complete: took over $num_users users in $num_channels channels",
+	           log_data_integer("num_users", restored),
+	           log_data_integer("num_channels", irccounts.channels));
+}
+
+#else
+
+void hot_restart_request(Client *requester)
+{
+	sendto_one(requester, NULL, "REPLY ERROR: Hot restart is not supported on Windows");
+	sendto_one(requester, NULL, "END 1");
+}
+
+void hot_restart_receive(void)
+{
+	config_error("Hot restart is not supported on Windows");
+	exit(-1);
+}
+
+int hot_restart_take_listener(ConfigItem_listen *listener, int index)
+{
+	return -1;
+}
+
+void hot_restart_close_listeners(void)
+{
+}
+
+void hot_restart_restore(void)
+{
+}
+
+#endif
@@ -198,6 +198,9 @@ EVENT(check_pings)
 {
 	Client *client, *next;
 
+	/* Apply new server bans, only to the clients they can match */
+	tkl_check_pending_bans();
+
 	list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
 	{
 		/* Check TKLs for this user */
@@ -467,6 +470,7 @@ int InitUnrealIRCd(int argc, char *argv[])
 	safe_strdup(configfile, CONFIGFILE);
 
 	init_random(); /* needs to be done very early!! */
+	profiler_init();
 	if (sodium_init() < 0)
 	{
 		fprintf(stderr, "Failed to initialize sodium library -- error accessing random device?\n");
@@ -527,6 +531,7 @@ int InitUnrealIRCd(int argc, char *argv[])
 	memset(&irccounts, '\0', sizeof(irccounts));
 	irccounts.servers = 1;
 
+	text_kernels_init();
 	mp_pool_init();
 	dbuf_init();
 	initlists();
@@ -645,9 +650,15 @@ int InitUnrealIRCd(int argc, char *argv[])
 		  case '8':
 		      utf8_test();
 		      exit(0);
+		  case 'B':
+		      text_kernels_test();
+		      exit(0);
 		  case 'L':
 		      loop.boot_function = link_generator;
 		      break;
+		  case 'H':
+		      loop.hot_restart = 1;
+		      break;
 		  default:
 #ifndef _WIN32
 			  return bad_command(myargv[0]);
@@ -859,6 +870,11 @@ int InitUnrealIRCd(int argc, char *argv[])
 	PS_STRINGS->ps_argvstr = me.name;
 #endif
 	module_loadall();
+	if (loop.hot_restart)
+	{
+		hot_restart_restore();
+		loop.hot_restart = 0; /* done, a REHASH must not do this again */
+	}
 	loop.config_status = CONFIG_STATUS_COMPLETE;
 
 #ifndef _WIN32
@@ -867,6 +883,29 @@ int InitUnrealIRCd(int argc, char *argv[])
 	return 1;
 }
 
+/** Account the time spent in one iteration of the main loop.
+ * The time spent waiting for I/O in fd_select() is not counted,
+ * so this reflects how busy the server is and reveals any stalls.
+ * @param start		Timestamp of the start of the iteration (monotonic_nsec)
+ * @param waited_before	Value of metrics.fd_select_wait_nsec at the start of the iteration
+ */
+static void update_loop_metrics(uint64_t start, uint64_t waited_before)
+{
+	uint64_t busy;
+	uint64_t usec;
+	int i;
+
+	busy = monotonic_nsec() - start - (metrics.fd_select_wait_nsec - waited_before);
+	usec = busy / 1000;
+
+	metrics.loop_iterations++;
+	metrics.loop_busy_nsec += busy;
+	for (i = 0; i < METRICS_LOOP_BUCKETS-1; i++)
+		if (usec <= metrics_loop_bucket_usec[i])
+			break;
+	metrics.loop_busy_bucket[i]++;
+}
+
 /** The main loop that the server will run all the time.
  * On Windows this is a thread, on *NIX we simply jump here from main()
  * when the server is ready.
@@ -874,12 +913,16 @@ int InitUnrealIRCd(int argc, char *argv[])
 void SocketLoop(void *dummy)
 {
 	struct timeval doevents_tv, process_clients_tv;
+	uint64_t loop_start, waited_before;
 
 	memset(&doevents_tv, 0, sizeof(doevents_tv));
 	memset(&process_clients_tv, 0, sizeof(process_clients_tv));
 
 	while (1)
 	{
+		loop_start = monotonic_nsec();
+		waited_before = metrics.fd_select_wait_nsec;
+
 		gettimeofday(&timeofday_tv, NULL);
 		timeofday = timeofday_tv.tv_sec;
 
@@ -923,6 +966,13 @@ void SocketLoop(void *dummy)
 		/* If rehashing, check if we are done. */
 		if (loop.rehashing && is_config_read_finished())
 			rehash_internal(loop.rehash_save_client);
+
+		RunHook(HOOKTYPE_LOOP_END);
+
+		/* Nothing in scratch memory survives a loop iteration */
+		scratch_reset();
+
+		update_loop_metrics(loop_start, waited_before);
 	}
 }
 
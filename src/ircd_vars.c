@@ -14,6 +14,11 @@ time_t timeofday = 0;
 struct timeval timeofday_tv;
 int tainted = 0;
 LoopStruct loop;
+MODVAR ServerMetrics metrics;
+/** Upper bounds of the event loop histogram buckets (in microseconds), the last bucket is +Inf */
+MODVAR const unsigned int metrics_loop_bucket_usec[METRICS_LOOP_BUCKETS-1] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
 MODVAR IRCCounts irccounts;
 MODVAR Client me;			/* That's me */
 MODVAR char *me_hash;
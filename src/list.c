@@ -37,8 +37,6 @@ static struct liststats {
 MODVAR int  flinks = 0;
 MODVAR int  freelinks = 0;
 MODVAR Link *freelink = NULL;
-MODVAR Member *freemember = NULL;
-MODVAR Membership *freemembership = NULL;
 MODVAR int  numclients = 0;
 
 // TODO: Document whether servers are included or excluded in these lists...
@@ -56,6 +54,7 @@ static mp_pool_t *client_pool = NULL;
 static mp_pool_t *local_client_pool = NULL;
 static mp_pool_t *user_pool = NULL;
 static mp_pool_t *link_pool = NULL;
+static mp_pool_t *ban_pool = NULL;
 
 void initlists(void)
 {
@@ -76,10 +75,11 @@ void initlists(void)
 	INIT_LIST_HEAD(&global_server_list);
 	INIT_LIST_HEAD(&dead_list);
 
-	client_pool = mp_pool_new(sizeof(Client), 512 * 1024);
-	local_client_pool = mp_pool_new(sizeof(LocalClient), 512 * 1024);
-	user_pool = mp_pool_new(sizeof(User), 512 * 1024);
-	link_pool = mp_pool_new(sizeof(Link), 512 * 1024);
+	client_pool = mp_pool_new_ex("client", sizeof(Client), 512 * 1024, MP_POOL_CACHE_ALIGN);
+	local_client_pool = mp_pool_new_ex("local_client", sizeof(LocalClient), 512 * 1024, MP_POOL_CACHE_ALIGN);
+	user_pool = mp_pool_new_ex("user", sizeof(User), 512 * 1024, 0);
+	link_pool = mp_pool_new_ex("link", sizeof(Link), 512 * 1024, 0);
+	ban_pool = mp_pool_new_ex("ban", sizeof(Ban), 256 * 1024, 0);
 }
 
 /*
@@ -321,10 +321,7 @@ void remove_client_from_list(Client *client)
 		irccounts.unknown--;
 
 	if (IsUser(client))	/* Only persons can have been added before */
-	{
 		add_history(client, 0);
-		off_history(client);	/* Remove all pointers to client */
-	}
 	
 	if (client->user)
 		free_user(client);
@@ -408,20 +405,29 @@ int link_list_length(Link *lp)
 	return count;
 }
 
+/** Allocate a new (zeroed) Ban entry.
+ * Bans come from a memory pool, so always free them with free_ban().
+ */
 Ban *make_ban(void)
 {
 	Ban *lp;
 
-	lp = safe_alloc(sizeof(Ban));
+	lp = mp_pool_get(ban_pool);
+	memset(lp, 0, sizeof(Ban));
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
 	return lp;
 }
 
+/** Free a Ban entry that was allocated via make_ban().
+ * Note that this does not free the banstr and who fields.
+ */
 void free_ban(Ban *lp)
 {
-	safe_free(lp);
+	if (!lp)
+		return;
+	mp_pool_release(lp);
 #ifdef	DEBUGMODE
 	links.inuse--;
 #endif
@@ -616,6 +616,9 @@ int fast_badword_replace(ConfigItem_badword *badword, const char *line, char *bu
  * Returns a string, which has been filtered by the words loaded via
  * the loadbadwords() function.  It's primary use is to filter swearing
  * in both private and public messages
+ * NOTE: this checks the badwords one by one, for anything that is
+ *       called often use badword_matcher_compile() and
+ *       badword_matcher_strip() instead.
  */
 const char *stripbadwords(const char *str, ConfigItem_badword *start_bw, int *blocked)
 {
@@ -866,3 +869,504 @@ void badword_config_free(ConfigItem_badword *e)
 		pcre2_code_free(e->pcre2_expr);
 	safe_free(e);
 }
+
+/* The BadwordMatcher is a compiled form of a badword list, built
+ * once after the configuration has been read. Checking a message
+ * against the list costs a single pass over the message for all
+ * the fast badwords (an Aho-Corasick automaton) and one regex run
+ * for all regex badwords combined, instead of one strcasestr()
+ * or regex run per badword.
+ */
+
+/** Node in the Aho-Corasick automaton */
+typedef struct BadwordNode {
+	int fail;		/**< Failure link: longest proper suffix that is also in the trie */
+	int output;		/**< Nearest node (ourselves or via fail links) where a word ends, or -1 */
+	int word;		/**< First badword ending at this node, or -1 (more in word_next[]) */
+	int edges;		/**< Index of our first outgoing edge in edge_char/edge_node */
+	int nedges;		/**< Number of outgoing edges */
+} BadwordNode;
+
+/** A piece of the message that is to be replaced */
+typedef struct BadwordSpan {
+	int start;
+	int end;
+	int word;
+} BadwordSpan;
+
+struct BadwordMatcher {
+	ConfigItem_badword **words;	/**< All badwords, indexed by word number */
+	int nwords;
+	int *word_len;			/**< Length of fast badwords */
+	int *word_next;			/**< Next badword ending at the same node, or -1 */
+	BadwordNode *nodes;		/**< Automaton, node 0 is the root */
+	int nnodes;
+	int root_next[256];		/**< Transitions of the root node, by character */
+	unsigned char *edge_char;
+	int *edge_node;
+	pcre2_code *block_regex;	/**< All regex badwords with action block, combined */
+	pcre2_code *replace_regex;	/**< All regex badwords with action replace, combined */
+	int *separate;			/**< Regex badwords that could not be combined (backreferences) */
+	int nseparate;
+	pcre2_match_data *md;		/**< Match data, re-used for every match */
+	BadwordSpan *spans;		/**< Replacements found in the current message */
+	int nspans;
+	int spans_size;
+};
+
+static int badword_trie_child(unsigned char *node_char, int *first_child, int *next_sibling, int node, unsigned char c)
+{
+	int n;
+
+	for (n = first_child[node]; n != -1; n = next_sibling[n])
+		if (node_char[n] == c)
+			return n;
+	return -1;
+}
+
+/** Build the Aho-Corasick automaton from the fast badwords */
+static void badword_matcher_build_automaton(BadwordMatcher *m)
+{
+	int *first_child, *next_sibling, *queue;
+	unsigned char *node_char;
+	int maxnodes = 1, i, j, n, e, qhead, qtail;
+
+	for (i = 0; i < m->nwords; i++)
+		if (m->words[i]->type & BADW_TYPE_FAST)
+			maxnodes += m->word_len[i];
+
+	m->nodes = safe_alloc(sizeof(BadwordNode) * maxnodes);
+	first_child = safe_alloc(sizeof(int) * maxnodes);
+	next_sibling = safe_alloc(sizeof(int) * maxnodes);
+	node_char = safe_alloc(maxnodes);
+	queue = safe_alloc(sizeof(int) * maxnodes);
+
+	m->nnodes = 1;
+	first_child[0] = next_sibling[0] = -1;
+	m->nodes[0].word = m->nodes[0].output = -1;
+
+	/* Insert all the words in the trie */
+	for (i = m->nwords - 1; i >= 0; i--)
+	{
+		const char *p;
+
+		if (!(m->words[i]->type & BADW_TYPE_FAST) || !m->word_len[i])
+			continue;
+		n = 0;
+		for (p = m->words[i]->word; *p; p++)
+		{
+			unsigned char c = tolower(*p);
+			int child = badword_trie_child(node_char, first_child, next_sibling, n, c);
+			if (child == -1)
+			{
+				child = m->nnodes++;
+				node_char[child] = c;
+				first_child[child] = -1;
+				m->nodes[child].word = m->nodes[child].output = -1;
+				next_sibling[child] = first_child[n];
+				first_child[n] = child;
+			}
+			n = child;
+		}
+		/* Inserted in reverse, so the list at each node is in word order */
+		m->word_next[i] = m->nodes[n].word;
+		m->nodes[n].word = i;
+	}
+
+	/* Breadth-first walk to set the failure and output links */
+	qhead = qtail = 0;
+	for (n = first_child[0]; n != -1; n = next_sibling[n])
+	{
+		m->nodes[n].fail = 0;
+		queue[qtail++] = n;
+	}
+	while (qhead < qtail)
+	{
+		int u = queue[qhead++];
+		BadwordNode *node = &m->nodes[u];
+
+		node->output = (node->word != -1) ? u : m->nodes[node->fail].output;
+		for (n = first_child[u]; n != -1; n = next_sibling[n])
+		{
+			int f = node->fail, target;
+			while (((target = badword_trie_child(node_char, first_child, next_sibling, f, node_char[n])) == -1) && f)
+				f = m->nodes[f].fail;
+			m->nodes[n].fail = ((target != -1) && (target != n)) ? target : 0;
+			queue[qtail++] = n;
+		}
+	}
+
+	/* Flatten the edges into two arrays, edges of a node are consecutive */
+	m->edge_char = safe_alloc(m->nnodes);
+	m->edge_node = safe_alloc(sizeof(int) * m->nnodes);
+	e = 0;
+	for (i = 0; i < m->nnodes; i++)
+	{
+		m->nodes[i].edges = e;
+		for (j = first_child[i]; j != -1; j = next_sibling[j])
+		{
+			m->edge_char[e] = node_char[j];
+			m->edge_node[e] = j;
+			e++;
+		}
+		m->nodes[i].nedges = e - m->nodes[i].edges;
+	}
+	for (j = first_child[0]; j != -1; j = next_sibling[j])
+		m->root_next[node_char[j]] = j;
+
+	safe_free(first_child);
+	safe_free(next_sibling);
+	safe_free(node_char);
+	safe_free(queue);
+}
+
+/** Combine all regex badwords with action 'action' into one regex.
+ * Each alternative is tagged with (*MARK:n) so we know which badword matched.
+ * Badwords using backreferences can't be combined, since the numbering
+ * of capture groups changes, these are added to m->separate.
+ */
+static pcre2_code *badword_matcher_combine_regex(BadwordMatcher *m, int action)
+{
+	char *pattern;
+	size_t len = 1, n;
+	int i, cnt = 0;
+	uint32_t backrefmax;
+	int errorcode = 0;
+	PCRE2_SIZE erroroffset = 0;
+	pcre2_code *expr;
+
+	for (i = 0; i < m->nwords; i++)
+		if ((m->words[i]->type & BADW_TYPE_REGEX) && (m->words[i]->action == action))
+			len += strlen(m->words[i]->word) + 32;
+
+	pattern = safe_alloc(len);
+	for (i = 0; i < m->nwords; i++)
+	{
+		ConfigItem_badword *bw = m->words[i];
+
+		if (!(bw->type & BADW_TYPE_REGEX) || (bw->action != action))
+			continue;
+		backrefmax = 0;
+		pcre2_pattern_info(bw->pcre2_expr, PCRE2_INFO_BACKREFMAX, &backrefmax);
+		if (backrefmax)
+		{
+			m->separate[m->nseparate++] = i;
+			continue;
+		}
+		n = strlen(pattern);
+		snprintf(pattern + n, len - n, "%s(?:%s)(*MARK:%d)", cnt ? "|" : "", bw->word, i);
+		cnt++;
+	}
+
+	if (!cnt)
+	{
+		safe_free(pattern);
+		return NULL;
+	}
+
+	expr = pcre2_compile(pattern, PCRE2_ZERO_TERMINATED, PCRE2_CASELESS|PCRE2_NEVER_UTF|PCRE2_NEVER_UCP,
+	                     &errorcode, &erroroffset, NULL);
+	safe_free(pattern);
+	if (!expr)
+	{
+		/* Some construct that does not survive being combined,
+		 * fall back to running these regexes one by one.
+		 */
+		for (i = 0; i < m->nwords; i++)
+		{
+			ConfigItem_badword *bw = m->words[i];
+			backrefmax = 0;
+			if ((bw->type & BADW_TYPE_REGEX) && (bw->action == action))
+			{
+				pcre2_pattern_info(bw->pcre2_expr, PCRE2_INFO_BACKREFMAX, &backrefmax);
+				if (!backrefmax)
+					m->separate[m->nseparate++] = i;
+			}
+		}
+		return NULL;
+	}
+	pcre2_jit_compile(expr, PCRE2_JIT_COMPLETE);
+	return expr;
+}
+
+/** Compile a badword list into a BadwordMatcher.
+ * This should be called after the list is (re)built, eg from MOD_LOAD.
+ * The matcher refers to the badwords in the list, so free the matcher
+ * through badword_matcher_free() before freeing the list.
+ * @param list		The list of badwords
+ * @returns The matcher, or NULL if the list is empty.
+ */
+BadwordMatcher *badword_matcher_compile(ConfigItem_badword *list)
+{
+	BadwordMatcher *m;
+	ConfigItem_badword *bw;
+	int i;
+
+	if (!list)
+		return NULL;
+
+	m = safe_alloc(sizeof(BadwordMatcher));
+	for (bw = list; bw; bw = bw->next)
+		m->nwords++;
+	m->words = safe_alloc(sizeof(ConfigItem_badword *) * m->nwords);
+	m->word_len = safe_alloc(sizeof(int) * m->nwords);
+	m->word_next = safe_alloc(sizeof(int) * m->nwords);
+	m->separate = safe_alloc(sizeof(int) * m->nwords);
+
+	/* The list is built with AddListItem() so it is in reverse config order */
+	i = m->nwords;
+	for (bw = list; bw; bw = bw->next)
+	{
+		i--;
+		m->words[i] = bw;
+		m->word_next[i] = -1;
+		if (bw->type & BADW_TYPE_FAST)
+			m->word_len[i] = strlen(bw->word);
+	}
+
+	badword_matcher_build_automaton(m);
+	m->block_regex = badword_matcher_combine_regex(m, BADWORD_BLOCK);
+	m->replace_regex = badword_matcher_combine_regex(m, BADWORD_REPLACE);
+	m->md = pcre2_match_data_create(9, NULL);
+
+	return m;
+}
+
+/** Free a BadwordMatcher created by badword_matcher_compile() */
+void badword_matcher_free(BadwordMatcher *m)
+{
+	if (!m)
+		return;
+	safe_free(m->words);
+	safe_free(m->word_len);
+	safe_free(m->word_next);
+	safe_free(m->nodes);
+	safe_free(m->edge_char);
+	safe_free(m->edge_node);
+	safe_free(m->separate);
+	safe_free(m->spans);
+	if (m->block_regex)
+		pcre2_code_free(m->block_regex);
+	if (m->replace_regex)
+		pcre2_code_free(m->replace_regex);
+	if (m->md)
+		pcre2_match_data_free(m->md);
+	safe_free(m);
+}
+
+static void badword_matcher_add_span(BadwordMatcher *m, int start, int end, int word)
+{
+	if (m->nspans == m->spans_size)
+	{
+		m->spans_size = m->spans_size ? m->spans_size * 2 : 16;
+		m->spans = realloc(m->spans, sizeof(BadwordSpan) * m->spans_size);
+		if (!m->spans)
+			outofmemory(sizeof(BadwordSpan) * m->spans_size);
+	}
+	m->spans[m->nspans].start = start;
+	m->spans[m->nspans].end = end;
+	m->spans[m->nspans].word = word;
+	m->nspans++;
+}
+
+static int badword_span_compare(const void *a, const void *b)
+{
+	const BadwordSpan *x = a, *y = b;
+
+	if (x->start != y->start)
+		return x->start - y->start;
+	return x->word - y->word;
+}
+
+/** Run the automaton over 'str', which must be in lowercase.
+ * @returns 1 if a badword with action block matched, 0 otherwise.
+ */
+static int badword_matcher_scan_fast(BadwordMatcher *m, const char *str)
+{
+	int state = 0, i, o, w, j;
+
+	if (m->nnodes == 1)
+		return 0; /* no fast badwords */
+
+	for (i = 0; str[i]; i++)
+	{
+		unsigned char c = str[i]; /* already lowercased */
+
+		/* Follow the failure links until we can make a transition */
+		while (1)
+		{
+			int next = -1;
+
+			if (state == 0)
+			{
+				state = m->root_next[c];
+				break;
+			}
+			for (j = m->nodes[state].edges; j < m->nodes[state].edges + m->nodes[state].nedges; j++)
+			{
+				if (m->edge_char[j] == c)
+				{
+					next = m->edge_node[j];
+					break;
+				}
+			}
+			if (next != -1)
+			{
+				state = next;
+				break;
+			}
+			state = m->nodes[state].fail;
+		}
+
+		for (o = m->nodes[state].output; o != -1; o = m->nodes[m->nodes[o].fail].output)
+		{
+			for (w = m->nodes[o].word; w != -1; w = m->word_next[w])
+			{
+				ConfigItem_badword *bw = m->words[w];
+				int start = i + 1 - m->word_len[w];
+				int end = i + 1;
+				int wstart, wend;
+
+				/* Find the boundaries of the word the match is in */
+				for (wstart = start; (wstart > 0) && !iswseperator(str[wstart - 1]); wstart--);
+				for (wend = end; str[wend] && !iswseperator(str[wend]); wend++);
+
+				if (!(bw->type & BADW_TYPE_FAST_L) && (wstart != start))
+					continue; /* aaBLA but no *BLA */
+				if (!(bw->type & BADW_TYPE_FAST_R) && (wend != end))
+					continue; /* BLAaa but no BLA* */
+
+				if (bw->action == BADWORD_BLOCK)
+					return 1;
+				/* For fast badwords the whole word is replaced */
+				badword_matcher_add_span(m, wstart, wend, w);
+			}
+		}
+	}
+	return 0;
+}
+
+/** Run a regex over 'str', adding each match as a span.
+ * @param word	The badword number, or -1 for a combined regex (use the MARK).
+ * @returns 1 if a badword with action block matched, 0 otherwise.
+ */
+static int badword_matcher_scan_regex(BadwordMatcher *m, pcre2_code *expr, int word, const char *str, int len)
+{
+	PCRE2_SIZE *ov;
+	PCRE2_SPTR mark;
+	int offset = 0, w;
+
+	while (offset <= len)
+	{
+		if (pcre2_match(expr, (PCRE2_SPTR)str, len, offset, 0, m->md, NULL) <= 0)
+			break;
+		ov = pcre2_get_ovector_pointer(m->md);
+		if ((ov[0] > len) || (ov[1] > len) || (ov[1] < ov[0]))
+		{
+			unreal_log(ULOG_FATAL, "main", "BUG_STRIPBADWORDS_PCRE2_MATCH_OOB", NULL,
+			           "[BUG] pcre2_match() returned an ovector with OOB start/end: $start/$end, len $length: '$buf'",
+			           log_data_integer("start", ov[0]),
+			           log_data_integer("end", ov[1]),
+			           log_data_integer("length", len),
+			           log_data_string("buf", str));
+			abort();
+		}
+		w = word;
+		if ((w == -1) && (mark = pcre2_get_mark(m->md)))
+			w = atoi((const char *)mark);
+		if ((w < 0) || (w >= m->nwords))
+			break; /* cannot happen */
+		if (m->words[w]->action == BADWORD_BLOCK)
+			return 1;
+		if (ov[1] == ov[0])
+			break; /* anti-loop */
+		badword_matcher_add_span(m, ov[0], ov[1], w);
+		offset = ov[1];
+	}
+	return 0;
+}
+
+/** Check and censor a message using a compiled badword list.
+ * This does the same as stripbadwords() but all badwords are checked
+ * in one go, see badword_matcher_compile().
+ * @param str		The message
+ * @param m		The badword matcher (may be NULL)
+ * @param blocked	Set to 1 if the message is to be blocked, 0 otherwise
+ * @returns The original message if nothing matched, the censored message
+ *          otherwise, or NULL if blocked.
+ */
+const char *badword_matcher_strip(const char *str, BadwordMatcher *m, int *blocked)
+{
+	static char cleanstr[4096];
+	char text[4096], folded[4096];
+	const char *replace;
+	int i, len, pos, end;
+	char *o;
+
+	*blocked = 0;
+
+	if (!m)
+		return str;
+
+	len = strlcpy(text, StripControlCodes(str), sizeof(text));
+	if (len >= sizeof(text))
+		len = sizeof(text) - 1;
+	m->nspans = 0;
+
+	/* The automaton works on lowercase, the regexes are caseless */
+	text_kernels.tolower_ascii(folded, text, len + 1);
+
+	if (badword_matcher_scan_fast(m, folded) ||
+	    (m->block_regex && badword_matcher_scan_regex(m, m->block_regex, -1, text, len)) ||
+	    (m->replace_regex && badword_matcher_scan_regex(m, m->replace_regex, -1, text, len)))
+	{
+		*blocked = 1;
+		return NULL;
+	}
+	for (i = 0; i < m->nseparate; i++)
+	{
+		int w = m->separate[i];
+		if (badword_matcher_scan_regex(m, m->words[w]->pcre2_expr, w, text, len))
+		{
+			*blocked = 1;
+			return NULL;
+		}
+	}
+
+	if (m->nspans == 0)
+		return str;
+
+	/* Build the result in a single left-to-right pass.
+	 * Where replacements overlap the leftmost one wins.
+	 */
+	if (m->nspans > 1)
+		qsort(m->spans, m->nspans, sizeof(BadwordSpan), badword_span_compare);
+	o = cleanstr;
+	end = 511; /* cutoff, same as stripbadwords() */
+	pos = 0;
+	for (i = 0; (i < m->nspans) && (o - cleanstr < end); i++)
+	{
+		BadwordSpan *s = &m->spans[i];
+		int n;
+
+		if (s->start < pos)
+			continue; /* overlaps with previous replacement */
+		n = MIN(s->start - pos, end - (o - cleanstr));
+		memcpy(o, text + pos, n);
+		o += n;
+		replace = m->words[s->word]->replace ? m->words[s->word]->replace : REPLACEWORD;
+		n = MIN(strlen(replace), end - (o - cleanstr));
+		memcpy(o, replace, n);
+		o += n;
+		pos = s->end;
+	}
+	if (o - cleanstr < end)
+	{
+		int n = MIN(len - pos, end - (o - cleanstr));
+		memcpy(o, text + pos, n);
+		o += n;
+	}
+	*o = '\0';
+
+	return cleanstr;
+}
@@ -38,6 +38,9 @@
 
 #include "unrealircd.h"
 
+/** All pools, see mp_pool_list(). */
+static mp_pool_t *mp_allocated_pools = NULL;
+
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
 /* When running with AddressSanitizer, if using memory pools we will
  * likely NOT detect various kinds of misusage. (This is a known problem)
@@ -54,7 +57,7 @@ void mp_pool_init(void)
 {
 }
 
-mp_pool_t *mp_pool_new(size_t sz, size_t ignored)
+mp_pool_t *mp_pool_new_ex(const char *name, size_t sz, size_t ignored, int flags)
 {
     mp_pool_t *m = safe_alloc(sizeof(mp_pool_t));
     /* We (mis)use the item_alloc_size. It has a slightly different
@@ -62,6 +65,9 @@ mp_pool_t *mp_pool_new(size_t sz, size_t ignored)
      * That is something we don't want as it would hide small overflows.
      */
     m->item_alloc_size = sz;
+    m->name = name;
+    m->next = mp_allocated_pools;
+    mp_allocated_pools = m;
     return m;
 }
 
@@ -74,6 +80,12 @@ void mp_pool_release(void *item)
 {
     safe_free(item);
 }
+
+void mp_pool_stats(mp_pool_t *pool, unsigned long long *bytes_used, unsigned long long *bytes_allocated)
+{
+    /* Not tracked when memory pools are disabled */
+    *bytes_used = *bytes_allocated = 0;
+}
 #else
 
 /** Returns floor(log2(u64)).  If u64 is 0, (incorrectly) returns 0. */
@@ -243,11 +255,10 @@ struct mp_chunk_t {
   int capacity; /**< Number of items that can be fit into this chunk. */
   size_t mem_size; /**< Number of usable bytes in mem. */
   char *next_mem; /**< Pointer into part of <b>mem</b> not yet carved up. */
+  char *start; /**< Where the first item in <b>mem</b> starts (for alignment). */
   char mem[]; /**< Storage for this chunk. */
 };
 
-static mp_pool_t *mp_allocated_pools = NULL;
-
 /** Number of extra bytes needed beyond mem_size to allocate a chunk. */
 #define CHUNK_OVERHEAD offsetof(mp_chunk_t, mem[0])
 
@@ -270,7 +281,8 @@ static mp_chunk_t *
 mp_chunk_new(mp_pool_t *pool)
 {
   size_t sz = pool->new_chunk_capacity * pool->item_alloc_size;
-  mp_chunk_t *chunk = safe_alloc(CHUNK_OVERHEAD + sz);
+  size_t slack = (pool->flags & MP_POOL_CACHE_ALIGN) ? MP_CACHE_LINE_SIZE : 0;
+  mp_chunk_t *chunk = safe_alloc(CHUNK_OVERHEAD + sz + slack);
 
 #ifdef MEMPOOL_STATS
   ++pool->total_chunks_allocated;
@@ -278,7 +290,15 @@ mp_chunk_new(mp_pool_t *pool)
   chunk->magic = MP_CHUNK_MAGIC;
   chunk->capacity = pool->new_chunk_capacity;
   chunk->mem_size = sz;
-  chunk->next_mem = chunk->mem;
+  chunk->start = chunk->mem;
+  if (slack) {
+    /* Shift the start so that the memory of each item (which comes
+     * after the in_chunk pointer) begins on a cache line. */
+    uintptr_t p = (uintptr_t)chunk->mem + offsetof(mp_allocated_t, u.mem);
+    p = (p + MP_CACHE_LINE_SIZE - 1) & ~((uintptr_t)MP_CACHE_LINE_SIZE - 1);
+    chunk->start = (char *)(p - offsetof(mp_allocated_t, u.mem));
+  }
+  chunk->next_mem = chunk->start;
   chunk->pool = pool;
   return chunk;
 }
@@ -350,7 +370,7 @@ mp_pool_get(mp_pool_t *pool)
   } else {
     /* Otherwise, the chunk had better have some free space left on it. */
     assert(chunk->next_mem + pool->item_alloc_size <=
-           chunk->mem + chunk->mem_size);
+           chunk->start + chunk->mem_size);
 
     /* Good, it did.  Let's carve off a bit of that free space, and use
      * that. */
@@ -438,7 +458,7 @@ mp_pool_release(void *item)
     /* Reset the guts of this chunk to defragment it, in case it gets
      * used again. */
     chunk->first_free = NULL;
-    chunk->next_mem = chunk->mem;
+    chunk->next_mem = chunk->start;
 
     ++pool->n_empty_chunks;
   }
@@ -447,9 +467,12 @@ mp_pool_release(void *item)
 }
 
 /** Allocate a new memory pool to hold items of size <b>item_size</b>. We'll
- * try to fit about <b>chunk_capacity</b> bytes in each chunk. */
+ * try to fit about <b>chunk_capacity</b> bytes in each chunk.
+ * The <b>name</b> is shown in the statistics and <b>flags</b> can be
+ * MP_POOL_CACHE_ALIGN to start every item on a new cache line, which
+ * is only worth it for big structs that are accessed a lot. */
 mp_pool_t *
-mp_pool_new(size_t item_size, size_t chunk_capacity)
+mp_pool_new_ex(const char *name, size_t item_size, size_t chunk_capacity, int flags)
 {
   mp_pool_t *pool;
   size_t alloc_size, new_chunk_cap;
@@ -459,6 +482,8 @@ mp_pool_new(size_t item_size, size_t chunk_capacity)
   assert(SIZE_T_CEILING / item_size > chunk_capacity);
 */
   pool = safe_alloc(sizeof(mp_pool_t));
+  pool->name = name;
+  pool->flags = flags;
   /*
    * First, we figure out how much space to allow per item. We'll want to
    * use make sure we have enough for the overhead plus the item size.
@@ -479,6 +504,10 @@ mp_pool_new(size_t item_size, size_t chunk_capacity)
     alloc_size = ALIGNMENT;
   assert((alloc_size % ALIGNMENT) == 0);
 
+  /* For cache line alignment every item must be a multiple of it. */
+  if ((flags & MP_POOL_CACHE_ALIGN) && (alloc_size % MP_CACHE_LINE_SIZE))
+    alloc_size = alloc_size + MP_CACHE_LINE_SIZE - (alloc_size % MP_CACHE_LINE_SIZE);
+
   /*
    * Now we figure out how many items fit in each chunk. We need to fit at
    * least 2 items per chunk. No chunk can be more than MAX_CHUNK bytes long,
@@ -646,8 +675,8 @@ assert_chunks_ok(mp_pool_t *pool, mp_chunk_t *chunk, int empty, int full)
     assert(chunk->mem_size ==
            pool->new_chunk_capacity * pool->item_alloc_size);
 
-    assert(chunk->next_mem >= chunk->mem &&
-           chunk->next_mem <= chunk->mem + chunk->mem_size);
+    assert(chunk->next_mem >= chunk->start &&
+           chunk->next_mem <= chunk->start + chunk->mem_size);
 
     if (chunk->next)
       assert(chunk->next->prev == chunk);
@@ -715,4 +744,44 @@ mp_pool_log_status(mp_pool_t *pool)
   bytes_used += bu;
   bytes_allocated += ba;
 }
+
+/** Return the number of bytes in use by items in <b>pool</b> and
+ * the total number of bytes allocated for the chunks of <b>pool</b>. */
+void
+mp_pool_stats(mp_pool_t *pool, unsigned long long *bytes_used,
+              unsigned long long *bytes_allocated)
+{
+  mp_chunk_t *chunk;
+
+  assert(pool);
+
+  *bytes_used = *bytes_allocated = 0;
+
+  for (chunk = pool->empty_chunks; chunk; chunk = chunk->next)
+    *bytes_allocated += chunk->mem_size;
+
+  for (chunk = pool->used_chunks; chunk; chunk = chunk->next) {
+    *bytes_used += chunk->n_allocated * pool->item_alloc_size;
+    *bytes_allocated += chunk->mem_size;
+  }
+
+  for (chunk = pool->full_chunks; chunk; chunk = chunk->next) {
+    *bytes_used += chunk->n_allocated * pool->item_alloc_size;
+    *bytes_allocated += chunk->mem_size;
+  }
+}
 #endif
+
+/** Allocate a new, unnamed, memory pool. See mp_pool_new_ex(). */
+mp_pool_t *
+mp_pool_new(size_t item_size, size_t chunk_capacity)
+{
+  return mp_pool_new_ex(NULL, item_size, chunk_capacity, 0);
+}
+
+/** Return the list of all memory pools, linked through pool->next. */
+mp_pool_t *
+mp_pool_list(void)
+{
+  return mp_allocated_pools;
+}
@@ -1241,7 +1241,10 @@ MessageTag *find_mtag(MessageTag *mtags, const char *token)
 	return NULL;
 }
 
-/** Free all message tags in the list 'm' */
+/** Free all message tags in the list 'm'.
+ * Tags in scratch memory, such as those received by parse(), are
+ * skipped here since they are released together with the rest of it.
+ */
 void free_message_tags(MessageTag *m)
 {
 	MessageTag *m_next;
@@ -1249,6 +1252,8 @@ void free_message_tags(MessageTag *m)
 	for (; m; m = m_next)
 	{
 		m_next = m->next;
+		if (scratch_owns(m))
+			continue;
 		safe_free(m->name);
 		safe_free(m->value);
 		safe_free(m);
@@ -1424,6 +1429,15 @@ int websocket_create_packet_simple_default_handler(int opcode, const char **buf,
 	return -1;
 }
 
+int websocket_create_packet_ex_default_handler(Client *client, int opcode, char **buf, int *len)
+{
+	return -1;
+}
+
+void rpc_send_notification_default_handler(Client *client, const char *method, json_t *params)
+{
+}
+
 /** my_timegm: mktime()-like function which will use GMT/UTC.
  * Strangely enough there is no standard function for this.
  * On some *NIX OS's timegm() may be available, sometimes only
@@ -2437,7 +2451,7 @@ void server_reboot(const char *mesg)
 	(void)closelog();
 #endif
 #ifndef _WIN32
-	for (i = 3; i < MAXCONNECTIONS; i++)
+	for (i = 3; i < maxclients + CLIENTS_RESERVE; i++)
 		(void)close(i);
 	if (!(bootopt & (BOOT_TTY | BOOT_DEBUG)))
 		(void)close(2);
@@ -2503,6 +2517,30 @@ int minimum_msec_since_last_run(struct timeval *tv_old, long minimum)
 	return 0;
 }
 
+/** Get a timestamp from a monotonic clock, in nanoseconds.
+ * This is only useful for measuring durations, eg for statistics.
+ * Unlike timeofday_tv it is not affected by time shifts and
+ * it is not cached, so every call reads the clock.
+ */
+uint64_t monotonic_nsec(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return ((uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ULL) +
+	       ((uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+#endif
+}
+
 /** Strip color, bold, underline, and reverse codes from a string.
  * @param text			The input text
  * @param output		The buffer for the output text
@@ -2516,6 +2554,7 @@ const char *StripControlCodesEx(const char *text, char *output, size_t outputlen
 	char nc = 0, col = 0, rgb = 0;
 	char *o = output;
 	const char *save_text=NULL;
+	size_t n;
 
 	/* Handle special cases first.. */
 
@@ -2533,6 +2572,27 @@ const char *StripControlCodesEx(const char *text, char *output, size_t outputlen
 
 	while (len > 0) 
 	{
+		if (!col && !rgb)
+		{
+			/* Copy a run of plain text in one go */
+			n = text_kernels.control_span(text, len);
+			if (n > 0)
+			{
+				if (n > outputlen)
+					n = outputlen;
+				memcpy(o, text, n);
+				o += n;
+				outputlen -= n;
+				text += n;
+				len -= n;
+				if (outputlen == 0)
+				{
+					*o = '\0';
+					return output;
+				}
+				continue;
+			}
+		}
 		if ( col && ((isdigit(*text) && nc < 2) || (*text == ',' && nc < 3)))
 		{
 			nc++;
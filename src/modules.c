@@ -36,6 +36,7 @@
 #include "modversion.h"
 
 Hook	   	*Hooks[MAXHOOKTYPES];
+HookVector	HookVectors[MAXHOOKTYPES][3];
 Hooktype	Hooktypes[MAXCUSTOMHOOKS];
 Callback	*Callbacks[MAXCALLBACKS];	/* Callback objects for modules, used for rehashing etc (can be multiple) */
 Callback	*RCallbacks[MAXCALLBACKS];	/* 'Real' callback function, used for callback function calls */
@@ -982,6 +983,58 @@ void VersionflagDel(Versionflag *vflag, Module *module)
 	}
 }
 
+/** Rebuild the HookVectors[] of a hook type from Hooks[],
+ * needs to be called after every change to the hooks of that type.
+ */
+static void hook_vector_build(int hooktype)
+{
+	static int skip_scope[3] = { -1, HOOK_SCOPE_REMOTE, HOOK_SCOPE_LOCAL };
+	HookVector *v;
+	Hook *h;
+	int count = 0, i;
+
+	for (h = Hooks[hooktype]; h; h = h->next)
+		count++;
+
+	for (i = 0; i < 3; i++)
+	{
+		v = &HookVectors[hooktype][i];
+		v->count = 0;
+		v->generation++;
+		safe_free(v->func);
+		safe_free(v->hook);
+		if (count == 0)
+			continue;
+		v->func = safe_alloc(sizeof(v->func[0]) * count);
+		v->hook = safe_alloc(sizeof(Hook *) * count);
+		for (h = Hooks[hooktype]; h; h = h->next)
+		{
+			if (h->scope == skip_scope[i])
+				continue;
+			v->func[v->count] = h->func.intfunc;
+			v->hook[v->count] = h;
+			v->count++;
+		}
+	}
+}
+
+/** Hook types that are always run through RunHookClient() and friends.
+ * Only for these it is possible to use HookAddLocal() or HookAddRemote().
+ */
+static int hooktype_has_scope(int hooktype)
+{
+	switch (hooktype)
+	{
+		case HOOKTYPE_USERMSG:
+		case HOOKTYPE_CHANMSG:
+		case HOOKTYPE_ACCOUNT_LOGIN:
+		case HOOKTYPE_IS_INVITED:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
 Hook *HookAddMain(Module *module, int hooktype, int priority, int (*func)(), void (*vfunc)(), char *(*stringfunc)(), const char *(*conststringfunc)())
 {
 	Hook *p;
@@ -1008,13 +1061,43 @@ Hook *HookAddMain(Module *module, int hooktype, int priority, int (*func)(), voi
 	}
 	
 	AddListItemPrio(p, Hooks[hooktype], p->priority);
+	hook_vector_build(hooktype);
 
 	return p;
 }
 
+/** Make a hook only be called for local or remote clients.
+ * Normally used through HookAddLocal() or HookAddRemote().
+ * @param hook	The hook (may be NULL, eg if HookAdd() failed)
+ * @param scope	One of HOOK_SCOPE_*
+ * @returns The hook, or NULL if the hook type does not support this,
+ *          in which case the hook is deleted.
+ */
+Hook *HookSetScope(Hook *hook, int scope)
+{
+	if (!hook)
+		return NULL;
+	if ((scope != HOOK_SCOPE_ALL) && !hooktype_has_scope(hook->type))
+	{
+		config_error("HookAddLocal/HookAddRemote: hook type %d does not support this. "
+		             "Module %s will not work correctly.",
+		             hook->type,
+		             hook->owner ? hook->owner->header->name : "");
+		if (hook->owner)
+			hook->owner->errorcode = MODERR_INVALID;
+		HookDel(hook);
+		return NULL;
+	}
+	hook->scope = scope;
+	hook_vector_build(hook->type);
+	return hook;
+}
+
 Hook *HookDel(Hook *hook)
 {
 	Hook *p, *q;
+	int hooktype = hook->type;
+
 	for (p = Hooks[hook->type]; p; p = p->next) {
 		if (p == hook) {
 			q = p->next;
@@ -1029,7 +1112,9 @@ Hook *HookDel(Hook *hook)
 					}
 				}
 			}
+			safe_free(p->profile);
 			safe_free(p);
+			hook_vector_build(hooktype);
 			return q;
 		}
 	}
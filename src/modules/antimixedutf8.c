@@ -160,6 +160,11 @@ int lookalikespam_score(const char *text)
 	int points = 0;
 	int last_character_was_word_separator = 0;
 	int skip = 0;
+	size_t len = strlen(text);
+
+	/* Pure ASCII text is all latin (or undefined) so can never score */
+	if (text_kernels.ascii_span(text, len) == len)
+		return 0;
 
 	for (p = text; *p; p++)
 	{
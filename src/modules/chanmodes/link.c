@@ -344,7 +344,7 @@ int link_pre_localjoin_cb(Client *client, Channel *channel, const char *key)
 	char *error = NULL;
 
 	// User might already be on this channel, let's also exclude any possible services bots early
-	if (IsULine(client) || find_membership_link(client->user->channel, channel))
+	if (IsULine(client) || find_membership(client, channel))
 		return HOOK_CONTINUE;
 
 	// Extbans take precedence over +L #channel and other restrictions,
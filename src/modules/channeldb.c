@@ -375,7 +375,7 @@ int ban_exists(Ban *lst, Ban *e)
 			{ \
 				safe_free(e->banstr); \
 				safe_free(e->who); \
-				safe_free(e); \
+				free_ban(e); \
 			} \
 			return 0; \
 		} \
@@ -393,7 +393,7 @@ int read_listmode(UnrealDB *db, Ban **lst)
 	for (i = 0; i < total; i++)
 	{
 		const char *str;
-		e = safe_alloc(sizeof(Ban));
+		e = make_ban();
 		R_SAFE(unrealdb_read_str(db, &e->banstr));
 		R_SAFE(unrealdb_read_str(db, &e->who));
 		R_SAFE(unrealdb_read_int64(db, &when));
@@ -404,7 +404,7 @@ int read_listmode(UnrealDB *db, Ban **lst)
 			config_warn("[channeldb] listmode skipped (no longer valid?): %s", e->banstr);
 			safe_free(e->banstr);
 			safe_free(e->who);
-			safe_free(e);
+			free_ban(e);
 			continue;
 		}
 		safe_strdup(e->banstr, str);
@@ -414,7 +414,7 @@ int read_listmode(UnrealDB *db, Ban **lst)
 			/* Free again - duplicate item */
 			safe_free(e->banstr);
 			safe_free(e->who);
-			safe_free(e);
+			free_ban(e);
 		} else {
 			/* Add to list */
 			e->when = when;
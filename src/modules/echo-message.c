@@ -48,8 +48,8 @@ MOD_INIT()
 	cap.name = "echo-message";
 	ClientCapabilityAdd(modinfo->handle, &cap, &CAP_ECHO_MESSAGE);
 
-	HookAdd(modinfo->handle, HOOKTYPE_CHANMSG, 0, em_chanmsg);
-	HookAdd(modinfo->handle, HOOKTYPE_USERMSG, 0, em_usermsg);
+	HookAddLocal(modinfo->handle, HOOKTYPE_CHANMSG, 0, em_chanmsg);
+	HookAddLocal(modinfo->handle, HOOKTYPE_USERMSG, 0, em_usermsg);
 
 	return MOD_SUCCESS;
 }
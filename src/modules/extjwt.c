@@ -857,7 +857,7 @@ char *extjwt_make_payload(Client *client, Channel *channel, struct extjwt_config
 
 	if (channel)
 	{ /* fill in channel information and user flags */
-		lp = find_membership_link(client->user->channel, channel);
+		lp = find_membership(client, channel);
 		if (lp)
 		{
 			modestring = lp->member_modes;
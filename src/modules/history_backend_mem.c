@@ -85,6 +85,9 @@ HistoryLogObject **history_hash_table;
 static long already_loaded = 0;
 static char *hbm_prehash = NULL;
 static char *hbm_posthash = NULL;
+static long hbm_num_objects = 0;
+static long hbm_num_lines = 0;
+static long hbm_memory_used = 0;
 
 /* Forward declarations */
 int hbm_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
@@ -113,6 +116,7 @@ static void hbm_delete_db(HistoryLogObject *h);
 static void hbm_flush(void);
 void hbm_generic_free(ModData *m);
 void hbm_free_all_history(ModData *m);
+int hbm_metrics(MultiLine **out);
 
 MOD_TEST()
 {
@@ -137,6 +141,9 @@ MOD_INIT()
 	setcfg(&cfg);
 
 	LoadPersistentLong(modinfo, already_loaded);
+	LoadPersistentLong(modinfo, hbm_num_objects);
+	LoadPersistentLong(modinfo, hbm_num_lines);
+	LoadPersistentLong(modinfo, hbm_memory_used);
 	LoadPersistentPointer(modinfo, siphashkey_history_backend_mem, hbm_generic_free);
 	LoadPersistentPointer(modinfo, history_hash_table, hbm_free_all_history);
 	if (history_hash_table == NULL)
@@ -147,6 +154,7 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_MODECHAR_DEL, 0, hbm_modechar_del);
 	HookAdd(modinfo->handle, HOOKTYPE_REHASH, 0, hbm_rehash);
 	HookAdd(modinfo->handle, HOOKTYPE_REHASH_COMPLETE, 0, hbm_rehash_complete);
+	HookAdd(modinfo->handle, HOOKTYPE_METRICS, 0, hbm_metrics);
 
 	if (siphashkey_history_backend_mem == NULL)
 	{
@@ -209,6 +217,9 @@ MOD_UNLOAD()
 	SavePersistentPointer(modinfo, history_hash_table);
 	SavePersistentPointer(modinfo, siphashkey_history_backend_mem);
 	SavePersistentLong(modinfo, already_loaded);
+	SavePersistentLong(modinfo, hbm_num_objects);
+	SavePersistentLong(modinfo, hbm_num_lines);
+	SavePersistentLong(modinfo, hbm_memory_used);
 	return MOD_SUCCESS;
 }
 
@@ -459,6 +470,8 @@ HistoryLogObject *hbm_find_or_add_object(const char *object)
 	h = safe_alloc(sizeof(HistoryLogObject));
 	strlcpy(h->name, object, sizeof(h->name));
 	AddListItem(h, history_hash_table[hashv]);
+	hbm_num_objects++;
+	hbm_memory_used += sizeof(HistoryLogObject);
 	return h;
 }
 
@@ -472,6 +485,8 @@ void hbm_delete_object_hlo(HistoryLogObject *h)
 	hashv = hbm_hash(h->name);
 	DelListItem(h, history_hash_table[hashv]);
 	safe_free(h);
+	hbm_num_objects--;
+	hbm_memory_used -= sizeof(HistoryLogObject);
 }
 
 int hbm_modechar_del(Channel *channel, int modechar)
@@ -538,6 +553,21 @@ void hbm_duplicate_mtags(HistoryLogLine *l, MessageTag *m)
 	l->t = server_time_to_unix_time(n->value);
 }
 
+/** Calculate the (approximate) amount of memory used by a history line */
+static long hbm_line_memory(HistoryLogLine *l)
+{
+	MessageTag *m;
+	long ret = sizeof(HistoryLogLine) + strlen(l->line);
+
+	for (m = l->mtags; m; m = m->next)
+	{
+		ret += sizeof(MessageTag) + strlen(m->name) + 1;
+		if (m->value)
+			ret += strlen(m->value) + 1;
+	}
+	return ret;
+}
+
 /** Add a line to a history object */
 void hbm_history_add_line(HistoryLogObject *h, MessageTag *mtags, const char *line)
 {
@@ -556,6 +586,8 @@ void hbm_history_add_line(HistoryLogObject *h, MessageTag *mtags, const char *li
 	}
 	h->dirty = 1;
 	h->num_lines++;
+	hbm_num_lines++;
+	hbm_memory_used += hbm_line_memory(l);
 	if ((l->t < h->oldest_t) || (h->oldest_t == 0))
 		h->oldest_t = l->t;
 }
@@ -578,6 +610,8 @@ void hbm_history_del_line(HistoryLogObject *h, HistoryLogLine *l)
 		h->tail = l->prev; /* could be NULL now */
 	}
 
+	hbm_num_lines--;
+	hbm_memory_used -= hbm_line_memory(l);
 	free_message_tags(l->mtags);
 	safe_free(l);
 
@@ -1069,6 +1103,8 @@ int hbm_history_destroy(const char *object)
 		 * The only danger is that we may forget to free some
 		 * fields that are added later there but not here.
 		 */
+		hbm_num_lines--;
+		hbm_memory_used -= hbm_line_memory(l);
 		free_message_tags(l->mtags);
 		safe_free(l);
 	}
@@ -1456,6 +1492,26 @@ void hbm_free_all_history(ModData *m)
 	safe_free(m->ptr);
 }
 
+/** Expose memory usage of the history backend, see hooktype_metrics() */
+int hbm_metrics(MultiLine **out)
+{
+	char buf[256];
+
+	addmultiline(out, "# HELP unrealircd_history_objects Number of channels with history in memory");
+	addmultiline(out, "# TYPE unrealircd_history_objects gauge");
+	snprintf(buf, sizeof(buf), "unrealircd_history_objects %ld", hbm_num_objects);
+	addmultiline(out, buf);
+	addmultiline(out, "# HELP unrealircd_history_lines Number of history lines in memory");
+	addmultiline(out, "# TYPE unrealircd_history_lines gauge");
+	snprintf(buf, sizeof(buf), "unrealircd_history_lines %ld", hbm_num_lines);
+	addmultiline(out, buf);
+	addmultiline(out, "# HELP unrealircd_history_memory_bytes Approximate memory used by the history backend");
+	addmultiline(out, "# TYPE unrealircd_history_memory_bytes gauge");
+	snprintf(buf, sizeof(buf), "unrealircd_history_memory_bytes %ld", hbm_memory_used);
+	addmultiline(out, buf);
+	return 0;
+}
+
 /** Periodically clean the history.
  * Instead of doing all channels in 1 go, we do a limited number
  * of channels each call, hence the 'static int' and the do { } while
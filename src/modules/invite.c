@@ -105,7 +105,7 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_DESTROY, 1000000, invite_channel_destroy);
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_QUIT, 0, invite_user_quit);
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_JOIN, 0, invite_user_join);
-	HookAdd(modinfo->handle, HOOKTYPE_IS_INVITED, 0, invite_is_invited);
+	HookAddLocal(modinfo->handle, HOOKTYPE_IS_INVITED, 0, invite_is_invited);
 	
 	return MOD_SUCCESS;
 }
@@ -208,10 +208,8 @@ void send_invite_list(Client *client)
 int invite_is_invited(Client *client, Channel *channel, int *invited)
 {
 	Link *lp;
-	
-	if (!MyConnect(client))
-		return 0; // not handling invite lists for remote clients
 
+	/* Only called for local clients, we don't keep invite lists for remote clients */
 	for (lp = CLIENT_INVITES(client); lp; lp = lp->next)
 		if (lp->value.channel == channel)
 		{
@@ -514,7 +514,7 @@ void _do_join(Client *client, int parc, const char *parv[])
 		}
 
 		channel = make_channel(name);
-		if (channel && (lp = find_membership_link(client->user->channel, channel)))
+		if (channel && (lp = find_membership(client, channel)))
 			continue;
 
 		if (!channel)
@@ -36,11 +36,50 @@ ModuleHeader MOD_HEADER
 	"unrealircd-6",
     };
 
+/** A channel in the channel list snapshot */
+typedef struct ChannelListEntry ChannelListEntry;
+struct ChannelListEntry {
+	char *name;
+	char *topic;
+	char modes[64];		/**< Mode string as shown in /LIST, eg "[+nt]" (or empty) */
+	int users;
+	time_t creationtime;
+	time_t topic_time;
+};
+
+/** A snapshot of all channels, shared by all /LIST requests.
+ * A new snapshot is built when the current one is too old, the
+ * old one stays around until the last /LIST using it is done.
+ */
+typedef struct ChannelListSnapshot ChannelListSnapshot;
+struct ChannelListSnapshot {
+	int refcount;
+	time_t built;
+	int count;
+	ChannelListEntry *entries;	/**< Sorted by user count (high to low), then name */
+	int *by_name;			/**< Indexes in 'entries', sorted by name */
+	int *by_creationtime;		/**< Indexes in 'entries', sorted by creation time */
+	int *by_topic_time;		/**< Indexes in 'entries', sorted by topic time */
+	int has_zero_creationtime;	/**< Any channels with a creationtime of 0? */
+};
+
+/** Rebuild the snapshot at most this often (in seconds) */
+#define LIST_SNAPSHOT_MIN_AGE	1
+/** Rebuild the snapshot after this many seconds, even if no
+ * channels were created/destroyed or topics/modes changed.
+ * This is mainly to pick up changes in user counts.
+ */
+#define LIST_SNAPSHOT_MAX_AGE	15
+
 typedef struct ChannelListOptions ChannelListOptions;
 struct ChannelListOptions {
 	NameList *yeslist;
 	NameList *nolist;
-	unsigned int starthash;
+	ChannelListSnapshot *snapshot;
+	int *order;		/**< Which order we walk 'snapshot' in, NULL for 'entries' order */
+	int pos;		/**< Current position in 'order' */
+	int end;		/**< Position to stop at */
+	short int sent_offchans;
 	short int showall;
 	unsigned short usermin;
 	int  usermax;
@@ -55,6 +94,8 @@ struct ChannelListOptions {
 /* Global variables */
 ModDataInfo *list_md = NULL;
 char modebuf[BUFSIZE], parabuf[BUFSIZE];
+static ChannelListSnapshot *list_snapshot = NULL;
+static int list_snapshot_dirty = 0;
 
 /* Macros */
 #define CHANNELLISTOPTIONS(x)       ((ChannelListOptions *)moddata_local_client(x, list_md).ptr)
@@ -67,6 +108,11 @@ char modebuf[BUFSIZE], parabuf[BUFSIZE];
 /* Forward declarations */
 EVENT(send_queued_list_data);
 void list_md_free(ModData *md);
+static void list_snapshot_unref(ChannelListSnapshot *snap);
+int list_channel_create(Channel *channel);
+int list_channel_destroy(Channel *channel, int *should_destroy);
+int list_topic(Client *client, Channel *channel, MessageTag *mtags, const char *topic);
+int list_chanmode(Client *client, Channel *channel, MessageTag *mtags, const char *modebuf, const char *parabuf, time_t sendts, int samode, int *destroy_channel);
 
 MOD_TEST()
 {
@@ -93,6 +139,11 @@ MOD_INIT()
 
 	CommandAdd(modinfo->handle, MSG_LIST, cmd_list, MAXPARA, CMD_USER);
 	EventAdd(modinfo->handle, "send_queued_list_data", send_queued_list_data, NULL, 1500, 0);
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_CREATE, 0, list_channel_create);
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_DESTROY, 0, list_channel_destroy);
+	HookAdd(modinfo->handle, HOOKTYPE_TOPIC, 0, list_topic);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CHANMODE, 0, list_chanmode);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_CHANMODE, 0, list_chanmode);
 
 	return MOD_SUCCESS;
 }
@@ -104,9 +155,285 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	/* Any /LIST in progress still holds its own reference */
+	if (list_snapshot)
+	{
+		list_snapshot_unref(list_snapshot);
+		list_snapshot = NULL;
+	}
 	return MOD_SUCCESS;
 }
 
+/* Anything that changes the channel list in a way users would notice
+ * quickly (new channels, topics, modes) causes a new snapshot to be
+ * built on the next /LIST.
+ */
+int list_channel_create(Channel *channel)
+{
+	list_snapshot_dirty = 1;
+	return 0;
+}
+
+int list_channel_destroy(Channel *channel, int *should_destroy)
+{
+	list_snapshot_dirty = 1;
+	return 0;
+}
+
+int list_topic(Client *client, Channel *channel, MessageTag *mtags, const char *topic)
+{
+	list_snapshot_dirty = 1;
+	return 0;
+}
+
+int list_chanmode(Client *client, Channel *channel, MessageTag *mtags, const char *modebuf, const char *parabuf, time_t sendts, int samode, int *destroy_channel)
+{
+	list_snapshot_dirty = 1;
+	return 0;
+}
+
+/** Compare two channel names, case insensitive.
+ * This uses the same case mapping as match_simple(), so
+ * that a prefix of a mask can be looked up in 'by_name'.
+ */
+static int list_namecmp(const char *a, const char *b, size_t n)
+{
+	for (; n; a++, b++, n--)
+	{
+		int diff = (int)tolower(*a) - (int)tolower(*b);
+		if (diff || !*a)
+			return diff;
+	}
+	return 0;
+}
+
+/* qsort() has no context argument, so the sort functions for
+ * the indexes use this.
+ */
+static ChannelListEntry *list_sort_entries;
+
+static int list_cmp_users(const void *a, const void *b)
+{
+	const ChannelListEntry *x = a, *y = b;
+
+	if (x->users != y->users)
+		return (x->users > y->users) ? -1 : 1;
+	return list_namecmp(x->name, y->name, SIZE_MAX);
+}
+
+static int list_cmp_name(const void *a, const void *b)
+{
+	return list_namecmp(list_sort_entries[*(const int *)a].name, list_sort_entries[*(const int *)b].name, SIZE_MAX);
+}
+
+static int list_cmp_creationtime(const void *a, const void *b)
+{
+	time_t x = list_sort_entries[*(const int *)a].creationtime;
+	time_t y = list_sort_entries[*(const int *)b].creationtime;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static int list_cmp_topic_time(const void *a, const void *b)
+{
+	time_t x = list_sort_entries[*(const int *)a].topic_time;
+	time_t y = list_sort_entries[*(const int *)b].topic_time;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static int *list_snapshot_index(ChannelListSnapshot *snap, int (*cmp)(const void *, const void *))
+{
+	int *idx = safe_alloc(sizeof(int) * (snap->count + 1));
+	int i;
+
+	for (i = 0; i < snap->count; i++)
+		idx[i] = i;
+	list_sort_entries = snap->entries;
+	qsort(idx, snap->count, sizeof(int), cmp);
+	return idx;
+}
+
+/** Build a new snapshot of all channels */
+static ChannelListSnapshot *list_snapshot_build(void)
+{
+	ChannelListSnapshot *snap = safe_alloc(sizeof(ChannelListSnapshot));
+	ChannelListEntry *e;
+	Channel *channel;
+	int n = 0;
+
+	for (channel = channels; channel; channel = channel->nextch)
+		n++;
+
+	snap->refcount = 1;
+	snap->built = TStime();
+	snap->entries = safe_alloc(sizeof(ChannelListEntry) * (n + 1));
+
+	for (channel = channels; channel && (snap->count < n); channel = channel->nextch)
+	{
+		e = &snap->entries[snap->count++];
+		safe_strdup(e->name, channel->name);
+		safe_strdup(e->topic, channel->topic);
+		e->users = channel->users;
+		e->creationtime = channel->creationtime;
+		e->topic_time = channel->topic_time;
+		if (!e->creationtime)
+			snap->has_zero_creationtime = 1;
+
+		/* The mode letters are the same for everyone, only the
+		 * parameters (which we don't show) depend on the client.
+		 */
+		e->modes[0] = '[';
+		channel_modes(NULL, e->modes+1, parabuf, sizeof(e->modes)-1, sizeof(parabuf), channel, 0);
+		if (e->modes[2] == '\0')
+			e->modes[0] = '\0';
+		else
+			strlcat(e->modes, "]", sizeof(e->modes));
+	}
+
+	qsort(snap->entries, snap->count, sizeof(ChannelListEntry), list_cmp_users);
+	snap->by_name = list_snapshot_index(snap, list_cmp_name);
+	snap->by_creationtime = list_snapshot_index(snap, list_cmp_creationtime);
+	snap->by_topic_time = list_snapshot_index(snap, list_cmp_topic_time);
+
+	return snap;
+}
+
+static void list_snapshot_unref(ChannelListSnapshot *snap)
+{
+	int i;
+
+	if (--snap->refcount > 0)
+		return;
+
+	for (i = 0; i < snap->count; i++)
+	{
+		safe_free(snap->entries[i].name);
+		safe_free(snap->entries[i].topic);
+	}
+	safe_free(snap->entries);
+	safe_free(snap->by_name);
+	safe_free(snap->by_creationtime);
+	safe_free(snap->by_topic_time);
+	safe_free(snap);
+}
+
+/** Get a reference to the current snapshot, building a new one if needed */
+static ChannelListSnapshot *list_snapshot_get(void)
+{
+	time_t age = list_snapshot ? TStime() - list_snapshot->built : 0;
+
+	if (!list_snapshot ||
+	    (age >= LIST_SNAPSHOT_MAX_AGE) ||
+	    (list_snapshot_dirty && (age >= LIST_SNAPSHOT_MIN_AGE)))
+	{
+		/* Copy-on-write: a /LIST that is still using the old one keeps it alive */
+		if (list_snapshot)
+			list_snapshot_unref(list_snapshot);
+		list_snapshot = list_snapshot_build();
+		list_snapshot_dirty = 0;
+	}
+
+	list_snapshot->refcount++;
+	return list_snapshot;
+}
+
+/* Binary searches: first position in 'order' (or in 'entries' if NULL)
+ * for which 'before' returns false. 'before' must be true for a (possibly
+ * empty) range at the start and false for the rest.
+ */
+static int list_bsearch(ChannelListSnapshot *snap, int *order, int (*before)(ChannelListEntry *e, const void *arg), const void *arg)
+{
+	int lo = 0, hi = snap->count;
+
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (before(&snap->entries[order ? order[mid] : mid], arg))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int list_users_above(ChannelListEntry *e, const void *arg) { return e->users > *(const int *)arg; }
+static int list_users_atleast(ChannelListEntry *e, const void *arg) { return e->users >= *(const int *)arg; }
+static int list_ctime_below(ChannelListEntry *e, const void *arg) { return e->creationtime < *(const time_t *)arg; }
+static int list_ctime_atmost(ChannelListEntry *e, const void *arg) { return e->creationtime <= *(const time_t *)arg; }
+static int list_ttime_below(ChannelListEntry *e, const void *arg) { return e->topic_time < *(const time_t *)arg; }
+static int list_ttime_atmost(ChannelListEntry *e, const void *arg) { return e->topic_time <= *(const time_t *)arg; }
+static int list_name_below(ChannelListEntry *e, const void *arg) { return list_namecmp(e->name, arg, strlen(arg)) < 0; }
+static int list_name_atmost(ChannelListEntry *e, const void *arg) { return list_namecmp(e->name, arg, strlen(arg)) <= 0; }
+
+/** Use this range for the /LIST if it is smaller than the current one */
+static void list_use_range(ChannelListOptions *lopt, int *order, int start, int end)
+{
+	if (end - start < lopt->end - lopt->pos)
+	{
+		lopt->order = order;
+		lopt->pos = start;
+		lopt->end = end;
+	}
+}
+
+/** Start a /LIST: take a snapshot and pick the smallest range of it
+ * that contains all channels that can match the filters.
+ * The filters themselves are still checked for each channel in send_list().
+ */
+static void list_start(ChannelListOptions *lopt)
+{
+	ChannelListSnapshot *snap = list_snapshot_get();
+	char prefix[CHANNELLEN+1];
+	int usermin = lopt->usermin;
+
+	lopt->snapshot = snap;
+	lopt->order = NULL;
+	lopt->pos = 0;
+	lopt->end = snap->count;
+
+	if (lopt->showall)
+		return;
+
+	/* User count: 'entries' is sorted by user count, high to low */
+	list_use_range(lopt, NULL,
+	               (lopt->usermax >= 0) ? list_bsearch(snap, NULL, list_users_above, &lopt->usermax) : 0,
+	               list_bsearch(snap, NULL, list_users_atleast, &usermin));
+
+	/* Creation time. Channels without a creation time always pass
+	 * this filter, so we can't use the range if there are any.
+	 */
+	if (!snap->has_zero_creationtime)
+	{
+		list_use_range(lopt, snap->by_creationtime,
+		               list_bsearch(snap, snap->by_creationtime, list_ctime_below, &lopt->chantimemin),
+		               list_bsearch(snap, snap->by_creationtime, list_ctime_atmost, &lopt->chantimemax));
+	}
+
+	/* Topic time */
+	list_use_range(lopt, snap->by_topic_time,
+	               list_bsearch(snap, snap->by_topic_time, list_ttime_below, &lopt->topictimemin),
+	               list_bsearch(snap, snap->by_topic_time, list_ttime_atmost, &lopt->topictimemax));
+
+	/* A single channel mask, like "#unreal*": the part before the
+	 * first wildcard is a range in 'by_name'.
+	 */
+	if (lopt->yeslist && !lopt->yeslist->next)
+	{
+		strlcpy(prefix, lopt->yeslist->name, sizeof(prefix));
+		prefix[strcspn(prefix, "*?")] = '\0';
+		if (*prefix)
+		{
+			list_use_range(lopt, snap->by_name,
+			               list_bsearch(snap, snap->by_name, list_name_below, prefix),
+			               list_bsearch(snap, snap->by_name, list_name_atmost, prefix));
+		}
+	}
+
+	if (lopt->end < lopt->pos)
+		lopt->end = lopt->pos;
+}
+
 /* Originally from bahamut, modified a bit for Unreal by codemastr
  * also Opers can now see +s channels -- codemastr */
 
@@ -163,6 +490,7 @@ CMD_FUNC(cmd_list)
 		sendnumeric(client, RPL_LISTSTART);
 		ALLOCATE_CHANNELLISTOPTIONS(client);
 		CHANNELLISTOPTIONS(client)->showall = 1;
+		list_start(CHANNELLISTOPTIONS(client));
 
 		if (send_list(client))
 		{
@@ -299,6 +627,7 @@ CMD_FUNC(cmd_list)
 		CHANNELLISTOPTIONS(client)->chantimemin = chantimemin;
 		CHANNELLISTOPTIONS(client)->nolist = nolist;
 		CHANNELLISTOPTIONS(client)->yeslist = yeslist;
+		list_start(CHANNELLISTOPTIONS(client));
 
 		if (send_list(client))
 		{
@@ -313,7 +642,8 @@ CMD_FUNC(cmd_list)
 }
 /*
  * The function which sends the actual channel list back to the user.
- * Operates by stepping through the hashtable, sending the entries back if
+ * Operates by stepping through the range of the channel list snapshot
+ * that was picked by list_start(), sending the entries back if
  * they match the criteria.
  * client = Local client to send the output back to.
  * Taken from bahamut, modified for Unreal by codemastr.
@@ -322,20 +652,16 @@ int send_list(Client *client)
 {
 	Channel *channel;
 	ChannelListOptions *lopt = CHANNELLISTOPTIONS(client);
-	unsigned int  hashnum;
+	ChannelListEntry *e;
 	int numsend = (get_sendq(client) / 768) + 1; /* (was previously hard-coded) */
 	/* ^
 	 * numsend = Number (roughly) of lines to send back. Once this number has
-	 * been exceeded, send_list will finish with the current hash bucket,
-	 * and record that number as the number to start next time send_list
-	 * is called for this user. So, this function will almost always send
-	 * back more lines than specified by numsend (though not by much,
-	 * assuming the hashing algorithm works well). Be conservative in your
-	 * choice of numsend. -Rak
-	 */	
+	 * been exceeded, send_list will stop and remember where it was, so it
+	 * can continue from there the next time send_list is called for this user.
+	 */
 
 	/* Begin of /LIST? then send official channels first. */
-	if ((lopt->starthash == 0) && conf_offchans)
+	if (!lopt->sent_offchans && conf_offchans)
 	{
 		ConfigItem_offchans *x;
 		for (x = conf_offchans; x; x = x->next)
@@ -346,80 +672,79 @@ int send_list(Client *client)
 			            x->topic ? x->topic : "");
 		}
 	}
+	lopt->sent_offchans = 1;
 
-	for (hashnum = lopt->starthash; hashnum < CHAN_HASH_TABLE_SIZE; hashnum++)
+	for (; (lopt->pos < lopt->end) && (numsend > 0); lopt->pos++)
 	{
-		if (numsend > 0)
-			for (channel = hash_get_chan_bucket(hashnum); channel; channel = channel->hnextch)
-			{
-				if (SecretChannel(channel)
-				    && !IsMember(client, channel)
-				    && !ValidatePermissionsForPath("channel:see:list:secret",client,NULL,channel,NULL))
-					continue;
-
-				/* set::hide-list { deny-channel } */
-				if (!IsOper(client) && iConf.hide_list && find_channel_allowed(client, channel->name))
-					continue;
+		e = &lopt->snapshot->entries[lopt->order ? lopt->order[lopt->pos] : lopt->pos];
 
-				/* Similarly, hide unjoinable channels for non-ircops since it would be confusing */
-				if (!IsOper(client) && !valid_channelname(channel->name))
-					continue;
+		/* Much more readable like this -- codemastr */
+		if ((!lopt->showall))
+		{
+			/* User count must be in range */
+			if ((e->users < lopt->usermin) ||
+			    ((lopt->usermax >= 0) && (e->users > lopt->usermax)))
+				continue;
+
+			/* Creation time must be in range */
+			if ((e->creationtime && (e->creationtime < lopt->chantimemin)) ||
+			    (e->creationtime > lopt->chantimemax))
+				continue;
+
+			/* Topic time must be in range */
+			if ((e->topic_time < lopt->topictimemin) ||
+			    (e->topic_time > lopt->topictimemax))
+				continue;
+
+			/* Must not be on nolist (if it exists) */
+			if (lopt->nolist && find_name_list_match(lopt->nolist, e->name))
+				continue;
+
+			/* Must be on yeslist (if it exists) */
+			if (lopt->yeslist && !find_name_list_match(lopt->yeslist, e->name))
+				continue;
+		}
 
-				/* Much more readable like this -- codemastr */
-				if ((!lopt->showall))
-				{
-					/* User count must be in range */
-					if ((channel->users < lopt->usermin) ||
-					    ((lopt->usermax >= 0) && (channel->users > lopt->usermax)))
-						continue;
-
-					/* Creation time must be in range */
-					if ((channel->creationtime && (channel->creationtime < lopt->chantimemin)) ||
-					    (channel->creationtime > lopt->chantimemax))
-						continue;
-
-					/* Topic time must be in range */
-					if ((channel->topic_time < lopt->topictimemin) ||
-					    (channel->topic_time > lopt->topictimemax))
-						continue;
-
-					/* Must not be on nolist (if it exists) */
-					if (lopt->nolist && find_name_list_match(lopt->nolist, channel->name))
-						continue;
-
-					/* Must be on yeslist (if it exists) */
-					if (lopt->yeslist && !find_name_list_match(lopt->yeslist, channel->name))
-						continue;
-				}
-				modebuf[0] = '[';
-				channel_modes(client, modebuf+1, parabuf, sizeof(modebuf)-1, sizeof(parabuf), channel, 0);
-				if (modebuf[2] == '\0')
-					modebuf[0] = '\0';
-				else
-					strlcat(modebuf, "]", sizeof modebuf);
-				if (!ValidatePermissionsForPath("channel:see:list:secret",client,NULL,channel,NULL))
-					sendnumeric(client, RPL_LIST,
-					    ShowChannel(client,
-					    channel) ? channel->name :
-					    "*", channel->users,
-					    ShowChannel(client, channel) ?
-					    modebuf : "",
-					    ShowChannel(client,
-					    channel) ? (channel->topic ?
-					    channel->topic : "") : "");
-				else
-					sendnumeric(client, RPL_LIST, channel->name,
-					    channel->users,
-					    modebuf,
-					    (channel->topic ? channel->topic : ""));
-				numsend--;
-			}
+		/* The snapshot may be a few seconds old, so the channel may
+		 * be gone by now. Who may see it is always checked live.
+		 */
+		channel = find_channel(e->name);
+		if (!channel)
+			continue;
+
+		if (SecretChannel(channel)
+		    && !IsMember(client, channel)
+		    && !ValidatePermissionsForPath("channel:see:list:secret",client,NULL,channel,NULL))
+			continue;
+
+		/* set::hide-list { deny-channel } */
+		if (!IsOper(client) && iConf.hide_list && find_channel_allowed(client, channel->name))
+			continue;
+
+		/* Similarly, hide unjoinable channels for non-ircops since it would be confusing */
+		if (!IsOper(client) && !valid_channelname(channel->name))
+			continue;
+
+		if (!ValidatePermissionsForPath("channel:see:list:secret",client,NULL,channel,NULL))
+			sendnumeric(client, RPL_LIST,
+			    ShowChannel(client,
+			    channel) ? channel->name :
+			    "*", e->users,
+			    ShowChannel(client, channel) ?
+			    e->modes : "",
+			    ShowChannel(client,
+			    channel) ? (e->topic ?
+			    e->topic : "") : "");
 		else
-			break;
+			sendnumeric(client, RPL_LIST, channel->name,
+			    e->users,
+			    e->modes,
+			    (e->topic ? e->topic : ""));
+		numsend--;
 	}
 
 	/* All done */
-	if (hashnum == CHAN_HASH_TABLE_SIZE)
+	if (lopt->pos == lopt->end)
 	{
 		sendnumeric(client, RPL_LISTEND);
 		free_list_options(client);
@@ -430,7 +755,6 @@ int send_list(Client *client)
 	 * We've exceeded the limit on the number of channels to send back
 	 * at once.
 	 */
-	lopt->starthash = hashnum;
 	return 1;
 }
 
@@ -462,6 +786,8 @@ void list_md_free(ModData *md)
 
 	free_entire_name_list(lopt->yeslist);
 	free_entire_name_list(lopt->nolist);
+	if (lopt->snapshot)
+		list_snapshot_unref(lopt->snapshot);
 	safe_free(lopt->lr_context);
 
 	safe_free(md->ptr);
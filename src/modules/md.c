@@ -181,7 +181,7 @@ CMD_FUNC(cmd_md)
 		if (!target)
 			return;
 
-		m = find_member_link(channel->members, target);
+		m = find_member(channel, target);
 		if (!m)
 			return;
 
@@ -224,7 +224,7 @@ CMD_FUNC(cmd_md)
 		if (!channel)
 			return;
 
-		m = find_membership_link(target->user->channel, channel);
+		m = find_membership(target, channel);
 		if (!m)
 			return;
 
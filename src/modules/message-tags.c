@@ -201,13 +201,14 @@ void _parse_message_tags(Client *client, char **str, MessageTag **mtag_list)
 		 */
 		if (message_tag_ok(client, name, value))
 		{
-			m = safe_alloc(sizeof(MessageTag));
-			safe_strdup(m->name, name);
+			/* These only live as long as the command, see parse() */
+			m = scratch_alloc(sizeof(MessageTag));
+			m->name = scratch_strdup(name);
 			/* Both NULL and empty become NULL: */
 			if (!*value)
 				m->value = NULL;
 			else /* a real value... */
-				safe_strdup(m->value, value);
+				m->value = scratch_strdup(value);
 			AddListItem(m, *mtag_list);
 		}
 	}
@@ -163,7 +163,7 @@ int can_send_to_member_mode(Client *client, Channel *channel, char mode)
 	if (op_can_override("channel:override:message:prefix",client,channel,NULL))
 		return 1;
 
-	lp = find_membership_link(client->user->channel, channel);
+	lp = find_membership(client, channel);
 
 	/* Check if user is allowed to send. RULES:
 	 * Need at least voice (+) in order to send to +,% or @
@@ -372,7 +372,7 @@ void cmd_message(Client *client, MessageTag *recv_mtags, int parc, const char *p
 					       client->name, targetstr);
 			}
 
-			RunHook(HOOKTYPE_CHANMSG, client, channel, sendflags, member_modes, targetstr, mtags, text, sendtype);
+			RunHookClient(HOOKTYPE_CHANMSG, client, channel, sendflags, member_modes, targetstr, mtags, text, sendtype);
 
 			free_message_tags(mtags);
 
@@ -465,7 +465,7 @@ void cmd_message(Client *client, MessageTag *recv_mtags, int parc, const char *p
 					}
 				}
 				labeled_response_inhibit = 0;
-				RunHook(HOOKTYPE_USERMSG, client, target, mtags, text, sendtype);
+				RunHookClient(HOOKTYPE_USERMSG, client, target, mtags, text, sendtype);
 				free_message_tags(mtags);
 				continue;
 			}
@@ -534,9 +534,23 @@ const char *_StripColors(const char *text)
 	char nc = 0, col = 0, rgb = 0;
 	const char *save_text=NULL;
 	static char new_str[4096];
+	size_t n;
 
 	while (len > 0) 
 	{
+		if (!col && !rgb)
+		{
+			/* Copy a run of plain text in one go */
+			n = text_kernels.control_span(text, len);
+			if (n > 0)
+			{
+				memcpy(new_str + i, text, n);
+				i += n;
+				text += n;
+				len -= n;
+				continue;
+			}
+		}
 		if ((col && isdigit(*text) && nc < 2) || (col && *text == ',' && nc < 3)) 
 		{
 			nc++;
@@ -647,7 +661,7 @@ int _can_send_to_channel(Client *client, Channel *channel, const char **msgtext,
 
 	member = IsMember(client, channel);
 
-	lp = find_membership_link(client->user->channel, channel);
+	lp = find_membership(client, channel);
 
 	/* Modules can plug in as well */
 	for (h = Hooks[HOOKTYPE_CAN_SEND_TO_CHANNEL]; h; h = h->next)
@@ -680,7 +694,7 @@ int _can_send_to_channel(Client *client, Channel *channel, const char **msgtext,
 		/* Don't send message if the user was previously a member
 		 * and isn't anymore, so if the user is KICK'ed, eg by floodprot.
 		 */
-		if (member && !IsDead(client) && !find_membership_link(client->user->channel, channel))
+		if (member && !IsDead(client) && !find_membership(client, channel))
 			*errmsg = NULL;
 		return 0;
 	}
@@ -0,0 +1,413 @@
+/*
+ * Server metrics in Prometheus / OpenMetrics text format
+ * (C) Copyright 2022-.. Bram Matthys (Syzop) and the UnrealIRCd team
+ * License: GPLv2 or later
+ */
+
+#include "unrealircd.h"
+#include "dns.h"
+
+ModuleHeader MOD_HEADER
+= {
+	"metrics",
+	"1.0.0",
+	"Expose server metrics over HTTP (Prometheus)",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+};
+
+/* Configuration */
+struct {
+	SecurityGroup *match;
+} cfg;
+
+/* Forward declarations */
+int metrics_config_test_listen(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int metrics_config_run_ex_listen(ConfigFile *cf, ConfigEntry *ce, int type, void *ptr);
+int metrics_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int metrics_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
+void metrics_client_handshake(Client *client);
+int metrics_handle_request(Client *client, WebRequest *web);
+int metrics_handle_body(Client *client, WebRequest *web, const char *buf, int len);
+static void metrics_collect(MultiLine **out);
+
+MOD_TEST()
+{
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, metrics_config_test_listen);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, metrics_config_test);
+	return MOD_SUCCESS;
+}
+
+MOD_INIT()
+{
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+	memset(&cfg, 0, sizeof(cfg));
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN_EX, 0, metrics_config_run_ex_listen);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, metrics_config_run);
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	free_security_group(cfg.match);
+	memset(&cfg, 0, sizeof(cfg));
+	return MOD_SUCCESS;
+}
+
+int metrics_config_test_listen(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	if (type != CONFIG_LISTEN_OPTIONS)
+		return 0;
+
+	/* We are only interested in listen::options::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	/* No options atm */
+	return 1;
+}
+
+int metrics_config_run_ex_listen(ConfigFile *cf, ConfigEntry *ce, int type, void *ptr)
+{
+	ConfigItem_listen *l;
+
+	if (type != CONFIG_LISTEN_OPTIONS)
+		return 0;
+
+	/* We are only interested in listen::options::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	l = (ConfigItem_listen *)ptr;
+	l->options |= LISTENER_NO_CHECK_CONNECT_FLOOD;
+	l->start_handshake = metrics_client_handshake;
+	l->webserver = safe_alloc(sizeof(WebServer));
+	l->webserver->handle_request = metrics_handle_request;
+	l->webserver->handle_body = metrics_handle_body;
+
+	return 1;
+}
+
+int metrics_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	int errors = 0;
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interrested in set::metrics... */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "match"))
+		{
+			test_match_block(cf, cep, &errors);
+		} else
+		{
+			config_error("%s:%i: unknown directive set::metrics::%s",
+				cep->file->filename, cep->line_number, cep->name);
+			errors++;
+		}
+	}
+
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+int metrics_config_run(ConfigFile *cf, ConfigEntry *ce, int type)
+{
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interrested in set::metrics... */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "match"))
+			conf_match_block(cf, cep, &cfg.match);
+	}
+	return 1;
+}
+
+/** Incoming connection on a metrics listener.
+ * Without a set::metrics::match we only permit connections
+ * from localhost, since the metrics reveal quite a bit about
+ * the internals of the server.
+ */
+void metrics_client_handshake(Client *client)
+{
+	if (cfg.match ? !user_allowed_by_security_group(client, cfg.match) : !IsLocalhost(client))
+	{
+		webserver_send_response(client, 403, "Access denied");
+		return;
+	}
+
+	/* Allow incoming data to be read from now on.. */
+	fd_setselect(client->local->fd, FD_SELECT_READ, read_packet, client);
+}
+
+/** Incoming HTTP request */
+int metrics_handle_request(Client *client, WebRequest *web)
+{
+	MultiLine *out = NULL, *m;
+	char hdr[256];
+	size_t len = 0;
+
+	if (strcmp(web->uri, "/metrics"))
+	{
+		webserver_send_response(client, 404, "Page not found.\n");
+		return 0;
+	}
+
+	metrics_collect(&out);
+	RunHook(HOOKTYPE_METRICS, &out);
+	addmultiline(&out, "# EOF");
+
+	for (m = out; m; m = m->next)
+		len += strlen(m->line) + 1;
+
+	snprintf(hdr, sizeof(hdr),
+	         "HTTP/1.1 200 OK\r\n"
+	         "Server: UnrealIRCd\r\n"
+	         "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+	         "Content-Length: %lu\r\n"
+	         "Connection: close\r\n\r\n",
+	         (unsigned long)len);
+	dbuf_put(&client->local->sendQ, hdr, strlen(hdr));
+	if (web->method != HTTP_METHOD_HEAD)
+	{
+		for (m = out; m; m = m->next)
+		{
+			dbuf_put(&client->local->sendQ, m->line, strlen(m->line));
+			dbuf_put(&client->local->sendQ, "\n", 1);
+		}
+	}
+	freemultiline(out);
+	webserver_close_client(client);
+	return 0;
+}
+
+/** We don't accept a request body, ignore any data */
+int metrics_handle_body(Client *client, WebRequest *web, const char *buf, int len)
+{
+	return 0;
+}
+
+/** Add a metric with a single value (without labels) */
+static void metric_simple(MultiLine **out, const char *name, const char *type, const char *help, unsigned long long value)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "# HELP %s %s", name, help);
+	addmultiline(out, buf);
+	snprintf(buf, sizeof(buf), "# TYPE %s %s", name, type);
+	addmultiline(out, buf);
+	if (!strcmp(type, "counter"))
+		snprintf(buf, sizeof(buf), "%s_total %llu", name, value);
+	else
+		snprintf(buf, sizeof(buf), "%s %llu", name, value);
+	addmultiline(out, buf);
+}
+
+/** Add the header of a metric, for metrics with labels */
+static void metric_header(MultiLine **out, const char *name, const char *type, const char *help)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "# HELP %s %s", name, help);
+	addmultiline(out, buf);
+	snprintf(buf, sizeof(buf), "# TYPE %s %s", name, type);
+	addmultiline(out, buf);
+}
+
+static void metrics_collect_clients(MultiLine **out)
+{
+	Client *client;
+	unsigned long long sendq = 0, recvq = 0;
+	char buf[256];
+
+	metric_header(out, "unrealircd_users", "gauge", "Number of users");
+	snprintf(buf, sizeof(buf), "unrealircd_users{scope=\"local\"} %d", irccounts.me_clients);
+	addmultiline(out, buf);
+	snprintf(buf, sizeof(buf), "unrealircd_users{scope=\"global\"} %d", irccounts.clients);
+	addmultiline(out, buf);
+	metric_simple(out, "unrealircd_servers", "gauge", "Number of servers on the network", irccounts.servers);
+	metric_simple(out, "unrealircd_channels", "gauge", "Number of channels", irccounts.channels);
+	metric_simple(out, "unrealircd_operators", "gauge", "Number of IRC operators on the network", irccounts.operators);
+	metric_simple(out, "unrealircd_unknown_connections", "gauge", "Number of local connections that are not registered yet", irccounts.unknown);
+
+	list_for_each_entry(client, &lclient_list, lclient_node)
+	{
+		sendq += DBufLength(&client->local->sendQ);
+		recvq += DBufLength(&client->local->recvQ);
+	}
+	list_for_each_entry(client, &unknown_list, lclient_node)
+	{
+		sendq += DBufLength(&client->local->sendQ);
+		recvq += DBufLength(&client->local->recvQ);
+	}
+	metric_simple(out, "unrealircd_sendq_bytes", "gauge", "Bytes currently queued for sending to local connections", sendq);
+	metric_simple(out, "unrealircd_recvq_bytes", "gauge", "Bytes currently queued for processing from local connections", recvq);
+}
+
+static void metrics_collect_traffic(MultiLine **out)
+{
+	unsigned long long used, allocated;
+
+	metric_simple(out, "unrealircd_messages_received", "counter", "Messages received", me.local->traffic.messages_received);
+	metric_simple(out, "unrealircd_messages_sent", "counter", "Messages sent", me.local->traffic.messages_sent);
+	metric_simple(out, "unrealircd_received_bytes", "counter", "Bytes received", me.local->traffic.bytes_received);
+	metric_simple(out, "unrealircd_sent_bytes", "counter", "Bytes sent", me.local->traffic.bytes_sent);
+
+	dbuf_pool_stats(&used, &allocated);
+	metric_simple(out, "unrealircd_dbuf_pool_used_bytes", "gauge", "Bytes in use by send and receive buffers", used);
+	metric_simple(out, "unrealircd_dbuf_pool_allocated_bytes", "gauge", "Bytes allocated by the send and receive buffer pool", allocated);
+}
+
+static void metrics_collect_loop(MultiLine **out)
+{
+	unsigned long long cumulative = 0;
+	char buf[256];
+	int i;
+
+	metric_header(out, "unrealircd_loop_busy_seconds", "histogram", "Time spent per event loop iteration, excluding waiting for I/O");
+	for (i = 0; i < METRICS_LOOP_BUCKETS; i++)
+	{
+		cumulative += metrics.loop_busy_bucket[i];
+		if (i < METRICS_LOOP_BUCKETS-1)
+		{
+			snprintf(buf, sizeof(buf), "unrealircd_loop_busy_seconds_bucket{le=\"%g\"} %llu",
+			         metrics_loop_bucket_usec[i] / 1000000.0, cumulative);
+		} else {
+			snprintf(buf, sizeof(buf), "unrealircd_loop_busy_seconds_bucket{le=\"+Inf\"} %llu", cumulative);
+		}
+		addmultiline(out, buf);
+	}
+	snprintf(buf, sizeof(buf), "unrealircd_loop_busy_seconds_sum %.6f", metrics.loop_busy_nsec / 1000000000.0);
+	addmultiline(out, buf);
+	snprintf(buf, sizeof(buf), "unrealircd_loop_busy_seconds_count %llu", (unsigned long long)metrics.loop_iterations);
+	addmultiline(out, buf);
+
+	metric_simple(out, "unrealircd_fd_select_calls", "counter", "Number of times we waited for I/O events", metrics.fd_select_calls);
+	metric_simple(out, "unrealircd_fd_select_wakeups", "counter", "Number of times waiting for I/O returned one or more events", metrics.fd_select_wakeups);
+	metric_simple(out, "unrealircd_fd_select_events", "counter", "Number of I/O events processed", metrics.fd_select_events);
+
+	metric_header(out, "unrealircd_rehash_blocked_seconds", "gauge", "Time the last rehash kept the event loop busy");
+	snprintf(buf, sizeof(buf), "unrealircd_rehash_blocked_seconds %.6f", metrics.rehash_blocked_nsec / 1000000000.0);
+	addmultiline(out, buf);
+}
+
+static void metrics_collect_commands(MultiLine **out)
+{
+	RealCommand *c;
+	char buf[256];
+	int i;
+
+	metric_header(out, "unrealircd_command_calls", "counter", "Number of times a command was executed");
+	for (i = 0; i < 256; i++)
+	{
+		for (c = CommandHash[i]; c; c = c->next)
+		{
+			if (!c->count)
+				continue;
+			snprintf(buf, sizeof(buf), "unrealircd_command_calls_total{command=\"%s\"} %u", c->cmd, c->count);
+			addmultiline(out, buf);
+		}
+	}
+
+	metric_header(out, "unrealircd_command_seconds", "counter", "Time spent executing a command");
+	for (i = 0; i < 256; i++)
+	{
+		for (c = CommandHash[i]; c; c = c->next)
+		{
+			if (!c->count)
+				continue;
+			snprintf(buf, sizeof(buf), "unrealircd_command_seconds_total{command=\"%s\",origin=\"local\"} %.6f",
+			         c->cmd, c->local_nsec / 1000000000.0);
+			addmultiline(out, buf);
+			snprintf(buf, sizeof(buf), "unrealircd_command_seconds_total{command=\"%s\",origin=\"remote\"} %.6f",
+			         c->cmd, c->remote_nsec / 1000000000.0);
+			addmultiline(out, buf);
+		}
+	}
+}
+
+static void metrics_collect_bans(MultiLine **out)
+{
+	metric_simple(out, "unrealircd_dns_cache_hits", "counter", "DNS cache hits", dnsstats.cache_hits);
+	metric_simple(out, "unrealircd_dns_cache_misses", "counter", "DNS cache misses", dnsstats.cache_misses);
+	metric_simple(out, "unrealircd_tkl_checks", "counter", "Number of times a client was checked against server bans", metrics.tkl_checks);
+	metric_simple(out, "unrealircd_tkl_entries_scanned", "counter", "Number of server ban entries compared against clients", metrics.tkl_entries_scanned);
+	metric_simple(out, "unrealircd_tkl_matches", "counter", "Number of server ban checks that matched", metrics.tkl_matches);
+	metric_simple(out, "unrealircd_tkl_new_bans_checked", "counter", "Number of new server bans applied to existing clients", metrics.tkl_new_bans_checked);
+	metric_simple(out, "unrealircd_tkl_new_bans_full_scan", "counter", "Number of new server bans that had to be checked against all clients", metrics.tkl_new_bans_full_scan);
+	metric_simple(out, "unrealircd_spamfilter_checks", "counter", "Number of times text was checked against spamfilters", metrics.spamfilter_checks);
+	metric_simple(out, "unrealircd_spamfilter_matches", "counter", "Number of spamfilter matches", metrics.spamfilter_matches);
+}
+
+static void metrics_collect_mempools(MultiLine **out)
+{
+	mp_pool_t *pool;
+	unsigned long long used, allocated;
+	char buf[256];
+
+	metric_header(out, "unrealircd_mempool_used_bytes", "gauge", "Bytes in use per memory pool");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		if (!pool->name)
+			continue;
+		mp_pool_stats(pool, &used, &allocated);
+		snprintf(buf, sizeof(buf), "unrealircd_mempool_used_bytes{pool=\"%s\"} %llu", pool->name, used);
+		addmultiline(out, buf);
+	}
+
+	metric_header(out, "unrealircd_mempool_allocated_bytes", "gauge", "Bytes allocated per memory pool");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		if (!pool->name)
+			continue;
+		mp_pool_stats(pool, &used, &allocated);
+		snprintf(buf, sizeof(buf), "unrealircd_mempool_allocated_bytes{pool=\"%s\"} %llu", pool->name, allocated);
+		addmultiline(out, buf);
+	}
+}
+
+static void metrics_collect_tls(MultiLine **out)
+{
+	metric_simple(out, "unrealircd_tls_handshakes_full", "counter", "Incoming TLS handshakes that did not resume a session", metrics.tls_handshakes_full);
+	metric_simple(out, "unrealircd_tls_handshakes_resumed", "counter", "Incoming TLS handshakes that resumed a session", metrics.tls_handshakes_resumed);
+	metric_simple(out, "unrealircd_tls_ktls_enabled", "counter", "TLS connections where the kernel took over encryption", metrics.tls_ktls_enabled);
+	metric_simple(out, "unrealircd_tls_ktls_fallback", "counter", "TLS connections with ktls enabled that stayed in userspace", metrics.tls_ktls_fallback);
+}
+
+/** Collect all the metrics from the core */
+static void metrics_collect(MultiLine **out)
+{
+	char buf[256];
+
+	metric_header(out, "unrealircd_info", "gauge", "Information about the server");
+	snprintf(buf, sizeof(buf), "unrealircd_info{version=\"%s\",server=\"%s\"} 1", version, me.name);
+	addmultiline(out, buf);
+	metric_simple(out, "unrealircd_start_time_seconds", "gauge", "Time the server was started (UNIX timestamp)", me.local->creationtime);
+
+	metrics_collect_clients(out);
+	metrics_collect_traffic(out);
+	metrics_collect_mempools(out);
+	metrics_collect_loop(out);
+	metrics_collect_commands(out);
+	metrics_collect_bans(out);
+	metrics_collect_tls(out);
+}
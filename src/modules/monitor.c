@@ -34,6 +34,41 @@ int monitor_post_nickchange(Client *client, MessageTag *mtags, const char *oldni
 int monitor_quit(Client *client, MessageTag *mtags, const char *comment);
 int monitor_connect(Client *client);
 int monitor_notification(Client *client, Watch *watch, Link *lp, int event);
+int monitor_loop_end(void);
+int monitor_away(Client *client, MessageTag *mtags, const char *reason, int already_as_away);
+int monitor_account_login(Client *client, MessageTag *mtags);
+int monitor_userhost_change(Client *client, const char *olduser, const char *oldhost);
+int monitor_realname_change(Client *client, const char *oldinfo);
+void monitor_pending_free(ModData *m);
+
+/* Online/offline notifications are not sent right away, they are
+ * collected per watcher and sent at the end of the loop iteration.
+ * That way a netsplit or netmerge results in a few RPL_MONONLINE and
+ * RPL_MONOFFLINE lines with many nicks each, instead of one line per
+ * nick. A nick that goes offline and comes back (or the other way
+ * around) within the same iteration only results in its final state.
+ */
+typedef struct MonitorEvent MonitorEvent;
+struct MonitorEvent {
+	MonitorEvent *next;
+	int online;			/**< Current state of the nick */
+	int was_online;			/**< State of the nick before the first event */
+	char nick[NICKLEN+1];
+	char userhost[USERLEN+HOSTLEN+2]; /**< user@host, only if online */
+};
+
+typedef struct MonitorPending MonitorPending;
+struct MonitorPending {
+	MonitorPending *prev, *next;
+	Client *client;			/**< The watcher */
+	MonitorEvent *events;
+	MonitorEvent *last;
+};
+
+#define MONITOR_PENDING(client) ((MonitorPending *)moddata_local_client(client, monitorPendingMD).ptr)
+
+ModDataInfo *monitorPendingMD;
+static MonitorPending *monitor_pending = NULL;
 
 ModuleHeader MOD_HEADER
   = {
@@ -46,7 +81,20 @@ ModuleHeader MOD_HEADER
 
 MOD_INIT()
 {	
+	ModDataInfo mreq;
+
 	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.type = MODDATATYPE_LOCAL_CLIENT;
+	mreq.name = "monitor_pending";
+	mreq.free = monitor_pending_free;
+	monitorPendingMD = ModDataAdd(modinfo->handle, mreq);
+	if (!monitorPendingMD)
+	{
+		config_error("[%s] Failed to request monitor_pending moddata: %s", MOD_HEADER.name, ModuleGetErrorStr(modinfo->handle));
+		return MOD_FAILED;
+	}
 	
 	CommandAdd(modinfo->handle, MSG_MONITOR, cmd_monitor, 2, CMD_USER);
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_NICKCHANGE, 0, monitor_nickchange);
@@ -57,6 +105,12 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_QUIT, 0, monitor_quit);
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CONNECT, 0, monitor_connect);
 	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_CONNECT, 0, monitor_connect);
+	HookAdd(modinfo->handle, HOOKTYPE_LOOP_END, 0, monitor_loop_end);
+	/* These run before extended-monitor, see monitor_flush_watchers() */
+	HookAdd(modinfo->handle, HOOKTYPE_AWAY, -1, monitor_away);
+	HookAdd(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, -1, monitor_account_login);
+	HookAdd(modinfo->handle, HOOKTYPE_USERHOST_CHANGE, -1, monitor_userhost_change);
+	HookAdd(modinfo->handle, HOOKTYPE_REALNAME_CHANGE, -1, monitor_realname_change);
 
 	return MOD_SUCCESS;
 }
@@ -69,6 +123,7 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	monitor_loop_end(); /* send out anything that is still pending */
 	return MOD_SUCCESS;
 }
 
@@ -108,6 +163,115 @@ int monitor_connect(Client *client)
 	return 0;
 }
 
+/** Send the pending notifications of one watcher and free them */
+static void monitor_flush(MonitorPending *pending)
+{
+	Client *client = pending->client;
+	MonitorEvent *e, *e_next;
+	char buf[BUFSIZE];
+	char item[NICKLEN+USERLEN+HOSTLEN+3];
+	size_t len, itemlen, max;
+	int online;
+
+	/* Stay within 510 bytes: ":server 73x nick :" followed by the list */
+	max = 510 - strlen(me.name) - strlen(client->name) - 9;
+	for (online = 1; online >= 0; online--)
+	{
+		len = 0;
+		for (e = pending->events; e; e = e->next)
+		{
+			if (e->online != online)
+				continue;
+			if (!e->online && !e->was_online)
+				continue; /* nick came and went again, nothing changed */
+			if (online)
+				snprintf(item, sizeof(item), "%s!%s", e->nick, e->userhost);
+			else
+				strlcpy(item, e->nick, sizeof(item));
+			itemlen = strlen(item);
+			if (len && (len + 1 + itemlen > max))
+			{
+				sendnumericfmt(client, online ? RPL_MONONLINE : RPL_MONOFFLINE, ":%s", buf);
+				len = 0;
+			}
+			if (len)
+				buf[len++] = ',';
+			strlcpy(buf + len, item, sizeof(buf) - len);
+			len += itemlen;
+		}
+		if (len)
+			sendnumericfmt(client, online ? RPL_MONONLINE : RPL_MONOFFLINE, ":%s", buf);
+	}
+
+	for (e = pending->events; e; e = e_next)
+	{
+		e_next = e->next;
+		safe_free(e);
+	}
+	DelListItem(pending, monitor_pending);
+	moddata_local_client(client, monitorPendingMD).ptr = NULL;
+	safe_free(pending);
+}
+
+int monitor_loop_end(void)
+{
+	while (monitor_pending)
+		monitor_flush(monitor_pending);
+	return 0;
+}
+
+void monitor_pending_free(ModData *m)
+{
+	MonitorPending *pending = m->ptr;
+	MonitorEvent *e, *e_next;
+
+	if (!pending)
+		return;
+	for (e = pending->events; e; e = e_next)
+	{
+		e_next = e->next;
+		safe_free(e);
+	}
+	DelListItem(pending, monitor_pending);
+	safe_free(pending);
+	m->ptr = NULL;
+}
+
+/** Queue an online or offline notification about 'client' for watcher 'to' */
+static void monitor_queue(Client *to, Client *client, int online)
+{
+	MonitorPending *pending = MONITOR_PENDING(to);
+	MonitorEvent *e;
+
+	if (!pending)
+	{
+		pending = safe_alloc(sizeof(MonitorPending));
+		pending->client = to;
+		AddListItem(pending, monitor_pending);
+		moddata_local_client(to, monitorPendingMD).ptr = pending;
+	}
+
+	/* A watcher has at most MAXWATCH entries, so this list is short */
+	for (e = pending->events; e; e = e->next)
+		if (!mycmp(e->nick, client->name))
+			break;
+
+	if (!e)
+	{
+		e = safe_alloc(sizeof(MonitorEvent));
+		e->was_online = !online;
+		if (pending->last)
+			pending->last->next = e;
+		else
+			pending->events = e;
+		pending->last = e;
+	}
+	e->online = online;
+	strlcpy(e->nick, client->name, sizeof(e->nick));
+	if (online)
+		snprintf(e->userhost, sizeof(e->userhost), "%s@%s", client->user->username, GetHost(client));
+}
+
 int monitor_notification(Client *client, Watch *watch, Link *lp, int event)
 {
 	if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
@@ -116,10 +280,10 @@ int monitor_notification(Client *client, Watch *watch, Link *lp, int event)
 	switch (event)
 	{
 		case WATCH_EVENT_ONLINE:
-			sendnumeric(lp->value.client, RPL_MONONLINE, client->name, client->user->username, GetHost(client));
+			monitor_queue(lp->value.client, client, 1);
 			break;
 		case WATCH_EVENT_OFFLINE:
-			sendnumeric(lp->value.client, RPL_MONOFFLINE, client->name);
+			monitor_queue(lp->value.client, client, 0);
 			break;
 		default:
 			break; /* may be handled by other modules */
@@ -128,6 +292,53 @@ int monitor_notification(Client *client, Watch *watch, Link *lp, int event)
 	return 0;
 }
 
+/** Before extended-monitor sends something about 'client' to its
+ * watchers (eg: AWAY), they must have seen the RPL_MONONLINE first.
+ * These hooks run before the ones of extended-monitor.
+ */
+static void monitor_flush_watchers(Client *client)
+{
+	Watch *watch;
+	Link *lp;
+	MonitorPending *pending;
+
+	if (!monitor_pending || !(watch = watch_get(client->name)))
+		return;
+
+	for (lp = watch->watch; lp; lp = lp->next)
+	{
+		if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
+			continue;
+		pending = MONITOR_PENDING(lp->value.client);
+		if (pending && HasCapability(lp->value.client, "extended-monitor"))
+			monitor_flush(pending);
+	}
+}
+
+int monitor_away(Client *client, MessageTag *mtags, const char *reason, int already_as_away)
+{
+	monitor_flush_watchers(client);
+	return 0;
+}
+
+int monitor_account_login(Client *client, MessageTag *mtags)
+{
+	monitor_flush_watchers(client);
+	return 0;
+}
+
+int monitor_userhost_change(Client *client, const char *olduser, const char *oldhost)
+{
+	monitor_flush_watchers(client);
+	return 0;
+}
+
+int monitor_realname_change(Client *client, const char *oldinfo)
+{
+	monitor_flush_watchers(client);
+	return 0;
+}
+
 void send_status(Client *client, MessageTag *recv_mtags, const char *nick)
 {
 	MessageTag *mtags = NULL;
@@ -157,6 +368,12 @@ CMD_FUNC(cmd_monitor)
 	if (!MyUser(client))
 		return;
 
+	/* Send any pending notifications first, so the replies below are
+	 * not followed by older information.
+	 */
+	if (MONITOR_PENDING(client))
+		monitor_flush(MONITOR_PENDING(client));
+
 	if (parc < 2 || BadPtr(parv[1]))
 		cmd = 'l';
 	else
@@ -0,0 +1,167 @@
+/*
+ * Profiler: /PROFILER command to control the command and hook profiler
+ * (C) Copyright 2022-.. Bram Matthys (Syzop) and the UnrealIRCd team
+ * License: GPLv2 or later
+ */
+
+#include "unrealircd.h"
+
+ModuleHeader MOD_HEADER
+= {
+	"profiler",
+	"1.0.0",
+	"command /profiler",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+};
+
+/* Forward declarations */
+CMD_FUNC(cmd_profiler);
+int profiler_metrics(MultiLine **out);
+
+/** Histogram buckets for the metrics, in microseconds */
+static double profiler_metrics_bucket_usec[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+MOD_INIT()
+{
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+	CommandAdd(modinfo->handle, "PROFILER", cmd_profiler, 1, CMD_USER);
+	HookAdd(modinfo->handle, HOOKTYPE_METRICS, 0, profiler_metrics);
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	return MOD_SUCCESS;
+}
+
+/** PROFILER ON|OFF|RESET
+ * The results can be viewed through /STATS profiler
+ */
+CMD_FUNC(cmd_profiler)
+{
+	if (!ValidatePermissionsForPath("server:profiler",client,NULL,NULL,NULL))
+	{
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return;
+	}
+
+	if ((parc < 2) || BadPtr(parv[1]))
+	{
+		sendnotice(client, "The profiler is currently %s", profiler_enabled ? "enabled" : "disabled");
+		sendnotice(client, "Usage: /PROFILER ON|OFF|RESET, the results can be viewed through /STATS profiler");
+		return;
+	}
+
+	if (!strcasecmp(parv[1], "ON"))
+	{
+		profiler_enable();
+		unreal_log(ULOG_INFO, "profiler", "PROFILER_ENABLED", client,
+		           "$client enabled the profiler");
+	} else
+	if (!strcasecmp(parv[1], "OFF"))
+	{
+		profiler_disable();
+		unreal_log(ULOG_INFO, "profiler", "PROFILER_DISABLED", client,
+		           "$client disabled the profiler");
+	} else
+	if (!strcasecmp(parv[1], "RESET"))
+	{
+		profiler_reset();
+		sendnotice(client, "Profiler data has been reset");
+	} else
+	{
+		sendnotice(client, "Usage: /PROFILER ON|OFF|RESET");
+	}
+}
+
+/** Add histogram 'src' to 'dst' */
+static void profiler_histogram_add(ProfilerHistogram *dst, ProfilerHistogram *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/** Returns 1 if entries 'a' and 'b' end up in the same series */
+static int profiler_same_series(ProfilerEntry *a, ProfilerEntry *b)
+{
+	return (a->type == b->type) && !strcmp(a->name, b->name) &&
+	       ((a->type != PROFILER_ENTRY_HOOK) || !strcmp(a->module, b->module));
+}
+
+/** Add the profiler data to the metrics (only when the profiler is enabled).
+ * Every command, hook type and hook is a series of
+ * the unrealircd_profiler_seconds histogram. A module can have
+ * multiple hooks of the same type, these are added together.
+ */
+int profiler_metrics(MultiLine **out)
+{
+	ProfilerEntry *entries;
+	ProfilerEntry *e;
+	ProfilerHistogram histogram;
+	char labels[256];
+	char buf[512];
+	int cnt, i, j;
+
+	if (!profiler_enabled)
+		return 0;
+
+	cnt = profiler_get_entries(&entries);
+
+	addmultiline(out, "# HELP unrealircd_profiler_seconds Time spent in command handlers and hooks, see /PROFILER");
+	addmultiline(out, "# TYPE unrealircd_profiler_seconds histogram");
+	for (i = 0; i < cnt; i++)
+	{
+		e = &entries[i];
+		/* Already done as part of an earlier entry? */
+		for (j = 0; j < i; j++)
+			if (profiler_same_series(&entries[j], e))
+				break;
+		if (j < i)
+			continue;
+		histogram = *e->histogram;
+		for (j = i + 1; j < cnt; j++)
+			if (profiler_same_series(&entries[j], e))
+				profiler_histogram_add(&histogram, entries[j].histogram);
+
+		if (e->type == PROFILER_ENTRY_COMMAND)
+			snprintf(labels, sizeof(labels), "type=\"command\",name=\"%s\"", e->name);
+		else if (e->type == PROFILER_ENTRY_HOOKTYPE)
+			snprintf(labels, sizeof(labels), "type=\"hooktype\",name=\"%s\"", e->name);
+		else
+			snprintf(labels, sizeof(labels), "type=\"hook\",name=\"%s\",module=\"%s\"", e->name, e->module);
+
+		for (j = 0; j < ARRAY_SIZEOF(profiler_metrics_bucket_usec); j++)
+		{
+			snprintf(buf, sizeof(buf), "unrealircd_profiler_seconds_bucket{%s,le=\"%g\"} %llu",
+			         labels, profiler_metrics_bucket_usec[j] / 1000000.0,
+			         (unsigned long long)profiler_count_upto(&histogram, profiler_metrics_bucket_usec[j]));
+			addmultiline(out, buf);
+		}
+		snprintf(buf, sizeof(buf), "unrealircd_profiler_seconds_bucket{%s,le=\"+Inf\"} %llu",
+		         labels, (unsigned long long)histogram.count);
+		addmultiline(out, buf);
+		snprintf(buf, sizeof(buf), "unrealircd_profiler_seconds_sum{%s} %.9f",
+		         labels, profiler_to_usec(histogram.sum) / 1000000.0);
+		addmultiline(out, buf);
+		snprintf(buf, sizeof(buf), "unrealircd_profiler_seconds_count{%s} %llu",
+		         labels, (unsigned long long)histogram.count);
+		addmultiline(out, buf);
+	}
+
+	safe_free(entries);
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* profiler.* RPC calls
+ * (C) Copyright 2022-.. Bram Matthys (Syzop) and the UnrealIRCd team
+ * License: GPLv2 or later
+ */
+
+#include "unrealircd.h"
+
+ModuleHeader MOD_HEADER
+= {
+	"rpc/profiler",
+	"1.0.0",
+	"profiler.* RPC calls",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+};
+
+/* Forward declarations */
+RPC_CALL_FUNC(rpc_profiler_get);
+RPC_CALL_FUNC(rpc_profiler_enable);
+RPC_CALL_FUNC(rpc_profiler_disable);
+RPC_CALL_FUNC(rpc_profiler_reset);
+
+MOD_INIT()
+{
+	RPCHandlerInfo r;
+
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	memset(&r, 0, sizeof(r));
+	r.method = "profiler.get";
+	r.call = rpc_profiler_get;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/profiler] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	r.method = "profiler.enable";
+	r.call = rpc_profiler_enable;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/profiler] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	r.method = "profiler.disable";
+	r.call = rpc_profiler_disable;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/profiler] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	r.method = "profiler.reset";
+	r.call = rpc_profiler_reset;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/profiler] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	return MOD_SUCCESS;
+}
+
+static void rpc_profiler_status(json_t *result)
+{
+	json_object_set_new(result, "enabled", json_boolean(profiler_enabled));
+	if (profiler_enabled)
+		json_object_set_new(result, "enabled_since", json_timestamp(profiler_enabled_since));
+}
+
+/** Get the profiler results. Times are in microseconds.
+ * Optional parameter 'limit' limits the number of entries (the
+ * entries are sorted by total time spent, high to low).
+ */
+RPC_CALL_FUNC(rpc_profiler_get)
+{
+	json_t *result, *list, *item, *j;
+	ProfilerEntry *entries, *e;
+	ProfilerHistogram *h;
+	int cnt, i, limit;
+	const char *type;
+
+	j = json_object_get(params, "limit");
+	limit = j ? json_integer_value(j) : 0;
+
+	result = json_object();
+	rpc_profiler_status(result);
+	list = json_array();
+	json_object_set_new(result, "list", list);
+
+	cnt = profiler_get_entries(&entries);
+	for (i = 0; i < cnt; i++)
+	{
+		if (limit && (i >= limit))
+			break;
+		e = &entries[i];
+		h = e->histogram;
+		if (e->type == PROFILER_ENTRY_COMMAND)
+			type = "command";
+		else if (e->type == PROFILER_ENTRY_HOOKTYPE)
+			type = "hooktype";
+		else
+			type = "hook";
+		item = json_object();
+		json_object_set_new(item, "type", json_string_unreal(type));
+		json_object_set_new(item, "name", json_string_unreal(e->name));
+		if (e->module)
+			json_object_set_new(item, "module", json_string_unreal(e->module));
+		json_object_set_new(item, "calls", json_integer(h->count));
+		json_object_set_new(item, "total", json_real(profiler_to_usec(h->sum)));
+		json_object_set_new(item, "avg", json_real(profiler_to_usec(h->sum) / h->count));
+		json_object_set_new(item, "p50", json_real(profiler_to_usec(profiler_percentile(h, 50.0))));
+		json_object_set_new(item, "p90", json_real(profiler_to_usec(profiler_percentile(h, 90.0))));
+		json_object_set_new(item, "p99", json_real(profiler_to_usec(profiler_percentile(h, 99.0))));
+		json_object_set_new(item, "p999", json_real(profiler_to_usec(profiler_percentile(h, 99.9))));
+		json_object_set_new(item, "max", json_real(profiler_to_usec(h->max)));
+		json_array_append_new(list, item);
+	}
+	safe_free(entries);
+
+	rpc_response(client, request, result);
+	json_decref(result);
+}
+
+RPC_CALL_FUNC(rpc_profiler_enable)
+{
+	json_t *result;
+
+	profiler_enable();
+	result = json_object();
+	rpc_profiler_status(result);
+	rpc_response(client, request, result);
+	json_decref(result);
+}
+
+RPC_CALL_FUNC(rpc_profiler_disable)
+{
+	json_t *result;
+
+	profiler_disable();
+	result = json_object();
+	rpc_profiler_status(result);
+	rpc_response(client, request, result);
+	json_decref(result);
+}
+
+RPC_CALL_FUNC(rpc_profiler_reset)
+{
+	json_t *result;
+
+	profiler_reset();
+	result = json_object();
+	rpc_profiler_status(result);
+	rpc_response(client, request, result);
+	json_decref(result);
+}
@@ -36,6 +36,7 @@ void rpc_call(Client *client, json_t *request);
 void _rpc_response(Client *client, json_t *request, json_t *result);
 void _rpc_error(Client *client, json_t *request, JsonRpcError error_code, const char *error_message);
 void _rpc_error_fmt(Client *client, json_t *request, JsonRpcError error_code, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,4,5)));
+void _rpc_send_notification(Client *client, const char *method, json_t *params);
 int rpc_handle_auth(Client *client, WebRequest *web);
 int rpc_parse_auth_basic_auth(Client *client, WebRequest *web, char **username, char **password);
 int rpc_parse_auth_uri(Client *client, WebRequest *web, char **username, char **password);
@@ -70,6 +71,7 @@ MOD_TEST()
 	EfunctionAddVoid(modinfo->handle, EFUNC_RPC_RESPONSE, _rpc_response);
 	EfunctionAddVoid(modinfo->handle, EFUNC_RPC_ERROR, _rpc_error);
 	EfunctionAddVoid(modinfo->handle, EFUNC_RPC_ERROR_FMT, TO_VOIDFUNC(_rpc_error_fmt));
+	EfunctionAddVoid(modinfo->handle, EFUNC_RPC_SEND_NOTIFICATION, _rpc_send_notification);
 
 	/* Call MOD_INIT very early, since we manage sockets, but depend on websocket_common */
 	ModuleSetOptions(modinfo->handle, MOD_OPT_PRIORITY, WEBSOCKET_MODULE_PRIORITY_INIT+1);
@@ -519,6 +521,37 @@ void _rpc_response(Client *client, json_t *request, json_t *result)
 	safe_free(json_serialized);
 }
 
+/** Send a JSON-RPC notification (a message without an 'id') to the client.
+ * This is used for pushing events to clients that subscribed to them,
+ * which is only possible on persistent connections (websocket and
+ * unix domain socket), not for ordinary HTTP(S) POST requests.
+ * @param client	The RPC client
+ * @param method	The notification method, eg "log.event"
+ * @param params	The parameters (this function does not take ownership)
+ */
+void _rpc_send_notification(Client *client, const char *method, json_t *params)
+{
+	char *json_serialized;
+	json_t *j = json_object();
+
+	json_object_set_new(j, "jsonrpc", json_string_unreal("2.0"));
+	json_object_set_new(j, "method", json_string_unreal(method));
+	json_object_set(j, "params", params);
+
+	json_serialized = json_dumps(j, 0);
+	if (!json_serialized)
+	{
+		unreal_log(ULOG_WARNING, "rpc", "BUG_RPC_NOTIFICATION_SERIALIZE_FAILED", client,
+		           "[BUG] rpc_send_notification() failed to serialize notification "
+		           "for $client ($method)",
+		           log_data_string("method", method));
+		json_decref(j);
+		return;
+	}
+	rpc_sendto(client, json_serialized, strlen(json_serialized));
+	json_decref(j);
+	safe_free(json_serialized);
+}
 
 /** Handle the RPC request: request is in JSON */
 void rpc_call(Client *client, json_t *request)
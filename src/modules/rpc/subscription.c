@@ -0,0 +1,873 @@
+/* Subscriptions: log.subscribe and object change streams
+ * (C) Copyright 2022-.. Bram Matthys (Syzop) and the UnrealIRCd team
+ * License: GPLv2 or later
+ */
+
+#include "unrealircd.h"
+
+ModuleHeader MOD_HEADER
+= {
+	"rpc/subscription",
+	"1.0.0",
+	"log.subscribe and *.subscribe RPC calls for pushed events",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+};
+
+/* This module lets persistent RPC connections (websocket and unix domain
+ * socket) subscribe to log messages and to changes of users, channels and
+ * server bans, so an admin panel does not have to poll user.list and
+ * channel.list all the time.
+ *
+ * Events are not sent immediately. They are queued per subscriber and
+ * flushed every RPC_SUBSCRIPTION_FLUSH_MSEC. While queued, events about
+ * the same object are coalesced (eg: 5 mode changes on a channel result
+ * in a single 'update', a user who connects and quits before the next
+ * flush is not sent at all). The queue is bounded: if a slow consumer
+ * can't keep up then we drop log events (and tell them how many) and
+ * for object streams we throw away the queue and tell the client to
+ * resync by doing a full user.list / channel.list / server_ban.list.
+ */
+
+/** Maximum number of queued events per subscriber */
+#define RPC_SUBSCRIPTION_MAX_QUEUE	2000
+/** Don't flush more events if the sendQ of the client is above this */
+#define RPC_SUBSCRIPTION_MAX_SENDQ	(512*1024)
+/** How often we flush the queues */
+#define RPC_SUBSCRIPTION_FLUSH_MSEC	250
+/** Size of the per-subscriber hash table that is used for coalescing */
+#define RPC_SUBSCRIPTION_HASH_SIZE	1024
+
+typedef enum RPCStream {
+	RPC_STREAM_LOG		= 0,
+	RPC_STREAM_USER		= 1,
+	RPC_STREAM_CHANNEL	= 2,
+	RPC_STREAM_SERVER_BAN	= 3,
+} RPCStream;
+#define RPC_STREAM_COUNT	4
+#define RPC_STREAM_MASK(x)	(1 << (x))
+
+typedef enum RPCEventAction {
+	RPC_EVENT_LOG		= 0,
+	RPC_EVENT_ADD		= 1,
+	RPC_EVENT_UPDATE	= 2,
+	RPC_EVENT_REMOVE	= 3,
+} RPCEventAction;
+
+typedef struct RPCEvent RPCEvent;
+struct RPCEvent {
+	RPCEvent *prev, *next;		/**< Queue (in order of arrival) */
+	RPCEvent *hnext;		/**< Next in coalescing hash bucket */
+	RPCStream stream;
+	RPCEventAction action;
+	char *key;			/**< Object key: UID, channel name or ban. NULL for log events. */
+	char *name;			/**< Object name for 'remove' (eg nick of the user) */
+	json_t *data;			/**< Log event, or the expanded ban. NULL for users and channels. */
+};
+
+typedef struct RPCSubscriber RPCSubscriber;
+struct RPCSubscriber {
+	RPCSubscriber *prev, *next;
+	Client *client;
+	int md_slot;			/**< Our moddata slot in client->local, see rpc_subscription_free_all() */
+	int streams;			/**< Bitmask of RPC_STREAM_MASK() */
+	LogSource *log_sources;		/**< For log.subscribe */
+	RPCEvent *queue;		/**< Queued events, oldest first */
+	RPCEvent *queue_tail;		/**< Last queued event */
+	int queue_len;
+	RPCEvent *hash[RPC_SUBSCRIPTION_HASH_SIZE];
+	int log_dropped;		/**< Number of log events that we had to drop */
+	int resync;			/**< Bitmask of streams that overflowed */
+};
+
+/* Forward declarations */
+RPC_CALL_FUNC(rpc_log_subscribe);
+RPC_CALL_FUNC(rpc_log_unsubscribe);
+RPC_CALL_FUNC(rpc_stream_subscribe);
+RPC_CALL_FUNC(rpc_stream_unsubscribe);
+void rpc_subscriber_free(ModData *m);
+void rpc_subscription_free_all(ModData *m);
+void rpc_subscription_generic_free(ModData *m);
+EVENT(rpc_subscription_flush);
+static void recalculate_subscribed_streams(void);
+int rpc_subscription_log(LogLevel loglevel, const char *subsystem, const char *event_id, MultiLine *msg, const char *json_serialized, const char *timebuf);
+int rpc_subscription_user_connect(Client *client);
+int rpc_subscription_user_quit(Client *client, MessageTag *mtags, const char *comment);
+int rpc_subscription_user_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
+int rpc_subscription_user_umode_change(Client *client, long setflags, long newflags);
+int rpc_subscription_user_userhost_change(Client *client, const char *olduser, const char *oldhost);
+int rpc_subscription_user_account_login(Client *client, MessageTag *mtags);
+int rpc_subscription_user_realname_change(Client *client, const char *oldinfo);
+int rpc_subscription_channel_create(Channel *channel);
+int rpc_subscription_channel_destroy(Channel *channel, int *should_destroy);
+int rpc_subscription_join(Client *client, Channel *channel, MessageTag *mtags);
+int rpc_subscription_part(Client *client, Channel *channel, MessageTag *mtags, const char *comment);
+int rpc_subscription_kick(Client *client, Client *victim, Channel *channel, MessageTag *mtags, const char *comment);
+int rpc_subscription_topic(Client *client, Channel *channel, MessageTag *mtags, const char *topic);
+int rpc_subscription_chanmode(Client *client, Channel *channel, MessageTag *mtags, const char *modebuf, const char *parabuf, time_t sendts, int samode, int *destroy_channel);
+int rpc_subscription_tkl_add(Client *client, TKL *tkl);
+int rpc_subscription_tkl_del(Client *client, TKL *tkl);
+
+/* Global variables */
+ModDataInfo *rpc_subscriber_md = NULL;
+ModDataInfo *websocket_md = NULL; /* (imported) */
+RPCSubscriber *subscribers = NULL;
+/** Union of the streams of all subscribers, so hooks can bail out quickly */
+int subscribed_streams = 0;
+char *siphashkey_rpc_subscription = NULL;
+
+/* Macros */
+#define RPCSUB(client)	((RPCSubscriber *)moddata_local_client(client, rpc_subscriber_md).ptr)
+#define WSU(client)	((WebSocketUser *)moddata_client(client, websocket_md).ptr)
+#define WantStream(x)	(subscribed_streams & RPC_STREAM_MASK(x))
+
+static const char *stream_names[RPC_STREAM_COUNT] = { "log", "user", "channel", "server_ban" };
+
+MOD_INIT()
+{
+	RPCHandlerInfo r;
+	ModDataInfo mreq;
+	int i;
+
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	/* Subscriptions and queued events survive a module reload (REHASH) */
+	LoadPersistentPointer(modinfo, siphashkey_rpc_subscription, rpc_subscription_generic_free);
+	LoadPersistentPointer(modinfo, subscribers, rpc_subscription_free_all);
+	if (siphashkey_rpc_subscription == NULL)
+	{
+		siphashkey_rpc_subscription = safe_alloc(SIPHASH_KEY_LENGTH);
+		siphash_generate_key(siphashkey_rpc_subscription);
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "rpc_subscriber";
+	mreq.type = MODDATATYPE_LOCAL_CLIENT;
+	mreq.free = rpc_subscriber_free;
+	rpc_subscriber_md = ModDataAdd(modinfo->handle, mreq);
+	if (!rpc_subscriber_md)
+	{
+		config_error("[rpc/subscription] Could not register moddata");
+		return MOD_FAILED;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.method = "log.subscribe";
+	r.call = rpc_log_subscribe;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/subscription] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	r.method = "log.unsubscribe";
+	r.call = rpc_log_unsubscribe;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/subscription] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	for (i = RPC_STREAM_USER; i < RPC_STREAM_COUNT; i++)
+	{
+		char method[64];
+
+		snprintf(method, sizeof(method), "%s.subscribe", stream_names[i]);
+		r.method = method;
+		r.call = rpc_stream_subscribe;
+		if (!RPCHandlerAdd(modinfo->handle, &r))
+		{
+			config_error("[rpc/subscription] Could not register RPC handler");
+			return MOD_FAILED;
+		}
+		snprintf(method, sizeof(method), "%s.unsubscribe", stream_names[i]);
+		r.method = method;
+		r.call = rpc_stream_unsubscribe;
+		if (!RPCHandlerAdd(modinfo->handle, &r))
+		{
+			config_error("[rpc/subscription] Could not register RPC handler");
+			return MOD_FAILED;
+		}
+	}
+
+	HookAdd(modinfo->handle, HOOKTYPE_LOG, 0, rpc_subscription_log);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CONNECT, 0, rpc_subscription_user_connect);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_CONNECT, 0, rpc_subscription_user_connect);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_QUIT, 0, rpc_subscription_user_quit);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_QUIT, 0, rpc_subscription_user_quit);
+	HookAdd(modinfo->handle, HOOKTYPE_POST_LOCAL_NICKCHANGE, 0, rpc_subscription_user_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_POST_REMOTE_NICKCHANGE, 0, rpc_subscription_user_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_UMODE_CHANGE, 0, rpc_subscription_user_umode_change);
+	HookAdd(modinfo->handle, HOOKTYPE_USERHOST_CHANGE, 0, rpc_subscription_user_userhost_change);
+	HookAdd(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, 0, rpc_subscription_user_account_login);
+	HookAdd(modinfo->handle, HOOKTYPE_REALNAME_CHANGE, 0, rpc_subscription_user_realname_change);
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_CREATE, 0, rpc_subscription_channel_create);
+	/* Run late, so we see the final verdict of *should_destroy: */
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_DESTROY, 1000000, rpc_subscription_channel_destroy);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_JOIN, 0, rpc_subscription_join);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_JOIN, 0, rpc_subscription_join);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_PART, 0, rpc_subscription_part);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_PART, 0, rpc_subscription_part);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_KICK, 0, rpc_subscription_kick);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_KICK, 0, rpc_subscription_kick);
+	HookAdd(modinfo->handle, HOOKTYPE_TOPIC, 0, rpc_subscription_topic);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CHANMODE, 0, rpc_subscription_chanmode);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_CHANMODE, 0, rpc_subscription_chanmode);
+	HookAdd(modinfo->handle, HOOKTYPE_TKL_ADD, 0, rpc_subscription_tkl_add);
+	HookAdd(modinfo->handle, HOOKTYPE_TKL_DEL, 0, rpc_subscription_tkl_del);
+
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	recalculate_subscribed_streams();
+	websocket_md = findmoddata_byname("websocket", MODDATATYPE_CLIENT); /* can be NULL */
+	EventAdd(modinfo->handle, "rpc_subscription_flush", rpc_subscription_flush, NULL, RPC_SUBSCRIPTION_FLUSH_MSEC, 0);
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	SavePersistentPointer(modinfo, siphashkey_rpc_subscription);
+	SavePersistentPointer(modinfo, subscribers);
+	return MOD_SUCCESS;
+}
+
+/*** Subscriber and queue management ***/
+
+static void recalculate_subscribed_streams(void)
+{
+	RPCSubscriber *s;
+
+	subscribed_streams = 0;
+	for (s = subscribers; s; s = s->next)
+		subscribed_streams |= s->streams;
+}
+
+/** Can this RPC client receive notifications? Only if it is a persistent connection. */
+static int rpc_client_can_subscribe(Client *client)
+{
+	if (!MyConnect(client) || !client->local->listener || !client->local->listener->rpc_options)
+		return 0;
+	if (client->local->listener->socket_type == SOCKET_TYPE_UNIX)
+		return 1;
+	if (websocket_md && WSU(client) && WSU(client)->handshake_completed)
+		return 1;
+	return 0;
+}
+
+static RPCSubscriber *rpc_subscriber_get(Client *client)
+{
+	RPCSubscriber *s = RPCSUB(client);
+
+	if (!s)
+	{
+		s = safe_alloc(sizeof(RPCSubscriber));
+		s->client = client;
+		s->md_slot = rpc_subscriber_md->slot;
+		moddata_local_client(client, rpc_subscriber_md).ptr = s;
+		AddListItem(s, subscribers);
+	}
+	return s;
+}
+
+static void rpc_event_free(RPCEvent *e)
+{
+	safe_free(e->key);
+	safe_free(e->name);
+	if (e->data)
+		json_decref(e->data);
+	safe_free(e);
+}
+
+static unsigned int rpc_event_hash(RPCStream stream, const char *key)
+{
+	return (siphash(key, siphashkey_rpc_subscription) + stream) % RPC_SUBSCRIPTION_HASH_SIZE;
+}
+
+static void rpc_event_hash_del(RPCSubscriber *s, RPCEvent *e)
+{
+	RPCEvent **p;
+
+	for (p = &s->hash[rpc_event_hash(e->stream, e->key)]; *p; p = &(*p)->hnext)
+	{
+		if (*p == e)
+		{
+			*p = e->hnext;
+			return;
+		}
+	}
+}
+
+/** Remove an event from the queue and free it */
+static void rpc_event_dequeue(RPCSubscriber *s, RPCEvent *e)
+{
+	if (e->key)
+		rpc_event_hash_del(s, e);
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		s->queue = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		s->queue_tail = e->prev;
+	s->queue_len--;
+	rpc_event_free(e);
+}
+
+/** Throw away all queued events of a stream (or all streams if stream is -1) */
+static void rpc_queue_purge(RPCSubscriber *s, int stream)
+{
+	RPCEvent *e, *e_next;
+
+	for (e = s->queue; e; e = e_next)
+	{
+		e_next = e->next;
+		if ((stream == -1) || (e->stream == stream))
+			rpc_event_dequeue(s, e);
+	}
+}
+
+void rpc_subscriber_free(ModData *m)
+{
+	RPCSubscriber *s = (RPCSubscriber *)m->ptr;
+
+	if (!s)
+		return;
+	rpc_queue_purge(s, -1);
+	free_log_sources(s->log_sources);
+	DelListItem(s, subscribers);
+	safe_free(s);
+	m->ptr = NULL;
+	recalculate_subscribed_streams();
+}
+
+/** Free all subscribers, only called when the module is unloaded for good. */
+void rpc_subscription_free_all(ModData *m)
+{
+	RPCSubscriber *s, *s_next;
+
+	for (s = (RPCSubscriber *)m->ptr; s; s = s_next)
+	{
+		s_next = s->next;
+		rpc_queue_purge(s, -1);
+		free_log_sources(s->log_sources);
+		/* RPC clients are not in lclient_list, so the moddata
+		 * system won't clear this for us:
+		 */
+		s->client->local->moddata[s->md_slot].ptr = NULL;
+		safe_free(s);
+	}
+	m->ptr = NULL;
+}
+
+void rpc_subscription_generic_free(ModData *m)
+{
+	safe_free(m->ptr);
+}
+
+/** Queue an event for a subscriber, coalescing it with any
+ * queued event for the same object.
+ * @param s		The subscriber
+ * @param stream	The stream
+ * @param action	One of RPC_EVENT_*
+ * @param key		Key of the object, or NULL for log events
+ * @param name		Name of the object (used for 'remove' events)
+ * @param data		JSON data, we take a new reference (may be NULL)
+ */
+static void rpc_event_queue(RPCSubscriber *s, RPCStream stream, RPCEventAction action, const char *key, const char *name, json_t *data)
+{
+	RPCEvent *e;
+
+	if (s->resync & RPC_STREAM_MASK(stream))
+		return; /* they will be doing a full resync anyway */
+
+	if (key)
+	{
+		for (e = s->hash[rpc_event_hash(stream, key)]; e; e = e->hnext)
+			if ((e->stream == stream) && !strcmp(e->key, key))
+				break;
+		if (e)
+		{
+			/* Coalesce with the already queued event for this object */
+			if ((e->action == RPC_EVENT_ADD) && (action == RPC_EVENT_REMOVE))
+			{
+				/* Created and gone before the client ever heard of it */
+				rpc_event_dequeue(s, e);
+				return;
+			}
+			if ((e->action == RPC_EVENT_ADD) && (action == RPC_EVENT_UPDATE))
+				action = RPC_EVENT_ADD; /* still new to the client */
+			else if ((e->action == RPC_EVENT_REMOVE) && (action == RPC_EVENT_ADD))
+				action = RPC_EVENT_UPDATE; /* client never saw it go */
+			e->action = action;
+			safe_strdup(e->name, name);
+			if (e->data)
+				json_decref(e->data);
+			e->data = data;
+			if (data)
+				json_incref(data);
+			return;
+		}
+	}
+
+	if (s->queue_len >= RPC_SUBSCRIPTION_MAX_QUEUE)
+	{
+		if (stream == RPC_STREAM_LOG)
+		{
+			s->log_dropped++;
+		} else {
+			/* Don't try to be smart: drop this stream and let them resync */
+			rpc_queue_purge(s, stream);
+			s->resync |= RPC_STREAM_MASK(stream);
+		}
+		return;
+	}
+
+	e = safe_alloc(sizeof(RPCEvent));
+	e->stream = stream;
+	e->action = action;
+	safe_strdup(e->key, key);
+	safe_strdup(e->name, name);
+	e->data = data;
+	if (data)
+		json_incref(data);
+
+	/* Append to queue */
+	e->prev = s->queue_tail;
+	if (s->queue_tail)
+		s->queue_tail->next = e;
+	else
+		s->queue = e;
+	s->queue_tail = e;
+	s->queue_len++;
+
+	if (key)
+	{
+		unsigned int hashv = rpc_event_hash(stream, key);
+		e->hnext = s->hash[hashv];
+		s->hash[hashv] = e;
+	}
+}
+
+/** Queue an object event for all subscribers of the stream */
+static void rpc_event_broadcast(RPCStream stream, RPCEventAction action, const char *key, const char *name, json_t *data)
+{
+	RPCSubscriber *s;
+
+	for (s = subscribers; s; s = s->next)
+		if (s->streams & RPC_STREAM_MASK(stream))
+			rpc_event_queue(s, stream, action, key, name, data);
+}
+
+/*** Sending ***/
+
+/** Send a single event to the subscriber.
+ * Object events are expanded here, at flush time, so the client
+ * always gets the latest state after coalescing.
+ */
+static void rpc_event_send(Client *client, RPCEvent *e)
+{
+	static const char *actions[] = { "log", "add", "update", "remove" };
+	char method[64];
+	json_t *params;
+
+	if (e->stream == RPC_STREAM_LOG)
+	{
+		rpc_send_notification(client, "log.event", e->data);
+		return;
+	}
+
+	params = json_object();
+	if (e->stream == RPC_STREAM_USER)
+	{
+		Client *acptr = (e->action == RPC_EVENT_REMOVE) ? NULL : hash_find_id(e->key, NULL);
+		if (acptr && IsUser(acptr))
+		{
+			json_object_set_new(params, "action", json_string_unreal(actions[e->action]));
+			json_expand_client(params, "client", acptr, 1);
+		} else {
+			json_t *j = json_object();
+			json_object_set_new(params, "action", json_string_unreal("remove"));
+			json_object_set_new(j, "name", json_string_unreal(e->name));
+			json_object_set_new(j, "id", json_string_unreal(e->key));
+			json_object_set_new(params, "client", j);
+		}
+	} else
+	if (e->stream == RPC_STREAM_CHANNEL)
+	{
+		Channel *channel = (e->action == RPC_EVENT_REMOVE) ? NULL : find_channel(e->key);
+		if (channel)
+		{
+			json_object_set_new(params, "action", json_string_unreal(actions[e->action]));
+			json_expand_channel(params, "channel", channel, 1);
+		} else {
+			json_t *j = json_object();
+			json_object_set_new(params, "action", json_string_unreal("remove"));
+			json_object_set_new(j, "name", json_string_unreal(e->key));
+			json_object_set_new(params, "channel", j);
+		}
+	} else
+	{
+		json_object_set_new(params, "action", json_string_unreal(actions[e->action]));
+		json_object_set(params, "tkl", e->data);
+	}
+
+	snprintf(method, sizeof(method), "%s.event", stream_names[e->stream]);
+	rpc_send_notification(client, method, params);
+	json_decref(params);
+}
+
+static void rpc_subscriber_flush(RPCSubscriber *s)
+{
+	Client *client = s->client;
+	int i;
+
+	if (IsDead(client))
+		return;
+
+	for (i = 0; i < RPC_STREAM_COUNT; i++)
+	{
+		if (s->resync & RPC_STREAM_MASK(i))
+		{
+			char method[64];
+			json_t *params = json_object();
+			json_object_set_new(params, "action", json_string_unreal("resync"));
+			snprintf(method, sizeof(method), "%s.event", stream_names[i]);
+			rpc_send_notification(client, method, params);
+			json_decref(params);
+		}
+	}
+	s->resync = 0;
+
+	if (s->log_dropped)
+	{
+		json_t *params = json_object();
+		json_object_set_new(params, "count", json_integer(s->log_dropped));
+		rpc_send_notification(client, "log.dropped", params);
+		json_decref(params);
+		s->log_dropped = 0;
+	}
+
+	/* Send in order. We stop early if the client is slow, the
+	 * remaining events stay queued (and keep being coalesced).
+	 */
+	while (s->queue && (DBufLength(&client->local->sendQ) < RPC_SUBSCRIPTION_MAX_SENDQ))
+	{
+		RPCEvent *e = s->queue;
+		rpc_event_send(client, e);
+		rpc_event_dequeue(s, e);
+	}
+
+	send_queued(client);
+}
+
+EVENT(rpc_subscription_flush)
+{
+	RPCSubscriber *s, *s_next;
+
+	for (s = subscribers; s; s = s_next)
+	{
+		s_next = s->next;
+		if (s->queue || s->resync || s->log_dropped)
+			rpc_subscriber_flush(s);
+	}
+}
+
+/*** RPC calls ***/
+
+RPC_CALL_FUNC(rpc_log_subscribe)
+{
+	json_t *sources, *value;
+	size_t index;
+	RPCSubscriber *s;
+	LogSource *ls;
+
+	if (!rpc_client_can_subscribe(client))
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_INVALID_REQUEST, "Subscriptions are only possible over websocket or unix socket connections");
+		return;
+	}
+
+	sources = json_object_get(params, "sources");
+	if (!sources || !json_is_array(sources) || !json_array_size(sources))
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Missing parameter: 'sources' (array of log sources, eg [\"all\", \"!debug\"])");
+		return;
+	}
+
+	json_array_foreach(sources, index, value)
+	{
+		const char *str = json_string_value(value);
+		if (!str || !*str)
+		{
+			rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Invalid value in 'sources': should be an array of strings");
+			return;
+		}
+	}
+
+	/* A new subscription replaces the previous one */
+	s = rpc_subscriber_get(client);
+	free_log_sources(s->log_sources);
+	s->log_sources = NULL;
+	json_array_foreach(sources, index, value)
+	{
+		ls = add_log_source(json_string_value(value));
+		AddListItem(ls, s->log_sources);
+	}
+	s->streams |= RPC_STREAM_MASK(RPC_STREAM_LOG);
+	recalculate_subscribed_streams();
+
+	rpc_response(client, request, json_true());
+}
+
+RPC_CALL_FUNC(rpc_log_unsubscribe)
+{
+	RPCSubscriber *s = RPCSUB(client);
+
+	if (s)
+	{
+		s->streams &= ~RPC_STREAM_MASK(RPC_STREAM_LOG);
+		free_log_sources(s->log_sources);
+		s->log_sources = NULL;
+		rpc_queue_purge(s, RPC_STREAM_LOG);
+		s->log_dropped = 0;
+		recalculate_subscribed_streams();
+	}
+	rpc_response(client, request, json_true());
+}
+
+/** Map "user.subscribe" etc. to the stream */
+static int stream_from_method(json_t *request)
+{
+	const char *method = json_object_get_string(request, "method");
+	int i;
+
+	for (i = RPC_STREAM_USER; i < RPC_STREAM_COUNT; i++)
+	{
+		size_t len = strlen(stream_names[i]);
+		if (!strncasecmp(method, stream_names[i], len) && (method[len] == '.'))
+			return i;
+	}
+	return -1;
+}
+
+RPC_CALL_FUNC(rpc_stream_subscribe)
+{
+	RPCSubscriber *s;
+	int stream = stream_from_method(request);
+
+	if (stream < 0)
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_METHOD_NOT_FOUND, "Unsupported method");
+		return;
+	}
+
+	if (!rpc_client_can_subscribe(client))
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_INVALID_REQUEST, "Subscriptions are only possible over websocket or unix socket connections");
+		return;
+	}
+
+	s = rpc_subscriber_get(client);
+	s->streams |= RPC_STREAM_MASK(stream);
+	recalculate_subscribed_streams();
+
+	rpc_response(client, request, json_true());
+}
+
+RPC_CALL_FUNC(rpc_stream_unsubscribe)
+{
+	RPCSubscriber *s = RPCSUB(client);
+	int stream = stream_from_method(request);
+
+	if (stream < 0)
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_METHOD_NOT_FOUND, "Unsupported method");
+		return;
+	}
+
+	if (s)
+	{
+		s->streams &= ~RPC_STREAM_MASK(stream);
+		s->resync &= ~RPC_STREAM_MASK(stream);
+		rpc_queue_purge(s, stream);
+		recalculate_subscribed_streams();
+	}
+	rpc_response(client, request, json_true());
+}
+
+/*** Hooks ***/
+
+int rpc_subscription_log(LogLevel loglevel, const char *subsystem, const char *event_id, MultiLine *msg, const char *json_serialized, const char *timebuf)
+{
+	RPCSubscriber *s;
+	json_t *j = NULL;
+
+	if (!WantStream(RPC_STREAM_LOG))
+		return 0;
+
+	for (s = subscribers; s; s = s->next)
+	{
+		if (!(s->streams & RPC_STREAM_MASK(RPC_STREAM_LOG)) ||
+		    !log_sources_match(s->log_sources, loglevel, subsystem, event_id, 0))
+		{
+			continue;
+		}
+		/* Only parse the JSON if there is someone interested, and only once */
+		if (!j)
+		{
+			j = json_loads(json_serialized, 0, NULL);
+			if (!j)
+				return 0;
+		}
+		rpc_event_queue(s, RPC_STREAM_LOG, RPC_EVENT_LOG, NULL, NULL, j);
+	}
+
+	if (j)
+		json_decref(j);
+	return 0;
+}
+
+static void rpc_user_event(Client *client, RPCEventAction action)
+{
+	if (!WantStream(RPC_STREAM_USER) || !*client->id)
+		return;
+	rpc_event_broadcast(RPC_STREAM_USER, action, client->id, client->name, NULL);
+}
+
+static void rpc_channel_event(Channel *channel, RPCEventAction action)
+{
+	if (!WantStream(RPC_STREAM_CHANNEL))
+		return;
+	rpc_event_broadcast(RPC_STREAM_CHANNEL, action, channel->name, channel->name, NULL);
+}
+
+int rpc_subscription_user_connect(Client *client)
+{
+	rpc_user_event(client, RPC_EVENT_ADD);
+	return 0;
+}
+
+int rpc_subscription_user_quit(Client *client, MessageTag *mtags, const char *comment)
+{
+	rpc_user_event(client, RPC_EVENT_REMOVE);
+	if (WantStream(RPC_STREAM_CHANNEL) && client->user)
+	{
+		/* Member count changes for all the channels the user was in */
+		Membership *mb;
+		for (mb = client->user->channel; mb; mb = mb->next)
+			rpc_channel_event(mb->channel, RPC_EVENT_UPDATE);
+	}
+	return 0;
+}
+
+int rpc_subscription_user_nickchange(Client *client, MessageTag *mtags, const char *oldnick)
+{
+	rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_user_umode_change(Client *client, long setflags, long newflags)
+{
+	if (IsUser(client))
+		rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_user_userhost_change(Client *client, const char *olduser, const char *oldhost)
+{
+	if (IsUser(client))
+		rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_user_account_login(Client *client, MessageTag *mtags)
+{
+	if (IsUser(client))
+		rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_user_realname_change(Client *client, const char *oldinfo)
+{
+	if (IsUser(client))
+		rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_channel_create(Channel *channel)
+{
+	rpc_channel_event(channel, RPC_EVENT_ADD);
+	return 0;
+}
+
+int rpc_subscription_channel_destroy(Channel *channel, int *should_destroy)
+{
+	if (*should_destroy)
+		rpc_channel_event(channel, RPC_EVENT_REMOVE);
+	return 0;
+}
+
+int rpc_subscription_join(Client *client, Channel *channel, MessageTag *mtags)
+{
+	rpc_channel_event(channel, RPC_EVENT_UPDATE);
+	rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_part(Client *client, Channel *channel, MessageTag *mtags, const char *comment)
+{
+	rpc_channel_event(channel, RPC_EVENT_UPDATE);
+	rpc_user_event(client, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_kick(Client *client, Client *victim, Channel *channel, MessageTag *mtags, const char *comment)
+{
+	rpc_channel_event(channel, RPC_EVENT_UPDATE);
+	rpc_user_event(victim, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_topic(Client *client, Channel *channel, MessageTag *mtags, const char *topic)
+{
+	rpc_channel_event(channel, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+int rpc_subscription_chanmode(Client *client, Channel *channel, MessageTag *mtags, const char *modebuf, const char *parabuf, time_t sendts, int samode, int *destroy_channel)
+{
+	rpc_channel_event(channel, RPC_EVENT_UPDATE);
+	return 0;
+}
+
+static void rpc_server_ban_event(TKL *tkl, RPCEventAction action)
+{
+	char key[BUFSIZE], uhost[BUFSIZE];
+	json_t *j;
+
+	if (!WantStream(RPC_STREAM_SERVER_BAN) || !TKLIsServerBan(tkl))
+		return;
+
+	snprintf(key, sizeof(key), "%c:%s",
+	         tkl_typetochar(tkl->type),
+	         tkl_uhost(tkl, uhost, sizeof(uhost), 0));
+	/* Bans have no cheap lookup by key, so expand them now */
+	j = json_object();
+	json_expand_tkl(j, NULL, tkl, 1);
+	rpc_event_broadcast(RPC_STREAM_SERVER_BAN, action, key, key, j);
+	json_decref(j);
+}
+
+int rpc_subscription_tkl_add(Client *client, TKL *tkl)
+{
+	rpc_server_ban_event(tkl, RPC_EVENT_ADD);
+	return 0;
+}
+
+int rpc_subscription_tkl_del(Client *client, TKL *tkl)
+{
+	rpc_server_ban_event(tkl, RPC_EVENT_REMOVE);
+	return 0;
+}
@@ -66,9 +66,6 @@ long CAP_SASL = 0L;
 
 int sasl_account_login(Client *client, MessageTag *mtags)
 {
-	if (!MyConnect(client))
-		return 0;
-
 	/* Notify user */
 	if (IsLoggedIn(client))
 	{
@@ -328,7 +325,7 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_QUIT, 0, sasl_quit);
 	HookAdd(modinfo->handle, HOOKTYPE_SERVER_QUIT, 0, sasl_server_quit);
 	HookAdd(modinfo->handle, HOOKTYPE_SERVER_SYNCED, 0, sasl_server_synced);
-	HookAdd(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, 0, sasl_account_login);
+	HookAddLocal(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, 0, sasl_account_login);
 
 	memset(&cap, 0, sizeof(cap));
 	cap.name = "sasl";
@@ -266,32 +266,23 @@ CMD_FUNC(cmd_sjoin)
 		{
 			Ban *ban = channel->banlist;
 			Addit('b', ban->banstr);
-			channel->banlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
+			del_listmode(&channel->banlist, channel, ban->banstr);
 		}
 		while(channel->exlist)
 		{
 			Ban *ban = channel->exlist;
 			Addit('e', ban->banstr);
-			channel->exlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
+			del_listmode(&channel->exlist, channel, ban->banstr);
 		}
 		while(channel->invexlist)
 		{
 			Ban *ban = channel->invexlist;
 			Addit('I', ban->banstr);
-			channel->invexlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
+			del_listmode(&channel->invexlist, channel, ban->banstr);
 		}
 		for (lp = channel->members; lp; lp = lp->next)
 		{
-			Membership *lp2 = find_membership_link(lp->client->user->channel, channel);
+			Membership *lp2 = find_membership(lp->client, channel);
 
 			/* Remove all our modes, one by one */
 			for (p = lp->member_modes; *p; p++)
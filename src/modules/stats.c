@@ -85,6 +85,8 @@ int stats_class(Client *, const char *);
 int stats_officialchannels(Client *, const char *);
 int stats_spamfilter(Client *, const char *);
 int stats_fdtable(Client *, const char *);
+int stats_profiler(Client *, const char *);
+int stats_memory(Client *, const char *);
 
 #define SERVER_AS_PARA 0x1
 #define FLAGS_AS_PARA 0x2
@@ -130,6 +132,7 @@ struct statstab StatsTable[] = {
 	{ 'm', "command",	stats_command,		0 		},
 	{ 'n', "banrealname",	stats_banrealname,	0 		},
 	{ 'o', "oper",		stats_oper,		0 		},
+	{ 'p', "profiler",	stats_profiler,		0 		},
 	{ 'q', "bannick",	stats_bannick,		FLAGS_AS_PARA	},
 	{ 'r', "chanrestrict",	stats_chanrestrict,	0 		},
 	{ 's', "shun",		stats_shun,		FLAGS_AS_PARA	},
@@ -138,6 +141,7 @@ struct statstab StatsTable[] = {
 	{ 'v', "denyver",	stats_denyver,		0 		},
 	{ 'x', "notlink",	stats_notlink,		0 		},
 	{ 'y', "class",		stats_class,		0 		},
+	{ 'z', "memory",	stats_memory,		0 		},
 	{ 0, 	NULL, 		NULL, 			0		}
 };
 
@@ -209,6 +213,7 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "M - command - Send list of how many times each command was used");
 	sendnumeric(client, RPL_STATSHELP, "n - banrealname - Send the ban realname block list");
 	sendnumeric(client, RPL_STATSHELP, "O - oper - Send the oper block list");
+	sendnumeric(client, RPL_STATSHELP, "p - profiler - Send the profiler results (see /PROFILER)");
 	sendnumeric(client, RPL_STATSHELP, "P - port - Send information about ports");
 	sendnumeric(client, RPL_STATSHELP, "q - bannick - Send the ban nick block list");
 	sendnumeric(client, RPL_STATSHELP, "Q - sqline - Send the global qline list");
@@ -228,6 +233,7 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "W - fdtable - Send the FD table listing");
 	sendnumeric(client, RPL_STATSHELP, "X - notlink - Send the list of servers that are not current linked");
 	sendnumeric(client, RPL_STATSHELP, "Y - class - Send the class block list");
+	sendnumeric(client, RPL_STATSHELP, "z - memory - Send memory allocator statistics");
 }
 
 static inline int allow_user_stats_short(char c)
@@ -540,10 +546,11 @@ static char *stats_port_helper(ConfigItem_listen *listener)
 {
 	static char buf[256];
 
-	ircsnprintf(buf, sizeof(buf), "%s%s%s",
+	ircsnprintf(buf, sizeof(buf), "%s%s%s%s",
 	    (listener->options & LISTENER_CLIENTSONLY)? "clientsonly ": "",
 	    (listener->options & LISTENER_SERVERSONLY)? "serversonly ": "",
-	    (listener->options & LISTENER_DEFER_ACCEPT)? "defer-accept ": "");
+	    (listener->options & LISTENER_DEFER_ACCEPT)? "defer-accept ": "",
+	    (listener->options & LISTENER_REUSEPORT)? "reuseport ": "");
 
 	/* And one of these.. */
 	if (listener->options & LISTENER_CONTROL)
@@ -628,6 +635,10 @@ int stats_traffic(Client *client, const char *para)
 	sendnumericfmt(client, RPL_STATSDEBUG, "numerics seen %u mode fakes %u", sp->is_num, sp->is_fake);
 	sendnumericfmt(client, RPL_STATSDEBUG, "auth successes %u fails %u", sp->is_asuc, sp->is_abad);
 	sendnumericfmt(client, RPL_STATSDEBUG, "local connections %u udp packets %u", sp->is_loc, sp->is_udp);
+	sendnumericfmt(client, RPL_STATSDEBUG, "TLS handshakes full %llu resumed %llu",
+	    (unsigned long long)metrics.tls_handshakes_full, (unsigned long long)metrics.tls_handshakes_resumed);
+	sendnumericfmt(client, RPL_STATSDEBUG, "TLS kernel offload enabled %llu fallback %llu",
+	    (unsigned long long)metrics.tls_ktls_enabled, (unsigned long long)metrics.tls_ktls_fallback);
 	sendnumericfmt(client, RPL_STATSDEBUG, "Client Server");
 	sendnumericfmt(client, RPL_STATSDEBUG, "connected %u %u", sp->is_cl, sp->is_sv);
 	sendnumericfmt(client, RPL_STATSDEBUG, "messages sent %lld", me.local->traffic.messages_sent);
@@ -644,7 +655,7 @@ int stats_fdtable(Client *client, const char *para)
 {
 	int i;
 
-	for (i = 0; i < MAXCONNECTIONS; i++)
+	for (i = 0; i < fd_table_size; i++)
 	{
 		FDEntry *fde = &fd_table[i];
 
@@ -659,6 +670,101 @@ int stats_fdtable(Client *client, const char *para)
 	return 0;
 }
 
+/** Number of entries to show in /STATS profiler */
+#define STATS_PROFILER_MAX_ENTRIES 40
+
+int stats_profiler(Client *client, const char *para)
+{
+	ProfilerEntry *entries, *e;
+	ProfilerHistogram *h;
+	int cnt, i;
+	const char *type;
+
+	if (profiler_enabled)
+		sendtxtnumeric(client, "Profiler is enabled, collecting data since %lld seconds", (long long)(TStime() - profiler_enabled_since));
+	else
+		sendtxtnumeric(client, "Profiler is disabled, use /PROFILER ON to enable it");
+
+	cnt = profiler_get_entries(&entries);
+	for (i = 0; (i < cnt) && (i < STATS_PROFILER_MAX_ENTRIES); i++)
+	{
+		e = &entries[i];
+		h = e->histogram;
+		if (e->type == PROFILER_ENTRY_COMMAND)
+			type = "command";
+		else if (e->type == PROFILER_ENTRY_HOOKTYPE)
+			type = "hooktype";
+		else
+			type = "hook";
+		sendtxtnumeric(client, "%s %s%s%s%s: calls=%llu total=%.0fus avg=%.2fus p50=%.2fus p99=%.2fus max=%.2fus",
+		               type, e->name,
+		               e->module ? " [" : "", e->module ? e->module : "", e->module ? "]" : "",
+		               (unsigned long long)h->count,
+		               profiler_to_usec(h->sum),
+		               profiler_to_usec(h->sum) / h->count,
+		               profiler_to_usec(profiler_percentile(h, 50.0)),
+		               profiler_to_usec(profiler_percentile(h, 99.0)),
+		               profiler_to_usec(h->max));
+	}
+	if (cnt > STATS_PROFILER_MAX_ENTRIES)
+		sendtxtnumeric(client, "(%d more entries not shown)", cnt - STATS_PROFILER_MAX_ENTRIES);
+	safe_free(entries);
+	return 0;
+}
+
+/** Number of commands to show in /STATS memory */
+#define STATS_MEMORY_MAX_COMMANDS 20
+
+static int stats_memory_cmp(const void *a, const void *b)
+{
+	const RealCommand *x = *(const RealCommand **)a;
+	const RealCommand *y = *(const RealCommand **)b;
+
+	if (x->scratch_allocs < y->scratch_allocs)
+		return 1;
+	if (x->scratch_allocs > y->scratch_allocs)
+		return -1;
+	return 0;
+}
+
+int stats_memory(Client *client, const char *para)
+{
+	RealCommand *cmds[256*8], *c;
+	mp_pool_t *pool;
+	unsigned long long used, allocated;
+	int cnt = 0, i;
+
+	sendtxtnumeric(client, "Scratch memory: %lld bytes, %llu allocations served (each one a malloc/free saved)",
+	               (long long)scratch_memory_size(), (unsigned long long)scratch_allocations);
+
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		if (!pool->name)
+			continue;
+		mp_pool_stats(pool, &used, &allocated);
+		sendtxtnumeric(client, "pool %s: item-size=%lld items=%llu used=%llu allocated=%llu chunks-allocated=%lld chunks-freed=%lld",
+		               pool->name, (long long)pool->item_alloc_size,
+		               pool->item_alloc_size ? used / pool->item_alloc_size : 0,
+		               used, allocated,
+		               (long long)pool->total_chunks_allocated,
+		               (long long)pool->total_chunks_freed);
+	}
+
+	for (i = 0; i < 256; i++)
+		for (c = CommandHash[i]; c; c = c->next)
+			if (c->scratch_allocs && c->count && (cnt < ARRAY_SIZEOF(cmds)))
+				cmds[cnt++] = c;
+	qsort(cmds, cnt, sizeof(RealCommand *), stats_memory_cmp);
+	for (i = 0; (i < cnt) && (i < STATS_MEMORY_MAX_COMMANDS); i++)
+	{
+		sendtxtnumeric(client, "command %s: calls=%u scratch-allocations=%llu per-call=%.2f",
+		               cmds[i]->cmd, cmds[i]->count,
+		               (unsigned long long)cmds[i]->scratch_allocs,
+		               (double)cmds[i]->scratch_allocs / cmds[i]->count);
+	}
+	return 0;
+}
+
 int stats_uline(Client *client, const char *para)
 {
 	ConfigItem_ulines *ulines;
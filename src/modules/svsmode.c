@@ -273,7 +273,7 @@ void channel_svsmode(Client *client, int parc, const char *parv[])
 			{
 				if (check_channel_access_letter(member->member_modes, *m))
 				{
-					Membership *mb = find_membership_link(member->client->user->channel, channel);
+					Membership *mb = find_membership(member->client, channel);
 					if (!mb)
 						continue; /* bug */
 					
@@ -108,6 +108,10 @@ int _server_ban_parse_mask(Client *client, int add, char type, const char *str,
 static void add_default_exempts(void);
 int parse_extended_server_ban(const char *mask_in, Client *client, char **error, int skip_checking, char *buf1, size_t buf1len, char *buf2, size_t buf2len);
 void _tkl_added(Client *client, TKL *tkl);
+void _tkl_check_pending_bans(void);
+static void tkl_pending_ban_add(TKL *tkl);
+static void tkl_pending_ban_del(TKL *tkl);
+static int tkl_ban_client(Client *client, TKL *tkl);
 
 /* Externals (only for us :D) */
 extern int MODVAR spamf_ugly_vchanoverride;
@@ -158,6 +162,12 @@ TKLTypeTable tkl_types[] = {
 #define ALL_VALID_EXCEPTION_TYPES "kline, gline, zline, gzline, spamfilter, shun, qline, blacklist, connect-flood, handshake-data-flood, antirandom, antimixedutf8, ban-version"
 
 int max_stats_matches = 1000;
+
+/** Server bans that still need to be applied to existing clients, see tkl_check_pending_bans() */
+static TKL **pending_bans = NULL;
+static int pending_bans_count = 0;
+static int pending_bans_size = 0;
+static char bancheck_siphashkey[SIPHASH_KEY_LENGTH];
 int mtag_spamfilters_present = 0; /**< Are any spamfilters with type SPAMF_MTAG present? */
 
 MOD_TEST()
@@ -214,6 +224,7 @@ MOD_TEST()
 	EfunctionAdd(modinfo->handle, EFUNC_UNREAL_MATCH_IPLIST, _unreal_match_iplist);
 	EfunctionAdd(modinfo->handle, EFUNC_SERVER_BAN_PARSE_MASK, TO_INTFUNC(_server_ban_parse_mask));
 	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_ADDED, _tkl_added);
+	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_CHECK_PENDING_BANS, _tkl_check_pending_bans);
 	return MOD_SUCCESS;
 }
 
@@ -226,6 +237,7 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, tkl_config_run_set);
 	HookAdd(modinfo->handle, HOOKTYPE_IP_CHANGE, 2000000000, tkl_ip_change);
 	HookAdd(modinfo->handle, HOOKTYPE_ACCEPT, -1000, tkl_accept);
+	siphash_generate_key(bancheck_siphashkey);
 	CommandAdd(modinfo->handle, "GLINE", cmd_gline, 3, CMD_OPER);
 	CommandAdd(modinfo->handle, "SHUN", cmd_shun, 3, CMD_OPER);
 	CommandAdd(modinfo->handle, "TEMPSHUN", cmd_tempshun, 2, CMD_OPER);
@@ -249,6 +261,19 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	int i;
+
+	/* Bans that were not applied yet get picked up by a full check */
+	for (i = 0; i < pending_bans_count; i++)
+	{
+		if (pending_bans[i])
+		{
+			pending_bans[i]->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+			loop.do_bancheck = 1;
+		}
+	}
+	safe_free(pending_bans);
+	pending_bans_count = pending_bans_size = 0;
 	return MOD_SUCCESS;
 }
 
@@ -2773,6 +2798,9 @@ void _tkl_del_line(TKL *tkl)
 		DelListItem(tkl, tklines[index]);
 	}
 
+	if (tkl->flags & TKL_FLAG_BANCHECK_PENDING)
+		tkl_pending_ban_del(tkl);
+
 	/* Finally, free the entry */
 	free_tkl(tkl);
 	check_mtag_spamfilters_present();
@@ -3085,6 +3113,8 @@ int _find_tkline_match(Client *client, int skip_soft)
 	if (IsServer(client) || IsMe(client))
 		return 0;
 
+	metrics.tkl_checks++;
+
 	/* First, the TKL ip hash table entries.. */
 	index2 = tkl_ip_hash(GetIP(client));
 	if (index2 >= 0)
@@ -3093,6 +3123,7 @@ int _find_tkline_match(Client *client, int skip_soft)
 		{
 			for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
 			{
+				metrics.tkl_entries_scanned++;
 				banned = find_tkline_match_matcher(client, skip_soft, tkl);
 				if (banned)
 					break;
@@ -3109,6 +3140,7 @@ int _find_tkline_match(Client *client, int skip_soft)
 		{
 			for (tkl = tklines[index]; tkl; tkl = tkl->next)
 			{
+				metrics.tkl_entries_scanned++;
 				banned = find_tkline_match_matcher(client, skip_soft, tkl);
 				if (banned)
 					break;
@@ -3121,7 +3153,16 @@ int _find_tkline_match(Client *client, int skip_soft)
 	if (!banned)
 		return 0;
 
+	return tkl_ban_client(client, tkl);
+}
+
+/** Take action on a client that matched server ban 'tkl'.
+ * @returns 1 if the client was killed, 0 if not.
+ */
+static int tkl_ban_client(Client *client, TKL *tkl)
+{
 	/* User is banned... */
+	metrics.tkl_matches++;
 
 	RunHookReturnInt(HOOKTYPE_FIND_TKLINE_MATCH, !=99, client, tkl);
 
@@ -3188,6 +3229,325 @@ int _find_shun(Client *client)
 	return 0;
 }
 
+/* Applying new server bans to existing clients.
+ *
+ * Checking all local clients against all server bans whenever a ban is
+ * added is expensive: a netburst with thousands of G-Lines would cost
+ * clients x bans. Instead, new server bans are queued and applied by
+ * tkl_check_pending_bans(), which checks each ban only against the
+ * clients it can possibly match. These are found through indexes on
+ * IP (/24 or /64), host suffix, account and realname. The indexes are
+ * built when needed, from scratch memory, for each batch of new bans.
+ * Bans that can't be narrowed down (eg *@*.org) are still checked
+ * against all local clients, but only that single ban, of course.
+ */
+
+#define BANCHECK_INDEX_IP		0
+#define BANCHECK_INDEX_HOST		1
+#define BANCHECK_INDEX_ACCOUNT		2
+#define BANCHECK_INDEX_REALNAME		3
+#define BANCHECK_INDEXES		4
+
+typedef struct BanCheckEntry BanCheckEntry;
+struct BanCheckEntry {
+	BanCheckEntry *next;
+	Client *client;
+};
+
+typedef struct BanCheckIndex BanCheckIndex;
+struct BanCheckIndex {
+	unsigned int size; /**< Number of buckets (power of two) */
+	BanCheckEntry **table[BANCHECK_INDEXES]; /**< NULL if not built yet */
+};
+
+/** Queue a server ban for tkl_check_pending_bans() */
+static void tkl_pending_ban_add(TKL *tkl)
+{
+	if (tkl->flags & TKL_FLAG_BANCHECK_PENDING)
+		return;
+	if (pending_bans_count == pending_bans_size)
+	{
+		pending_bans_size = pending_bans_size ? pending_bans_size * 2 : 64;
+		pending_bans = realloc(pending_bans, sizeof(TKL *) * pending_bans_size);
+		if (!pending_bans)
+			outofmemory(sizeof(TKL *) * pending_bans_size);
+	}
+	pending_bans[pending_bans_count++] = tkl;
+	tkl->flags |= TKL_FLAG_BANCHECK_PENDING;
+}
+
+/** Remove a server ban from the queue (it is being deleted) */
+static void tkl_pending_ban_del(TKL *tkl)
+{
+	int i;
+
+	for (i = 0; i < pending_bans_count; i++)
+		if (pending_bans[i] == tkl)
+			pending_bans[i] = NULL;
+	tkl->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+}
+
+/** Index key of an IP: the /24 for IPv4 and the /64 for IPv6.
+ * @param ip	The IP address
+ * @param cidr	CIDR length or -1 for none
+ * @returns 1 if 'buf' was filled, 0 if not an IP or the CIDR is too wide.
+ */
+static int bancheck_ip_key(const char *ip, int cidr, char *buf, size_t buflen)
+{
+	unsigned char addr[16];
+
+	if (inet_pton(AF_INET, ip, addr) == 1)
+	{
+		if ((cidr >= 0) && (cidr < 24))
+			return 0;
+		snprintf(buf, buflen, "%d.%d.%d", addr[0], addr[1], addr[2]);
+		return 1;
+	}
+	if (inet_pton(AF_INET6, ip, addr) == 1)
+	{
+		if ((cidr >= 0) && (cidr < 64))
+			return 0;
+		snprintf(buf, buflen, "%02x%02x%02x%02x%02x%02x%02x%02x",
+		         addr[0], addr[1], addr[2], addr[3], addr[4], addr[5], addr[6], addr[7]);
+		return 1;
+	}
+	return 0;
+}
+
+/** Index key of a hostname: the last two labels, eg "example.org" for "irc.example.org" */
+static const char *bancheck_host_key(const char *host)
+{
+	const char *p, *last = NULL, *prev = NULL;
+
+	for (p = host; *p; p++)
+	{
+		if (*p == '.')
+		{
+			prev = last;
+			last = p;
+		}
+	}
+	return prev ? prev + 1 : host;
+}
+
+/** Index key for a host mask, or NULL if the mask is too wide.
+ * With wildcards, the literal part after the last wildcard must
+ * contain the complete last two labels, eg "*.example.org".
+ */
+static const char *bancheck_mask_host_key(const char *mask)
+{
+	const char *p, *tail = mask, *key;
+	int wild = 0;
+
+	for (p = mask; *p; p++)
+	{
+		if ((*p == '*') || (*p == '?'))
+		{
+			tail = p + 1;
+			wild = 1;
+		}
+	}
+	key = bancheck_host_key(tail);
+	if (!wild)
+		return key;
+	if (strchr(key, '.') && (key > tail) && (key[-1] == '.'))
+		return key;
+	return NULL;
+}
+
+/** Index key of a realname, or of a ~realname mask without wildcards.
+ * In such a mask a '_' also matches a space (see match_esc), so
+ * both are stored as a '_' in the key.
+ */
+static void bancheck_realname_key(char *buf)
+{
+	for (; *buf; buf++)
+		if (*buf == ' ')
+			*buf = '_';
+}
+
+/** Figure out which index can be used to find the clients that server ban 'tkl' can match.
+ * @returns One of BANCHECK_INDEX_* with the key in 'buf',
+ *          or -1 if all clients need to be checked.
+ */
+static int bancheck_tkl_key(TKL *tkl, char *buf, size_t buflen)
+{
+	const char *usermask = tkl->ptr.serverban->usermask;
+	const char *hostmask = tkl->ptr.serverban->hostmask;
+	const char *key;
+	char ip[HOSTLEN+1], *p;
+	int cidr = -1;
+
+	if (is_extended_server_ban(usermask))
+	{
+		/* Only exact matches, and not ~account:0 (all unauthenticated users) */
+		if (strpbrk(hostmask, "*?\\") || !strcmp(hostmask, "0"))
+			return -1;
+		strlcpy(buf, hostmask, buflen);
+		if (!strcmp(usermask, "~a:") || !strcmp(usermask, "~account:"))
+			return BANCHECK_INDEX_ACCOUNT;
+		if (!strcmp(usermask, "~r:") || !strcmp(usermask, "~realname:"))
+		{
+			bancheck_realname_key(buf);
+			return BANCHECK_INDEX_REALNAME;
+		}
+		return -1;
+	}
+
+	if (!strpbrk(hostmask, "*?"))
+	{
+		strlcpy(ip, hostmask, sizeof(ip));
+		if ((p = strchr(ip, '/')))
+		{
+			*p++ = '\0';
+			cidr = atoi(p);
+			if (cidr <= 0)
+				return -1;
+		}
+		if (bancheck_ip_key(ip, cidr, buf, buflen))
+			return BANCHECK_INDEX_IP;
+		if (cidr >= 0)
+			return -1;
+	}
+
+	key = bancheck_mask_host_key(hostmask);
+	if (!key)
+		return -1;
+	strlcpy(buf, key, buflen);
+	return BANCHECK_INDEX_HOST;
+}
+
+static void bancheck_index_add(BanCheckIndex *idx, int type, const char *key, Client *client)
+{
+	unsigned int hashv = siphash_nocase(key, bancheck_siphashkey) & (idx->size - 1);
+	BanCheckEntry *e = scratch_alloc(sizeof(BanCheckEntry));
+
+	e->client = client;
+	e->next = idx->table[type][hashv];
+	idx->table[type][hashv] = e;
+}
+
+/** Build index 'type' of all local clients */
+static void bancheck_index_build(BanCheckIndex *idx, int type)
+{
+	Client *client;
+	const char *host, *key, *key2;
+	char buf[REALLEN+1];
+
+	idx->table[type] = scratch_alloc(sizeof(BanCheckEntry *) * idx->size);
+	list_for_each_entry(client, &lclient_list, lclient_node)
+	{
+		if (IsServer(client) || IsMe(client) || IsDead(client))
+			continue;
+		switch (type)
+		{
+			case BANCHECK_INDEX_IP:
+				if (client->ip && bancheck_ip_key(client->ip, -1, buf, sizeof(buf)))
+					bancheck_index_add(idx, type, buf, client);
+				break;
+			case BANCHECK_INDEX_HOST:
+				/* Host masks are matched against the IP too (eg *.0.2.1) */
+				host = client->user ? client->user->realhost : client->local->sockhost;
+				key = bancheck_host_key(host);
+				bancheck_index_add(idx, type, key, client);
+				if (client->ip)
+				{
+					key2 = bancheck_host_key(client->ip);
+					if (strcasecmp(key, key2))
+						bancheck_index_add(idx, type, key2, client);
+				}
+				break;
+			case BANCHECK_INDEX_ACCOUNT:
+				if (client->user && IsLoggedIn(client))
+					bancheck_index_add(idx, type, client->user->account, client);
+				break;
+			case BANCHECK_INDEX_REALNAME:
+				if (client->user)
+				{
+					strlcpy(buf, client->info, sizeof(buf));
+					bancheck_realname_key(buf);
+					bancheck_index_add(idx, type, buf, client);
+				}
+				break;
+		}
+	}
+}
+
+/** Check one client against one (new) server ban */
+static void bancheck_client(Client *client, TKL *tkl)
+{
+	/* The same client may be visited twice, eg via both its host and IP */
+	if (IsServer(client) || IsMe(client) || IsDead(client))
+		return;
+
+	metrics.tkl_entries_scanned++;
+	if (tkl->type & TKL_SHUN)
+	{
+		if (!IsShunned(client))
+			find_shun(client);
+		return;
+	}
+	if (find_tkline_match_matcher(client, 0, tkl))
+		tkl_ban_client(client, tkl);
+}
+
+/** Apply the server bans that were added since the last call
+ * to the existing clients. This is called from check_pings().
+ */
+void _tkl_check_pending_bans(void)
+{
+	BanCheckIndex idx;
+	BanCheckEntry *e;
+	ScratchMark mark;
+	Client *client, *next;
+	TKL *tkl;
+	char buf[HOSTLEN+1];
+	int i, type;
+
+	if (!pending_bans_count)
+		return;
+
+	if (loop.do_bancheck)
+	{
+		/* Everyone is checked against everything anyway */
+		for (i = 0; i < pending_bans_count; i++)
+			if (pending_bans[i])
+				pending_bans[i]->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+		pending_bans_count = 0;
+		return;
+	}
+
+	scratch_mark(&mark);
+	memset(&idx, 0, sizeof(idx));
+	for (idx.size = 64; idx.size < irccounts.me_clients; idx.size *= 2);
+
+	/* Note that pending_bans may grow while we are in this loop */
+	for (i = 0; i < pending_bans_count; i++)
+	{
+		tkl = pending_bans[i];
+		if (!tkl)
+			continue; /* removed in the meantime */
+		tkl->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+		metrics.tkl_new_bans_checked++;
+
+		type = bancheck_tkl_key(tkl, buf, sizeof(buf));
+		if (type < 0)
+		{
+			metrics.tkl_new_bans_full_scan++;
+			list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
+				bancheck_client(client, tkl);
+			continue;
+		}
+
+		if (!idx.table[type])
+			bancheck_index_build(&idx, type);
+		for (e = idx.table[type][siphash_nocase(buf, bancheck_siphashkey) & (idx.size - 1)]; e; e = e->next)
+			bancheck_client(e->client, tkl);
+	}
+	pending_bans_count = 0;
+	scratch_release(&mark);
+}
+
 /** Helper function for spamfilter_build_user_string().
  * This ensures IPv6 hosts are in brackets.
  */
@@ -3343,6 +3703,8 @@ TKL *_find_tkline_match_zap(Client *client)
 	if (IsServer(client) || IsMe(client))
 		return NULL;
 
+	metrics.tkl_checks++;
+
 	/* First, the TKL ip hash table entries.. */
 	index = tkl_ip_hash_type('z');
 	index2 = tkl_ip_hash(GetIP(client));
@@ -3350,18 +3712,26 @@ TKL *_find_tkline_match_zap(Client *client)
 	{
 		for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
 		{
+			metrics.tkl_entries_scanned++;
 			ret = find_tkline_match_zap_matcher(client, tkl);
 			if (ret)
+			{
+				metrics.tkl_matches++;
 				return ret;
+			}
 		}
 	}
 
 	/* If not banned (yet), then check regular entries.. */
 	for (tkl = tklines[tkl_hash('z')]; tkl; tkl = tkl->next)
 	{
+		metrics.tkl_entries_scanned++;
 		ret = find_tkline_match_zap_matcher(client, tkl);
 		if (ret)
+		{
+			metrics.tkl_matches++;
 			return ret;
+		}
 	}
 
 	return NULL;
@@ -3979,8 +4349,13 @@ void _tkl_added(Client *client, TKL *tkl)
 	if ((tkl->type & TKL_SPAMF) && (tkl->ptr.spamfilter->action == BAN_ACT_WARN) && (tkl->ptr.spamfilter->target & SPAMF_USER))
 		spamfilter_check_users(tkl);
 
-	/* Ban checking executes during run loop for efficiency */
-	loop.do_bancheck = 1;
+	/* Ban checking executes during run loop for efficiency.
+	 * For server bans only the clients that the ban can match are checked.
+	 */
+	if (TKLIsServerBan(tkl))
+		tkl_pending_ban_add(tkl);
+	else
+		loop.do_bancheck = 1;
 
 	if (tkl->type & TKL_GLOBAL)
 		tkl_broadcast_entry(1, client, client, tkl);
@@ -4770,6 +5145,8 @@ int _match_spamfilter(Client *client, const char *str_in, int target, const char
 	if (find_tkl_exception(TKL_SPAMF, client))
 		return 0;
 
+	metrics.spamfilter_checks++;
+
 	for (tkl = tklines[tkl_hash('F')]; tkl; tkl = tkl->next)
 	{
 		if (!(tkl->ptr.spamfilter->target & target))
@@ -4824,6 +5201,8 @@ int _match_spamfilter(Client *client, const char *str_in, int target, const char
 			if (!winner_tkl && destination && target_is_spamexcept(destination))
 				return 0; /* No problem! */
 
+			metrics.spamfilter_matches++;
+
 			unreal_log(ULOG_INFO, "tkl", "SPAMFILTER_MATCH", client,
 			           "[Spamfilter] $client.details matches filter '$tkl': [cmd: $command$_space$destination: '$str'] [reason: $tkl.reason] [action: $tkl.ban_action]",
 				   log_data_tkl("tkl", tkl),
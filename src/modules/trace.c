@@ -58,11 +58,10 @@ MOD_UNLOAD()
 */
 CMD_FUNC(cmd_trace)
 {
-	int  i;
 	Client *acptr;
 	ConfigItem_class *cltmp;
 	const char *tname;
-	int  doall, link_s[MAXCONNECTIONS], link_u[MAXCONNECTIONS];
+	int  doall, *link_s, *link_u;
 	int  cnt = 0, wilds, dow;
 	time_t now;
 
@@ -119,9 +118,9 @@ CMD_FUNC(cmd_trace)
 	wilds = !parv[1] || strchr(tname, '*') || strchr(tname, '?');
 	dow = wilds || doall;
 
-	for (i = 0; i < MAXCONNECTIONS; i++)
-		link_s[i] = 0, link_u[i] = 0;
-
+	/* Number of servers and users behind each local connection, by fd */
+	link_s = safe_alloc(sizeof(int) * fd_table_size);
+	link_u = safe_alloc(sizeof(int) * fd_table_size);
 
 	if (doall) {
 		list_for_each_entry(acptr, &client_list, client_node)
@@ -221,6 +220,9 @@ CMD_FUNC(cmd_trace)
 				break;
 		}
 	}
+	safe_free(link_s);
+	safe_free(link_u);
+
 	/*
 	 * Add these lines to summarize the above which can get rather long
 	 * and messy when done remotely - Avalon
@@ -28,6 +28,7 @@ int censor_config_run(ConfigFile *, ConfigEntry *, int);
 ModuleInfo *ModInfo = NULL;
 
 ConfigItem_badword *conf_badword_message = NULL;
+BadwordMatcher *badword_matcher_message = NULL;
 
 static ConfigItem_badword *copy_badword_struct(ConfigItem_badword *ca, int regex, int regflags);
 
@@ -53,6 +54,8 @@ MOD_INIT()
 
 MOD_LOAD()
 {
+	/* All badword { } blocks have been read now, compile them */
+	badword_matcher_message = badword_matcher_compile(conf_badword_message);
 	return MOD_SUCCESS;
 }
 
@@ -61,6 +64,9 @@ MOD_UNLOAD()
 {
 ConfigItem_badword *badword, *next;
 
+	badword_matcher_free(badword_matcher_message);
+	badword_matcher_message = NULL;
+
 	for (badword = conf_badword_message; badword; badword = next)
 	{
 		next = badword->next;
@@ -233,7 +239,7 @@ int censor_config_run(ConfigFile *cf, ConfigEntry *ce, int type)
 
 const char *stripbadwords_message(const char *str, int *blocked)
 {
-	return stripbadwords(str, conf_badword_message, blocked);
+	return badword_matcher_strip(str, badword_matcher_message, blocked);
 }
 
 int censor_can_send_to_user(Client *client, Client *target, const char **text, const char **errmsg, SendType sendtype)
@@ -29,6 +29,11 @@ ModuleHeader MOD_HEADER
 
 #define WSU(client)	((WebSocketUser *)moddata_client(client, websocket_md).ptr)
 
+/** Window bits we use for permessage-deflate with context takeover.
+ * This limits the memory of the per-client zlib streams.
+ */
+#define WEBSOCKET_DEFLATE_WINDOW_BITS	12
+
 #define WEBSOCKET_PORT(client)	((client->local && client->local->listener) ? client->local->listener->websocket_options : 0)
 #define WEBSOCKET_TYPE(client)	(WSU(client)->type)
 
@@ -55,6 +60,7 @@ int websocket_secure_connect(Client *client);
 struct HTTPForwardedHeader *websocket_parse_forwarded_header(char *input);
 int websocket_ip_compare(const char *ip1, const char *ip2);
 int websocket_handle_request(Client *client, WebRequest *web);
+int websocket_negotiate_deflate(Client *client, char *header);
 
 /* Global variables */
 ModDataInfo *websocket_md;
@@ -159,6 +165,17 @@ int websocket_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
 				errors++;
 				continue;
 			}
+		} else if (!strcmp(cep->name, "compression") || !strcmp(cep->name, "compression-context-takeover"))
+		{
+			CheckNull(cep);
+#ifndef HAVE_ZLIB
+			if (config_checkval(cep->value, CFG_YESNO))
+			{
+				config_warn("%s:%i: listen::options::websocket::%s is set but UnrealIRCd was compiled without zlib. "
+				            "WebSocket compression will not be available.",
+				            cep->file->filename, cep->line_number, cep->name);
+			}
+#endif
 		} else
 		{
 			config_error("%s:%i: unknown directive listen::options::websocket::%s",
@@ -221,6 +238,18 @@ int websocket_config_run_ex(ConfigFile *cf, ConfigEntry *ce, int type, void *ptr
 		{
 			safe_strdup(l->websocket_forward, cep->value);
 		}
+#ifdef HAVE_ZLIB
+		else if (!strcmp(cep->name, "compression"))
+		{
+			if (config_checkval(cep->value, CFG_YESNO))
+				l->websocket_compression |= WEBSOCKET_COMPRESSION;
+		}
+		else if (!strcmp(cep->name, "compression-context-takeover"))
+		{
+			if (config_checkval(cep->value, CFG_YESNO))
+				l->websocket_compression |= WEBSOCKET_COMPRESSION_CONTEXT_TAKEOVER;
+		}
+#endif
 	}
 	return 1;
 }
@@ -304,14 +333,14 @@ int websocket_packet_out(Client *from, Client *to, Client *intended_to, char **m
 	if (MyConnect(to) && !IsRPC(to) && websocket_md && WSU(to) && WSU(to)->handshake_completed)
 	{
 		if (WEBSOCKET_TYPE(to) == WEBSOCKET_TYPE_BINARY)
-			websocket_create_packet(WSOP_BINARY, msg, length);
+			websocket_create_packet_ex(to, WSOP_BINARY, msg, length);
 		else if (WEBSOCKET_TYPE(to) == WEBSOCKET_TYPE_TEXT)
 		{
 			/* Some more conversions are needed */
 			char *safe_msg = unrl_utf8_make_valid(*msg, utf8buf, sizeof(utf8buf), 1);
 			*msg = safe_msg;
 			*length = *msg ? strlen(safe_msg) : 0;
-			websocket_create_packet(WSOP_TEXT, msg, length);
+			websocket_create_packet_ex(to, WSOP_TEXT, msg, length);
 		}
 		return 0;
 	}
@@ -490,6 +519,19 @@ int websocket_handle_request(Client *client, WebRequest *web)
 		{
 			/* will be processed later too */
 			safe_strdup(WSU(client)->forwarded, value);
+		} else
+		if (!strcasecmp(key, "Sec-WebSocket-Extensions"))
+		{
+			/* May be sent more than once, which is the same as a comma separated list */
+			if (WSU(client)->sec_websocket_extensions)
+			{
+				char *old = WSU(client)->sec_websocket_extensions;
+				WSU(client)->sec_websocket_extensions = safe_alloc(strlen(old) + strlen(value) + 3);
+				sprintf(WSU(client)->sec_websocket_extensions, "%s, %s", old, value);
+				safe_free(old);
+			} else {
+				safe_strdup(WSU(client)->sec_websocket_extensions, value);
+			}
 		}
 	}
 
@@ -545,6 +587,16 @@ int websocket_handle_request(Client *client, WebRequest *web)
 		}
 	}
 
+	/* Sec-WebSocket-Extensions (optional): only permessage-deflate is supported */
+	if (WSU(client)->sec_websocket_extensions)
+	{
+		if (!(client->local->listener->websocket_compression & WEBSOCKET_COMPRESSION) ||
+		    !websocket_negotiate_deflate(client, WSU(client)->sec_websocket_extensions))
+		{
+			safe_free(WSU(client)->sec_websocket_extensions);
+		}
+	}
+
 	/* Check forwarded header (by k4be) */
 	if (WSU(client)->forwarded)
 	{
@@ -605,6 +657,156 @@ int websocket_handle_request(Client *client, WebRequest *web)
 	return 1;
 }
 
+/** Strip leading and trailing whitespace, for header parsing */
+static void websocket_trim(char **p)
+{
+	char *e;
+
+	skip_whitespace(p);
+	for (e = *p + strlen(*p); (e > *p) && ((e[-1] == ' ') || (e[-1] == '\t')); e--)
+		e[-1] = '\0';
+}
+
+/** Parse a permessage-deflate window bits parameter value (8-15).
+ * @returns The value, or 0 if it is invalid.
+ */
+static int websocket_window_bits(char *value)
+{
+	int n;
+
+	if (*value == '"')
+	{
+		/* Quoted-string is permitted too (RFC7692 section 7.1) */
+		char *p = strchr(value+1, '"');
+		if (!p || p[1])
+			return 0;
+		*p = '\0';
+		value++;
+	}
+	if (!*value || strlen(value) > 2 || !isdigit(value[0]) || (value[1] && !isdigit(value[1])))
+		return 0;
+	n = atoi(value);
+	if ((n < 8) || (n > 15))
+		return 0;
+	return n;
+}
+
+/** Negotiate permessage-deflate (RFC7692).
+ * We accept the first offer in the Sec-WebSocket-Extensions header
+ * that we understand. Unless context takeover is enabled in the
+ * listen block, we always ask for no context takeover in both directions:
+ * this way we need no zlib streams per client, and a message that is
+ * sent to many websocket users only needs to be compressed once.
+ * @param client	The client
+ * @param header	The Sec-WebSocket-Extensions header(s), this buffer is modified.
+ * @returns 1 if permessage-deflate is going to be used, 0 if not.
+ *          On success WSU(client)->sec_websocket_extensions is replaced
+ *          with our response.
+ */
+int websocket_negotiate_deflate(Client *client, char *header)
+{
+	char *p = NULL, *offer;
+	char *p2, *param, *value;
+	char response[256];
+	int takeover = client->local->listener->websocket_compression & WEBSOCKET_COMPRESSION_CONTEXT_TAKEOVER;
+	int server_no_context_takeover, client_no_context_takeover;
+	int server_max_window_bits, client_max_window_bits;
+	int server_window_bits, client_window_bits;
+	int ok;
+
+	for (offer = strtoken(&p, header, ","); offer; offer = strtoken(&p, NULL, ","))
+	{
+		p2 = NULL;
+		param = strtoken(&p2, offer, ";");
+		if (!param)
+			continue;
+		websocket_trim(&param);
+		if (strcmp(param, "permessage-deflate"))
+			continue; /* some other extension */
+
+		ok = 1;
+		server_no_context_takeover = client_no_context_takeover = 0;
+		server_max_window_bits = 0; /* not present */
+		client_max_window_bits = -1; /* not present */
+		for (param = strtoken(&p2, NULL, ";"); param; param = strtoken(&p2, NULL, ";"))
+		{
+			value = strchr(param, '=');
+			if (value)
+			{
+				*value++ = '\0';
+				websocket_trim(&value);
+			}
+			websocket_trim(&param);
+			if (!strcmp(param, "server_no_context_takeover") && !value && !server_no_context_takeover)
+			{
+				server_no_context_takeover = 1;
+			} else
+			if (!strcmp(param, "client_no_context_takeover") && !value && !client_no_context_takeover)
+			{
+				client_no_context_takeover = 1;
+			} else
+			if (!strcmp(param, "server_max_window_bits") && value && !server_max_window_bits)
+			{
+				server_max_window_bits = websocket_window_bits(value);
+				/* zlib can't deflate with a window of 256 bytes (8 bits) */
+				if (server_max_window_bits < 9)
+					ok = 0;
+			} else
+			if (!strcmp(param, "client_max_window_bits") && (client_max_window_bits == -1))
+			{
+				client_max_window_bits = value ? websocket_window_bits(value) : 15;
+				if (!client_max_window_bits)
+					ok = 0;
+			} else
+			{
+				ok = 0; /* unknown, duplicate or invalid parameter: decline this offer */
+			}
+		}
+		if (!ok)
+			continue;
+
+		/* Accept this offer. Now decide on the parameters.. */
+		strlcpy(response, "permessage-deflate", sizeof(response));
+
+		if (!takeover)
+			server_no_context_takeover = 1;
+		server_window_bits = server_max_window_bits ? server_max_window_bits : 15;
+		if (!server_no_context_takeover && (server_window_bits > WEBSOCKET_DEFLATE_WINDOW_BITS))
+			server_window_bits = WEBSOCKET_DEFLATE_WINDOW_BITS;
+		if (server_no_context_takeover)
+			strlcat(response, "; server_no_context_takeover", sizeof(response));
+		if (server_window_bits < 15)
+			snprintf(response+strlen(response), sizeof(response)-strlen(response), "; server_max_window_bits=%d", server_window_bits);
+
+		if (!takeover)
+			client_no_context_takeover = 1;
+		if (client_no_context_takeover)
+			strlcat(response, "; client_no_context_takeover", sizeof(response));
+		client_window_bits = 15;
+		if (client_max_window_bits > 0)
+		{
+			/* Client supports the parameter, so we may limit it */
+			client_window_bits = client_max_window_bits;
+			if (!client_no_context_takeover && (client_window_bits > WEBSOCKET_DEFLATE_WINDOW_BITS))
+				client_window_bits = WEBSOCKET_DEFLATE_WINDOW_BITS;
+			snprintf(response+strlen(response), sizeof(response)-strlen(response), "; client_max_window_bits=%d", client_window_bits);
+		}
+
+		WSU(client)->deflate = WEBSOCKET_DEFLATE;
+		if (server_no_context_takeover)
+			WSU(client)->deflate |= WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER;
+		if (client_no_context_takeover)
+			WSU(client)->deflate |= WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER;
+		WSU(client)->deflate_server_window_bits = server_window_bits;
+		/* zlib deflate uses 9 when asked for 8, so be prepared for that */
+		WSU(client)->deflate_client_window_bits = MAX(client_window_bits, 9);
+		safe_strdup(WSU(client)->sec_websocket_extensions, response);
+		return 1;
+	}
+
+	return 0;
+}
+
 int websocket_secure_connect(Client *client)
 {
 	/* Remove secure mode (-z) if the WEBIRC gateway did not ensure
@@ -645,6 +847,15 @@ int websocket_handshake_send_response(Client *client)
 		         WSU(client)->sec_websocket_protocol);
 	}
 
+	if (WSU(client)->sec_websocket_extensions)
+	{
+		/* This has been replaced by our response in websocket_negotiate_deflate() */
+		snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf),
+		         "Sec-WebSocket-Extensions: %s\r\n",
+		         WSU(client)->sec_websocket_extensions);
+		safe_free(WSU(client)->sec_websocket_extensions);
+	}
+
 	strlcat(buf, "\r\n", sizeof(buf));
 
 	/* Caution: we bypass sendQ flood checking by doing it this way.
@@ -6,6 +6,9 @@
  */
    
 #include "unrealircd.h"
+#ifdef HAVE_ZLIB
+ #include <zlib.h>
+#endif
 
 ModuleHeader MOD_HEADER
   = {
@@ -26,6 +29,11 @@ ModuleHeader MOD_HEADER
 
 #define WSU(client)	((WebSocketUser *)moddata_client(client, websocket_md).ptr)
 
+/* permessage-deflate (RFC7692) settings */
+#define WEBSOCKET_DEFLATE_LEVEL		6	/**< Compression level (1-9) */
+#define WEBSOCKET_DEFLATE_MEMLEVEL	5	/**< zlib memLevel for per-client streams, lower is less memory */
+#define WEBSOCKET_DEFLATE_MIN_SIZE	64	/**< Don't bother compressing shorter messages (without context takeover) */
+
 /* used to parse http Forwarded header (RFC 7239) */
 #define IPLEN 48
 #define FHEADER_NAMELEN	20
@@ -37,20 +45,45 @@ struct HTTPForwardedHeader
 	char ip[IPLEN+1];
 };
 
+/** A channel message to N websocket users is the same payload N times.
+ * We remember the last payload and the frames built from it, so it only
+ * needs to be framed (and possibly compressed) once.
+ */
+typedef struct WebSocketFrameCache WebSocketFrameCache;
+struct WebSocketFrameCache
+{
+	int opcode; /**< WSOP_TEXT or WSOP_BINARY */
+	int window_bits; /**< 0 if not compressed, otherwise the window bits of the shared deflate stream */
+	int inlen; /**< Length of 'in', or -1 if the cache entry is not valid */
+	int outlen; /**< Length of 'out' */
+	char in[WEBSOCKET_SEND_BUFFER_SIZE]; /**< The payload (IRC line(s)) */
+	char out[WEBSOCKET_SEND_BUFFER_SIZE]; /**< The resulting websocket frame(s) */
+};
+
 /* Forward declarations - public functions */
 int _websocket_handle_websocket(Client *client, WebRequest *web, const char *readbuf2, int length2, int callback(Client *client, char *buf, int len));
 int _websocket_create_packet(int opcode, char **buf, int *len);
 int _websocket_create_packet_simple(int opcode, const char **buf, int *len);
+int _websocket_create_packet_ex(Client *client, int opcode, char **buf, int *len);
 /* Forward declarations - other */
 int websocket_handle_packet(Client *client, const char *readbuf, int length, int callback(Client *client, char *buf, int len));
 int websocket_handle_packet_ping(Client *client, const char *buf, int len);
 int websocket_handle_packet_pong(Client *client, const char *buf, int len);
 int websocket_send_pong(Client *client, const char *buf, int len);
+int websocket_inflate(Client *client, const char *buf, int len, char **outbuf, int *outlen);
 void websocket_mdata_free(ModData *m);
 
 /* Global variables */
 ModDataInfo *websocket_md;
 static int ws_text_mode_available = 1;
+/** Frame cache, indexed by [text][compressed] */
+static WebSocketFrameCache frame_cache[2][2];
+#ifdef HAVE_ZLIB
+/** Shared deflate streams for clients without server context takeover, indexed by window bits */
+static z_stream *shared_deflate[16];
+/** Shared inflate stream for clients without client context takeover */
+static z_stream *shared_inflate;
+#endif
 
 MOD_TEST()
 {
@@ -58,6 +91,7 @@ MOD_TEST()
 	EfunctionAdd(modinfo->handle, EFUNC_WEBSOCKET_HANDLE_WEBSOCKET, _websocket_handle_websocket);
 	EfunctionAdd(modinfo->handle, EFUNC_WEBSOCKET_CREATE_PACKET, _websocket_create_packet);
 	EfunctionAdd(modinfo->handle, EFUNC_WEBSOCKET_CREATE_PACKET_SIMPLE, _websocket_create_packet_simple);
+	EfunctionAdd(modinfo->handle, EFUNC_WEBSOCKET_CREATE_PACKET_EX, _websocket_create_packet_ex);
 
 	/* Init first, since we manage sockets */
 	ModuleSetOptions(modinfo->handle, MOD_OPT_PRIORITY, WEBSOCKET_MODULE_PRIORITY_INIT);
@@ -88,11 +122,30 @@ MOD_INIT()
 
 MOD_LOAD()
 {
+	frame_cache[0][0].inlen = frame_cache[0][1].inlen = -1;
+	frame_cache[1][0].inlen = frame_cache[1][1].inlen = -1;
 	return MOD_SUCCESS;
 }
 
 MOD_UNLOAD()
 {
+#ifdef HAVE_ZLIB
+	int i;
+
+	for (i = 0; i < 16; i++)
+	{
+		if (shared_deflate[i])
+		{
+			deflateEnd(shared_deflate[i]);
+			safe_free(shared_deflate[i]);
+		}
+	}
+	if (shared_inflate)
+	{
+		inflateEnd(shared_inflate);
+		safe_free(shared_inflate);
+	}
+#endif
 	return MOD_SUCCESS;
 }
 
@@ -149,6 +202,8 @@ int _websocket_handle_websocket(Client *client, WebRequest *web, const char *rea
  */
 int websocket_handle_packet(Client *client, const char *readbuf, int length, int callback(Client *client, char *buf, int len))
 {
+	char fin; /**< Final fragment */
+	char rsv; /**< Reserved bits (RSV1 = compressed) */
 	char opcode; /**< Opcode */
 	char masked; /**< Masked */
 	int len; /**< Length of the packet */
@@ -164,13 +219,31 @@ int websocket_handle_packet(Client *client, const char *readbuf, int length, int
 		return 0;
 	}
 
-	/* fin    = readbuf[0] & 0x80; -- unused */
-	opcode = readbuf[0] & 0x7F;
+	fin    = readbuf[0] & 0x80;
+	rsv    = readbuf[0] & 0x70;
+	opcode = readbuf[0] & 0x0F;
 	masked = readbuf[1] & 0x80;
 	len    = readbuf[1] & 0x7F;
 	p = &readbuf[2]; /* point to next element */
 
-	/* actually 'fin' is unused.. we don't care. */
+	/* Other than that, 'fin' is unused.. we don't care. */
+
+	if (rsv)
+	{
+		/* Only RSV1 is defined, and only if permessage-deflate was negotiated.
+		 * We only accept it on complete (unfragmented) data frames.
+		 */
+		if ((rsv != 0x40) || !WSU(client)->deflate)
+		{
+			dead_socket(client, "WebSocket packet with reserved bits set");
+			return -1;
+		}
+		if (!fin || ((opcode != WSOP_TEXT) && (opcode != WSOP_BINARY)))
+		{
+			dead_socket(client, "WebSocket: fragmented or non-data compressed packet");
+			return -1;
+		}
+	}
 
 	if (!masked)
 	{
@@ -220,21 +293,18 @@ int websocket_handle_packet(Client *client, const char *readbuf, int length, int
 
 	if (len > 0)
 	{
-		memcpy(payloadbuf, p, len);
+		/* Copy and unmask this thing (page 33, section 5.3) */
+		text_kernels.unmask(payloadbuf, p, len, maskkey);
 		payload = payloadbuf;
 	} /* else payload is NULL */
 
-	if (len > 0)
+	if (rsv)
 	{
-		/* Unmask this thing (page 33, section 5.3) */
-		int n;
-		char v;
-		char *p;
-		for (p = payload, n = 0; n < len; n++)
-		{
-			v = *p;
-			*p++ = v ^ maskkey[n % 4];
-		}
+		/* Compressed message (RFC7692) */
+		if (websocket_inflate(client, payloadbuf, len, &payload, &len) < 0)
+			return -1; /* killed */
+		if (len == 0)
+			payload = NULL;
 	}
 
 	switch(opcode)
@@ -321,28 +391,72 @@ int _websocket_create_packet_simple(int opcode, const char **buf, int *len)
 	return 0;
 }
 
-/** Create a websocket packet that is ready to be send.
- * This is the more complex version that takes into account
- * stripping off \r and \n, and possibly multi line due to
- * labeled-response. It is used for WSOP_TEXT and WSOP_BINARY.
- * The end result is one or more websocket frames,
- * all in a single packet *buf with size *len.
+#ifdef HAVE_ZLIB
+/** Compress a single message for permessage-deflate (RFC7692 section 7.2.1).
+ * @param zs		The deflate stream
+ * @param takeover	If this is 0 then the stream is reset first,
+ *			so the message does not depend on earlier ones.
+ * @returns Length of the compressed data in 'out', or -1 on error.
  */
-int _websocket_create_packet(int opcode, char **buf, int *len)
+static int websocket_deflate(z_stream *zs, int takeover, const char *buf, int len, char *out, int outsize)
 {
-	static char sendbuf[WEBSOCKET_SEND_BUFFER_SIZE];
-	char *s = *buf; /* points to start of current line */
-	char *s2; /* used for searching of end of current line */
-	char *lastbyte = *buf + *len - 1; /* points to last byte in *buf that can be safely read */
+	int n;
+
+	if (!takeover)
+		deflateReset(zs);
+
+	zs->next_in = (Bytef *)buf;
+	zs->avail_in = len;
+	zs->next_out = (Bytef *)out;
+	zs->avail_out = outsize;
+	if ((deflate(zs, Z_SYNC_FLUSH) != Z_OK) || zs->avail_in || !zs->avail_out)
+		return -1;
+
+	/* Strip the 0x00 0x00 0xff 0xff trailer of the sync flush */
+	n = outsize - zs->avail_out;
+	if ((n < 4) || memcmp(out + n - 4, "\x00\x00\xff\xff", 4))
+		return -1;
+	return n - 4;
+}
+
+/** Create a raw deflate stream */
+static z_stream *websocket_deflate_stream(int window_bits, int memlevel)
+{
+	z_stream *zs = safe_alloc(sizeof(z_stream));
+
+	/* Window bits are negative, which means raw deflate (no zlib header) */
+	if (deflateInit2(zs, WEBSOCKET_DEFLATE_LEVEL, Z_DEFLATED, -window_bits, memlevel, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		safe_free(zs);
+		return NULL;
+	}
+	return zs;
+}
+#endif
+
+/** Build the websocket frame(s) for 'buf'.
+ * Every line in 'buf' becomes a frame of its own, with the
+ * \r and \n stripped off.
+ * @param opcode	WSOP_TEXT or WSOP_BINARY
+ * @param zs		The deflate stream to compress with, or NULL
+ * @param takeover	Set to 1 if 'zs' keeps context between messages
+ * @returns Number of bytes written to 'out', or -1 on error.
+ */
+static int websocket_make_frames(int opcode, const char *buf, int len, char *out, int outsize, void *zs, int takeover)
+{
+	const char *s = buf; /* points to start of current line */
+	const char *s2; /* used for searching of end of current line */
+	const char *lastbyte = buf + len - 1; /* points to last byte in buf that can be safely read */
+	const char *payload;
 	int bytes_to_copy;
-	char newline;
-	char *o = sendbuf; /* points to current byte within 'sendbuf' of output buffer */
+	char *o = out; /* points to current byte within the output buffer */
 	int bytes_in_sendbuf = 0;
 	int bytes_single_frame;
-
-	/* Sending 0 bytes makes no sense, and the code below may assume >0, so reject this. */
-	if (*len == 0)
-		return -1;
+	char rsv1;
+#ifdef HAVE_ZLIB
+	static char zbuf[WEBSOCKET_SEND_BUFFER_SIZE];
+	int n;
+#endif
 
 	do {
 		/* Find next \r or \n */
@@ -356,13 +470,34 @@ int _websocket_create_packet(int opcode, char **buf, int *len)
 		 * (either at \r, \n or beyond the buffer).
 		 */
 		bytes_to_copy = s2 - s;
+		payload = s;
+		rsv1 = 0;
+
+#ifdef HAVE_ZLIB
+		/* Compress the line if it pays off. With context takeover we always
+		 * compress: the stream has seen the data now, so the client needs
+		 * to see it too. Uncompressed (empty) messages don't count.
+		 */
+		if (zs && bytes_to_copy && (takeover || (bytes_to_copy >= WEBSOCKET_DEFLATE_MIN_SIZE)))
+		{
+			n = websocket_deflate((z_stream *)zs, takeover, s, bytes_to_copy, zbuf, sizeof(zbuf));
+			if ((n < 0) && takeover)
+				return -1; /* stream is out of sync now */
+			if ((n >= 0) && (takeover || (n < bytes_to_copy)))
+			{
+				payload = zbuf;
+				bytes_to_copy = n;
+				rsv1 = 0x40;
+			}
+		}
+#endif
 
 		if (bytes_to_copy < 126)
 			bytes_single_frame = 2 + bytes_to_copy;
 		else
 			bytes_single_frame = 4 + bytes_to_copy;
 
-		if (bytes_in_sendbuf + bytes_single_frame > sizeof(sendbuf))
+		if (bytes_in_sendbuf + bytes_single_frame > outsize)
 		{
 			/* Overflow. This should never happen. */
 			unreal_log(ULOG_WARNING, "websocket", "BUG_WEBSOCKET_OVERFLOW", NULL,
@@ -370,24 +505,24 @@ int _websocket_create_packet(int opcode, char **buf, int *len)
 			           "$bytes_in_sendbuf + $bytes_single_frame > $sendbuf_size",
 			           log_data_integer("bytes_in_sendbuf", bytes_in_sendbuf),
 			           log_data_integer("bytes_single_frame", bytes_single_frame),
-			           log_data_integer("sendbuf_size", sizeof(sendbuf)));
+			           log_data_integer("sendbuf_size", outsize));
 			return -1;
 		}
 
 		/* Create the new frame */
-		o[0] = opcode | 0x80; /* opcode & final */
+		o[0] = opcode | 0x80 | rsv1; /* opcode & final & compressed */
 
 		if (bytes_to_copy < 126)
 		{
 			/* Short payload */
 			o[1] = (char)bytes_to_copy;
-			memcpy(&o[2], s, bytes_to_copy);
+			memcpy(&o[2], payload, bytes_to_copy);
 		} else {
 			/* Long payload */
 			o[1] = 126;
 			o[2] = (char)((bytes_to_copy >> 8) & 0xFF);
 			o[3] = (char)(bytes_to_copy & 0xFF);
-			memcpy(&o[4], s, bytes_to_copy);
+			memcpy(&o[4], payload, bytes_to_copy);
 		}
 
 		/* Advance destination pointer and counter */
@@ -398,11 +533,205 @@ int _websocket_create_packet(int opcode, char **buf, int *len)
 		for (s = s2; *s && (s <= lastbyte) && ((*s == '\n') || (*s == '\r')); s++);
 	} while(s <= lastbyte);
 
-	*buf = sendbuf;
-	*len = bytes_in_sendbuf;
+	return bytes_in_sendbuf;
+}
+
+/** Create the frame(s) for 'buf', or return them from the frame cache
+ * if we just did the same thing for another client.
+ * @param window_bits	0 for uncompressed, otherwise compress with the
+ *			shared deflate stream with these window bits.
+ */
+static int websocket_create_packet_cached(int opcode, char **buf, int *len, int window_bits)
+{
+	WebSocketFrameCache *c = &frame_cache[(opcode == WSOP_TEXT) ? 1 : 0][window_bits ? 1 : 0];
+	void *zs = NULL;
+	int n;
+
+	/* Sending 0 bytes makes no sense, and the code below may assume >0, so reject this. */
+	if (*len == 0)
+		return -1;
+
+	if ((c->inlen == *len) && (c->opcode == opcode) && (c->window_bits == window_bits) &&
+	    !memcmp(c->in, *buf, *len))
+	{
+		*buf = c->out;
+		*len = c->outlen;
+		return 0;
+	}
+
+#ifdef HAVE_ZLIB
+	if (window_bits)
+	{
+		if (!shared_deflate[window_bits])
+			shared_deflate[window_bits] = websocket_deflate_stream(window_bits, 8);
+		zs = shared_deflate[window_bits];
+	}
+#endif
+
+	c->inlen = -1; /* invalidate, in case of an error or an oversized payload */
+	n = websocket_make_frames(opcode, *buf, *len, c->out, sizeof(c->out), zs, 0);
+	if (n < 0)
+		return -1;
+
+	if (*len <= sizeof(c->in))
+	{
+		memcpy(c->in, *buf, *len);
+		c->inlen = *len;
+		c->opcode = opcode;
+		c->window_bits = window_bits;
+		c->outlen = n;
+	}
+
+	*buf = c->out;
+	*len = n;
 	return 0;
 }
 
+/** Create a websocket packet that is ready to be send.
+ * This is the more complex version that takes into account
+ * stripping off \r and \n, and possibly multi line due to
+ * labeled-response. It is used for WSOP_TEXT and WSOP_BINARY.
+ * The end result is one or more websocket frames,
+ * all in a single packet *buf with size *len.
+ */
+int _websocket_create_packet(int opcode, char **buf, int *len)
+{
+	return websocket_create_packet_cached(opcode, buf, len, 0);
+}
+
+/** Create a websocket packet for a specific client.
+ * Same as websocket_create_packet() but this compresses the
+ * message if permessage-deflate was negotiated with the client.
+ */
+int _websocket_create_packet_ex(Client *client, int opcode, char **buf, int *len)
+{
+#ifdef HAVE_ZLIB
+	WebSocketUser *wsu = WSU(client);
+	static char sendbuf[WEBSOCKET_SEND_BUFFER_SIZE];
+	int n;
+
+	if (wsu && wsu->deflate)
+	{
+		if (wsu->deflate & WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER)
+		{
+			/* Every message is compressed on its own, so the result
+			 * is the same for every client and can be cached.
+			 */
+			return websocket_create_packet_cached(opcode, buf, len, wsu->deflate_server_window_bits);
+		}
+
+		/* Context takeover: each client has its own deflate stream */
+		if (*len == 0)
+			return -1;
+		if (!wsu->deflate_stream)
+		{
+			wsu->deflate_stream = websocket_deflate_stream(wsu->deflate_server_window_bits, WEBSOCKET_DEFLATE_MEMLEVEL);
+			if (!wsu->deflate_stream)
+				return -1;
+		}
+		n = websocket_make_frames(opcode, *buf, *len, sendbuf, sizeof(sendbuf), wsu->deflate_stream, 1);
+		if (n < 0)
+		{
+			dead_socket(client, "WebSocket: compression failed");
+			return -1;
+		}
+		*buf = sendbuf;
+		*len = n;
+		return 0;
+	}
+#endif
+	return websocket_create_packet_cached(opcode, buf, len, 0);
+}
+
+/** Decompress a message that was sent with permessage-deflate (RFC7692 section 7.2.2).
+ * @returns 0 on success (with *outbuf and *outlen set),
+ *          -1 if the client was killed.
+ */
+int websocket_inflate(Client *client, const char *buf, int len, char **outbuf, int *outlen)
+{
+#ifdef HAVE_ZLIB
+	WebSocketUser *wsu = WSU(client);
+	static char inflatebuf[READBUF_SIZE];
+	z_stream *zs;
+	int r;
+
+	if (wsu->deflate & WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER)
+	{
+		/* Each message stands on its own: use the shared stream */
+		if (!shared_inflate)
+		{
+			shared_inflate = safe_alloc(sizeof(z_stream));
+			if (inflateInit2(shared_inflate, -15) != Z_OK)
+			{
+				safe_free(shared_inflate);
+				dead_socket(client, "WebSocket: decompression failed");
+				return -1;
+			}
+		}
+		zs = shared_inflate;
+		inflateReset(zs);
+	} else {
+		if (!wsu->inflate_stream)
+		{
+			wsu->inflate_stream = safe_alloc(sizeof(z_stream));
+			if (inflateInit2((z_stream *)wsu->inflate_stream, -wsu->deflate_client_window_bits) != Z_OK)
+			{
+				safe_free(wsu->inflate_stream);
+				dead_socket(client, "WebSocket: decompression failed");
+				return -1;
+			}
+		}
+		zs = wsu->inflate_stream;
+	}
+
+	zs->next_out = (Bytef *)inflatebuf;
+	zs->avail_out = sizeof(inflatebuf);
+
+	zs->next_in = (Bytef *)buf;
+	zs->avail_in = len;
+	r = inflate(zs, Z_SYNC_FLUSH);
+	if (r == Z_STREAM_END)
+	{
+		/* Sender used a final block, the next message starts a new stream */
+		inflateReset(zs);
+	} else
+	if ((r != Z_OK) && (r != Z_BUF_ERROR))
+	{
+		dead_socket(client, "WebSocket: invalid compressed data");
+		return -1;
+	} else
+	{
+		if (zs->avail_in || !zs->avail_out)
+		{
+			dead_socket(client, "WebSocket: decompressed message too large");
+			return -1;
+		}
+
+		/* Add the 0x00 0x00 0xff 0xff that the sender stripped off */
+		zs->next_in = (Bytef *)"\x00\x00\xff\xff";
+		zs->avail_in = 4;
+		r = inflate(zs, Z_SYNC_FLUSH);
+		if ((r != Z_OK) && (r != Z_BUF_ERROR))
+		{
+			dead_socket(client, "WebSocket: invalid compressed data");
+			return -1;
+		}
+		if (zs->avail_in || !zs->avail_out)
+		{
+			dead_socket(client, "WebSocket: decompressed message too large");
+			return -1;
+		}
+	}
+
+	*outbuf = inflatebuf;
+	*outlen = sizeof(inflatebuf) - zs->avail_out;
+	return 0;
+#else
+	dead_socket(client, "WebSocket: compression not supported");
+	return -1;
+#endif
+}
+
 /** Create and send a WSOP_PONG frame */
 int websocket_send_pong(Client *client, const char *buf, int len)
 {
@@ -433,6 +762,19 @@ void websocket_mdata_free(ModData *m)
 		safe_free(wsu->lefttoparse);
 		safe_free(wsu->sec_websocket_protocol);
 		safe_free(wsu->forwarded);
+		safe_free(wsu->sec_websocket_extensions);
+#ifdef HAVE_ZLIB
+		if (wsu->deflate_stream)
+		{
+			deflateEnd((z_stream *)wsu->deflate_stream);
+			safe_free(wsu->deflate_stream);
+		}
+		if (wsu->inflate_stream)
+		{
+			inflateEnd((z_stream *)wsu->inflate_stream);
+			safe_free(wsu->inflate_stream);
+		}
+#endif
 		safe_free(m->ptr);
 	}
 }
@@ -52,10 +52,6 @@ MOD_UNLOAD()
 	return MOD_SUCCESS;
 }
 
-/* externally defined functions */
-extern WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-extern WhoWas MODVAR *WHOWASHASH[WHOWAS_HASH_TABLE_SIZE];
-
 /*
 ** cmd_whowas
 **      parv[1] = nickname queried
@@ -87,24 +83,18 @@ CMD_FUNC(cmd_whowas)
 	if (p)
 		*p = '\0';
 	nick = request;
-	temp = WHOWASHASH[hash_whowas_name(nick)];
 	found = 0;
-	for (; temp; temp = temp->next)
+	for (temp = whowas_find(nick); temp; temp = whowas_older(temp))
 	{
-		if (!mycmp(nick, temp->name))
-		{
-			sendnumeric(client, RPL_WHOWASUSER, temp->name,
-			    temp->username,
-			    (IsOper(client) ? temp->hostname :
-			    (*temp->virthost !=
-			    '\0') ? temp->virthost : temp->hostname),
-			    temp->realname);
-                	if (!((find_uline(temp->servername)) && !IsOper(client) && HIDE_ULINES))
-				sendnumeric(client, RPL_WHOISSERVER, temp->name, temp->servername,
-				    myctime(temp->logoff));
-			cur++;
-			found++;
-		}
+		sendnumeric(client, RPL_WHOWASUSER, temp->name,
+		    temp->username,
+		    ((IsOper(client) || !*temp->virthost) ? temp->hostname : temp->virthost),
+		    temp->realname);
+		if (!((find_uline(temp->servername)) && !IsOper(client) && HIDE_ULINES))
+			sendnumeric(client, RPL_WHOISSERVER, temp->name, temp->servername,
+			    myctime(temp->logoff));
+		cur++;
+		found++;
 		if (max > 0 && cur >= max)
 			break;
 	}
@@ -56,9 +56,42 @@ ModuleHeader MOD_HEADER
 #define HasField(x, y) ((x)->fields & (y))
 #define IsMatch(x, y) ((x)->matchsel & (y))
 
-#define IsMarked(x)           (moddata_client(x, whox_md).l)
-#define SetMark(x)            do { moddata_client(x, whox_md).l = 1; } while(0)
-#define ClearMark(x)          do { moddata_client(x, whox_md).l = 0; } while(0)
+/* Marks are a generation number, so starting a new search is just
+ * a matter of bumping whox_mark_generation instead of walking all clients.
+ */
+#define IsMarked(x)           (moddata_client(x, whox_md).l == whox_mark_generation)
+#define SetMark(x)            do { moddata_client(x, whox_md).l = whox_mark_generation; } while(0)
+
+/* Size of the WHO index hash table (must be a power of 2) */
+#define WHOX_INDEX_SIZE		8192
+
+/* The kinds of keys in the WHO index. This is hashed along
+ * with the key, so they can all share the same hash table.
+ */
+#define WHOX_KEY_NICK		'n' /**< First two characters of the nick */
+#define WHOX_KEY_USERDOT	'u' /**< Username contains a dot (no key) */
+#define WHOX_KEY_HOST_SUFFIX	'h' /**< Last two labels of the host */
+#define WHOX_KEY_HOST_PREFIX	'H' /**< Host up to the second '.' or ':' */
+#define WHOX_KEY_IP		'i' /**< IP up to the second '.' or ':' */
+#define WHOX_KEY_ACCOUNT	'a' /**< Services account */
+#define WHOX_KEY_SERVER		's' /**< Server the user is on */
+
+/* Node slots in a WhoxIndexEntry. The hosts that are indexed
+ * are the real host and the vhost, hence two slots for those.
+ */
+#define WHOX_NODE_NICK		0
+#define WHOX_NODE_USERDOT	1
+#define WHOX_NODE_IP		2
+#define WHOX_NODE_ACCOUNT	3
+#define WHOX_NODE_SERVER	4
+#define WHOX_NODE_HOST_SUFFIX	5 /* and 6 */
+#define WHOX_NODE_HOST_PREFIX	7 /* and 8 */
+#define WHOX_NODES		9
+
+/* Maximum number of index lookups for one WHO request */
+#define WHOX_MAX_LOOKUPS	32
+
+#define WhoxIndexEntryOf(x)	((WhoxIndexEntry *)moddata_client(x, whox_index_md).ptr)
 
 /* Structs */
 struct who_format
@@ -74,8 +107,36 @@ struct who_format
 	time_t contimemax;
 };
 
+typedef struct WhoxIndexNode WhoxIndexNode;
+/** A client in one bucket of the WHO index */
+struct WhoxIndexNode
+{
+	WhoxIndexNode *prev, *next;
+	Client *client;
+	uint64_t hash;		/**< Hash of the key, candidates are only those with the exact same hash */
+	int linked;		/**< Set if in the index */
+};
+
+/** All WHO index nodes of a client (moddata) */
+typedef struct WhoxIndexEntry
+{
+	WhoxIndexNode node[WHOX_NODES];
+} WhoxIndexEntry;
+
+/** The index lookups that a WHO request translates to */
+typedef struct WhoxLookups
+{
+	int count;
+	uint64_t hash[WHOX_MAX_LOOKUPS];
+} WhoxLookups;
+
 /* Global variables */
 ModDataInfo *whox_md = NULL;
+ModDataInfo *whox_index_md = NULL;
+static long whox_mark_generation = 0;
+static int whox_index_built = 0;
+static WhoxIndexNode *whox_index[WHOX_INDEX_SIZE];
+static char whox_siphash_key[SIPHASH_KEY_LENGTH];
 
 /* Forward declarations */
 CMD_FUNC(cmd_whox);
@@ -87,6 +148,15 @@ static int convert_classical_who_request(Client *client, int *parc, const char *
 const char *whox_md_serialize(ModData *m);
 void whox_md_unserialize(const char *str, ModData *m);
 void whox_md_free(ModData *md);
+void whox_index_md_free(ModData *md);
+int whox_index_update(Client *client);
+int whox_index_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
+int whox_index_userhost_change(Client *client, const char *olduser, const char *oldhost);
+int whox_index_umode_change(Client *client, long setflags, long newflags);
+int whox_index_account_login(Client *client, MessageTag *mtags);
+int whox_index_ip_change(Client *client, const char *oldip);
+int whox_index_free_user(Client *client);
+static void whox_index_remove(Client *client);
 static void append_format(char *buf, size_t bufsize, size_t *pos, const char *fmt, ...) __attribute__((format(printf,4,5)));
 
 MOD_INIT()
@@ -115,6 +185,34 @@ MOD_INIT()
 		return MOD_FAILED;
 	}
 
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "whox_index";
+	mreq.type = MODDATATYPE_CLIENT;
+	mreq.free = whox_index_md_free;
+	mreq.sync = 0;
+	whox_index_md = ModDataAdd(modinfo->handle, mreq);
+	if (!whox_index_md)
+	{
+		config_error("could not register whox_index moddata");
+		return MOD_FAILED;
+	}
+
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CONNECT, 0, whox_index_update);
+	HookAdd(modinfo->handle, HOOKTYPE_REMOTE_CONNECT, 0, whox_index_update);
+	HookAdd(modinfo->handle, HOOKTYPE_POST_LOCAL_NICKCHANGE, 0, whox_index_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_POST_REMOTE_NICKCHANGE, 0, whox_index_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_USERHOST_CHANGE, 0, whox_index_userhost_change);
+	HookAdd(modinfo->handle, HOOKTYPE_UMODE_CHANGE, 0, whox_index_umode_change);
+	HookAdd(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, 0, whox_index_account_login);
+	HookAdd(modinfo->handle, HOOKTYPE_IP_CHANGE, 0, whox_index_ip_change);
+	HookAdd(modinfo->handle, HOOKTYPE_FREE_USER, 0, whox_index_free_user);
+
+	siphash_generate_key(whox_siphash_key);
+	/* The marks in the moddata survive a module reload, so the
+	 * generation must not start over, see IsMarked().
+	 */
+	LoadPersistentLong(modinfo, whox_mark_generation);
+
 	ISupportAdd(modinfo->handle, "WHOX", NULL);
 	return MOD_SUCCESS;
 }
@@ -126,23 +224,32 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	Client *acptr;
+
+	/* The index moddata survives a module reload, but the hash table
+	 * and key do not, so take everyone out. It is rebuilt on the
+	 * first WHO request after the reload.
+	 */
+	list_for_each_entry(acptr, &client_list, client_node)
+		whox_index_remove(acptr);
+
+	SavePersistentLong(modinfo, whox_mark_generation);
 	return MOD_SUCCESS;
 }
 
-/** whox module data operations: serialize (rare) */
+/** whox module data operations: serialize (rare).
+ * Marks are only meaningful during a single WHO request,
+ * so there is never anything to save.
+ */
 const char *whox_md_serialize(ModData *m)
 {
-	static char buf[32];
-	if (m->i == 0)
-		return NULL; /* not set */
-	snprintf(buf, sizeof(buf), "%d", m->i);
-	return buf;
+	return NULL;
 }
 
 /** whox module data operations: unserialize (rare) */
 void whox_md_unserialize(const char *str, ModData *m)
 {
-	m->i = atoi(str);
+	m->l = 0;
 }
 
 /** whox module data operations: free */
@@ -152,6 +259,426 @@ void whox_md_free(ModData *md)
 	md->l = 0;
 }
 
+/*
+ * WHO index
+ *
+ * Searching through all clients for every WHO request is expensive on big
+ * networks, especially with bots and opers doing 'WHO *.isp.net' or
+ * 'WHO 1.2.3.*' all the time. So we keep an index of users by nick prefix,
+ * host suffix and prefix, IP prefix, account and server. A WHO mask is
+ * translated to a number of lookups in this index, which give us a (small)
+ * list of candidates. Each candidate is then checked with do_match() like
+ * before, so the index only needs to guarantee that it never misses a
+ * client that could match. If any of the fields that the mask is matched
+ * against cannot be looked up in the index then we do a full scan instead.
+ *
+ * The index is built on the first WHO request and is kept up to date
+ * through hooks after that.
+ */
+
+/** Hash a key for the WHO index.
+ * @param kind	One of WHOX_KEY_*
+ * @param str	The key
+ * @param len	Length of the key
+ */
+static uint64_t whox_hash(char kind, const char *str, size_t len)
+{
+	char buf[HOSTLEN+2];
+	size_t i;
+
+	if (len > HOSTLEN)
+		len = HOSTLEN;
+	buf[0] = kind;
+	for (i = 0; i < len; i++)
+		buf[i+1] = tolower(str[i]);
+	buf[len+1] = '\0';
+	return siphash(buf, whox_siphash_key);
+}
+
+/** Returns the key for a host suffix lookup: the last two labels */
+static const char *whox_host_suffix(const char *str)
+{
+	const char *p;
+	int dots = 0;
+
+	for (p = str + strlen(str); p > str; p--)
+		if ((p[-1] == '.') && (++dots == 2))
+			return p;
+	return str;
+}
+
+/** Returns the length of the key for a host or IP prefix lookup:
+ * everything up to the second '.' or ':'.
+ */
+static size_t whox_prefix_len(const char *str)
+{
+	const char *p;
+	int seps = 0;
+
+	for (p = str; *p; p++)
+		if (((*p == '.') || (*p == ':')) && (++seps == 2))
+			break;
+	return p - str;
+}
+
+static int whox_count_chars(const char *str, const char *chars)
+{
+	int n = 0;
+
+	for (; *str; str++)
+		if (strchr(chars, *str))
+			n++;
+	return n;
+}
+
+static void whox_node_unlink(WhoxIndexNode *n)
+{
+	if (!n->linked)
+		return;
+	if (n->prev)
+		n->prev->next = n->next;
+	else
+		whox_index[n->hash & (WHOX_INDEX_SIZE-1)] = n->next;
+	if (n->next)
+		n->next->prev = n->prev;
+	n->prev = n->next = NULL;
+	n->linked = 0;
+}
+
+/** Put a node in the index under 'hash', or take it out if 'present' is 0 */
+static void whox_node_set(WhoxIndexNode *n, Client *client, int present, uint64_t hash)
+{
+	WhoxIndexNode **head;
+
+	if (n->linked && present && (n->hash == hash))
+		return; /* unchanged */
+
+	whox_node_unlink(n);
+	if (!present)
+		return;
+
+	n->client = client;
+	n->hash = hash;
+	head = &whox_index[hash & (WHOX_INDEX_SIZE-1)];
+	n->next = *head;
+	if (*head)
+		(*head)->prev = n;
+	*head = n;
+	n->linked = 1;
+}
+
+/** (Re)index a user. Called on connect and after anything changed
+ * that we index on. It is fine to call this if nothing changed.
+ */
+int whox_index_update(Client *client)
+{
+	WhoxIndexEntry *e;
+	const char *hosts[2];
+	uint64_t hash;
+	int i;
+
+	if (!whox_index_built || !IsUser(client))
+		return 0;
+
+	e = WhoxIndexEntryOf(client);
+	if (!e)
+	{
+		e = safe_alloc(sizeof(WhoxIndexEntry));
+		moddata_client(client, whox_index_md).ptr = e;
+	}
+
+	whox_node_set(&e->node[WHOX_NODE_NICK], client, 1,
+	              whox_hash(WHOX_KEY_NICK, client->name, MIN(strlen(client->name), 2)));
+	whox_node_set(&e->node[WHOX_NODE_USERDOT], client, strchr(client->user->username, '.') ? 1 : 0,
+	              whox_hash(WHOX_KEY_USERDOT, "", 0));
+	whox_node_set(&e->node[WHOX_NODE_IP], client, client->ip ? 1 : 0,
+	              client->ip ? whox_hash(WHOX_KEY_IP, client->ip, whox_prefix_len(client->ip)) : 0);
+	whox_node_set(&e->node[WHOX_NODE_ACCOUNT], client, IsLoggedIn(client) ? 1 : 0,
+	              whox_hash(WHOX_KEY_ACCOUNT, client->user->account, strlen(client->user->account)));
+	whox_node_set(&e->node[WHOX_NODE_SERVER], client, 1,
+	              whox_hash(WHOX_KEY_SERVER, client->user->server, strlen(client->user->server)));
+
+	/* The vhost is only indexed if it differs from the real host */
+	hosts[0] = client->user->realhost;
+	hosts[1] = (client->user->virthost && strcasecmp(client->user->virthost, client->user->realhost)) ? client->user->virthost : NULL;
+	for (i = 0; i < 2; i++)
+	{
+		const char *suffix = hosts[i] ? whox_host_suffix(hosts[i]) : NULL;
+
+		hash = hosts[i] ? whox_hash(WHOX_KEY_HOST_SUFFIX, suffix, strlen(suffix)) : 0;
+		whox_node_set(&e->node[WHOX_NODE_HOST_SUFFIX+i], client, hosts[i] ? 1 : 0, hash);
+		hash = hosts[i] ? whox_hash(WHOX_KEY_HOST_PREFIX, hosts[i], whox_prefix_len(hosts[i])) : 0;
+		whox_node_set(&e->node[WHOX_NODE_HOST_PREFIX+i], client, hosts[i] ? 1 : 0, hash);
+	}
+
+	return 0;
+}
+
+/** Remove a client from the WHO index */
+static void whox_index_remove(Client *client)
+{
+	WhoxIndexEntry *e = WhoxIndexEntryOf(client);
+	int i;
+
+	if (!e)
+		return;
+	for (i = 0; i < WHOX_NODES; i++)
+		whox_node_unlink(&e->node[i]);
+	safe_free(e);
+	moddata_client(client, whox_index_md).ptr = NULL;
+}
+
+/** Build the WHO index from scratch. This is done on the first
+ * WHO request rather than on module load, so users that are
+ * added without running the connect hooks (such as after a
+ * hot restart) are also included.
+ */
+static void whox_index_build(void)
+{
+	Client *acptr;
+
+	whox_index_built = 1;
+	list_for_each_entry(acptr, &client_list, client_node)
+		if (IsUser(acptr))
+			whox_index_update(acptr);
+}
+
+int whox_index_nickchange(Client *client, MessageTag *mtags, const char *oldnick)
+{
+	return whox_index_update(client);
+}
+
+int whox_index_userhost_change(Client *client, const char *olduser, const char *oldhost)
+{
+	return whox_index_update(client);
+}
+
+int whox_index_umode_change(Client *client, long setflags, long newflags)
+{
+	return whox_index_update(client);
+}
+
+int whox_index_account_login(Client *client, MessageTag *mtags)
+{
+	return whox_index_update(client);
+}
+
+int whox_index_ip_change(Client *client, const char *oldip)
+{
+	return whox_index_update(client);
+}
+
+int whox_index_free_user(Client *client)
+{
+	whox_index_remove(client);
+	return 0;
+}
+
+/** whox_index module data operations: free */
+void whox_index_md_free(ModData *md)
+{
+	WhoxIndexEntry *e = md->ptr;
+	int i;
+
+	if (!e)
+		return;
+	for (i = 0; i < WHOX_NODES; i++)
+		whox_node_unlink(&e->node[i]);
+	safe_free(md->ptr);
+}
+
+static int whox_add_lookup(WhoxLookups *l, char kind, const char *str, size_t len)
+{
+	if (l->count == WHOX_MAX_LOOKUPS)
+		return 0;
+	l->hash[l->count++] = whox_hash(kind, str, len);
+	return 1;
+}
+
+/* The whox_lookup_* functions below add the index lookups for
+ * matching 'mask' against one field. They return 1 if the field
+ * can be looked up in the index (which includes the case where
+ * the mask can never match the field, with no lookups added)
+ * and 0 if a full scan is needed.
+ */
+
+static int whox_lookup_nick(WhoxLookups *l, const char *mask, size_t prefixlen)
+{
+	if (whox_count_chars(mask, ".:"))
+		return 1; /* these can never be in a nick, so nothing to look up */
+	if (!mask[prefixlen])
+		return whox_add_lookup(l, WHOX_KEY_NICK, mask, MIN(prefixlen, 2)); /* no wildcards */
+	if (prefixlen < 2)
+		return 0;
+	return whox_add_lookup(l, WHOX_KEY_NICK, mask, 2);
+}
+
+/* Hardly any usernames contain a dot, while nearly all host and
+ * IP masks do. So if we keep track of the few users that do have a
+ * dot in their username then the default search can still use the index.
+ */
+static int whox_lookup_username(WhoxLookups *l, const char *mask, size_t prefixlen)
+{
+	if (!strchr(mask, '.'))
+		return 0;
+	return whox_add_lookup(l, WHOX_KEY_USERDOT, "", 0);
+}
+
+static int whox_lookup_host(WhoxLookups *l, const char *mask, size_t prefixlen)
+{
+	const char *suffix;
+	size_t len;
+
+	if (!mask[prefixlen])
+	{
+		/* No wildcards */
+		suffix = whox_host_suffix(mask);
+		return whox_add_lookup(l, WHOX_KEY_HOST_SUFFIX, suffix, strlen(suffix));
+	}
+
+	/* Mask like '*.isp.net' */
+	for (suffix = mask + strlen(mask); (suffix > mask) && (suffix[-1] != '*') && (suffix[-1] != '?'); suffix--);
+	if (whox_count_chars(suffix, ".") >= 2)
+	{
+		suffix = whox_host_suffix(suffix);
+		return whox_add_lookup(l, WHOX_KEY_HOST_SUFFIX, suffix, strlen(suffix));
+	}
+
+	/* Mask like '192.168.*' (unresolved hosts) */
+	len = whox_prefix_len(mask);
+	if (len < prefixlen)
+		return whox_add_lookup(l, WHOX_KEY_HOST_PREFIX, mask, len);
+
+	return 0;
+}
+
+static int whox_lookup_ip(WhoxLookups *l, const char *mask, size_t prefixlen)
+{
+	const char *p;
+	size_t len;
+
+	for (p = mask; *p; p++)
+		if (!strchr("*?.:0123456789abcdefABCDEF", *p))
+			return 1; /* this can never match an IP address */
+
+	if (!mask[prefixlen])
+		return whox_add_lookup(l, WHOX_KEY_IP, mask, whox_prefix_len(mask)); /* no wildcards */
+
+	len = whox_prefix_len(mask);
+	if (len < prefixlen)
+		return whox_add_lookup(l, WHOX_KEY_IP, mask, len);
+
+	return 0;
+}
+
+/** Like whox_lookup_ip() but for the 'i' flag, which uses match_user()
+ * and thus also accepts CIDR masks.
+ */
+static int whox_lookup_ip_cidr(WhoxLookups *l, const char *mask)
+{
+	char buf[HOSTLEN+1];
+	char *p;
+	int cidr = -1;
+	unsigned char addr[4];
+
+	if (strchr(mask, '!') || strchr(mask, '@'))
+		return 0; /* nick!user@host, let match_user() sort it out */
+
+	strlcpy(buf, mask, sizeof(buf));
+	p = strchr(buf, '/');
+	if (p)
+	{
+		*p++ = '\0';
+		cidr = atoi(p);
+		if (cidr <= 0)
+			return 1; /* invalid CIDR, never matches */
+	}
+
+	p = buf + strcspn(buf, "*?");
+	if (*p)
+		return whox_lookup_ip(l, buf, p - buf);
+
+	if (strchr(buf, ':'))
+		return 0; /* IPv6 address or CIDR, not worth the trouble */
+
+	if (!inet_pton(AF_INET, buf, addr) || (cidr > 32))
+		return 1; /* never matches */
+
+	if ((cidr >= 0) && (cidr < 16))
+		return 0; /* too wide for our index */
+
+	snprintf(buf, sizeof(buf), "%d.%d", (int)addr[0], (int)addr[1]);
+	return whox_add_lookup(l, WHOX_KEY_IP, buf, strlen(buf));
+}
+
+static int whox_lookup_server(WhoxLookups *l, const char *mask)
+{
+	Client *acptr;
+
+	list_for_each_entry(acptr, &global_server_list, client_node)
+		if (match_simple(mask, acptr->name) && !whox_add_lookup(l, WHOX_KEY_SERVER, acptr->name, strlen(acptr->name)))
+			return 0;
+	return 1;
+}
+
+static int whox_lookup_account(WhoxLookups *l, const char *mask, size_t prefixlen)
+{
+	if (mask[prefixlen])
+		return 0; /* wildcards */
+	return whox_add_lookup(l, WHOX_KEY_ACCOUNT, mask, strlen(mask));
+}
+
+/** Translate a WHO request to index lookups.
+ * This mirrors the fields that do_match() looks at.
+ * @returns 1 if the index can be used, 0 if a full scan is needed.
+ */
+static int whox_lookups(Client *client, const char *mask, struct who_format *fmt, WhoxLookups *l)
+{
+	size_t prefixlen = strcspn(mask, "*?");
+
+	l->count = 0;
+
+	if (fmt->matchsel == 0)
+	{
+		if (!whox_lookup_nick(l, mask, prefixlen) ||
+		    !whox_lookup_username(l, mask, prefixlen) ||
+		    !whox_lookup_host(l, mask, prefixlen))
+		{
+			return 0;
+		}
+		if (IsOper(client) && !whox_lookup_ip(l, mask, prefixlen))
+			return 0;
+		return 1;
+	}
+
+	if (IsMatch(fmt, WMATCH_INFO) ||
+	    (IsMatch(fmt, WMATCH_MODES) && (fmt->umodes || fmt->noumodes)) ||
+	    (IsMatch(fmt, WMATCH_CONTIME) && (fmt->contimemin || fmt->contimemax)))
+	{
+		return 0;
+	}
+
+	if (IsMatch(fmt, WMATCH_NICK) && !whox_lookup_nick(l, mask, prefixlen))
+		return 0;
+	if (IsMatch(fmt, WMATCH_USER) && !whox_lookup_username(l, mask, prefixlen))
+		return 0;
+	if (IsMatch(fmt, WMATCH_SERVER) && IsOper(client) && !whox_lookup_server(l, mask))
+		return 0;
+	if (IsMatch(fmt, WMATCH_HOST))
+	{
+		if (!whox_lookup_host(l, mask, prefixlen))
+			return 0;
+		if (IsOper(client) && !whox_lookup_ip(l, mask, prefixlen))
+			return 0;
+	}
+	if (IsMatch(fmt, WMATCH_IP) && IsOper(client) && !whox_lookup_ip_cidr(l, mask))
+		return 0;
+	if (IsMatch(fmt, WMATCH_ACCOUNT) && !whox_lookup_account(l, mask, prefixlen))
+		return 0;
+
+	return 1;
+}
+
 /** cmd_whox: standardized "extended" version of WHO.
  * The good thing about WHOX is that it allows the client to define what
  * output they want to see. Another good thing is that it is standardized
@@ -532,17 +1059,44 @@ static void who_common_channel(Client *client, Channel *channel,
 
 		SetMark(acptr);
 
-		if (*maxmatches > 0)
+		if (do_match(client, acptr, mask, fmt))
 		{
-			if (do_match(client, acptr, mask, fmt))
-			{
-				do_who(client, acptr, NULL, fmt);
-				--(*maxmatches);
-			}
+			do_who(client, acptr, NULL, fmt);
+			if (--(*maxmatches) <= 0)
+				return;
 		}
 	}
 }
 
+/** Check a client found by who_global() and send the WHO reply
+ * if it matches.
+ * @returns 1 if we reached the maximum number of matches, 0 otherwise.
+ */
+static int who_global_one(Client *client, Client *acptr, char *mask, int operspy, Client *hunted, int *maxmatches, struct who_format *fmt)
+{
+	if (!IsUser(acptr))
+		return 0;
+
+	if (IsInvisible(acptr) && !operspy && (client != acptr) && (acptr != hunted))
+		return 0;
+
+	if (IsMarked(acptr))
+		return 0;
+
+	if (IsMatch(fmt, WMATCH_OPER) && !IsOper(acptr))
+		return 0;
+
+	SetMark(acptr);
+
+	if (do_match(client, acptr, mask, fmt))
+	{
+		do_who(client, acptr, NULL, fmt);
+		if (--(*maxmatches) <= 0)
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * who_global
  *
@@ -552,58 +1106,65 @@ static void who_common_channel(Client *client, Channel *channel,
  *			- int if operspy or not
  *			- format options
  * output		- NONE
- * side effects		- do a global scan of all clients looking for match
- *			  this is slightly expensive on EFnet ...
- *			  marks assumed cleared for all clients initially
- *			  and will be left cleared on return
+ * side effects		- look up the candidates in the WHO index, or do a
+ *			  global scan of all clients if the mask cannot use
+ *			  the index. Stops as soon as maxmatches is reached.
  */
-
 static void who_global(Client *client, char *mask, int operspy, struct who_format *fmt)
 {
 	Client *hunted = NULL;
 	Client *acptr;
 	int maxmatches = IsOper(client) ? INT_MAX : WHOLIMIT;
+	WhoxLookups lookups;
+	int i;
 
 	/* If searching for a nick explicitly, then include it later on in the result: */
 	if (mask && ((fmt->matchsel & WMATCH_NICK) || (fmt->matchsel == 0)))
 		hunted = find_user(mask, NULL);
 
-	/* Initialize the markers to zero */
-	list_for_each_entry(acptr, &client_list, client_node)
-		ClearMark(acptr);
+	/* Start with all markers cleared */
+	whox_mark_generation++;
 
 	/* First, if not operspy, then list all matching clients on common channels */
 	if (!operspy)
 	{
 		Membership *lp;
 
-		for (lp = client->user->channel; lp; lp = lp->next)
+		for (lp = client->user->channel; lp && (maxmatches > 0); lp = lp->next)
 			who_common_channel(client, lp->channel, mask, &maxmatches, fmt);
 	}
 
-	/* Second, list all matching visible clients. */
-	list_for_each_entry(acptr, &client_list, client_node)
+	/* Second, list all matching visible clients.
+	 * If possible, only look at the candidates from the index.
+	 */
+	if (maxmatches > 0)
 	{
-		if (!IsUser(acptr))
-			continue;
-
-		if (IsInvisible(acptr) && !operspy && (client != acptr) && (acptr != hunted))
-			continue;
-
-		if (IsMarked(acptr))
-			continue;
+		if (!whox_index_built)
+			whox_index_build();
 
-		if (IsMatch(fmt, WMATCH_OPER) && !IsOper(acptr))
-			continue;
-
-		if (maxmatches > 0)
+		if (mask && whox_lookups(client, mask, fmt, &lookups))
 		{
-			if (do_match(client, acptr, mask, fmt))
- 			{
-				do_who(client, acptr, NULL, fmt);
-				--maxmatches;
- 			}
- 		}
+			for (i = 0; i < lookups.count; i++)
+			{
+				WhoxIndexNode *n, *n_next;
+
+				for (n = whox_index[lookups.hash[i] & (WHOX_INDEX_SIZE-1)]; n; n = n_next)
+				{
+					n_next = n->next;
+					if ((n->hash == lookups.hash[i]) &&
+					    who_global_one(client, n->client, mask, operspy, hunted, &maxmatches, fmt))
+					{
+						break;
+					}
+				}
+				if (maxmatches <= 0)
+					break;
+			}
+		} else {
+			list_for_each_entry(acptr, &client_list, client_node)
+				if (who_global_one(client, acptr, mask, operspy, hunted, &maxmatches, fmt))
+					break;
+		}
 	}
 
 	if (maxmatches <= 0)
@@ -747,7 +1308,7 @@ static void do_who(Client *client, Client *acptr, Channel *channel, struct who_f
 	{
 		Membership *lp;
 
-		if ((lp = find_membership_link(acptr->user->channel, channel)))
+		if ((lp = find_membership(acptr, channel)))
 		{
 			if (!(fmt->fields || HasCapability(client, "multi-prefix")))
 			{
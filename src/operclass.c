@@ -139,6 +139,32 @@ OperClassACLPath *OperClass_parsePath(const char *path)
 	return pathHead;
 }
 
+/** Parse a path like OperClass_parsePath() but in scratch memory,
+ * for the lookups in ValidatePermissionsForPath().
+ * The identifiers point into a single copy of 'path'.
+ */
+static OperClassACLPath *OperClass_parseScratchPath(const char *path)
+{
+	char *pathCopy = scratch_strdup(path);
+	OperClassACLPath *pathHead = NULL, *pathTail = NULL;
+	OperClassACLPath *tmpPath;
+	char *p, *str;
+
+	for (str = strtoken(&p, pathCopy, ":"); str; str = strtoken(&p, NULL, ":"))
+	{
+		tmpPath = scratch_alloc(sizeof(OperClassACLPath));
+		tmpPath->identifier = str;
+		tmpPath->prev = pathTail;
+		if (pathTail)
+			pathTail->next = tmpPath;
+		else
+			pathHead = tmpPath;
+		pathTail = tmpPath;
+	}
+
+	return pathHead;
+}
+
 void OperClass_freePath(OperClassACLPath *path)
 {
 	OperClassACLPath *next;
@@ -286,6 +312,8 @@ OperPermission ValidatePermissionsForPath(const char *path, Client *client, Clie
 	ConfigItem_operclass *ce_operClass;
 	OperClass *oc = NULL;
 	OperClassACLPath *operPath;
+	ScratchMark scratch;
+	OperPermission perm = OPER_DENY;
 
 	if (!client)
 		return OPER_DENY;
@@ -313,23 +341,21 @@ OperPermission ValidatePermissionsForPath(const char *path, Client *client, Clie
 		return OPER_DENY;
 
 	oc = ce_operClass->classStruct;
-	operPath = OperClass_parsePath(path);
+	scratch_mark(&scratch);
+	operPath = OperClass_parseScratchPath(path);
 	while (oc && operPath)
 	{
 		OperClassACL *acl = OperClass_FindACL(oc->acls,operPath->identifier);
 		if (acl)
 		{
-			OperPermission perm;
-			OperClassCheckParams *params = safe_alloc(sizeof(OperClassCheckParams));
+			OperClassCheckParams *params = scratch_alloc(sizeof(OperClassCheckParams));
 			params->client = client;
 			params->victim = victim;
 			params->channel = channel;
 			params->extra = extra;
 			
 			perm = ValidatePermissionsForPathEx(acl, operPath, params);
-			OperClass_freePath(operPath);
-			safe_free(params);
-			return perm;
+			break;
 		}
 		if (!oc->ISA)
 		{
@@ -343,6 +369,6 @@ OperPermission ValidatePermissionsForPath(const char *path, Client *client, Clie
 			break; /* parent not found */
 		}
 	}
-	OperClass_freePath(operPath);
-	return OPER_DENY;
+	scratch_release(&scratch);
+	return perm;
 }
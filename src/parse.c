@@ -32,7 +32,7 @@ static char *para[MAXPARA + 2];
 static int do_numeric(int, Client *, MessageTag *, int, const char **);
 static void cancel_clients(Client *, Client *, char *);
 static void remove_unknown(Client *, char *);
-static void parse2(Client *client, Client **fromptr, MessageTag *mtags, int mtags_bytes, char *ch);
+static void parse2(Client *client, Client **fromptr, MessageTag *mtags, int mtags_bytes, char *ch, uint64_t scratch_start);
 static void parse_addlag(Client *client, int command_bytes, int mtags_bytes);
 static int client_lagged_up(Client *client);
 static void ban_handshake_data_flooder(Client *client);
@@ -167,6 +167,8 @@ void parse(Client *cptr, char *buffer, int length)
 	int i, ret;
 	MessageTag *mtags = NULL;
 	int mtags_bytes = 0;
+	ScratchMark scratch;
+	uint64_t scratch_start;
 
 	/* Take extreme care in this function, as messages can be up to READBUFSIZE
 	 * in size, which is 8192 at the time of writing.
@@ -208,6 +210,12 @@ void parse(Client *cptr, char *buffer, int length)
 	for (ch = buffer; *ch == ' '; ch++)
 		;
 
+	/* Everything allocated from scratch memory from here on
+	 * is released at the end of this function.
+	 */
+	scratch_mark(&scratch);
+	scratch_start = scratch_allocations;
+
 	/* Now, parse message tags, if any */
 	if (*ch == '@')
 	{
@@ -220,7 +228,7 @@ void parse(Client *cptr, char *buffer, int length)
 			;
 	}
 
-	parse2(cptr, &from, mtags, mtags_bytes, ch);
+	parse2(cptr, &from, mtags, mtags_bytes, ch, scratch_start);
 
 	if (IsDead(cptr))
 		RunHook(HOOKTYPE_POST_COMMAND, NULL, mtags, ch);
@@ -228,6 +236,7 @@ void parse(Client *cptr, char *buffer, int length)
 		RunHook(HOOKTYPE_POST_COMMAND, from, mtags, ch);
 
 	free_message_tags(mtags);
+	scratch_release(&scratch);
 	return;
 }
 
@@ -238,16 +247,15 @@ void parse(Client *cptr, char *buffer, int length)
  * @param mtags  	Message tags received for this message.
  * @param mtags_bytes	The length of all message tags.
  * @param ch		The incoming line received (buffer), excluding message tags.
+ * @param scratch_start	Value of scratch_allocations at the start of parse().
  */
-static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_bytes, char *ch)
+static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_bytes, char *ch, uint64_t scratch_start)
 {
 	Client *from = cptr;
 	char *s;
 	int len, i, numeric = 0, paramcount;
-#ifdef DEBUGMODE
-	time_t then, ticks;
-	int retval;
-#endif
+	uint64_t then;
+	int profiling;
 	RealCommand *cmptr = NULL;
 	int bytes;
 
@@ -502,8 +510,13 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_
 	if (IsUser(cptr) && (cmptr->flags & CMD_RESETIDLE))
 		cptr->local->idle_since = TStime();
 
-	/* Now ready to execute the command */
-#ifndef DEBUGMODE
+	/* Now ready to execute the command.
+	 * The same pair of timestamps is used for the command statistics
+	 * and for the profiler, so with the profiler enabled they are
+	 * taken with profiler_now() and converted to nsec afterwards.
+	 */
+	profiling = profiler_enabled; /* PROFILER ON/OFF may change it */
+	then = profiling ? profiler_now() : monotonic_nsec();
 	if (cmptr->flags & CMD_ALIAS)
 	{
 		(*cmptr->aliasfunc) (from, mtags, i, (const char **)para, cmptr->cmd);
@@ -513,26 +526,19 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_
 		else
 			(*cmptr->overriders->func) (cmptr->overriders, from, mtags, i, (const char **)para);
 	}
-#else
-	then = clock();
-	if (cmptr->flags & CMD_ALIAS)
+	cmptr->scratch_allocs += scratch_allocations - scratch_start;
+	if (profiling)
 	{
-		(*cmptr->aliasfunc) (from, mtags, i, (const char **)para, cmptr->cmd);
+		then = profiler_now() - then;
+		profiler_record_value(&cmptr->profile, then);
+		then = profiler_to_nsec(then);
 	} else {
-		if (!cmptr->overriders)
-			(*cmptr->func) (from, mtags, i, (const char **)para);
-		else
-			(*cmptr->overriders->func) (cmptr->overriders, from, mtags, i, (const char **)para);
+		then = monotonic_nsec() - then;
 	}
-	if (!IsDead(cptr))
-	{
-		ticks = (clock() - then);
-		if (IsServer(cptr))
-			cmptr->rticks += ticks;
-		else
-			cmptr->lticks += ticks;
-	}
-#endif
+	if (IsServer(cptr))
+		cmptr->remote_nsec += then;
+	else
+		cmptr->local_nsec += then;
 }
 
 /** Ban user that is "flooding from an unknown connection".
@@ -32,6 +32,7 @@ CMD_FUNC(procio_modules);
 CMD_FUNC(procio_rehash);
 CMD_FUNC(procio_exit);
 CMD_FUNC(procio_help);
+CMD_FUNC(procio_hotrestart);
 void start_of_control_client_handshake(Client *client);
 int procio_accept(Client *client);
 
@@ -59,6 +60,7 @@ void add_proc_io_server(void)
 	CommandAdd(NULL, "REHASH", procio_rehash, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "EXIT", procio_exit, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "HELP", procio_help, MAXPARA, CMD_CONTROL);
+	CommandAdd(NULL, "HOTRESTART", procio_hotrestart, MAXPARA, CMD_CONTROL);
 	HookAdd(NULL, HOOKTYPE_ACCEPT, -1000000, procio_accept);
 }
 
@@ -163,11 +165,27 @@ CMD_FUNC(procio_exit)
 	exit_client(client, NULL, "");
 }
 
+/** Hand over everything to a new UnrealIRCd process.
+ * This is sent by the new process itself ('unrealircd -H'),
+ * on success we never return from hot_restart_request().
+ */
+CMD_FUNC(procio_hotrestart)
+{
+	if (loop.rehashing)
+	{
+		sendto_one(client, NULL, "REPLY ERROR: A rehash is in progress");
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+	hot_restart_request(client);
+}
+
 CMD_FUNC(procio_help)
 {
 	sendto_one(client, NULL, "REPLY Commands available:");
 	sendto_one(client, NULL, "REPLY EXIT");
 	sendto_one(client, NULL, "REPLY HELP");
+	sendto_one(client, NULL, "REPLY HOTRESTART");
 	sendto_one(client, NULL, "REPLY REHASH");
 	sendto_one(client, NULL, "REPLY STATUS");
 	sendto_one(client, NULL, "REPLY MODULES");
@@ -0,0 +1,477 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/profiler.c
+ * (c) 2022- Bram Matthys and The UnrealIRCd Team
+ * License: GPLv2 or later
+ */
+
+/** @file
+ * @brief Profiler for command handlers and hooks
+ */
+#include "unrealircd.h"
+
+/** The profiler keeps track of the time spent in command handlers,
+ * per hook type and per hook (so per module and hook type).
+ * It is always compiled in but disabled by default. When disabled the
+ * only cost is a single branch on 'profiler_enabled' in parse2()
+ * and in the RunHook macros.
+ * Durations are measured in profiler_now() units, which is the CPU
+ * timestamp counter (cycles) on x86 and nanoseconds elsewhere.
+ * @defgroup ProfilerAPI Profiler API
+ * @{
+ */
+
+/** Is the profiler enabled? Use profiler_enable() and profiler_disable() to change */
+MODVAR int profiler_enabled = 0;
+
+/** Time the profiler was enabled (0 if disabled) */
+MODVAR time_t profiler_enabled_since = 0;
+
+/** Profiler data per hook type (for all hooks of that type together) */
+static ProfilerHistogram *hooktype_profile[MAXHOOKTYPES];
+
+/* For converting profiler_now() units to time */
+static uint64_t calibrate_start_units = 0;
+static uint64_t calibrate_start_nsec = 0;
+static double units_per_usec = 1000.0;
+
+typedef struct HooktypeName HooktypeName;
+struct HooktypeName {
+	int hooktype;
+	const char *name;
+};
+
+/** Names of the hook types, for displaying */
+static HooktypeName hooktype_names[] = {
+	{ HOOKTYPE_PRE_LOCAL_CONNECT,        "pre_local_connect" },
+	{ HOOKTYPE_LOCAL_CONNECT,            "local_connect" },
+	{ HOOKTYPE_REMOTE_CONNECT,           "remote_connect" },
+	{ HOOKTYPE_PRE_LOCAL_QUIT,           "pre_local_quit" },
+	{ HOOKTYPE_LOCAL_QUIT,               "local_quit" },
+	{ HOOKTYPE_REMOTE_QUIT,              "remote_quit" },
+	{ HOOKTYPE_UNKUSER_QUIT,             "unkuser_quit" },
+	{ HOOKTYPE_SERVER_CONNECT,           "server_connect" },
+	{ HOOKTYPE_SERVER_HANDSHAKE_OUT,     "server_handshake_out" },
+	{ HOOKTYPE_SERVER_SYNC,              "server_sync" },
+	{ HOOKTYPE_POST_SERVER_CONNECT,      "post_server_connect" },
+	{ HOOKTYPE_SERVER_SYNCED,            "server_synced" },
+	{ HOOKTYPE_SERVER_QUIT,              "server_quit" },
+	{ HOOKTYPE_LOCAL_NICKCHANGE,         "local_nickchange" },
+	{ HOOKTYPE_REMOTE_NICKCHANGE,        "remote_nickchange" },
+	{ HOOKTYPE_CAN_JOIN,                 "can_join" },
+	{ HOOKTYPE_PRE_LOCAL_JOIN,           "pre_local_join" },
+	{ HOOKTYPE_LOCAL_JOIN,               "local_join" },
+	{ HOOKTYPE_REMOTE_JOIN,              "remote_join" },
+	{ HOOKTYPE_PRE_LOCAL_PART,           "pre_local_part" },
+	{ HOOKTYPE_LOCAL_PART,               "local_part" },
+	{ HOOKTYPE_REMOTE_PART,              "remote_part" },
+	{ HOOKTYPE_PRE_LOCAL_KICK,           "pre_local_kick" },
+	{ HOOKTYPE_CAN_KICK,                 "can_kick" },
+	{ HOOKTYPE_LOCAL_KICK,               "local_kick" },
+	{ HOOKTYPE_REMOTE_KICK,              "remote_kick" },
+	{ HOOKTYPE_PRE_CHANMSG,              "pre_chanmsg" },
+	{ HOOKTYPE_CAN_SEND_TO_USER,         "can_send_to_user" },
+	{ HOOKTYPE_CAN_SEND_TO_CHANNEL,      "can_send_to_channel" },
+	{ HOOKTYPE_USERMSG,                  "usermsg" },
+	{ HOOKTYPE_CHANMSG,                  "chanmsg" },
+	{ HOOKTYPE_PRE_LOCAL_TOPIC,          "pre_local_topic" },
+	{ HOOKTYPE_TOPIC,                    "topic" },
+	{ HOOKTYPE_PRE_LOCAL_CHANMODE,       "pre_local_chanmode" },
+	{ HOOKTYPE_PRE_REMOTE_CHANMODE,      "pre_remote_chanmode" },
+	{ HOOKTYPE_LOCAL_CHANMODE,           "local_chanmode" },
+	{ HOOKTYPE_REMOTE_CHANMODE,          "remote_chanmode" },
+	{ HOOKTYPE_MODECHAR_DEL,             "modechar_del" },
+	{ HOOKTYPE_MODECHAR_ADD,             "modechar_add" },
+	{ HOOKTYPE_AWAY,                     "away" },
+	{ HOOKTYPE_PRE_INVITE,               "pre_invite" },
+	{ HOOKTYPE_INVITE,                   "invite" },
+	{ HOOKTYPE_PRE_KNOCK,                "pre_knock" },
+	{ HOOKTYPE_KNOCK,                    "knock" },
+	{ HOOKTYPE_WHOIS,                    "whois" },
+	{ HOOKTYPE_WHO_STATUS,               "who_status" },
+	{ HOOKTYPE_PRE_KILL,                 "pre_kill" },
+	{ HOOKTYPE_LOCAL_KILL,               "local_kill" },
+	{ HOOKTYPE_REHASHFLAG,               "rehashflag" },
+	{ HOOKTYPE_CONFIGPOSTTEST,           "configposttest" },
+	{ HOOKTYPE_REHASH,                   "rehash" },
+	{ HOOKTYPE_REHASH_COMPLETE,          "rehash_complete" },
+	{ HOOKTYPE_CONFIGTEST,               "configtest" },
+	{ HOOKTYPE_CONFIGRUN,                "configrun" },
+	{ HOOKTYPE_CONFIGRUN_EX,             "configrun_ex" },
+	{ HOOKTYPE_STATS,                    "stats" },
+	{ HOOKTYPE_LOCAL_OPER,               "local_oper" },
+	{ HOOKTYPE_LOCAL_PASS,               "local_pass" },
+	{ HOOKTYPE_CHANNEL_CREATE,           "channel_create" },
+	{ HOOKTYPE_CHANNEL_DESTROY,          "channel_destroy" },
+	{ HOOKTYPE_TKL_EXCEPT,               "tkl_except" },
+	{ HOOKTYPE_UMODE_CHANGE,             "umode_change" },
+	{ HOOKTYPE_TKL_ADD,                  "tkl_add" },
+	{ HOOKTYPE_TKL_DEL,                  "tkl_del" },
+	{ HOOKTYPE_LOG,                      "log" },
+	{ HOOKTYPE_LOCAL_SPAMFILTER,         "local_spamfilter" },
+	{ HOOKTYPE_SILENCED,                 "silenced" },
+	{ HOOKTYPE_RAWPACKET_IN,             "rawpacket_in" },
+	{ HOOKTYPE_PACKET,                   "packet" },
+	{ HOOKTYPE_HANDSHAKE,                "handshake" },
+	{ HOOKTYPE_FREE_CLIENT,              "free_client" },
+	{ HOOKTYPE_FREE_USER,                "free_user" },
+	{ HOOKTYPE_CAN_JOIN_LIMITEXCEEDED,   "can_join_limitexceeded" },
+	{ HOOKTYPE_VISIBLE_IN_CHANNEL,       "visible_in_channel" },
+	{ HOOKTYPE_SEE_CHANNEL_IN_WHOIS,     "see_channel_in_whois" },
+	{ HOOKTYPE_JOIN_DATA,                "join_data" },
+	{ HOOKTYPE_INVITE_BYPASS,            "invite_bypass" },
+	{ HOOKTYPE_VIEW_TOPIC_OUTSIDE_CHANNEL, "view_topic_outside_channel" },
+	{ HOOKTYPE_CHAN_PERMIT_NICK_CHANGE,  "chan_permit_nick_change" },
+	{ HOOKTYPE_IS_CHANNEL_SECURE,        "is_channel_secure" },
+	{ HOOKTYPE_CHANNEL_SYNCED,           "channel_synced" },
+	{ HOOKTYPE_CAN_SAJOIN,               "can_sajoin" },
+	{ HOOKTYPE_MODE_DEOP,                "mode_deop" },
+	{ HOOKTYPE_DCC_DENIED,               "dcc_denied" },
+	{ HOOKTYPE_SECURE_CONNECT,           "secure_connect" },
+	{ HOOKTYPE_CAN_BYPASS_CHANNEL_MESSAGE_RESTRICTION, "can_bypass_channel_message_restriction" },
+	{ HOOKTYPE_SASL_CONTINUATION,        "sasl_continuation" },
+	{ HOOKTYPE_SASL_RESULT,              "sasl_result" },
+	{ HOOKTYPE_PLACE_HOST_BAN,           "place_host_ban" },
+	{ HOOKTYPE_FIND_TKLINE_MATCH,        "find_tkline_match" },
+	{ HOOKTYPE_WELCOME,                  "welcome" },
+	{ HOOKTYPE_PRE_COMMAND,              "pre_command" },
+	{ HOOKTYPE_POST_COMMAND,             "post_command" },
+	{ HOOKTYPE_NEW_MESSAGE,              "new_message" },
+	{ HOOKTYPE_IS_HANDSHAKE_FINISHED,    "is_handshake_finished" },
+	{ HOOKTYPE_PRE_LOCAL_QUIT_CHAN,      "pre_local_quit_chan" },
+	{ HOOKTYPE_IDENT_LOOKUP,             "ident_lookup" },
+	{ HOOKTYPE_ACCOUNT_LOGIN,            "account_login" },
+	{ HOOKTYPE_CLOSE_CONNECTION,         "close_connection" },
+	{ HOOKTYPE_CONNECT_EXTINFO,          "connect_extinfo" },
+	{ HOOKTYPE_IS_INVITED,               "is_invited" },
+	{ HOOKTYPE_POST_LOCAL_NICKCHANGE,    "post_local_nickchange" },
+	{ HOOKTYPE_POST_REMOTE_NICKCHANGE,   "post_remote_nickchange" },
+	{ HOOKTYPE_USERHOST_CHANGE,          "userhost_change" },
+	{ HOOKTYPE_REALNAME_CHANGE,          "realname_change" },
+	{ HOOKTYPE_CAN_SET_TOPIC,            "can_set_topic" },
+	{ HOOKTYPE_IP_CHANGE,                "ip_change" },
+	{ HOOKTYPE_JSON_EXPAND_CLIENT,       "json_expand_client" },
+	{ HOOKTYPE_JSON_EXPAND_CLIENT_USER,  "json_expand_client_user" },
+	{ HOOKTYPE_JSON_EXPAND_CLIENT_SERVER, "json_expand_client_server" },
+	{ HOOKTYPE_JSON_EXPAND_CHANNEL,      "json_expand_channel" },
+	{ HOOKTYPE_ACCEPT,                   "accept" },
+	{ HOOKTYPE_METRICS,                  "metrics" },
+	{ HOOKTYPE_LOOP_END,                 "loop_end" },
+	{ 0,                                 NULL },
+};
+
+/** Get the name of a hook type, eg "local_connect" for HOOKTYPE_LOCAL_CONNECT.
+ * For hook types that are not in our table, such as ones that were
+ * added by a module, the name from Hooktypes[] is used, or "hooktype_N".
+ * @param hooktype	The hook type (HOOKTYPE_*)
+ * @returns The name, never NULL.
+ */
+const char *hooktype_name(int hooktype)
+{
+	static char *generated_names[MAXHOOKTYPES];
+	char buf[32];
+	HooktypeName *n;
+	Hooktype *h;
+
+	for (n = hooktype_names; n->name; n++)
+		if (n->hooktype == hooktype)
+			return n->name;
+	for (h = Hooktypes; (h < Hooktypes + MAXCUSTOMHOOKS) && h->string; h++)
+		if (h->id == hooktype)
+			return h->string;
+	if ((hooktype < 0) || (hooktype >= MAXHOOKTYPES))
+	{
+		/* Not something we can cache, shouldn't happen */
+		return "hooktype_unknown";
+	}
+	/* Keep the name around, profiler_get_entries() hands out the pointer */
+	if (!generated_names[hooktype])
+	{
+		snprintf(buf, sizeof(buf), "hooktype_%d", hooktype);
+		safe_strdup(generated_names[hooktype], buf);
+	}
+	return generated_names[hooktype];
+}
+
+/** Start measuring the profiler_now() rate, called on boot.
+ * By the time the profiler is enabled we have a good idea of
+ * the rate already, which profiler_to_nsec() depends on.
+ */
+void profiler_init(void)
+{
+	calibrate_start_units = profiler_now();
+	calibrate_start_nsec = monotonic_nsec();
+}
+
+/** Update the profiler_now() units per microsecond, on x86 */
+static void profiler_calibrate(void)
+{
+#ifdef PROFILER_USE_TSC
+	uint64_t elapsed_nsec;
+
+	if (calibrate_start_nsec)
+	{
+		elapsed_nsec = monotonic_nsec() - calibrate_start_nsec;
+		/* Need at least 10ms for a somewhat accurate measurement */
+		if (elapsed_nsec > 10000000)
+			units_per_usec = (double)(profiler_now() - calibrate_start_units) / (elapsed_nsec / 1000.0);
+	}
+#endif
+}
+
+/** Enable the profiler */
+void profiler_enable(void)
+{
+	if (profiler_enabled)
+		return;
+	if (calibrate_start_nsec == 0)
+		profiler_init();
+	profiler_calibrate();
+	profiler_enabled = 1;
+	profiler_enabled_since = TStime();
+}
+
+/** Disable the profiler. The data that was collected so far is kept. */
+void profiler_disable(void)
+{
+	profiler_enabled = 0;
+	profiler_enabled_since = 0;
+}
+
+/** Throw away all data collected by the profiler */
+void profiler_reset(void)
+{
+	RealCommand *c;
+	Hook *h;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		for (c = CommandHash[i]; c; c = c->next)
+			safe_free(c->profile);
+
+	for (i = 0; i < MAXHOOKTYPES; i++)
+	{
+		for (h = Hooks[i]; h; h = h->next)
+			safe_free(h->profile);
+		safe_free(hooktype_profile[i]);
+	}
+
+	if (profiler_enabled)
+		profiler_enabled_since = TStime();
+}
+
+/** Returns floor(log2(v)), for v > 0 */
+static int profiler_log2(uint64_t v)
+{
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(v);
+#else
+	int n = 0;
+	while (v >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+/** Bucket index for value 'v' in a ProfilerHistogram */
+static int profiler_bucket(uint64_t v)
+{
+	int msb;
+
+	if (v < PROFILER_SUB_BUCKETS)
+		return (int)v;
+	msb = profiler_log2(v);
+	return ((msb - PROFILER_SUB_BUCKET_BITS + 1) * PROFILER_SUB_BUCKETS) +
+	       (int)((v >> (msb - PROFILER_SUB_BUCKET_BITS)) & (PROFILER_SUB_BUCKETS - 1));
+}
+
+/** Highest value that ends up in bucket index 'i' (the reverse of profiler_bucket) */
+static uint64_t profiler_bucket_value(int i)
+{
+	int shift;
+
+	if (i < PROFILER_SUB_BUCKETS)
+		return i;
+	shift = (i / PROFILER_SUB_BUCKETS) - 1;
+	return ((uint64_t)(PROFILER_SUB_BUCKETS + (i % PROFILER_SUB_BUCKETS)) << shift) + ((1ULL << shift) - 1);
+}
+
+/** Record the time since 'start' in a histogram.
+ * The histogram is allocated on first use.
+ * @param hist	Pointer to the histogram pointer, eg &hook->profile
+ * @param start	The start time, as returned by profiler_now()
+ */
+void profiler_record(ProfilerHistogram **hist, uint64_t start)
+{
+	profiler_record_value(hist, profiler_now() - start);
+}
+
+/** Record a duration in a histogram, for callers that measured it themselves.
+ * @param hist	Pointer to the histogram pointer, eg &cmd->profile
+ * @param v	The duration, in profiler_now() units
+ */
+void profiler_record_value(ProfilerHistogram **hist, uint64_t v)
+{
+	ProfilerHistogram *h = *hist;
+
+	if (!h)
+		h = *hist = safe_alloc(sizeof(ProfilerHistogram));
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+	h->buckets[profiler_bucket(v)]++;
+}
+
+/** Record the time spent in all hooks of type 'hooktype' together */
+void profiler_record_hooktype(int hooktype, uint64_t start)
+{
+	profiler_record(&hooktype_profile[hooktype], start);
+}
+
+/** Get the profiler data of a hook type (can be NULL) */
+ProfilerHistogram *profiler_hooktype(int hooktype)
+{
+	if ((hooktype < 0) || (hooktype >= MAXHOOKTYPES))
+		return NULL;
+	return hooktype_profile[hooktype];
+}
+
+/** Get the value at a certain percentile.
+ * @param h		The histogram
+ * @param percentile	The percentile, eg 99.0
+ * @returns The value, in profiler_now() units (accurate to within 12.5%)
+ */
+uint64_t profiler_percentile(ProfilerHistogram *h, double percentile)
+{
+	uint64_t wanted, seen = 0;
+	int i;
+
+	if (!h || !h->count)
+		return 0;
+
+	wanted = (uint64_t)((percentile / 100.0) * h->count);
+	if (wanted < 1)
+		wanted = 1;
+
+	for (i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->buckets[i];
+		if (seen >= wanted)
+		{
+			uint64_t v = profiler_bucket_value(i);
+			return (v > h->max) ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+/** Convert profiler_now() units to microseconds.
+ * On x86 the units are CPU cycles, the conversion rate is
+ * measured against the monotonic clock since boot.
+ */
+double profiler_to_usec(uint64_t value)
+{
+	profiler_calibrate();
+	return value / units_per_usec;
+}
+
+/** Convert profiler_now() units to nanoseconds.
+ * Unlike profiler_to_usec() this does not update the conversion
+ * rate, so it is cheap enough to call for every command.
+ */
+uint64_t profiler_to_nsec(uint64_t value)
+{
+#ifdef PROFILER_USE_TSC
+	return (uint64_t)(value * 1000.0 / units_per_usec);
+#else
+	return value;
+#endif
+}
+
+/** Get the number of recorded values up to a certain duration.
+ * @param h		The histogram
+ * @param usec		The duration, in microseconds
+ * @returns The number of values that are (within 12.5%) not higher than 'usec'
+ */
+uint64_t profiler_count_upto(ProfilerHistogram *h, double usec)
+{
+	uint64_t limit, cnt = 0;
+	int i;
+
+	if (!h)
+		return 0;
+
+	profiler_calibrate();
+	limit = (uint64_t)(usec * units_per_usec);
+	for (i = 0; (i < PROFILER_HISTOGRAM_BUCKETS) && (profiler_bucket_value(i) <= limit); i++)
+		cnt += h->buckets[i];
+	return cnt;
+}
+
+static int profiler_entry_compare(const void *a, const void *b)
+{
+	const ProfilerEntry *x = a, *y = b;
+
+	if (x->histogram->sum > y->histogram->sum)
+		return -1;
+	if (x->histogram->sum < y->histogram->sum)
+		return 1;
+	return 0;
+}
+
+static void profiler_add_entry(ProfilerEntry **entries, int *cnt, int *size, ProfilerEntryType type,
+                               const char *name, const char *module, ProfilerHistogram *histogram)
+{
+	if (*cnt == *size)
+	{
+		*size = *size ? *size * 2 : 64;
+		*entries = realloc(*entries, sizeof(ProfilerEntry) * *size);
+		if (!*entries)
+			outofmemory(sizeof(ProfilerEntry) * *size);
+	}
+	(*entries)[*cnt].type = type;
+	(*entries)[*cnt].name = name;
+	(*entries)[*cnt].module = module;
+	(*entries)[*cnt].histogram = histogram;
+	(*cnt)++;
+}
+
+/** Get all commands and hooks that have profiler data.
+ * @param entries	Will be set to an array, sorted by total time spent (high to low).
+ *			The caller should safe_free() this.
+ * @returns Number of items in the array.
+ * @note The names in the array point to the command and module structs,
+ *       so don't keep the array around.
+ */
+int profiler_get_entries(ProfilerEntry **entries)
+{
+	RealCommand *c;
+	Hook *h;
+	int i, cnt = 0, size = 0;
+	const char *name;
+
+	*entries = NULL;
+
+	for (i = 0; i < 256; i++)
+		for (c = CommandHash[i]; c; c = c->next)
+			if (c->profile)
+				profiler_add_entry(entries, &cnt, &size, PROFILER_ENTRY_COMMAND, c->cmd, NULL, c->profile);
+
+	for (i = 0; i < MAXHOOKTYPES; i++)
+	{
+		if (!hooktype_profile[i])
+			continue;
+		name = hooktype_name(i);
+		profiler_add_entry(entries, &cnt, &size, PROFILER_ENTRY_HOOKTYPE, name, NULL, hooktype_profile[i]);
+		for (h = Hooks[i]; h; h = h->next)
+			if (h->profile)
+				profiler_add_entry(entries, &cnt, &size, PROFILER_ENTRY_HOOK, name,
+				                   h->owner ? h->owner->header->name : "core", h->profile);
+	}
+
+	if (cnt)
+		qsort(*entries, cnt, sizeof(ProfilerEntry), profiler_entry_compare);
+	return cnt;
+}
+
+/** @} */
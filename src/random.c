@@ -421,14 +421,23 @@ static void arc4_addrandom(void *dat, int datlen)
 	return;
 }
 
-void add_entropy_configfile(struct stat *st, char *buf)
+/** Add entropy from a configuration file, with the SHA256 of the file
+ * contents already calculated. The configuration reading thread does
+ * the hashing, since only the main thread may use the random generator.
+ */
+void add_entropy_configfile_hash(struct stat *st, const char *sha256buf)
 {
-	char sha256buf[SHA256_DIGEST_LENGTH];
-
 	arc4_addrandom(&st->st_size, sizeof(st->st_size));
 	arc4_addrandom(&st->st_mtime, sizeof(st->st_mtime));
+	arc4_addrandom((void *)sha256buf, SHA256_DIGEST_LENGTH);
+}
+
+void add_entropy_configfile(struct stat *st, const char *buf)
+{
+	char sha256buf[SHA256_DIGEST_LENGTH];
+
 	sha256hash_binary(sha256buf, buf, strlen(buf));
-	arc4_addrandom(sha256buf, sizeof(sha256buf));
+	add_entropy_configfile_hash(st, sha256buf);
 }
 
 /*
@@ -0,0 +1,203 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/scratch.c
+ *   (C) 2022-.. Bram Matthys (Syzop) and the UnrealIRCd Team
+ *   License: GPLv2 or later
+ */
+
+/** @file
+ * @brief Scratch memory for short-lived allocations.
+ *
+ * This is a simple bump allocator for objects that only live during
+ * the processing of a single line, such as the message tags that
+ * parse() receives or a BanContext. Allocating is just moving a
+ * pointer forward and there is no free: everything is released at
+ * once by going back to an earlier scratch_mark().
+ *
+ * parse() takes a mark before processing a line and releases it
+ * afterwards, and the main loop does a full scratch_reset() at the end
+ * of every iteration. So anything that must live longer than that has
+ * to be copied to the heap, eg. via duplicate_mtag() for message tags.
+ */
+
+#include "unrealircd.h"
+
+/** Size of each scratch chunk, allocations bigger than
+ * this get a chunk of their own.
+ */
+#define SCRATCH_CHUNK_SIZE	65536
+
+/** Number of chunks we keep around after a scratch_reset() */
+#define SCRATCH_KEEP_CHUNKS	4
+
+/** All allocations are aligned to this */
+#define SCRATCH_ALIGN		16
+
+typedef struct ScratchChunk ScratchChunk;
+struct ScratchChunk {
+	ScratchChunk *next;
+	size_t size;	/**< Usable size of 'data' */
+	size_t used;	/**< Bytes of 'data' in use */
+	char data[];
+};
+
+/** Number of allocations served from scratch memory (each one is a malloc+free saved) */
+MODVAR uint64_t scratch_allocations = 0;
+
+static ScratchChunk *scratch_first = NULL;
+static ScratchChunk *scratch_current = NULL;
+
+static ScratchChunk *scratch_new_chunk(size_t size)
+{
+	ScratchChunk *c;
+
+	if (size < SCRATCH_CHUNK_SIZE)
+		size = SCRATCH_CHUNK_SIZE;
+	c = malloc(sizeof(ScratchChunk) + size);
+	if (!c)
+		outofmemory(sizeof(ScratchChunk) + size);
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+/** Allocate zeroed memory from the scratch arena.
+ * @param size	Number of bytes
+ * @returns Pointer to the memory, this never returns NULL.
+ * @note The memory is only valid until the next scratch_release()
+ *       of an earlier mark or scratch_reset(), so NEVER safe_free()
+ *       it or store it anywhere that outlives the current command.
+ */
+void *scratch_alloc(size_t size)
+{
+	ScratchChunk *c;
+	void *ret;
+
+	size = (size + SCRATCH_ALIGN - 1) & ~((size_t)SCRATCH_ALIGN - 1);
+	if (!size)
+		size = SCRATCH_ALIGN;
+
+	if (!scratch_current)
+		scratch_first = scratch_current = scratch_new_chunk(size);
+
+	c = scratch_current;
+	if (c->used + size > c->size)
+	{
+		/* Move on to the next chunk, or insert a (bigger) new one */
+		if (c->next && (c->next->size >= size))
+		{
+			c = c->next;
+		} else {
+			ScratchChunk *n = scratch_new_chunk(size);
+			n->next = c->next;
+			c->next = n;
+			c = n;
+		}
+		c->used = 0;
+		scratch_current = c;
+	}
+
+	ret = c->data + c->used;
+	c->used += size;
+	memset(ret, 0, size);
+	scratch_allocations++;
+	return ret;
+}
+
+/** Duplicate a string into the scratch arena.
+ * @param str	The string to copy, may be NULL.
+ * @returns The copy, or NULL if 'str' was NULL.
+ */
+char *scratch_strdup(const char *str)
+{
+	size_t len;
+	char *ret;
+
+	if (!str)
+		return NULL;
+	len = strlen(str);
+	ret = scratch_alloc(len + 1);
+	memcpy(ret, str, len);
+	return ret;
+}
+
+/** Remember the current position in the scratch arena.
+ * Pass it to scratch_release() to free everything that was
+ * allocated after this point.
+ */
+void scratch_mark(ScratchMark *mark)
+{
+	mark->chunk = scratch_current;
+	mark->used = scratch_current ? scratch_current->used : 0;
+}
+
+/** Release all scratch memory that was allocated after 'mark' was taken */
+void scratch_release(ScratchMark *mark)
+{
+	if (!mark->chunk)
+	{
+		/* Nothing was allocated when the mark was taken */
+		if (scratch_first)
+		{
+			scratch_first->used = 0;
+			scratch_current = scratch_first;
+		}
+		return;
+	}
+	scratch_current = mark->chunk;
+	scratch_current->used = mark->used;
+}
+
+/** Release all scratch memory.
+ * This is called at the end of every main loop iteration. Any extra
+ * chunks beyond SCRATCH_KEEP_CHUNKS (eg. after a huge command) are
+ * given back to the system.
+ */
+void scratch_reset(void)
+{
+	ScratchChunk *c, *next;
+	int n = 0;
+
+	for (c = scratch_first; c; c = next)
+	{
+		next = c->next;
+		c->used = 0;
+		if (++n == SCRATCH_KEEP_CHUNKS)
+		{
+			c->next = NULL;
+			for (c = next; c; c = next)
+			{
+				next = c->next;
+				free(c);
+			}
+			break;
+		}
+	}
+	scratch_current = scratch_first;
+}
+
+/** Returns 1 if 'ptr' points into the scratch arena, 0 if not.
+ * This is used by code that frees objects which may either be
+ * on the heap or in scratch memory, such as free_message_tags().
+ */
+int scratch_owns(const void *ptr)
+{
+	ScratchChunk *c;
+	const char *p = ptr;
+
+	for (c = scratch_first; c; c = c->next)
+		if ((p >= c->data) && (p < c->data + c->size))
+			return 1;
+	return 0;
+}
+
+/** Total number of bytes of scratch memory that we have allocated from the system */
+size_t scratch_memory_size(void)
+{
+	ScratchChunk *c;
+	size_t total = 0;
+
+	for (c = scratch_first; c; c = c->next)
+		total += c->size;
+	return total;
+}
@@ -459,6 +459,8 @@ void sendto_channel(Channel *channel, Client *from, Client *skip,
 	Member *lp;
 	Client *acptr;
 	char member_modes_ext[64];
+	long skip_umodes = 0;
+	int filter, i;
 
 	if (member_modes)
 	{
@@ -466,52 +468,73 @@ void sendto_channel(Channel *channel, Client *from, Client *skip,
 		member_modes = member_modes_ext;
 	}
 
-	++current_serial;
-	for (lp = channel->members; lp; lp = lp->next)
-	{
-		acptr = lp->client;
+	/* Work out once which user modes exclude a recipient */
+	if (sendflags & SKIP_DEAF)
+		skip_umodes |= UMODE_DEAF;
+	if (sendflags & SKIP_CTCP)
+		skip_umodes |= find_user_mode('T');
+	filter = skip_umodes || member_modes || clicap;
 
-		/* Skip sending to 'skip' */
-		if ((acptr == skip) || (acptr->direction == skip))
-			continue;
-		/* Don't send to deaf clients (unless 'senddeaf' is set) */
-		if (IsDeaf(acptr) && (sendflags & SKIP_DEAF))
-			continue;
-		/* Don't send to NOCTCP clients */
-		if (has_user_mode(acptr, 'T') && (sendflags & SKIP_CTCP))
-			continue;
-		/* Now deal with 'member_modes' (if not NULL) */
-		if (member_modes && !check_channel_access_member(lp, member_modes))
-			continue;
-		/* Now deal with 'clicap' (if non-zero) */
-		if (clicap && MyUser(acptr) && ((clicap & CAP_INVERT) ? HasCapabilityFast(acptr, clicap) : !HasCapabilityFast(acptr, clicap)))
-			continue;
+	++current_serial;
 
-		if (MyUser(acptr))
+	/* Local members. These are kept in a separate array in the channel,
+	 * so remote members don't need to be walked at all.
+	 */
+	if (sendflags & SEND_LOCAL)
+	{
+		for (i = 0; i < channel->local_members_count; i++)
 		{
-			/* Local client */
-			if (sendflags & SEND_LOCAL)
+			lp = channel->local_members[i];
+			acptr = lp->client;
+
+			/* Skip sending to 'skip' (for local clients direction == client) */
+			if (acptr == skip)
+				continue;
+			if (filter)
 			{
-				va_start(vl, pattern);
-				vsendto_prefix_one(acptr, from, mtags, pattern, vl);
-				va_end(vl);
+				/* Don't send to deaf (unless 'senddeaf' is set) or NOCTCP clients */
+				if (acptr->umodes & skip_umodes)
+					continue;
+				/* Now deal with 'member_modes' (if not NULL) */
+				if (member_modes && !check_channel_access_member(lp, member_modes))
+					continue;
+				/* Now deal with 'clicap' (if non-zero) */
+				if (clicap && ((clicap & CAP_INVERT) ? HasCapabilityFast(acptr, clicap) : !HasCapabilityFast(acptr, clicap)))
+					continue;
 			}
+
+			va_start(vl, pattern);
+			vsendto_prefix_one(acptr, from, mtags, pattern, vl);
+			va_end(vl);
 		}
-		else
+	}
+
+	/* Remote members: send it once to each server link that has one or
+	 * more members of this channel behind it. The deaf/noctcp/member_modes
+	 * filters are applied by the server on the other side, just like
+	 * we already did for 'clicap'.
+	 */
+	if (sendflags & SEND_REMOTE)
+	{
+		for (i = 0; i < channel->directions_count; i++)
 		{
-			/* Remote client */
-			if (sendflags & SEND_REMOTE)
+			acptr = channel->directions[i].client;
+			if (acptr == skip)
+				continue;
+			/* If 'skip' is a remote user and the only member
+			 * behind this link, then there's nobody to send to.
+			 */
+			if (skip && (skip->direction == acptr) && (channel->directions[i].users == 1) &&
+			    IsUser(skip) && find_membership(skip, channel))
 			{
-				/* Message already sent to remote link? */
-				if (acptr->direction->local->serial != current_serial)
-				{
-					va_start(vl, pattern);
-					vsendto_prefix_one(acptr, from, mtags, pattern, vl);
-					va_end(vl);
-
-					acptr->direction->local->serial = current_serial;
-				}
+				continue;
 			}
+
+			va_start(vl, pattern);
+			vsendto_prefix_one(acptr, from, mtags, pattern, vl);
+			va_end(vl);
+
+			acptr->local->serial = current_serial;
 		}
 	}
 
@@ -0,0 +1,489 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/simd.c
+ *   (C) 2022-.. Bram Matthys (Syzop) and the UnrealIRCd Team
+ *   License: GPLv2 or later
+ */
+
+/** @file
+ * @brief Vectorized text kernels.
+ *
+ * Small building blocks used by the per-message text functions, such as
+ * UTF8 validation, stripping of color codes and websocket unmasking.
+ * There is a scalar version of each kernel and, on x86, an SSE2 and
+ * an AVX2 version. The best one for the CPU is picked at boot in
+ * text_kernels_init() and is then available via 'text_kernels'.
+ */
+
+#include "unrealircd.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+ #define TEXT_KERNELS_SSE2
+ #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+ #define TEXT_KERNELS_AVX2
+ #include <immintrin.h>
+#endif
+
+MODVAR TextKernels text_kernels;
+
+/* Counting trailing zeroes, for turning a byte mask into a position */
+#ifdef _MSC_VER
+static int text_ctz(unsigned int v)
+{
+	unsigned long r;
+	_BitScanForward(&r, v);
+	return (int)r;
+}
+#else
+ #define text_ctz(v)	__builtin_ctz(v)
+#endif
+
+/** Is 'c' a byte that stops text_kernels.control_span()? */
+#define IsTextControlByte(c)	(((unsigned char)(c) < 0x20) || ((unsigned char)(c) == 0xe2))
+
+/*** Legacy: byte by byte, exactly like the code before the kernels ***/
+
+static size_t legacy_span(const char *s, size_t len)
+{
+	return 0; /* callers then fall back to their own byte-by-byte code */
+}
+
+static void legacy_tolower_ascii(char *dst, const char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = tolower(src[i]);
+}
+
+static void legacy_unmask(char *dst, const char *src, size_t len, const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = src[i] ^ key[i % 4];
+}
+
+/*** Scalar: 8 bytes at a time where possible ***/
+
+#define REPEAT_BYTE(x)	(0x0101010101010101ULL * (uint64_t)(x))
+
+static size_t scalar_ascii_span(const char *s, size_t len)
+{
+	size_t i = 0;
+	uint64_t w;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		memcpy(&w, s + i, 8);
+		if (w & REPEAT_BYTE(0x80))
+			break;
+	}
+	for (; i < len; i++)
+		if ((unsigned char)s[i] >= 0x80)
+			break;
+	return i;
+}
+
+static size_t scalar_control_span(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (IsTextControlByte(s[i]))
+			break;
+	return i;
+}
+
+static void scalar_tolower_ascii(char *dst, const char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = src[i];
+		dst[i] = ((c >= 'A') && (c <= 'Z')) ? c + 32 : c;
+	}
+}
+
+static void scalar_unmask(char *dst, const char *src, size_t len, const char *key)
+{
+	size_t i = 0;
+	uint32_t k32;
+	uint64_t k64, w;
+
+	memcpy(&k32, key, 4);
+	k64 = ((uint64_t)k32 << 32) | k32;
+	for (; i + 8 <= len; i += 8)
+	{
+		memcpy(&w, src + i, 8);
+		w ^= k64;
+		memcpy(dst + i, &w, 8);
+	}
+	for (; i < len; i++)
+		dst[i] = src[i] ^ key[i % 4];
+}
+
+/*** SSE2: 16 bytes at a time ***/
+
+#ifdef TEXT_KERNELS_SSE2
+static size_t sse2_ascii_span(const char *s, size_t len)
+{
+	size_t i = 0;
+	int m;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+		if (m)
+			return i + text_ctz(m);
+	}
+	return i + scalar_ascii_span(s + i, len - i);
+}
+
+static size_t sse2_control_span(const char *s, size_t len)
+{
+	const __m128i max_control = _mm_set1_epi8(0x1f);
+	const __m128i zwsp = _mm_set1_epi8((char)0xe2);
+	size_t i = 0;
+	__m128i v, hit;
+	int m;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		/* v <= 0x1f (unsigned) is the same as min(v, 0x1f) == v */
+		hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, max_control), v),
+		                   _mm_cmpeq_epi8(v, zwsp));
+		m = _mm_movemask_epi8(hit);
+		if (m)
+			return i + text_ctz(m);
+	}
+	return i + scalar_control_span(s + i, len - i);
+}
+
+static void sse2_tolower_ascii(char *dst, const char *src, size_t len)
+{
+	const __m128i upper_a = _mm_set1_epi8('A');
+	const __m128i upper_z = _mm_set1_epi8('Z');
+	const __m128i bit = _mm_set1_epi8(0x20);
+	size_t i = 0;
+	__m128i v, is_upper;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		is_upper = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, upper_a), v),
+		                         _mm_cmpeq_epi8(_mm_min_epu8(v, upper_z), v));
+		v = _mm_or_si128(v, _mm_and_si128(is_upper, bit));
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+	scalar_tolower_ascii(dst + i, src + i, len - i);
+}
+
+static void sse2_unmask(char *dst, const char *src, size_t len, const char *key)
+{
+	size_t i = 0;
+	int32_t k32;
+	__m128i k, v;
+
+	memcpy(&k32, key, 4);
+	k = _mm_set1_epi32(k32);
+	for (; i + 16 <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+	}
+	/* 16 is a multiple of 4, so the key is still aligned with 'i' */
+	scalar_unmask(dst + i, src + i, len - i, key);
+}
+#endif
+
+/*** AVX2: 32 bytes at a time, only used if the CPU supports it ***/
+
+#ifdef TEXT_KERNELS_AVX2
+__attribute__((target("avx2")))
+static size_t avx2_ascii_span(const char *s, size_t len)
+{
+	size_t i = 0;
+	unsigned int m;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		m = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i)));
+		if (m)
+			return i + text_ctz(m);
+	}
+	return i + scalar_ascii_span(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_control_span(const char *s, size_t len)
+{
+	const __m256i max_control = _mm256_set1_epi8(0x1f);
+	const __m256i zwsp = _mm256_set1_epi8((char)0xe2);
+	size_t i = 0;
+	__m256i v, hit;
+	unsigned int m;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		hit = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, max_control), v),
+		                      _mm256_cmpeq_epi8(v, zwsp));
+		m = _mm256_movemask_epi8(hit);
+		if (m)
+			return i + text_ctz(m);
+	}
+	return i + scalar_control_span(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_tolower_ascii(char *dst, const char *src, size_t len)
+{
+	const __m256i upper_a = _mm256_set1_epi8('A');
+	const __m256i upper_z = _mm256_set1_epi8('Z');
+	const __m256i bit = _mm256_set1_epi8(0x20);
+	size_t i = 0;
+	__m256i v, is_upper;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)(src + i));
+		is_upper = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, upper_a), v),
+		                            _mm256_cmpeq_epi8(_mm256_min_epu8(v, upper_z), v));
+		v = _mm256_or_si256(v, _mm256_and_si256(is_upper, bit));
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+	scalar_tolower_ascii(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_unmask(char *dst, const char *src, size_t len, const char *key)
+{
+	size_t i = 0;
+	int32_t k32;
+	__m256i k, v;
+
+	memcpy(&k32, key, 4);
+	k = _mm256_set1_epi32(k32);
+	for (; i + 32 <= len; i += 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
+	}
+	scalar_unmask(dst + i, src + i, len - i, key);
+}
+#endif
+
+static TextKernels text_kernels_legacy = {
+	"legacy", legacy_span, legacy_span, legacy_tolower_ascii, legacy_unmask
+};
+
+static TextKernels text_kernels_available[] = {
+#ifdef TEXT_KERNELS_AVX2
+	{ "avx2", avx2_ascii_span, avx2_control_span, avx2_tolower_ascii, avx2_unmask },
+#endif
+#ifdef TEXT_KERNELS_SSE2
+	{ "sse2", sse2_ascii_span, sse2_control_span, sse2_tolower_ascii, sse2_unmask },
+#endif
+	{ "scalar", scalar_ascii_span, scalar_control_span, scalar_tolower_ascii, scalar_unmask },
+	{ NULL }
+};
+
+static int text_kernels_supported(TextKernels *k)
+{
+#ifdef TEXT_KERNELS_AVX2
+	if (!strcmp(k->name, "avx2"))
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return 1;
+}
+
+/** Select the best text kernels for this CPU. Called early on boot. */
+void text_kernels_init(void)
+{
+	TextKernels *k;
+
+	for (k = text_kernels_available; k->name; k++)
+	{
+		if (text_kernels_supported(k))
+		{
+			text_kernels = *k;
+			return;
+		}
+	}
+}
+
+/*** Self-test and benchmark (unrealircd -B) ***/
+
+static void text_kernels_random_text(char *buf, size_t len)
+{
+	/* Mostly ASCII text, with some UTF8, control codes and invalid bytes */
+	static const char *pieces[] = {
+		"hello", "world", " ", " ", ", ", "HeLLo", "ABCxyz", "\xd0\xbf\xd1\x80", "\xe2\x80\x8b",
+		"\xe2\x82\xac", "\xf0\x9f\x98\x80", "\003", "\00312,4", "\0034", "\004ff00ff", "\004123",
+		"\002", "\037", "\026", "\017", "\n", "\xc3", "\xff", "\x80", "\xed\xa0\x80", "0123",
+		NULL
+	};
+	const char *p;
+	int npieces, n;
+	size_t i = 0;
+
+	for (npieces = 0; pieces[npieces]; npieces++);
+	while (i < len)
+	{
+		if (getrandom8() < 16)
+		{
+			buf[i++] = getrandom8();
+			continue;
+		}
+		n = getrandom8() % npieces;
+		for (p = pieces[n]; *p && (i < len); p++)
+			buf[i++] = *p;
+	}
+	buf[len] = '\0';
+	/* Random bytes may contain NUL, which is fine but makes the string shorter */
+}
+
+static int text_kernels_selftest(TextKernels *k)
+{
+	char in[600], out1[700], out2[700], key[4];
+	char result1[700], result2[700];
+	const char *r1, *r2, *e1, *e2;
+	size_t len, i, outlen;
+	int iteration, errors = 0;
+
+	for (iteration = 0; iteration < 100000; iteration++)
+	{
+		len = getrandom16() % 520;
+		text_kernels_random_text(in, len);
+		len = strlen(in);
+
+		/* The raw kernels against a plain byte loop */
+		for (i = 0; (i < len) && ((unsigned char)in[i] < 0x80); i++);
+		if (k->ascii_span(in, len) != i)
+			errors++;
+		for (i = 0; (i < len) && !IsTextControlByte(in[i]); i++);
+		if (k->control_span(in, len) != i)
+			errors++;
+		k->tolower_ascii(out1, in, len);
+		legacy_tolower_ascii(out2, in, len);
+		if (memcmp(out1, out2, len))
+			errors++;
+		for (i = 0; i < 4; i++)
+			key[i] = getrandom8();
+		k->unmask(out1, in, len, key);
+		legacy_unmask(out2, in, len, key);
+		if (memcmp(out1, out2, len))
+			errors++;
+
+		/* And the functions that use them, against the legacy code */
+		text_kernels = text_kernels_legacy;
+		r1 = StripControlCodesEx(in, result1, sizeof(result1), UNRL_STRIP_LOW_ASCII|UNRL_STRIP_KEEP_LF);
+		unrl_utf8_validate(in, &e1);
+		text_kernels = *k;
+		r2 = StripControlCodesEx(in, result2, sizeof(result2), UNRL_STRIP_LOW_ASCII|UNRL_STRIP_KEEP_LF);
+		unrl_utf8_validate(in, &e2);
+		if (strcmp(r1, r2) || (e1 != e2))
+			errors++;
+
+		/* Truncating output */
+		outlen = 1 + getrandom8() % 64;
+		text_kernels = text_kernels_legacy;
+		r1 = StripControlCodesEx(in, result1, outlen, 0);
+		text_kernels = *k;
+		r2 = StripControlCodesEx(in, result2, outlen, 0);
+		if (strcmp(r1, r2))
+			errors++;
+
+		if (errors)
+		{
+			fprintf(stderr, "[%s] mismatch on input of %d bytes\n", k->name, (int)len);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Walk the whole buffer with a span function, as the callers do */
+static size_t text_kernels_walk(size_t (*span)(const char *s, size_t len), const char *buf, size_t len)
+{
+	size_t i = 0, runs = 0;
+
+	while (i < len)
+	{
+		i += span(buf + i, len - i) + 1;
+		runs++;
+	}
+	return runs;
+}
+
+static void text_kernels_benchmark(TextKernels *k, const char *buf, size_t len)
+{
+	char out[4096], key[4] = { 1, 2, 3, 4 };
+	const char *end;
+	uint64_t start;
+	int i, iterations = 20000;
+	double mb = (double)len * iterations / (1024.0 * 1024.0);
+
+#define BENCH(name, code) \
+	start = monotonic_nsec(); \
+	for (i = 0; i < iterations; i++) { code; } \
+	fprintf(stderr, "  %-20s %8.0f MB/s\n", name, mb / ((monotonic_nsec() - start) / 1000000000.0));
+
+	text_kernels = *k;
+	fprintf(stderr, "%s:\n", k->name);
+	if (k != &text_kernels_legacy)
+	{
+		BENCH("ascii_span", text_kernels_walk(k->ascii_span, buf, len));
+		BENCH("control_span", text_kernels_walk(k->control_span, buf, len));
+	}
+	BENCH("tolower_ascii", k->tolower_ascii(out, buf, len));
+	BENCH("unmask", k->unmask(out, buf, len, key));
+	BENCH("utf8_validate", unrl_utf8_validate(buf, &end));
+	BENCH("StripControlCodes", StripControlCodesEx(buf, out, sizeof(out), 0));
+#undef BENCH
+}
+
+/** Run the self-test and benchmark of all text kernels.
+ * This is called from the command line (unrealircd -B), for testing only.
+ */
+void text_kernels_test(void)
+{
+	TextKernels *k;
+	TextKernels selected = text_kernels;
+	char buf[4000];
+	int i, ok = 1;
+
+	/* Benchmark input: mostly ASCII chat text with some UTF8 and a color */
+	*buf = '\0';
+	for (i = 0; strlen(buf) < sizeof(buf) - 100; i++)
+		strlcat(buf, (i % 10 == 9) ? "\00304red\003 \xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 " : "the quick brown fox jumps over the lazy dog ", sizeof(buf));
+
+	fprintf(stderr, "Selected text kernels: %s\n", selected.name);
+	for (k = text_kernels_available; k->name; k++)
+	{
+		if (!text_kernels_supported(k))
+		{
+			fprintf(stderr, "%s: not supported by this CPU\n", k->name);
+			continue;
+		}
+		if (text_kernels_selftest(k))
+			fprintf(stderr, "%s: self-test OK\n", k->name);
+		else
+			ok = 0;
+	}
+	for (k = text_kernels_available; k->name; k++)
+		if (text_kernels_supported(k))
+			text_kernels_benchmark(k, buf, strlen(buf));
+	text_kernels_benchmark(&text_kernels_legacy, buf, strlen(buf));
+
+	text_kernels = selected;
+	if (!ok)
+		exit(1);
+}
@@ -90,16 +90,23 @@ void close_connections(void)
 #endif
 }
 
+/** Maximum number of connections to accept in one go, per listener socket.
+ * This way we drain the backlog quickly during a connection flood,
+ * while still getting to the rest of the work in the main loop.
+ */
+#define LISTENER_ACCEPT_BATCH	100
+
 /** Accept an incoming connection.
+ * @param listener	The listen { } block configuration data.
  * @param listener_fd	The file descriptor of a listen() socket.
- * @param data		The listen { } block configuration data.
+ * @returns 1 if a connection was accepted (or refused), 0 if there are
+ *          no more pending connections or the listener was closed.
  */
-static void listener_accept(int listener_fd, int revents, void *data)
+static int listener_accept_one(ConfigItem_listen *listener, int listener_fd)
 {
-	ConfigItem_listen *listener = data;
 	int cli_fd;
 
-	if ((cli_fd = fd_accept(listener->fd)) < 0)
+	if ((cli_fd = fd_accept(listener_fd)) < 0)
 	{
 		if ((ERRNO != P_EWOULDBLOCK) && (ERRNO != P_ECONNABORTED))
 		{
@@ -124,12 +131,15 @@ static void listener_accept(int listener_fd, int revents, void *data)
 			close_listener(listener);
 			start_listeners();
 		}
-		return;
+		return 0;
 	}
 
 	ircstats.is_ac++;
 
+#if !defined(SOCK_NONBLOCK) || !defined(SOCK_CLOEXEC)
+	/* Not needed if we got the socket from accept4(), see fd_accept() */
 	set_sock_opts(cli_fd, NULL, listener->socket_type);
+#endif
 
 	/* Allow connections to the control socket, even if maxclients is reached */
 	if (listener->options & LISTENER_CONTROL)
@@ -146,7 +156,7 @@ static void listener_accept(int listener_fd, int revents, void *data)
 			}
 			fd_close(cli_fd);
 			--OpenFiles;
-			return;
+			return 1;
 		}
 	} else
 	{
@@ -171,39 +181,60 @@ static void listener_accept(int listener_fd, int revents, void *data)
 
 			fd_close(cli_fd);
 			--OpenFiles;
-			return;
+			return 1;
 		}
 	}
 
 	/* add_connection() may fail. we just don't care. */
 	add_connection(listener, cli_fd);
+	return 1;
 }
 
-int unreal_listen_inet(ConfigItem_listen *listener)
+/** Accept incoming connections, called by the I/O engine.
+ * @param listener_fd	The file descriptor of a listen() socket.
+ * @param data		The listen { } block configuration data.
+ */
+static void listener_accept(int listener_fd, int revents, void *data)
 {
-	const char *ip = listener->ip;
-	int port = listener->port;
+	ConfigItem_listen *listener = data;
+	int i;
 
-	if (BadPtr(ip))
-		ip = "*";
+	for (i = 0; i < LISTENER_ACCEPT_BATCH; i++)
+		if (!listener_accept_one(listener, listener_fd))
+			break;
+}
 
-	if (*ip == '*')
-	{
-		if (listener->socket_type == SOCKET_TYPE_IPV6)
-			ip = "::";
-		else
-			ip = "0.0.0.0";
-	}
+/** Take over a listening socket from the old process (hot restart).
+ * @param listener	The listen { } block
+ * @param index		0 for the main socket, 1+ for the other sockets of a SO_REUSEPORT group
+ * @returns The file descriptor, or -1 if there is no socket to take over.
+ */
+static int unreal_listen_adopt(ConfigItem_listen *listener, int index, const char *desc)
+{
+	int fd;
 
-	/* At first, open a new socket */
-	if (listener->fd >= 0)
-		abort(); /* Socket already exists but we are asked to create and listen on one. Bad! */
+	if (!loop.hot_restart)
+		return -1;
 
-	if (port == 0)
-		abort(); /* Impossible as well, right? */
+	fd = hot_restart_take_listener(listener, index);
+	if (fd < 0)
+		return -1;
 
-	listener->fd = fd_socket(listener->socket_type == SOCKET_TYPE_IPV6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0, "Listener socket");
-	if (listener->fd < 0)
+	fd_open(fd, desc, FDCLOSE_SOCKET);
+	++OpenFiles;
+	fd_setselect(fd, FD_SELECT_READ, listener_accept, listener);
+	return fd;
+}
+
+/** Create, bind and listen on one IPv4/IPv6 socket for a listener.
+ * @returns The file descriptor, or -1 on error (which is already logged).
+ */
+static int unreal_listen_inet_socket(ConfigItem_listen *listener, const char *ip, int port)
+{
+	int fd;
+
+	fd = fd_socket(listener->socket_type == SOCKET_TYPE_IPV6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0, "Listener socket");
+	if (fd < 0)
 	{
 		unreal_log(ULOG_FATAL, "listen", "LISTEN_SOCKET_ERROR", NULL,
 		           "Could not listen on IP \"$listen_ip\" on port $listen_port: $socket_error",
@@ -219,36 +250,49 @@ int unreal_listen_inet(ConfigItem_listen *listener)
 		           "Could not listen on IP \"$listen_ip\" on port $listen_port: all connections in use",
 		           log_data_string("listen_ip", ip),
 		           log_data_integer("listen_port", port));
-		fd_close(listener->fd);
-		listener->fd = -1;
+		fd_close(fd);
 		--OpenFiles;
 		return -1;
 	}
 
-	set_sock_opts(listener->fd, NULL, listener->socket_type);
+	set_sock_opts(fd, NULL, listener->socket_type);
 
-	if (!unreal_bind(listener->fd, ip, port, listener->socket_type))
+#ifdef SO_REUSEPORT
+	if (listener->options & LISTENER_REUSEPORT)
+	{
+		int yes = 1;
+
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&yes, sizeof(yes)) < 0)
+		{
+			unreal_log(ULOG_WARNING, "listen", "LISTEN_REUSEPORT_ERROR", NULL,
+			           "Could not set SO_REUSEPORT on IP \"$listen_ip\" port $listen_port: $socket_error",
+			           log_data_socket_error(fd),
+			           log_data_string("listen_ip", ip),
+			           log_data_integer("listen_port", port));
+		}
+	}
+#endif
+
+	if (!unreal_bind(fd, ip, port, listener->socket_type))
 	{
 		unreal_log(ULOG_FATAL, "listen", "LISTEN_BIND_ERROR", NULL,
 		           "Could not listen on IP \"$listen_ip\" on port $listen_port: $socket_error",
-		           log_data_socket_error(listener->fd),
+		           log_data_socket_error(fd),
 		           log_data_string("listen_ip", ip),
 		           log_data_integer("listen_port", port));
-		fd_close(listener->fd);
-		listener->fd = -1;
+		fd_close(fd);
 		--OpenFiles;
 		return -1;
 	}
 
-	if (listen(listener->fd, LISTEN_SIZE) < 0)
+	if (listen(fd, LISTEN_SIZE) < 0)
 	{
 		unreal_log(ULOG_FATAL, "listen", "LISTEN_LISTEN_ERROR", NULL,
 		           "Could not listen on IP \"$listen_ip\" on port $listen_port: $socket_error",
-		           log_data_socket_error(listener->fd),
+		           log_data_socket_error(fd),
 		           log_data_string("listen_ip", ip),
 		           log_data_integer("listen_port", port));
-		fd_close(listener->fd);
-		listener->fd = -1;
+		fd_close(fd);
 		--OpenFiles;
 		return -1;
 	}
@@ -258,7 +302,7 @@ int unreal_listen_inet(ConfigItem_listen *listener)
 	{
 		int yes = 1;
 
-		(void)setsockopt(listener->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &yes, sizeof(int));
+		(void)setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &yes, sizeof(int));
 	}
 #endif
 
@@ -269,11 +313,60 @@ int unreal_listen_inet(ConfigItem_listen *listener)
 
 		memset(&afa, '\0', sizeof afa);
 		strlcpy(afa.af_name, "dataready", sizeof afa.af_name);
-		(void)setsockopt(listener->fd, SOL_SOCKET, SO_ACCEPTFILTER, &afa, sizeof afa);
+		(void)setsockopt(fd, SOL_SOCKET, SO_ACCEPTFILTER, &afa, sizeof afa);
 	}
 #endif
 
-	fd_setselect(listener->fd, FD_SELECT_READ, listener_accept, listener);
+	fd_setselect(fd, FD_SELECT_READ, listener_accept, listener);
+
+	return fd;
+}
+
+int unreal_listen_inet(ConfigItem_listen *listener)
+{
+	const char *ip = listener->ip;
+	int port = listener->port;
+	int i;
+
+	if (BadPtr(ip))
+		ip = "*";
+
+	if (*ip == '*')
+	{
+		if (listener->socket_type == SOCKET_TYPE_IPV6)
+			ip = "::";
+		else
+			ip = "0.0.0.0";
+	}
+
+	/* At first, open a new socket */
+	if (listener->fd >= 0)
+		abort(); /* Socket already exists but we are asked to create and listen on one. Bad! */
+
+	if (port == 0)
+		abort(); /* Impossible as well, right? */
+
+	listener->fd = unreal_listen_adopt(listener, 0, "Listener socket");
+	if (listener->fd < 0)
+		listener->fd = unreal_listen_inet_socket(listener, ip, port);
+	if (listener->fd < 0)
+		return -1;
+
+	/* The rest of the SO_REUSEPORT group, if any. The kernel spreads
+	 * incoming connections over all the sockets in the group,
+	 * each with their own backlog. If one of these fails then
+	 * we simply continue with fewer sockets.
+	 */
+	if ((listener->options & LISTENER_REUSEPORT) && (listener->reuseport_sockets > 1))
+	{
+		listener->reuseport_fds = safe_alloc(sizeof(int) * (listener->reuseport_sockets - 1));
+		for (i = 0; i < listener->reuseport_sockets - 1; i++)
+		{
+			listener->reuseport_fds[i] = unreal_listen_adopt(listener, i + 1, "Listener socket");
+			if (listener->reuseport_fds[i] < 0)
+				listener->reuseport_fds[i] = unreal_listen_inet_socket(listener, ip, port);
+		}
+	}
 
 	return 0;
 }
@@ -287,6 +380,10 @@ int unreal_listen_unix(ConfigItem_listen *listener)
 	if (listener->fd >= 0)
 		abort(); /* Socket already exists but we are asked to create and listen on one. Bad! */
 
+	listener->fd = unreal_listen_adopt(listener, 0, "Listener socket (UNIX)");
+	if (listener->fd >= 0)
+		return 0;
+
 	listener->fd = fd_socket(AF_UNIX, SOCK_STREAM, 0, "Listener socket (UNIX)");
 	if (listener->fd < 0)
 	{
@@ -379,6 +476,8 @@ int add_listener(ConfigItem_listen *listener)
  */
 void close_listener(ConfigItem_listen *listener)
 {
+	int i;
+
 	if (listener->fd >= 0)
 	{
 		unreal_log(ULOG_INFO, "listen", "LISTEN_REMOVED", NULL,
@@ -389,6 +488,19 @@ void close_listener(ConfigItem_listen *listener)
 		--OpenFiles;
 	}
 
+	if (listener->reuseport_fds)
+	{
+		for (i = 0; i < listener->reuseport_sockets - 1; i++)
+		{
+			if (listener->reuseport_fds[i] >= 0)
+			{
+				fd_close(listener->reuseport_fds[i]);
+				--OpenFiles;
+			}
+		}
+		safe_free(listener->reuseport_fds);
+	}
+
 	listener->options &= ~LISTENER_BOUND;
 	listener->fd = -1;
 	/* We can already free the TLS context, since it is only
@@ -435,15 +547,18 @@ void check_user_limit(void)
 		/* Adjust soft limit (if necessary, which is often the case) */
 		if (m != limit.rlim_cur)
 		{
+			long old_limit = limit.rlim_cur;
+
 			limit.rlim_cur = limit.rlim_max = m;
 			if (setrlimit(RLIMIT_FD_MAX, &limit) == -1)
 			{
-				/* HACK: if it's mac os X then don't error... */
-#ifndef OSXTIGER
-				fprintf(stderr, "error setting maximum number of open files to %ld\n",
-					(long)limit.rlim_cur);
-				exit(-1);
-#endif // OSXTIGER
+				/* Some systems refuse such a high value even though the
+				 * hard limit says otherwise (eg: an "unlimited" hard limit
+				 * on macOS). In that case stay at the current soft limit.
+				 */
+				fprintf(stderr, "WARNING: could not raise the maximum number of open files to %ld, "
+				                "staying at %ld\n", m, old_limit);
+				m = MIN(old_limit, MAXCONNECTIONS);
 			}
 		}
 		/* This can only happen if it is due to resource limits (./Config already rejects <100) */
@@ -1208,7 +1323,8 @@ int deliver_it(Client *client, char *str, int len, int *want_read)
 		return -1;
 	}
 
-	if (IsTLS(client) && client->local->ssl != NULL)
+	/* With kTLS the kernel does the encryption, so we skip SSL_write() */
+	if (IsTLS(client) && client->local->ssl != NULL && !IsKTLS(client))
 	{
 		retval = SSL_write(client->local->ssl, str, len);
 
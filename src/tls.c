@@ -24,6 +24,11 @@
 
 #include "unrealircd.h"
 #include "openssl_hostname_validation.h"
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 #ifdef _WIN32
 #define IDC_PASS                        1166
@@ -272,6 +277,165 @@ void disable_ssl_protocols(SSL_CTX *ctx, TLSOptions *tlsoptions)
 #endif
 }
 
+/* Session resumption through session tickets (RFC 5077 / TLSv1.3).
+ *
+ * The ticket keys are derived from a secret and the current "epoch",
+ * which is the time divided by set::tls::session-resumption::key-rotation.
+ * Tickets are encrypted with the key of the current epoch. Tickets from
+ * the previous and next epoch are still accepted (and renewed), the
+ * latter to deal with small clock differences between servers.
+ * The secret is random (generated on boot), unless a key-file is
+ * configured. Servers sharing the same key-file can resume each
+ * others sessions, eg. when they are all behind irc.example.net.
+ */
+#define TLS_TICKET_KEYS		3	/* previous, current and next epoch */
+
+typedef struct TLSTicketKey TLSTicketKey;
+struct TLSTicketKey {
+	unsigned char name[16];
+	unsigned char aes_key[32];
+	unsigned char hmac_key[32];
+};
+
+static unsigned char tls_ticket_secret[SHA256_DIGEST_LENGTH];
+static int tls_ticket_secret_set = 0;
+static long long tls_ticket_epoch = -1;
+static TLSTicketKey tls_ticket_keys[TLS_TICKET_KEYS];
+
+/** Derive one part of the ticket key for the specified epoch */
+static void tls_ticket_derive(unsigned char *dst, size_t dstlen, const char *label, long long epoch)
+{
+	unsigned char out[EVP_MAX_MD_SIZE];
+	unsigned int outlen = sizeof(out);
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "unrealircd-ticket-%s-%lld", label, epoch);
+	HMAC(EVP_sha256(), tls_ticket_secret, sizeof(tls_ticket_secret), (unsigned char *)buf, strlen(buf), out, &outlen);
+	memcpy(dst, out, MIN(dstlen, outlen));
+}
+
+/** Recalculate the ticket keys if we entered a new epoch */
+static void tls_ticket_keys_update(void)
+{
+	long long epoch = TStime() / iConf.tls_options->session_ticket_rotation;
+	int i;
+
+	if (epoch == tls_ticket_epoch)
+		return;
+
+	tls_ticket_epoch = epoch;
+	for (i = 0; i < TLS_TICKET_KEYS; i++)
+	{
+		/* [0] is current, [1] is previous, [2] is next */
+		long long e = (i == 0) ? epoch : ((i == 1) ? epoch - 1 : epoch + 1);
+		tls_ticket_derive(tls_ticket_keys[i].name, sizeof(tls_ticket_keys[i].name), "name", e);
+		tls_ticket_derive(tls_ticket_keys[i].aes_key, sizeof(tls_ticket_keys[i].aes_key), "aes", e);
+		tls_ticket_derive(tls_ticket_keys[i].hmac_key, sizeof(tls_ticket_keys[i].hmac_key), "hmac", e);
+	}
+}
+
+/** (Re)load the secret for the ticket keys.
+ * Called on boot and whenever TLS is reinitialized (eg. on REHASH).
+ * @returns 1 on success, 0 if the key-file could not be read.
+ */
+static int tls_ticket_keys_load(void)
+{
+	const char *fname = iConf.tls_options->session_ticket_key_file;
+	const char *hash;
+
+	/* Force recalculating the keys on next use */
+	tls_ticket_epoch = -1;
+
+	if (!fname)
+	{
+		/* No key-file: use a random secret, but keep the same one
+		 * across rehashes so existing tickets remain valid.
+		 */
+		if (!tls_ticket_secret_set)
+		{
+			if (RAND_bytes(tls_ticket_secret, sizeof(tls_ticket_secret)) != 1)
+				return 0;
+			tls_ticket_secret_set = 1;
+		}
+		return 1;
+	}
+
+	hash = sha256sum_file(fname);
+	if (!hash)
+	{
+		unreal_log(ULOG_ERROR, "config", "TLS_TICKET_KEY_FILE_FAILED", NULL,
+		           "Could not read TLS session ticket key file $filename: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("system_error", strerror(errno)));
+		return 0;
+	}
+	/* The secret is the hash of the file contents, this way the
+	 * file can contain anything, like the output of 'openssl rand'.
+	 */
+	sha256hash_binary((char *)tls_ticket_secret, hash, strlen(hash));
+	tls_ticket_secret_set = 1;
+	return 1;
+}
+
+/** Called by OpenSSL to encrypt or decrypt a session ticket.
+ * @returns -1 on error, 0 if the key is unknown (do a full handshake),
+ *          1 on success and 2 on success if the ticket should be renewed.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int tls_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc)
+#else
+static int tls_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc)
+#endif
+{
+	TLSTicketKey *key = NULL;
+	int i;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[3];
+#endif
+
+	if (!tls_ticket_secret_set)
+		return enc ? -1 : 0;
+
+	tls_ticket_keys_update();
+
+	if (enc)
+	{
+		key = &tls_ticket_keys[0];
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+			return -1;
+		memcpy(key_name, key->name, sizeof(key->name));
+		if (!EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+			return -1;
+	} else {
+		for (i = 0; i < TLS_TICKET_KEYS; i++)
+		{
+			if (!memcmp(key_name, tls_ticket_keys[i].name, sizeof(tls_ticket_keys[i].name)))
+			{
+				key = &tls_ticket_keys[i];
+				break;
+			}
+		}
+		if (!key)
+			return 0; /* unknown or expired key: do a full handshake */
+		if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+			return -1;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	params[0] = (OSSL_PARAM)OSSL_PARAM_octet_string(OSSL_MAC_PARAM_KEY, key->hmac_key, sizeof(key->hmac_key));
+	params[1] = (OSSL_PARAM)OSSL_PARAM_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+	params[2] = (OSSL_PARAM)OSSL_PARAM_END;
+	if (!EVP_MAC_CTX_set_params(hctx, params))
+		return -1;
+#else
+	if (!HMAC_Init_ex(hctx, key->hmac_key, sizeof(key->hmac_key), EVP_sha256(), NULL))
+		return -1;
+#endif
+
+	/* Issue a new ticket if this one was encrypted with an older (or newer) key */
+	return (key == &tls_ticket_keys[0]) ? 1 : 2;
+}
+
 /** Initialize TLS context
  * @param tlsoptions	The ::tls-options configuration
  * @param server	Set to 1 if we are initializing a server, 0 for client.
@@ -312,7 +476,32 @@ SSL_CTX *init_ctx(TLSOptions *tlsoptions, int server)
 #ifndef SSL_OP_NO_TICKET
  #error "Your system has an outdated OpenSSL version. Please upgrade OpenSSL."
 #endif
-	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	if (server && tlsoptions->session_resumption)
+	{
+		/* Stateless session tickets only, we still don't keep
+		 * a session cache on the server side.
+		 */
+		SSL_CTX_set_session_id_context(ctx, (unsigned char *)"unrealircd", 10);
+		SSL_CTX_set_timeout(ctx, tlsoptions->session_ticket_rotation);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_ticket_key_callback);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_ticket_key_callback);
+#endif
+#ifdef SSL_OP_NO_TLSv1_3
+		SSL_CTX_set_num_tickets(ctx, 1);
+#endif
+	} else {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	}
+#ifdef SSL_OP_ENABLE_KTLS
+	/* Let OpenSSL hand the keys to the kernel after the handshake.
+	 * If the kernel or cipher does not support it then OpenSSL simply
+	 * keeps doing the encryption itself, see tls_check_ktls().
+	 */
+	if (tlsoptions->options & TLSFLAG_KTLS)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
 
 	if (SSL_CTX_use_certificate_chain_file(ctx, tlsoptions->certificate_file) <= 0)
 	{
@@ -501,6 +690,8 @@ int early_init_tls(void)
  */
 int init_tls(void)
 {
+	if (!tls_ticket_keys_load())
+		return 0;
 	ctx_server = init_ctx(iConf.tls_options, 1);
 	if (!ctx_server)
 		return 0;
@@ -519,6 +710,13 @@ int reinit_tls(void)
 	ConfigItem_sni *sni;
 	ConfigItem_link *link;
 
+	if (!tls_ticket_keys_load())
+	{
+		unreal_log(ULOG_ERROR, "config", "TLS_RELOAD_FAILED", NULL,
+		           "TLS Reload failed. See previous errors.");
+		return 0;
+	}
+
 	tmp = init_ctx(iConf.tls_options, 1);
 	if (!tmp)
 	{
@@ -529,6 +727,7 @@ int reinit_tls(void)
 	if (ctx_server)
 		SSL_CTX_free(ctx_server);
 	ctx_server = tmp; /* activate */
+	check_certificate_expiry_ctx_and_warn(ctx_server, iConf.tls_options);
 	
 	tmp = init_ctx(iConf.tls_options, 0);
 	if (!tmp)
@@ -556,6 +755,7 @@ int reinit_tls(void)
 			if (listen->ssl_ctx)
 				SSL_CTX_free(listen->ssl_ctx);
 			listen->ssl_ctx = tmp; /* activate */
+			check_certificate_expiry_ctx_and_warn(listen->ssl_ctx, listen->tls_options);
 		}
 	}
 
@@ -574,6 +774,7 @@ int reinit_tls(void)
 			if (sni->ssl_ctx)
 				SSL_CTX_free(sni->ssl_ctx);
 			sni->ssl_ctx = tmp; /* activate */
+			check_certificate_expiry_ctx_and_warn(sni->ssl_ctx, sni->tls_options);
 		}
 	}
 
@@ -593,6 +794,7 @@ int reinit_tls(void)
 			if (link->ssl_ctx)
 				SSL_CTX_free(link->ssl_ctx);
 			link->ssl_ctx = tmp; /* activate */
+			check_certificate_expiry_ctx_and_warn(link->ssl_ctx, link->tls_options);
 		}
 	}
 
@@ -707,6 +909,28 @@ void unreal_tls_client_handshake(int fd, int revents, void *data)
 
 }
 
+/** Check if the kernel took over the TLS record encryption (kTLS)
+ * after a completed handshake. If so, we can write to the socket
+ * directly with send() from now on, see deliver_it().
+ * We keep using SSL_read() for reading, since OpenSSL needs to
+ * process non-data records such as alerts and key updates.
+ */
+static void tls_check_ktls(Client *client)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	if (!(SSL_get_options(client->local->ssl) & SSL_OP_ENABLE_KTLS))
+		return;
+
+	if (BIO_get_ktls_send(SSL_get_wbio(client->local->ssl)))
+	{
+		SetKTLS(client);
+		metrics.tls_ktls_enabled++;
+	} else {
+		metrics.tls_ktls_fallback++;
+	}
+#endif
+}
+
 /** Called by I/O engine to (re)try accepting an TLS connection */
 static void unreal_tls_accept_retry(int fd, int revents, void *data)
 {
@@ -780,6 +1004,13 @@ int unreal_tls_accept(Client *client, int fd)
 		return -1;
 	}
 
+	if (SSL_session_reused(client->local->ssl))
+		metrics.tls_handshakes_resumed++;
+	else
+		metrics.tls_handshakes_full++;
+
+	tls_check_ktls(client);
+
 	client->local->listener->start_handshake(client);
 
 	return 1;
@@ -827,6 +1058,8 @@ int unreal_tls_connect(Client *client, int fd)
 		return -1;
 	}
 
+	tls_check_ktls(client);
+
 	fd_setselect(fd, FD_SELECT_READ | FD_SELECT_WRITE, NULL, client);
 	completed_connection(fd, FD_SELECT_READ | FD_SELECT_WRITE, client);
 
@@ -1395,16 +1628,11 @@ int check_certificate_expiry_ctx(SSL_CTX *ctx, char **errstr)
 #endif
 }
 
-void check_certificate_expiry_tlsoptions_and_warn(TLSOptions *tlsoptions)
+/** Warn if the certificate of 'ctx', loaded via 'tlsoptions', is (nearly) expired */
+void check_certificate_expiry_ctx_and_warn(SSL_CTX *ctx, TLSOptions *tlsoptions)
 {
-	SSL_CTX *ctx;
-	int ret;
 	char *errstr = NULL;
 
-	ctx = init_ctx(tlsoptions, 1);
-	if (!ctx)
-		return;
-
 	if (check_certificate_expiry_ctx(ctx, &errstr))
 	{
 		unreal_log(ULOG_ERROR, "tls", "TLS_CERT_EXPIRING", NULL,
@@ -1412,6 +1640,17 @@ void check_certificate_expiry_tlsoptions_and_warn(TLSOptions *tlsoptions)
 		           log_data_string("filename", tlsoptions->certificate_file),
 		           log_data_string("error_string", errstr));
 	}
+}
+
+void check_certificate_expiry_tlsoptions_and_warn(TLSOptions *tlsoptions)
+{
+	SSL_CTX *ctx;
+
+	ctx = init_ctx(tlsoptions, 1);
+	if (!ctx)
+		return;
+
+	check_certificate_expiry_ctx_and_warn(ctx, tlsoptions);
 	SSL_CTX_free(ctx);
 }
 
@@ -168,10 +168,9 @@ static int url_socket_cb(CURL *e, curl_socket_t s, int what, void *cbp, void *so
 	}
 	else
 	{
-		FDEntry *fde = &fd_table[s];
 		int flags = 0;
 
-		if (!fde->is_open)
+		if ((s >= fd_table_size) || !fd_table[s].is_open)
 		{
 			/* NOTE: We use FDCLOSE_NONE here because cURL will take
 			 * care of the closing of the socket. So *WE* must never
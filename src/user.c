@@ -708,7 +708,7 @@ void user_account_login(MessageTag *recv_mtags, Client *client)
 		if (find_tkline_match(client, 0) && IsDead(client))
 			return;
 	}
-	RunHook(HOOKTYPE_ACCOUNT_LOGIN, client, recv_mtags);
+	RunHookClient(HOOKTYPE_ACCOUNT_LOGIN, client, recv_mtags);
 }
 
 /** Should we hide the idle time of 'target' to user 'client'?
@@ -31,6 +31,8 @@
 static const char *fast_validate(const char *str)
 {
 	const char *p;
+	const char *end = str + strlen(str);
+	size_t n;
 
 	for (p = str; *p; p++)
 	{
@@ -95,6 +97,10 @@ static const char *fast_validate(const char *str)
 error:
 			return last;
 		}
+		/* Skip the rest of this run of ASCII characters in one go */
+		n = text_kernels.ascii_span(p, end - p);
+		if (n > 1)
+			p += n - 1;
 	}
 
 	return p;
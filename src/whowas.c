@@ -23,164 +23,232 @@
 // Consider making add_history an efunc? Or via a hook?
 // Some users may not want to load cmd_whowas at all.
 
-/* internally defined function */
-static void add_whowas_to_clist(WhoWas **, WhoWas *);
-static void del_whowas_from_clist(WhoWas **, WhoWas *);
-static void add_whowas_to_list(WhoWas **, WhoWas *);
-static void del_whowas_from_list(WhoWas **, WhoWas *);
-
-WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-WhoWas MODVAR *WHOWASHASH[WHOWAS_HASH_TABLE_SIZE];
+/* The history is a ring of whowas_length entries allocated in one block.
+ * Slot whowas_next is the oldest entry and is overwritten by the next
+ * add_history(), so memory use is fixed (no allocations per entry)
+ * and eviction is O(1).
+ */
+static WhoWas *whowas_ring = NULL;
+static int whowas_length = 0;
+static int whowas_next = 0;
+
+/* Nick index: open addressing hash table (linear probing), which maps a
+ * nick name to the slot of the newest entry for that nick, or -1 if the
+ * bucket is empty. Older entries for the same nick are reached through
+ * WhoWas->older. Sized at least twice the ring length so it never fills.
+ */
+static int *whowas_nick_index = NULL;
+static unsigned int whowas_nick_index_size = 0;
+
+/** Find the nick index bucket for 'nick'.
+ * @returns The bucket with the newest entry for this nick, or the
+ *          (empty) bucket where it should be added.
+ */
+static int *whowas_nick_bucket(const char *nick, uint32_t hashv)
+{
+	unsigned int mask = whowas_nick_index_size - 1;
+	unsigned int i;
+	WhoWas *e;
 
-MODVAR int whowas_next = 0;
+	for (i = hashv & mask; whowas_nick_index[i] != -1; i = (i + 1) & mask)
+	{
+		e = &whowas_ring[whowas_nick_index[i]];
+		if ((e->hashv == hashv) && !mycmp(e->name, nick))
+			break;
+	}
+	return &whowas_nick_index[i];
+}
 
-void add_history(Client *client, int online)
+/** Remove bucket 'i' from the nick index (backward shift deletion) */
+static void whowas_nick_index_del(unsigned int i)
 {
-	WhoWas *new;
+	unsigned int mask = whowas_nick_index_size - 1;
+	unsigned int j, home;
 
-	new = &WHOWAS[whowas_next];
-
-	if (new->hashv != -1)
+	for (j = (i + 1) & mask; whowas_nick_index[j] != -1; j = (j + 1) & mask)
 	{
-		safe_free(new->name);
-		safe_free(new->hostname);
-		safe_free(new->virthost);
-		safe_free(new->realname);
-		safe_free(new->username);
-		new->servername = NULL;
-
-		if (new->online)
-			del_whowas_from_clist(&(new->online->user->whowas), new);
-		del_whowas_from_list(&WHOWASHASH[new->hashv], new);
+		home = whowas_ring[whowas_nick_index[j]].hashv & mask;
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			whowas_nick_index[i] = whowas_nick_index[j];
+			i = j;
+		}
 	}
-	new->hashv = hash_whowas_name(client->name);
-	new->logoff = TStime();
-	new->umodes = client->umodes;
-	safe_strdup(new->name, client->name);
-	safe_strdup(new->username, client->user->username);
-	safe_strdup(new->hostname, client->user->realhost);
-	if (client->user->virthost)
-		safe_strdup(new->virthost, client->user->virthost);
-	else
-		safe_strdup(new->virthost, "");
-	new->servername = client->user->server;
-	safe_strdup(new->realname, client->info);
+	whowas_nick_index[i] = -1;
+}
 
-	/* Its not string copied, a pointer to the scache hash is copied
-	   -Dianora
-	 */
-	/*  strlcpy(new->servername, client->user->server,HOSTLEN); */
-	new->servername = client->user->server;
+/** Make ring entry 'n' the newest entry for its nick */
+static void whowas_link(int n)
+{
+	WhoWas *e = &whowas_ring[n];
+	int *bucket = whowas_nick_bucket(e->name, e->hashv);
+
+	e->newer = -1;
+	e->older = *bucket;
+	if (e->older != -1)
+		whowas_ring[e->older].newer = n;
+	*bucket = n;
+}
 
-	if (online)
+/** Remove ring entry 'n' from the nick index */
+static void whowas_unlink(int n)
+{
+	WhoWas *e = &whowas_ring[n];
+	unsigned int mask = whowas_nick_index_size - 1;
+	unsigned int i;
+
+	if (e->older != -1)
+		whowas_ring[e->older].newer = e->newer;
+	if (e->newer != -1)
 	{
-		new->online = client;
-		add_whowas_to_clist(&(client->user->whowas), new);
+		whowas_ring[e->newer].older = e->older;
+		return;
 	}
+	/* This is the newest entry for the nick, so the index points to it */
+	for (i = e->hashv & mask; whowas_nick_index[i] != n; i = (i + 1) & mask)
+		;
+	if (e->older != -1)
+		whowas_nick_index[i] = e->older;
 	else
-		new->online = NULL;
-	add_whowas_to_list(&WHOWASHASH[new->hashv], new);
-	whowas_next++;
-	if (whowas_next == NICKNAMEHISTORYLENGTH)
-		whowas_next = 0;
+		whowas_nick_index_del(i);
 }
 
-void off_history(Client *client)
+void add_history(Client *client, int online)
 {
-	WhoWas *temp, *next;
+	WhoWas *new;
+	int n = whowas_next;
 
-	for (temp = client->user->whowas; temp; temp = next)
-	{
-		next = temp->cnext;
-		temp->online = NULL;
-		del_whowas_from_clist(&(client->user->whowas), temp);
-	}
+	if (!whowas_length)
+		return;
+
+	new = &whowas_ring[n];
+	if (*new->name)
+		whowas_unlink(n); /* evict the oldest entry */
+
+	strlcpy(new->name, client->name, sizeof(new->name));
+	strlcpy(new->username, client->user->username, sizeof(new->username));
+	strlcpy(new->realname, client->info, sizeof(new->realname));
+	strlcpy(new->hostname, client->user->realhost, sizeof(new->hostname));
+	strlcpy(new->virthost, client->user->virthost ? client->user->virthost : "", sizeof(new->virthost));
+	/* Not copied, this points to the scache */
+	new->servername = client->user->server;
+	new->umodes = client->umodes;
+	new->logoff = TStime();
+	if (online)
+		strlcpy(new->online_id, client->id, sizeof(new->online_id));
+	else
+		*new->online_id = '\0';
+	new->hashv = hash_whowas_name(new->name);
+	whowas_link(n);
+
+	whowas_next++;
+	if (whowas_next == whowas_length)
+		whowas_next = 0;
 }
 
 Client *get_history(const char *nick, time_t timelimit)
 {
 	WhoWas *temp;
-	int  blah;
 
 	timelimit = TStime() - timelimit;
-	blah = hash_whowas_name(nick);
-	temp = WHOWASHASH[blah];
-	for (; temp; temp = temp->next)
+	for (temp = whowas_find(nick); temp; temp = whowas_older(temp))
 	{
-		if (mycmp(nick, temp->name))
-			continue;
 		if (temp->logoff < timelimit)
 			continue;
-		return temp->online;
+		/* The UID is only found if the user is still online */
+		if (*temp->online_id)
+			return hash_find_id(temp->online_id, NULL);
+		return NULL;
 	}
 	return NULL;
 }
 
+WhoWas *whowas_find(const char *nick)
+{
+	int n;
+
+	if (!whowas_length)
+		return NULL;
+
+	n = *whowas_nick_bucket(nick, hash_whowas_name(nick));
+	return (n == -1) ? NULL : &whowas_ring[n];
+}
+
+WhoWas *whowas_older(WhoWas *e)
+{
+	return (e->older == -1) ? NULL : &whowas_ring[e->older];
+}
+
 void count_whowas_memory(int *wwu, u_long *wwum)
 {
-	WhoWas *tmp;
-	int  i;
+	unsigned int i;
 	int  u = 0;
 	u_long um = 0;
 	/* count the number of used whowas structs in 'u' */
-	/* count up the memory used of whowas structs in um */
+	/* count up the memory used by the ring and the nick index in 'um' */
 
-	for (i = 0, tmp = &WHOWAS[0]; i < NICKNAMEHISTORYLENGTH; i++, tmp++)
-		if (tmp->hashv != -1)
-		{
+	for (i = 0; i < (unsigned int)whowas_length; i++)
+		if (*whowas_ring[i].name)
 			u++;
-			um += sizeof(WhoWas);
-		}
+	um += sizeof(WhoWas) * whowas_length;
+	um += sizeof(int) * whowas_nick_index_size;
 	*wwu = u;
 	*wwum = um;
 	return;
 }
 
-void initwhowas()
+void whowas_set_length(int length)
 {
-	int  i;
-
-	for (i = 0; i < NICKNAMEHISTORYLENGTH; i++)
+	WhoWas *old = whowas_ring;
+	int old_length = whowas_length;
+	int oldest = whowas_next;
+	int i, used = 0, drop;
+	unsigned int j;
+	WhoWas *e;
+
+	if (length == whowas_length)
+		return;
+
+	for (i = 0; i < old_length; i++)
+		if (*old[i].name)
+			used++;
+	drop = (used > length) ? used - length : 0;
+
+	whowas_ring = safe_alloc(sizeof(WhoWas) * length);
+	whowas_length = length;
+	whowas_next = 0;
+
+	safe_free(whowas_nick_index);
+	whowas_nick_index_size = 16;
+	while (whowas_nick_index_size < (unsigned int)length * 2)
+		whowas_nick_index_size *= 2;
+	whowas_nick_index = safe_alloc(sizeof(int) * whowas_nick_index_size);
+	for (j = 0; j < whowas_nick_index_size; j++)
+		whowas_nick_index[j] = -1;
+
+	/* Move the entries over, oldest first, dropping the oldest
+	 * ones if the history got shorter.
+	 */
+	for (i = 0; i < old_length; i++)
 	{
-		memset(&WHOWAS[i], 0, sizeof(WhoWas));
-		WHOWAS[i].hashv = -1;
+		e = &old[(oldest + i) % old_length];
+		if (!*e->name)
+			continue;
+		if (drop > 0)
+		{
+			drop--;
+			continue;
+		}
+		whowas_ring[whowas_next] = *e;
+		whowas_link(whowas_next);
+		whowas_next++;
+		if (whowas_next == whowas_length)
+			whowas_next = 0;
 	}
-	for (i = 0; i < WHOWAS_HASH_TABLE_SIZE; i++)
-		WHOWASHASH[i] = NULL;
+	safe_free(old);
 }
 
-static void add_whowas_to_clist(WhoWas ** bucket, WhoWas * whowas)
-{
-	whowas->cprev = NULL;
-	if ((whowas->cnext = *bucket) != NULL)
-		whowas->cnext->cprev = whowas;
-	*bucket = whowas;
-}
-
-static void del_whowas_from_clist(WhoWas ** bucket, WhoWas * whowas)
-{
-	if (whowas->cprev)
-		whowas->cprev->cnext = whowas->cnext;
-	else
-		*bucket = whowas->cnext;
-	if (whowas->cnext)
-		whowas->cnext->cprev = whowas->cprev;
-}
-
-static void add_whowas_to_list(WhoWas ** bucket, WhoWas * whowas)
-{
-	whowas->prev = NULL;
-	if ((whowas->next = *bucket) != NULL)
-		whowas->next->prev = whowas;
-	*bucket = whowas;
-}
-
-static void del_whowas_from_list(WhoWas ** bucket, WhoWas * whowas)
+void initwhowas()
 {
-	if (whowas->prev)
-		whowas->prev->next = whowas->next;
-	else
-		*bucket = whowas->next;
-	if (whowas->next)
-		whowas->next->prev = whowas->prev;
+	whowas_set_length(NICKNAMEHISTORYLENGTH);
 }